@@ -0,0 +1,153 @@
+#include "dns_server.h"
+#include "dns_resolver.h"
+#include "dns_parser.h"
+#include "dns_trie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// response size and encode time with and without name compression
+//
+//   plain:      every owner and rdata name written in full
+//   compressed: dns_build_response with its per message compression table
+//
+// usage: bench_compression [iterations]   (default 1000000)
+
+#define BENCH_DEFAULT_ITERATIONS 1000000
+#define BENCH_BUFFER 4096
+
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static dns_trie_t *make_zone(void) {
+  dns_trie_t *trie = dns_trie_create();
+  if (!trie) return NULL;
+
+  dns_soa_t *soa = calloc(1, sizeof(dns_soa_t));
+  dns_rrset_t *ns_rrset = dns_rrset_create(DNS_TYPE_NS, 3600);
+  if (!soa || !ns_rrset) return NULL;
+
+  strcpy(soa->mname, "ns1.example.com");
+  strcpy(soa->rname, "hostmaster.example.com");
+  soa->serial = 2024010101;
+  soa->refresh = 3600;
+  soa->retry = 600;
+  soa->expire = 86400;
+  soa->minimum = 300;
+  dns_rrset_add(ns_rrset, dns_rr_create_ns("ns1.example.com", 3600));
+  dns_trie_insert_zone(trie, "example.com", soa, ns_rrset);
+
+  dns_trie_insert_ns(trie, "example.com", "ns1.example.com", 3600);
+  dns_trie_insert_ns(trie, "example.com", "ns2.example.com", 3600);
+
+  char ip[32];
+  for (int i = 0; i < 10; ++i) {
+    snprintf(ip, sizeof(ip), "192.0.2.%d", i + 1);
+    dns_trie_insert_a(trie, "www.example.com", ip, 300);
+  }
+
+  char exchange[64];
+  for (int i = 0; i < 5; ++i) {
+    snprintf(exchange, sizeof(exchange), "mx%d.mail.example.com", i);
+    dns_trie_insert_mx(trie, "example.com", (uint16_t)(10 * (i + 1)), exchange, 300);
+  }
+
+  return trie;
+}
+
+// the same layout as dns_build_response, minus the compression table
+static size_t encode_plain(const dns_message_t *query, const dns_resolution_result_t *result,
+                           uint8_t *buf, size_t capacity) {
+  dns_header_t header = {
+    .id = query->header.id,
+    .qr = DNS_QR_RESPONSE,
+    .aa = result->authoritative,
+    .rcode = result->rcode,
+    .qdcount = 1,
+    .ancount = result->answer_count,
+    .nscount = result->authority_count,
+    .arcount = result->additional_count,
+  };
+  if (dns_encode_header(buf, capacity, &header) < 0) return 0;
+
+  size_t offset = 12;
+  if (dns_encode_question(buf, capacity, &offset, query->questions) < 0) return 0;
+
+  const dns_section_t *sections[] = {&result->answer, &result->authority, &result->additional};
+  for (int s = 0; s < 3; ++s) {
+    for (int i = 0; i < sections[s]->rrset_count; ++i) {
+      const dns_section_rrset_t *entry = &sections[s]->rrsets[i];
+      const char *name = entry->owner ? entry->owner : query->questions[0].qname;
+      if (dns_encode_rrset(buf, capacity, &offset, name, entry->rrset, entry->ttl, NULL) < 0) return 0;
+    }
+  }
+
+  return offset;
+}
+
+static void bench_query(dns_trie_t *trie, const char *label, const char *qname,
+                        dns_record_type_t qtype, size_t iterations) {
+  dns_question_t question = {.qtype = qtype, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, qname);
+
+  dns_message_t query = {
+    .header = {.id = 0x1234, .rd = 1, .qdcount = 1},
+    .questions = &question,
+  };
+
+  dns_resolution_result_t result;
+  dns_resolution_result_init(&result);
+  dns_error_t err;
+  dns_error_init(&err);
+  if (dns_resolve_query_full(trie, &question, &result, &err) < 0) {
+    printf("%-10s resolve failed\n", label);
+    return;
+  }
+
+  static uint8_t buf[BENCH_BUFFER];
+  size_t plain_len = 0;
+  size_t compressed_len = 0;
+
+  double start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) {
+    plain_len = encode_plain(&query, &result, buf, sizeof(buf));
+  }
+  double plain_ns = (now_ns() - start) / iterations;
+
+  start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) {
+    dns_build_response(&query, &result, buf, sizeof(buf), &compressed_len, &err);
+  }
+  double compressed_ns = (now_ns() - start) / iterations;
+
+  printf("%-10s %6d %12zu %12zu %10.1f %10.1f\n", label, result.answer_count + result.authority_count,
+         plain_len, compressed_len, plain_ns, compressed_ns);
+
+  dns_resolution_result_clear(&result);
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = BENCH_DEFAULT_ITERATIONS;
+  if (argc > 1) iterations = strtoul(argv[1], NULL, 10);
+  if (iterations == 0) iterations = BENCH_DEFAULT_ITERATIONS;
+
+  dns_trie_t *trie = make_zone();
+  if (!trie) return 1;
+
+  printf("iterations: %zu\n", iterations);
+  printf("%-10s %6s %12s %12s %10s %10s\n", "query", "rrs", "plain bytes", "comp bytes", "plain ns", "comp ns");
+
+  bench_query(trie, "A x10", "www.example.com", DNS_TYPE_A, iterations);
+  bench_query(trie, "MX x5", "example.com", DNS_TYPE_MX, iterations);
+  bench_query(trie, "NS x2", "example.com", DNS_TYPE_NS, iterations);
+  bench_query(trie, "NXDOMAIN", "missing.example.com", DNS_TYPE_A, iterations);
+
+  dns_trie_free(trie);
+  return 0;
+}
@@ -0,0 +1,458 @@
+#include "dns_server.h"
+#include "dns_resolver.h"
+#include "dns_parser.h"
+#include "dns_cache.h"
+#include "dns_trie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// microbenchmarks for the core data structures
+//
+//   trie_lookup:    dns_trie_lookup at the bottom of a chain of depth
+//                   levels with fanout siblings at each
+//   cache_lookup:   dns_cache_lookup_into against table size and hit ratio
+//   parse_name:     dns_parse_name and dns_parse_name_wire through a chain
+//                   of compression pointers
+//   build_response: dns_build_response for typical answers
+//
+// each case is warmed up while the iteration count is calibrated to about
+// 50ms a repetition, then timed over the repetitions. allocations are
+// counted by wrapping malloc and friends at link time (see CMakeLists.txt),
+// so libc internals such as strdup are not seen.
+//
+// usage: bench_core [--json] [--reps N] [--filter substring]
+
+#define BENCH_WARMUP_NS 20e6
+#define BENCH_TARGET_NS 50e6
+#define BENCH_DEFAULT_REPS 5
+#define BENCH_MAX_REPS 64
+#define BENCH_NAMES 1024 // lookup keys cycled through by each case
+#define BENCH_BUFFER 4096
+
+
+typedef struct {
+  const char *key;
+  long value;
+} bench_param_t;
+
+// runs the operation iterations times, the result only keeps it alive
+typedef size_t (*bench_fn_t)(void *ctx, size_t iterations);
+
+static struct {
+  bool json;
+  int reps;
+  const char *filter;
+  int reported;
+} options = {.reps = BENCH_DEFAULT_REPS};
+
+static volatile size_t sink;
+
+
+// allocation counting, the linker sends every call here
+static size_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  ++allocations;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  ++allocations;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  ++allocations;
+  return __real_realloc(ptr, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size) {
+  ++allocations;
+  return __real_aligned_alloc(alignment, size);
+}
+
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void bench_run(const char *name, const bench_param_t *params, int param_count,
+                      bench_fn_t fn, void *ctx) {
+  if (options.filter && !strstr(name, options.filter)) return;
+
+  // doubling until a run is long enough doubles as the warmup
+  size_t iterations = 1;
+  double elapsed;
+  for (;;) {
+    double start = now_ns();
+    sink += fn(ctx, iterations);
+    elapsed = now_ns() - start;
+    if (elapsed >= BENCH_WARMUP_NS) break;
+    iterations *= 2;
+  }
+  iterations = (size_t)(iterations * (BENCH_TARGET_NS / elapsed));
+  if (iterations == 0) iterations = 1;
+
+  double ns_per_op[BENCH_MAX_REPS];
+  size_t allocs = 0;
+  for (int r = 0; r < options.reps; ++r) {
+    size_t allocs_before = allocations;
+    double start = now_ns();
+    sink += fn(ctx, iterations);
+    ns_per_op[r] = (now_ns() - start) / iterations;
+    allocs += allocations - allocs_before;
+  }
+  qsort(ns_per_op, options.reps, sizeof(double), compare_double);
+
+  double median = ns_per_op[options.reps / 2];
+  double allocs_per_op = (double)allocs / ((double)iterations * options.reps);
+
+  if (options.json) {
+    printf("%s    {\"name\": \"%s\", \"params\": {", options.reported ? ",\n" : "", name);
+    for (int i = 0; i < param_count; ++i) {
+      printf("%s\"%s\": %ld", i ? ", " : "", params[i].key, params[i].value);
+    }
+    printf("}, \"iterations\": %zu, \"repetitions\": %d, "
+           "\"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, \"ns_per_op_max\": %.2f, "
+           "\"allocs_per_op\": %.3f}",
+           iterations, options.reps, median, ns_per_op[0], ns_per_op[options.reps - 1], allocs_per_op);
+  } else {
+    char label[96];
+    int n = snprintf(label, sizeof(label), "%s", name);
+    for (int i = 0; i < param_count && n < (int)sizeof(label); ++i) {
+      n += snprintf(label + n, sizeof(label) - n, " %s=%ld", params[i].key, params[i].value);
+    }
+    printf("%-44s %12.1f %12.1f %12.1f %10.3f\n",
+           label, median, ns_per_op[0], ns_per_op[options.reps - 1], allocs_per_op);
+  }
+  ++options.reported;
+}
+
+
+// trie
+
+typedef struct {
+  dns_trie_t *trie;
+  char names[BENCH_NAMES][MAX_DOMAIN_NAME];
+} trie_case_t;
+
+static size_t run_trie_lookup(void *ctx, size_t iterations) {
+  trie_case_t *tc = ctx;
+  size_t found = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    found += dns_trie_lookup(tc->trie, tc->names[i % BENCH_NAMES], DNS_TYPE_A) != NULL;
+  }
+  return found;
+}
+
+static void bench_trie(void) {
+  static const long fanouts[] = {10, 100, 1000};
+  static const long depths[] = {2, 4, 8};
+  trie_case_t *tc = calloc(1, sizeof(trie_case_t));
+  if (!tc) return;
+
+  for (size_t f = 0; f < sizeof(fanouts) / sizeof(fanouts[0]); ++f) {
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d) {
+      tc->trie = dns_trie_create();
+
+      // fanout siblings at every level down a chain l1.l2...
+      // the deepest chain is well under a name's length
+      char suffix[128] = "bench.example";
+      char name[MAX_DOMAIN_NAME];
+      for (long level = 0; level < depths[d]; ++level) {
+        for (long j = 0; j < fanouts[f]; ++j) {
+          snprintf(name, sizeof(name), "s%ld.%s", j, suffix);
+          dns_trie_insert_a(tc->trie, name, "192.0.2.1", 300);
+        }
+        if (level + 1 < depths[d]) {
+          snprintf(name, sizeof(name), "l%ld.%s", level, suffix);
+          dns_safe_strncpy(suffix, name, sizeof(suffix));
+        }
+      }
+
+      srand(42);
+      for (int i = 0; i < BENCH_NAMES; ++i) {
+        snprintf(tc->names[i], MAX_DOMAIN_NAME, "s%ld.%s", (long)(rand() % fanouts[f]), suffix);
+      }
+
+      bench_param_t params[] = {{"fanout", fanouts[f]}, {"depth", depths[d]}};
+      bench_run("trie_lookup", params, 2, run_trie_lookup, tc);
+      dns_trie_free(tc->trie);
+    }
+  }
+
+  free(tc);
+}
+
+
+// cache
+
+typedef struct {
+  dns_cache_t *cache;
+  char names[BENCH_NAMES][MAX_DOMAIN_NAME];
+} cache_case_t;
+
+static size_t run_cache_lookup(void *ctx, size_t iterations) {
+  cache_case_t *cc = ctx;
+  dns_cache_result_t result;
+  size_t found = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    if (dns_cache_lookup_into(cc->cache, cc->names[i % BENCH_NAMES], DNS_TYPE_A, DNS_CLASS_IN, &result)) {
+      ++found;
+      dns_cache_result_clear(&result);
+    }
+  }
+  return found;
+}
+
+static void bench_cache(void) {
+  static const long sizes[] = {100, 1000, 10000, 100000};
+  static const long hit_pcts[] = {100, 50, 0};
+  cache_case_t *cc = calloc(1, sizeof(cache_case_t));
+  if (!cc) return;
+
+  dns_rr_t *rr = dns_rr_create_a_str("192.0.2.1", 3600);
+  char name[MAX_DOMAIN_NAME];
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    cc->cache = dns_cache_create((size_t)sizes[s]);
+    for (long i = 0; i < sizes[s]; ++i) {
+      snprintf(name, sizeof(name), "h%ld.cache.example", i);
+      dns_cache_insert(cc->cache, name, DNS_TYPE_A, DNS_CLASS_IN, rr, 1, 3600);
+    }
+
+    for (size_t h = 0; h < sizeof(hit_pcts) / sizeof(hit_pcts[0]); ++h) {
+      srand(42);
+      for (int i = 0; i < BENCH_NAMES; ++i) {
+        bool hit = rand() % 100 < hit_pcts[h];
+        snprintf(cc->names[i], MAX_DOMAIN_NAME, "%s%ld.cache.example", hit ? "h" : "m",
+                 (long)(rand() % sizes[s]));
+      }
+
+      bench_param_t params[] = {{"entries", sizes[s]}, {"hit_pct", hit_pcts[h]}};
+      bench_run("cache_lookup", params, 2, run_cache_lookup, cc);
+    }
+    dns_cache_free(cc->cache);
+  }
+
+  dns_rr_free(rr);
+  free(cc);
+}
+
+
+// parser
+
+typedef struct {
+  uint8_t buf[512];
+  size_t len;
+  size_t offset; // of the name to parse
+} parse_case_t;
+
+static size_t run_parse_name(void *ctx, size_t iterations) {
+  parse_case_t *pc = ctx;
+  char name[MAX_DOMAIN_NAME];
+  size_t total = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    size_t offset = pc->offset;
+    if (dns_parse_name(pc->buf, pc->len, &offset, name, sizeof(name)) == 0) total += offset;
+  }
+  return total;
+}
+
+static size_t run_parse_name_wire(void *ctx, size_t iterations) {
+  parse_case_t *pc = ctx;
+  dns_name_t name;
+  size_t total = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    size_t offset = pc->offset;
+    if (dns_parse_name_wire(pc->buf, pc->len, &offset, &name) == 0) total += offset;
+  }
+  return total;
+}
+
+static size_t put_label(uint8_t *buf, size_t offset, const char *label) {
+  size_t len = strlen(label);
+  buf[offset] = (uint8_t)len;
+  memcpy(buf + offset + 1, label, len);
+  return offset + 1 + len;
+}
+
+static void bench_parser(void) {
+  static const long pointer_counts[] = {0, 1, 4, 8};
+  parse_case_t pc;
+
+  for (size_t p = 0; p < sizeof(pointer_counts) / sizeof(pointer_counts[0]); ++p) {
+    memset(&pc, 0, sizeof(pc));
+    size_t offset = 12;
+
+    // a name in full, then one label and a pointer to the previous name per
+    // level, so every case decodes to the same eleven labels
+    long pointers = pointer_counts[p];
+    size_t target = offset;
+    for (long i = 0; i < 8 - pointers; ++i) offset = put_label(pc.buf, offset, "lbl");
+    offset = put_label(pc.buf, offset, "www");
+    offset = put_label(pc.buf, offset, "example");
+    offset = put_label(pc.buf, offset, "com");
+    pc.buf[offset++] = 0;
+
+    for (long i = 0; i < pointers; ++i) {
+      size_t next = offset;
+      offset = put_label(pc.buf, offset, "lbl");
+      pc.buf[offset++] = (uint8_t)(0xC0 | (target >> 8));
+      pc.buf[offset++] = (uint8_t)target;
+      target = next;
+    }
+    pc.offset = target;
+    pc.len = offset;
+
+    bench_param_t params[] = {{"pointers", pointers}};
+    bench_run("parse_name", params, 1, run_parse_name, &pc);
+    bench_run("parse_name_wire", params, 1, run_parse_name_wire, &pc);
+  }
+}
+
+
+// encoder
+
+typedef struct {
+  dns_message_t query;
+  dns_question_t question;
+  dns_resolution_result_t result;
+  uint8_t buf[BENCH_BUFFER];
+} build_case_t;
+
+static size_t run_build_response(void *ctx, size_t iterations) {
+  build_case_t *bc = ctx;
+  size_t length = 0;
+  size_t total = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    if (dns_build_response(&bc->query, &bc->result, bc->buf, sizeof(bc->buf), &length, NULL) == 0) {
+      total += length;
+    }
+  }
+  return total;
+}
+
+static dns_trie_t *make_zone(void) {
+  dns_trie_t *trie = dns_trie_create();
+  dns_soa_t *soa = calloc(1, sizeof(dns_soa_t));
+  dns_rrset_t *ns_rrset = dns_rrset_create(DNS_TYPE_NS, 3600);
+  if (!trie || !soa || !ns_rrset) return NULL;
+
+  strcpy(soa->mname, "ns1.example.com");
+  strcpy(soa->rname, "hostmaster.example.com");
+  soa->serial = 2024010101;
+  soa->refresh = 3600;
+  soa->retry = 600;
+  soa->expire = 86400;
+  soa->minimum = 300;
+  dns_rrset_add(ns_rrset, dns_rr_create_ns("ns1.example.com", 3600));
+  dns_trie_insert_zone(trie, "example.com", soa, ns_rrset);
+
+  dns_trie_insert_ns(trie, "example.com", "ns1.example.com", 3600);
+  dns_trie_insert_ns(trie, "example.com", "ns2.example.com", 3600);
+  dns_trie_insert_a(trie, "ns1.example.com", "192.0.2.53", 3600);
+  dns_trie_insert_a(trie, "one.example.com", "192.0.2.1", 300);
+
+  char ip[32];
+  for (int i = 0; i < 10; ++i) {
+    snprintf(ip, sizeof(ip), "192.0.2.%d", i + 10);
+    dns_trie_insert_a(trie, "www.example.com", ip, 300);
+  }
+
+  char exchange[64];
+  for (int i = 0; i < 5; ++i) {
+    snprintf(exchange, sizeof(exchange), "mx%d.mail.example.com", i);
+    dns_trie_insert_mx(trie, "example.com", (uint16_t)(10 * (i + 1)), exchange, 300);
+  }
+
+  return trie;
+}
+
+static void bench_encoder(void) {
+  static const struct {
+    const char *qname;
+    dns_record_type_t qtype;
+    long answers;
+  } cases[] = {
+    {"one.example.com", DNS_TYPE_A, 1},
+    {"www.example.com", DNS_TYPE_A, 10},
+    {"example.com", DNS_TYPE_MX, 5},
+    {"missing.example.com", DNS_TYPE_A, 0},
+  };
+
+  dns_trie_t *trie = make_zone();
+  build_case_t *bc = calloc(1, sizeof(build_case_t));
+  if (!trie || !bc) return;
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+    memset(&bc->question, 0, sizeof(bc->question));
+    dns_safe_strncpy(bc->question.qname, cases[c].qname, sizeof(bc->question.qname));
+    bc->question.qtype = cases[c].qtype;
+    bc->question.qclass = DNS_CLASS_IN;
+
+    memset(&bc->query, 0, sizeof(bc->query));
+    bc->query.header.id = 0x1234;
+    bc->query.header.rd = 1;
+    bc->query.header.qdcount = 1;
+    bc->query.questions = &bc->question;
+
+    dns_resolution_result_init(&bc->result);
+    if (dns_resolve_query_full(trie, &bc->question, &bc->result, NULL) < 0) continue;
+
+    bench_param_t params[] = {{"qtype", cases[c].qtype}, {"answers", cases[c].answers}};
+    bench_run("build_response", params, 2, run_build_response, bc);
+    dns_resolution_result_clear(&bc->result);
+  }
+
+  free(bc);
+  dns_trie_free(trie);
+}
+
+
+int main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--json") == 0) {
+      options.json = true;
+    } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+      options.reps = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--json] [--reps N] [--filter substring]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (options.reps < 1) options.reps = 1;
+  if (options.reps > BENCH_MAX_REPS) options.reps = BENCH_MAX_REPS;
+
+  if (options.json) {
+    printf("{\n  \"repetitions\": %d,\n  \"benchmarks\": [\n", options.reps);
+  } else {
+    printf("%-44s %12s %12s %12s %10s\n", "benchmark", "ns/op", "min", "max", "allocs/op");
+  }
+
+  bench_trie();
+  bench_cache();
+  bench_parser();
+  bench_encoder();
+
+  if (options.json) printf("\n  ]\n}\n");
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include "dns_simd.h"
+#include "dns_records.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+
+
+// name kernels at each dispatch level next to the byte loops they replaced
+//
+//   lower:      dns_simd_lower vs a tolower() loop
+//   find dot:   dns_simd_find_byte vs a byte loop
+//   case equal: dns_simd_case_equal vs strcasecmp on equal names
+//   normalize:  dns_normalize_domain, which runs on every trie lookup
+//
+// names are the lengths seen in practice: a short host, a typical CDN name
+// and a long one near the 255 byte limit
+//
+// usage: bench_name_kernels [iterations]   (default 2000000)
+
+#define BENCH_DEFAULT_ITERATIONS 2000000
+
+
+static volatile size_t sink;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void lower_loop(char *dst, const char *src, size_t len) {
+  for (size_t i = 0; i < len; ++i) dst[i] = (char)tolower((unsigned char)src[i]);
+}
+
+static size_t find_dot_loop(const char *src, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (src[i] == '.') return i;
+  }
+  return len;
+}
+
+static void bench_name(const char *label, const char *name, size_t iterations) {
+  size_t len = strlen(name);
+  char upper[MAX_DOMAIN_NAME];
+  char out[MAX_DOMAIN_NAME];
+  for (size_t i = 0; i <= len; ++i) upper[i] = (char)toupper((unsigned char)name[i]);
+
+  // the dot search looks past the first label, as split_domain does
+  const char *tail = name + len / 2;
+  size_t tail_len = len - len / 2;
+
+  double start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) {
+    lower_loop(out, upper, len);
+    sink += (unsigned char)out[i % len];
+  }
+  double lower_ns = (now_ns() - start) / iterations;
+
+  start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) sink += find_dot_loop(tail, tail_len);
+  double find_ns = (now_ns() - start) / iterations;
+
+  start = now_ns();
+  for (size_t i = 0; i < iterations; ++i) sink += (strcasecmp(name, upper) == 0);
+  double equal_ns = (now_ns() - start) / iterations;
+
+  printf("%-7s %4zu %-7s %9.1f %9.1f %9.1f %9s\n", label, len, "loop", lower_ns, find_ns, equal_ns, "-");
+
+  for (int level = DNS_SIMD_SCALAR; level <= DNS_SIMD_AVX2; ++level) {
+    if (dns_simd_set_level((dns_simd_level_t)level) != (dns_simd_level_t)level) continue;
+
+    start = now_ns();
+    for (size_t i = 0; i < iterations; ++i) {
+      dns_simd_lower(out, upper, len);
+      sink += (unsigned char)out[i % len];
+    }
+    lower_ns = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    for (size_t i = 0; i < iterations; ++i) sink += dns_simd_find_byte(tail, tail_len, '.');
+    find_ns = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    for (size_t i = 0; i < iterations; ++i) sink += dns_simd_case_equal(name, upper, len);
+    equal_ns = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    for (size_t i = 0; i < iterations; ++i) {
+      dns_normalize_domain(upper, out);
+      sink += (unsigned char)out[0];
+    }
+    double normalize_ns = (now_ns() - start) / iterations;
+
+    printf("%-7s %4zu %-7s %9.1f %9.1f %9.1f %9.1f\n", label, len,
+           dns_simd_level_name((dns_simd_level_t)level), lower_ns, find_ns, equal_ns, normalize_ns);
+  }
+
+  dns_simd_set_level(dns_simd_best_level());
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = BENCH_DEFAULT_ITERATIONS;
+  if (argc > 1) iterations = strtoul(argv[1], NULL, 10);
+  if (iterations == 0) iterations = BENCH_DEFAULT_ITERATIONS;
+
+  char long_name[MAX_DOMAIN_NAME];
+  snprintf(long_name, sizeof(long_name), "%s.%s.%s.example.com",
+           "a-very-long-label-that-fills-most-of-the-sixty-three-bytes-xyz",
+           "another-long-label-for-the-middle-of-this-benchmark-name-abc",
+           "third-long-label-to-reach-two-hundred-bytes-of-qname-here");
+
+  printf("iterations: %zu, best level: %s\n", iterations, dns_simd_level_name(dns_simd_best_level()));
+  printf("%-7s %4s %-7s %9s %9s %9s %9s\n", "name", "len", "kernel", "lower ns", "dot ns", "equal ns", "norm ns");
+
+  bench_name("short", "www.example.com", iterations);
+  bench_name("typical", "e1234.dscb.akamaiedge.net.edgekey.example.com", iterations);
+  bench_name("long", long_name, iterations);
+
+  return 0;
+}
@@ -0,0 +1,130 @@
+#include "dns_trie.h"
+#include "dns_records.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// heap bytes per record for a zone of N single-record names
+//
+//   rr only: the dns_rr_t allocations alone, kept on a list
+//   zone:    the same records inserted into a trie (nodes, maps, rrsets)
+//   free ms: time spent in dns_trie_free for that zone
+//
+// usage: bench_rr_memory [records]   (default 1000000)
+
+#define BENCH_DEFAULT_RECORDS 1000000
+
+
+static size_t heap_in_use(void) {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static dns_rr_t *make_record(dns_record_type_t type, size_t i) {
+  switch (type) {
+    case DNS_TYPE_A:
+      return dns_rr_create_a((uint32_t)i, 300);
+
+    case DNS_TYPE_AAAA: {
+      uint8_t addr[16] = {0x20, 0x01, 0x0d, 0xb8};
+      memcpy(addr + 12, &i, 4);
+      return dns_rr_create_aaaa(addr, 300);
+    }
+
+    case DNS_TYPE_MX: {
+      char exchange[64];
+      snprintf(exchange, sizeof(exchange), "mx%zu.mail.example.com", i % 1000);
+      return dns_rr_create_mx(10, exchange, 300);
+    }
+
+    default:
+      return NULL;
+  }
+}
+
+// three levels of at most 100 labels keep child scans short
+static void make_name(char *buf, size_t len, size_t i) {
+  snprintf(buf, len, "h%zu.g%zu.f%zu.bench.example.com", i % 100, (i / 100) % 100, i / 10000);
+}
+
+static double bench_rr_only(dns_record_type_t type, size_t count) {
+  size_t before = heap_in_use();
+
+  dns_rr_t *head = NULL;
+  for (size_t i = 0; i < count; ++i) {
+    dns_rr_t *rr = make_record(type, i);
+    if (!rr) return -1;
+    rr->next = head;
+    head = rr;
+  }
+
+  size_t after = heap_in_use();
+  while (head) {
+    dns_rr_t *next = head->next;
+    head->next = NULL;
+    dns_rr_free(head);
+    head = next;
+  }
+
+  return (double)(after - before) / count;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static double bench_zone(dns_record_type_t type, size_t count, double *free_ms) {
+  size_t before = heap_in_use();
+
+  dns_trie_t *trie = dns_trie_create();
+  if (!trie) return -1;
+
+  char name[MAX_DOMAIN_NAME];
+  for (size_t i = 0; i < count; ++i) {
+    make_name(name, sizeof(name), i);
+    dns_rr_t *rr = make_record(type, i);
+    if (!rr || !dns_trie_insert_rr(trie, name, rr)) {
+      dns_trie_free(trie);
+      return -1;
+    }
+  }
+
+  size_t after = heap_in_use();
+  double start = now_ms();
+  dns_trie_free(trie);
+  *free_ms = now_ms() - start;
+
+  return (double)(after - before) / count;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = BENCH_DEFAULT_RECORDS;
+  if (argc > 1) count = strtoul(argv[1], NULL, 10);
+  if (count == 0) count = BENCH_DEFAULT_RECORDS;
+
+  static const struct {
+    dns_record_type_t type;
+    const char *name;
+  } types[] = {
+    {DNS_TYPE_A, "A"},
+    {DNS_TYPE_AAAA, "AAAA"},
+    {DNS_TYPE_MX, "MX"},
+  };
+
+  printf("records: %zu, sizeof(dns_rr_t): %zu\n", count, sizeof(dns_rr_t));
+  printf("%-6s %16s %16s %10s\n", "type", "rr bytes/rec", "zone bytes/rec", "free ms");
+
+  for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t) {
+    double rr_bytes = bench_rr_only(types[t].type, count);
+    double free_ms = 0;
+    double zone_bytes = bench_zone(types[t].type, count, &free_ms);
+    printf("%-6s %16.1f %16.1f %10.1f\n", types[t].name, rr_bytes, zone_bytes, free_ms);
+  }
+
+  return 0;
+}
@@ -0,0 +1,482 @@
+#include "dns_server.h"
+#include "dns_latency.h"
+#include "dns_rdata.h"
+#include "dns_zone_file.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// loopback load generator
+//
+//   closed loop: -c queries are kept in flight, each answer or timeout
+//                sends the next one
+//   open loop:   -r queries a second are sent on schedule whether or not
+//                the answers keep up, so a slow server shows as latency
+//                and loss instead of a lower offered rate
+//
+// without -s the server is started in this process on an ephemeral port
+// with recursion off and the zone from -z, or a small example.com. queries come from -f, one
+// "name [type]" per line, or a built-in mix over example.zone.
+//
+// usage: dns_bench [-s host:port] [-z zone] [-f queries] [-c inflight]
+//                  [-r qps] [-d seconds] [-t timeout_ms]
+
+#define BENCH_DEFAULT_INFLIGHT 64
+#define BENCH_DEFAULT_SECONDS 5
+#define BENCH_DEFAULT_TIMEOUT_MS 1000
+#define BENCH_MAX_QUERIES 4096
+#define BENCH_IDS 65536
+
+
+typedef struct {
+  uint8_t wire[512]; // the ID is patched in per send
+  size_t length;
+} bench_query_t;
+
+typedef struct {
+  struct sockaddr_in target;
+  bool in_process;
+  const char *zone_file;
+  const char *query_file;
+  int inflight;
+  double rate;
+  double seconds;
+  uint64_t timeout_ns;
+} bench_config_t;
+
+typedef struct {
+  int fd;
+  bench_query_t *queries;
+  int query_count;
+  int next_query;
+
+  uint64_t sent_at[BENCH_IDS]; // 0 when the ID is free
+  uint16_t next_id;
+  int outstanding;
+
+  // IDs in send order, timeouts expire from the front
+  uint16_t order[BENCH_IDS];
+  uint64_t order_sent[BENCH_IDS];
+  size_t order_head;
+  size_t order_tail;
+
+  uint64_t sent;
+  uint64_t received;
+  uint64_t lost;
+  uint64_t late; // answers after their timeout, or for IDs never sent
+  uint64_t send_errors;
+  uint64_t rcode_noerror;
+  uint64_t rcode_nxdomain;
+  uint64_t rcode_other;
+  uint64_t truncated;
+  uint64_t last_answer;
+  dns_histogram_t latency; // nanoseconds
+} bench_state_t;
+
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int encode_query(bench_query_t *query, const char *name, uint16_t type) {
+  dns_header_t header = {.qr = DNS_QR_QUERY, .opcode = DNS_OPCODE_QUERY, .qdcount = 1};
+  if (dns_encode_header(query->wire, sizeof(query->wire), &header) < 0) return -1;
+
+  dns_question_t question = {.qtype = type, .qclass = DNS_CLASS_IN};
+  dns_safe_strncpy(question.qname, name, sizeof(question.qname));
+
+  size_t offset = 12;
+  if (dns_encode_question(query->wire, sizeof(query->wire), &offset, &question) < 0) return -1;
+  query->length = offset;
+  return 0;
+}
+
+static int load_queries(const char *filename, bench_query_t *queries) {
+  static const char *builtin[][2] = {
+    {"example.com", "A"},
+    {"www.example.com", "A"},
+    {"www.example.com", "AAAA"},
+    {"mail.example.com", "A"},
+    {"example.com", "NS"},
+    {"example.com", "MX"},
+    {"ftp.example.com", "A"},
+    {"missing.example.com", "A"},
+  };
+
+  int count = 0;
+  if (!filename) {
+    for (size_t i = 0; i < sizeof(builtin) / sizeof(builtin[0]); ++i) {
+      if (encode_query(&queries[count], builtin[i][0], dns_rdata_type_from_text(builtin[i][1])) == 0) {
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    perror(filename);
+    return -1;
+  }
+
+  char line[512];
+  while (count < BENCH_MAX_QUERIES && fgets(line, sizeof(line), file)) {
+    char name[MAX_DOMAIN_NAME];
+    char type_text[32] = "A";
+    if (line[0] == '#' || sscanf(line, "%254s %31s", name, type_text) < 1) continue;
+
+    uint16_t type = dns_rdata_type_from_text(type_text);
+    if (type == 0 || encode_query(&queries[count], name, type) < 0) {
+      fprintf(stderr, "skipping query '%s %s'\n", name, type_text);
+      continue;
+    }
+    ++count;
+  }
+
+  fclose(file);
+  return count;
+}
+
+static int send_next(bench_state_t *state, uint64_t now) {
+  // the ID space is the limit on queries in flight
+  if (state->outstanding >= BENCH_IDS - 1) return -1;
+  while (state->sent_at[state->next_id] != 0) ++state->next_id;
+
+  uint16_t id = state->next_id++;
+  bench_query_t *query = &state->queries[state->next_query];
+  state->next_query = (state->next_query + 1) % state->query_count;
+
+  query->wire[0] = (uint8_t)(id >> 8);
+  query->wire[1] = (uint8_t)id;
+  if (send(state->fd, query->wire, query->length, 0) < 0) {
+    ++state->send_errors;
+    return -1;
+  }
+
+  state->sent_at[id] = now;
+  state->order[state->order_tail % BENCH_IDS] = id;
+  state->order_sent[state->order_tail % BENCH_IDS] = now;
+  ++state->order_tail;
+  ++state->outstanding;
+  ++state->sent;
+  return 0;
+}
+
+static void expire(bench_state_t *state, uint64_t now, uint64_t timeout_ns) {
+  while (state->order_head < state->order_tail) {
+    size_t slot = state->order_head % BENCH_IDS;
+    uint64_t sent_at = state->order_sent[slot];
+    uint16_t id = state->order[slot];
+
+    // answered already, or the ID went to a newer query
+    if (state->sent_at[id] != sent_at) {
+      ++state->order_head;
+      continue;
+    }
+    if (now - sent_at < timeout_ns) break;
+
+    state->sent_at[id] = 0;
+    --state->outstanding;
+    ++state->lost;
+    ++state->order_head;
+  }
+}
+
+// everything waiting on the socket, returns the number of answers
+static int receive(bench_state_t *state) {
+  uint8_t buf[DNS_BUFFER_SIZE];
+  int answers = 0;
+
+  for (;;) {
+    ssize_t n = recv(state->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (n < 12) continue;
+
+    uint64_t now = now_ns();
+    uint16_t id = (uint16_t)(buf[0] << 8 | buf[1]);
+    if (state->sent_at[id] == 0) {
+      ++state->late;
+      continue;
+    }
+
+    dns_histogram_record(&state->latency, now - state->sent_at[id]);
+    state->last_answer = now;
+    state->sent_at[id] = 0;
+    --state->outstanding;
+    ++state->received;
+    ++answers;
+
+    uint8_t rcode = buf[3] & 0x0F;
+    if (rcode == DNS_RCODE_NOERROR) {
+      ++state->rcode_noerror;
+    } else if (rcode == DNS_RCODE_NXDOMAIN) {
+      ++state->rcode_nxdomain;
+    } else {
+      ++state->rcode_other;
+    }
+    if (buf[2] & 0x02) ++state->truncated;
+  }
+
+  return answers;
+}
+
+static void wait_readable(int fd, uint64_t wait_ns) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  poll(&pfd, 1, (int)(wait_ns / 1000000));
+}
+
+static void run(bench_state_t *state, const bench_config_t *config) {
+  uint64_t start = now_ns();
+  uint64_t end = start + (uint64_t)(config->seconds * 1e9);
+  double interval_ns = config->rate > 0 ? 1e9 / config->rate : 0;
+  uint64_t scheduled = 0;
+
+  for (;;) {
+    uint64_t now = now_ns();
+    bool sending = now < end;
+    if (!sending && state->outstanding == 0) break;
+    if (!sending && now - end > config->timeout_ns) break;
+
+    if (sending && config->rate > 0) {
+      // open loop, catch up on everything due by now
+      while (start + (uint64_t)(scheduled * interval_ns) <= now) {
+        send_next(state, now);
+        ++scheduled;
+      }
+    } else if (sending) {
+      while (state->outstanding < config->inflight && send_next(state, now) == 0) {
+      }
+    }
+
+    if (receive(state) == 0) {
+      uint64_t wait_ns = 1000000;
+      if (sending && config->rate > 0) {
+        uint64_t due = start + (uint64_t)(scheduled * interval_ns);
+        wait_ns = due > now ? due - now : 0;
+      }
+      wait_readable(state->fd, wait_ns);
+    }
+    expire(state, now_ns(), config->timeout_ns);
+  }
+
+  // whatever is still out counts as lost
+  state->lost += (uint64_t)state->outstanding;
+}
+
+static void report(const bench_state_t *state, const bench_config_t *config, double elapsed) {
+  printf("target      %s:%d%s\n",
+         inet_ntoa(config->target.sin_addr),
+         ntohs(config->target.sin_port),
+         config->in_process ? " (in process)" : "");
+  if (config->rate > 0) {
+    printf("mode        open loop, %.0f qps offered\n", config->rate);
+  } else {
+    printf("mode        closed loop, %d in flight\n", config->inflight);
+  }
+  printf("query mix   %d queries\n", state->query_count);
+  printf("elapsed     %.2f s\n", elapsed);
+  printf("sent        %lu\n", (unsigned long)state->sent);
+  printf("received    %lu\n", (unsigned long)state->received);
+  printf("lost        %lu (%.3f%%)\n",
+         (unsigned long)state->lost,
+         state->sent ? 100.0 * state->lost / state->sent : 0.0);
+  if (state->late || state->send_errors) {
+    printf("late        %lu\n", (unsigned long)state->late);
+    printf("send errors %lu\n", (unsigned long)state->send_errors);
+  }
+  printf("qps         %.0f\n", elapsed > 0 ? state->received / elapsed : 0.0);
+  printf("rcodes      noerror %lu, nxdomain %lu, other %lu, truncated %lu\n",
+         (unsigned long)state->rcode_noerror,
+         (unsigned long)state->rcode_nxdomain,
+         (unsigned long)state->rcode_other,
+         (unsigned long)state->truncated);
+
+  const dns_histogram_t *hist = &state->latency;
+  uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+  printf("latency us  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  mean %.1f\n",
+         dns_histogram_quantile(hist, 0.50) / 1e3,
+         dns_histogram_quantile(hist, 0.90) / 1e3,
+         dns_histogram_quantile(hist, 0.99) / 1e3,
+         dns_histogram_quantile(hist, 0.999) / 1e3,
+         atomic_load_explicit(&hist->max, memory_order_relaxed) / 1e3,
+         count ? atomic_load_explicit(&hist->sum, memory_order_relaxed) / 1e3 / count : 0.0);
+}
+
+// what the built-in query mix asks for
+static int make_zone(dns_trie_t *trie) {
+  dns_soa_t *soa = calloc(1, sizeof(dns_soa_t));
+  dns_rrset_t *ns_rrset = dns_rrset_create(DNS_TYPE_NS, 3600);
+  if (!soa || !ns_rrset) return -1;
+
+  strcpy(soa->mname, "ns1.example.com");
+  strcpy(soa->rname, "admin.example.com");
+  soa->serial = 2024010101;
+  soa->refresh = 3600;
+  soa->retry = 600;
+  soa->expire = 86400;
+  soa->minimum = 300;
+  dns_rrset_add(ns_rrset, dns_rr_create_ns("ns1.example.com", 3600));
+  dns_trie_insert_zone(trie, "example.com", soa, ns_rrset);
+
+  dns_trie_insert_ns(trie, "example.com", "ns1.example.com", 3600);
+  dns_trie_insert_ns(trie, "example.com", "ns2.example.com", 3600);
+  dns_trie_insert_a(trie, "example.com", "192.0.2.1", 300);
+  dns_trie_insert_a(trie, "www.example.com", "192.0.2.2", 300);
+  dns_trie_insert_aaaa(trie, "www.example.com", "2001:db8::2", 300);
+  dns_trie_insert_a(trie, "mail.example.com", "192.0.2.3", 300);
+  dns_trie_insert_a(trie, "ns1.example.com", "192.0.2.4", 300);
+  dns_trie_insert_a(trie, "ns2.example.com", "192.0.2.5", 300);
+  dns_trie_insert_mx(trie, "example.com", 10, "mail.example.com", 300);
+  dns_trie_insert_cname(trie, "ftp.example.com", "www.example.com", 300);
+  return 0;
+}
+
+static void *server_thread(void *arg) {
+  dns_server_run(arg);
+  return NULL;
+}
+
+static dns_server_t *start_server(const bench_config_t *config, struct sockaddr_in *addr) {
+  dns_server_t *server = dns_server_create(0);
+  if (!server) return NULL;
+  server->enable_recursion = false; // nothing leaves the host
+
+  if (config->zone_file) {
+    zone_load_result_t result;
+    if (zone_load_file(server->trie, config->zone_file, "example.com", &result) < 0) {
+      fprintf(stderr, "failed to load zone file %s\n", config->zone_file);
+      dns_server_free(server);
+      return NULL;
+    }
+  } else if (make_zone(server->trie) < 0) {
+    dns_server_free(server);
+    return NULL;
+  }
+  dns_trie_compile(server->trie);
+
+  if (dns_server_start(server) < 0) {
+    dns_server_free(server);
+    return NULL;
+  }
+
+  socklen_t len = sizeof(*addr);
+  getsockname(server->socket_fd, (struct sockaddr *)addr, &len);
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return server;
+}
+
+static int parse_target(const char *text, struct sockaddr_in *addr) {
+  char host[64];
+  int port = DNS_DEFAULT_PORT;
+  if (sscanf(text, "%63[^:]:%d", host, &port) < 1) return -1;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons((uint16_t)port);
+  return inet_pton(AF_INET, host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-s host:port] [-z zone] [-f queries] [-c inflight] [-r qps]\n"
+          "          [-d seconds] [-t timeout_ms]\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  bench_config_t config = {
+    .in_process = true,
+    .inflight = BENCH_DEFAULT_INFLIGHT,
+    .seconds = BENCH_DEFAULT_SECONDS,
+    .timeout_ns = (uint64_t)BENCH_DEFAULT_TIMEOUT_MS * 1000000u,
+  };
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:z:f:c:r:d:t:h")) != -1) {
+    switch (opt) {
+      case 's':
+        if (parse_target(optarg, &config.target) < 0) {
+          fprintf(stderr, "bad target %s\n", optarg);
+          return 1;
+        }
+        config.in_process = false;
+        break;
+      case 'z': config.zone_file = optarg; break;
+      case 'f': config.query_file = optarg; break;
+      case 'c': config.inflight = atoi(optarg); break;
+      case 'r': config.rate = atof(optarg); break;
+      case 'd': config.seconds = atof(optarg); break;
+      case 't': config.timeout_ns = (uint64_t)atoi(optarg) * 1000000u; break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (config.inflight < 1) config.inflight = 1;
+  if (config.inflight > BENCH_IDS - 1) config.inflight = BENCH_IDS - 1;
+
+  bench_state_t *state = calloc(1, sizeof(bench_state_t));
+  bench_query_t *queries = calloc(BENCH_MAX_QUERIES, sizeof(bench_query_t));
+  if (!state || !queries) return 1;
+
+  state->queries = queries;
+  state->query_count = load_queries(config.query_file, queries);
+  if (state->query_count <= 0) {
+    fprintf(stderr, "no queries to send\n");
+    return 1;
+  }
+
+  dns_server_t *server = NULL;
+  pthread_t thread;
+  if (config.in_process) {
+    server = start_server(&config, &config.target);
+    if (!server) {
+      fprintf(stderr, "failed to start the server\n");
+      return 1;
+    }
+    if (pthread_create(&thread, NULL, server_thread, server) != 0) {
+      dns_server_free(server);
+      return 1;
+    }
+  }
+
+  // connected, so replies from anywhere else are filtered by the kernel
+  state->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (state->fd < 0 || connect(state->fd, (struct sockaddr *)&config.target, sizeof(config.target)) < 0) {
+    perror("bench socket");
+    return 1;
+  }
+  int rcvbuf = 4 * 1024 * 1024;
+  setsockopt(state->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  // up to the last answer, the wait for stragglers is not throughput
+  uint64_t start = now_ns();
+  run(state, &config);
+  uint64_t finish = state->last_answer ? state->last_answer : now_ns();
+  report(state, &config, (finish - start) / 1e9);
+
+  close(state->fd);
+  if (server) {
+    server->running = false; // the loop notices within its 1s select timeout
+    pthread_join(thread, NULL);
+    dns_server_free(server);
+  }
+  free(queries);
+  free(state);
+  return 0;
+}
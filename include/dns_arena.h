@@ -0,0 +1,59 @@
+#ifndef DNS_ARENA_H
+#define DNS_ARENA_H
+
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+// chunked bump allocator with per size class free lists
+//
+// small blocks are carved out of large chunks and rounded up to a power of
+// two size class, released blocks go back on their class list and are reused
+// by the next allocation of that class. blocks larger than the biggest class
+// get a chunk of their own. nothing is returned to malloc until the whole
+// arena is reset or destroyed.
+
+#define DNS_ARENA_DEFAULT_CHUNK (256 * 1024)
+#define DNS_ARENA_ALIGN 16
+#define DNS_ARENA_MIN_CLASS 4  // 16 bytes
+#define DNS_ARENA_MAX_CLASS 14 // 16 KiB
+#define DNS_ARENA_CLASS_COUNT (DNS_ARENA_MAX_CLASS - DNS_ARENA_MIN_CLASS + 1)
+
+
+typedef struct dns_arena_chunk dns_arena_chunk_t;
+typedef struct dns_arena_block dns_arena_block_t;
+
+typedef struct dns_arena_chunk {
+  dns_arena_chunk_t *next;
+  size_t size; // usable bytes after the header
+  size_t used;
+} dns_arena_chunk_t;
+
+typedef struct dns_arena_block {
+  dns_arena_block_t *next;
+} dns_arena_block_t;
+
+typedef struct {
+  dns_arena_chunk_t *chunks; // current chunk first
+  dns_arena_block_t *free_lists[DNS_ARENA_CLASS_COUNT];
+  size_t chunk_size;
+
+  size_t bytes_reserved; // obtained from malloc
+  size_t bytes_in_use;   // handed out and not released
+} dns_arena_t;
+
+
+dns_arena_t *dns_arena_create(size_t chunk_size);
+void dns_arena_destroy(dns_arena_t *arena);
+
+// zeroed memory, NULL on failure
+void *dns_arena_alloc(dns_arena_t *arena, size_t size);
+// size must be the size passed to dns_arena_alloc
+void dns_arena_release(dns_arena_t *arena, void *ptr, size_t size);
+
+// drop every allocation but keep the first chunk for reuse
+void dns_arena_reset(dns_arena_t *arena);
+
+
+#endif // DNS_ARENA_H
@@ -4,6 +4,7 @@
 
 #include "dns_records.h"
 #include "dns_parser.h"
+#include "dns_stats.h"
 #include <pthread.h>
 #include <time.h>
 #include <stdbool.h>
@@ -12,6 +13,8 @@
 
 #define DNS_CACHE_DEFAULT_SIZE 1000
 #define DNS_CACHE_HASH_SIZE 256
+#define DNS_CACHE_MAX_RRSETS 32 // per entry, a CNAME chain plus the final RRset
+#define DNS_CACHE_DUMP_LINE_MAX 384 // one line of a dump, the longest name included
 
 
 typedef struct dns_cache_entry dns_cache_entry_t;
@@ -23,7 +26,7 @@ typedef enum {
 } dns_cache_entry_type_t;
 
 typedef struct dns_cache_entry {
-  char qname[MAX_DOMAIN_NAME];
+  dns_name_t name; // canonical, the key together with qtype and qclass
   dns_record_type_t qtype;
   dns_class_t qclass;
 
@@ -32,8 +35,9 @@ typedef struct dns_cache_entry {
   time_t expiration; // expired at time
   uint32_t original_ttl;
 
-  // positive responses
-  dns_rr_t *records;
+  // positive responses, one reference held per RRset
+  dns_rrset_t **rrsets;
+  int rrset_count;
   int record_count;
 
   // negative responses
@@ -42,24 +46,19 @@ typedef struct dns_cache_entry {
   dns_cache_entry_t *next; // hash collision chaining
   dns_cache_entry_t *lru_prev;
   dns_cache_entry_t *lru_next;
-} dns_cache_entry_t;
 
-typedef struct {
-  uint64_t queries;
-  uint64_t hits;
-  uint64_t misses;
-  uint64_t expired;
-  uint64_t evictions;
-  uint64_t insertions;
-
-  uint64_t positive_hits;
-  uint64_t negative_hits;
-  uint64_t nxdomain_hits;
-  uint64_t nodata_hits;
-} dns_cache_stats_t;
+  // NXDOMAIN and wildcard answers are also chained under the name's closest
+  // encloser, a change to the zone there finds them without a table walk
+  bool enclosed;
+  uint8_t encloser_labels;
+  unsigned int encloser_bucket;
+  dns_cache_entry_t *encloser_prev;
+  dns_cache_entry_t *encloser_next;
+} dns_cache_entry_t;
 
 typedef struct {
   dns_cache_entry_t *hash_table[DNS_CACHE_HASH_SIZE];
+  dns_cache_entry_t *encloser_table[DNS_CACHE_HASH_SIZE]; // by closest encloser
 
   dns_cache_entry_t *lru_head;
   dns_cache_entry_t *lru_tail;
@@ -67,7 +66,14 @@ typedef struct {
   size_t max_entries;
   size_t current_entries;
 
-  dns_cache_stats_t stats;
+  // running totals over the live entries so a summary never walks the table
+  size_t positive_entries;
+  size_t negative_entries;
+  size_t record_count;
+  int64_t timestamp_sum;
+  int64_t expiration_sum;
+
+  dns_stats_t *stats; // the CACHE_ counters
 
   // configuration
   uint32_t min_ttl;          // minimum TTL (default: 0)
@@ -76,15 +82,29 @@ typedef struct {
   bool enable_negative_cache;
 } dns_cache_t;
 
+// positive hits reference the cached RRsets instead of copying them, their
+// stored TTLs are stale and remaining_ttl is what goes on the wire
 typedef struct {
   bool found;
   dns_cache_entry_type_t type;
-  dns_rr_t *records;         // caller must free these
+  dns_rrset_t *rrsets[DNS_CACHE_MAX_RRSETS]; // released by dns_cache_result_clear
+  int rrset_count;
   int record_count;
   uint32_t remaining_ttl;
   uint8_t rcode;
 } dns_cache_result_t;
 
+// a place in a walk over the table, zeroed to start from the top. holds the
+// key of the last entry handed out, the walk goes through a bucket in key
+// order so it picks up after that key wherever the chain has moved it
+typedef struct {
+  int bucket;
+  bool started; // name, qtype and qclass are set
+  dns_name_t name;
+  dns_record_type_t qtype;
+  dns_class_t qclass;
+} dns_cache_cursor_t;
+
 typedef struct {
   dns_cache_t *cache;
   int cleanup_interval_sec;
@@ -103,10 +123,10 @@ typedef struct {
   uint64_t total_queries;
   uint64_t positive_entries;
   uint64_t negative_entries;
+  uint64_t record_count;
 
-  time_t oldest_entry_age;
-  time_t newest_entry_age;
-  uint32_t avg_remaining_ttl;
+  time_t avg_entry_age;
+  uint32_t avg_remaining_ttl; // entries expired but not yet removed pull it down
 } dns_cache_summary_t;
 
 
@@ -146,6 +166,15 @@ int dns_cache_insert(dns_cache_t *cache,
                      int record_count,
                      uint32_t ttl);
 
+// takes a reference on each RRset, nothing is copied
+int dns_cache_insert_rrsets(dns_cache_t *cache,
+                            const char *qname,
+                            dns_record_type_t qtype,
+                            dns_class_t qclass,
+                            dns_rrset_t *const *rrsets,
+                            int rrset_count,
+                            uint32_t ttl);
+
 int dns_cache_insert_negative(dns_cache_t *cache,
                               const char *qname,
                               dns_record_type_t qtype,
@@ -159,6 +188,20 @@ dns_cache_result_t *dns_cache_lookup(dns_cache_t *cache,
                                      dns_record_type_t qtype,
                                      dns_class_t qclass);
 
+// fills caller storage, no allocation on the hit path
+bool dns_cache_lookup_into(dns_cache_t *cache,
+                           const char *qname,
+                           dns_record_type_t qtype,
+                           dns_class_t qclass,
+                           dns_cache_result_t *result);
+// the text forms convert to a canonical name and land here
+bool dns_cache_lookup_name(dns_cache_t *cache,
+                           const dns_name_t *name,
+                           dns_record_type_t qtype,
+                           dns_class_t qclass,
+                           dns_cache_result_t *result);
+
+void dns_cache_result_clear(dns_cache_result_t *result);
 void dns_cache_result_free(dns_cache_result_t *result);
 
 //  maintenance
@@ -167,17 +210,40 @@ int dns_cache_remove_entry(dns_cache_t *cache,
                            const char *qname,
                            dns_record_type_t qtype,
                            dns_class_t qclass);
+int dns_cache_remove_name(dns_cache_t *cache, const char *qname);
+// walks the whole table, dynamic update uses the encloser index instead
+int dns_cache_remove_suffix(dns_cache_t *cache, const char *suffix);
+
+// marks a cached answer as turning on the closest encloser of its name, the
+// rightmost encloser_labels of it. set after the insert, a later insert of
+// the same key clears it
+int dns_cache_set_encloser(dns_cache_t *cache,
+                           const char *qname,
+                           dns_record_type_t qtype,
+                           dns_class_t qclass,
+                           int encloser_labels);
+// entries whose closest encloser is encloser and whose name is at or below
+// below, NULL for all of them. costs the entries chained under encloser
+int dns_cache_remove_enclosed(dns_cache_t *cache, const char *encloser, const char *below);
 
 // stats/monitoring
-const dns_cache_stats_t *dns_cache_get_stats(const dns_cache_t *cache);
-void dns_cache_reset_stats(dns_cache_t *cache);
 void dns_cache_print_stats(const dns_cache_t *cache, FILE *output);
 float dns_cache_hit_rate(const dns_cache_t *cache);
 
+// constant time, from the running totals
 int dns_cache_get_summary(const dns_cache_t *cache, dns_cache_summary_t *summary);
 size_t dns_cache_memory_usage(const dns_cache_t *cache);
 int dns_cache_dump_entries(const dns_cache_t *cache, FILE *output, int max_entries);
 
+// the entry after cursor, NULL once every bucket is done. nothing is held
+// between calls, so a walk can be spread out while the cache keeps changing:
+// no entry is seen twice and those there for the whole walk are all seen,
+// ones added or removed meanwhile may or may not be. costs a bucket's chain
+const dns_cache_entry_t *dns_cache_next_entry(const dns_cache_t *cache, dns_cache_cursor_t *cursor);
+// the lines of a dump, snprintf's return
+int dns_cache_format_header(char *buf, size_t len);
+int dns_cache_format_entry(const dns_cache_entry_t *entry, time_t now, char *buf, size_t len);
+
 // configuration
 void dns_cache_set_ttl_limits(dns_cache_t *cache, uint32_t min_ttl, uint32_t max_ttl);
 void dns_cache_set_negative_ttl(dns_cache_t *cache, uint32_t ttl);
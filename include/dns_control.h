@@ -0,0 +1,82 @@
+#ifndef DNS_CONTROL_H
+#define DNS_CONTROL_H
+
+
+#include "dns_cache.h"
+#include "dns_metrics.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/select.h>
+#include <time.h>
+
+
+// runtime control over a unix socket
+//
+// like the metrics listener it lives in the server's select loop, so a
+// command runs on the thread that answers queries and needs no locks. a
+// client sends one line, "command arg...", and reads the reply until the
+// server closes the connection. a reply that failed is a single line
+// starting with "error: ". one client is served at a time.
+//
+// a cache dump goes out a chunk per pass of the loop, queries are answered
+// in between and the cache is never held for the whole walk.
+
+#define DNS_CONTROL_BUFFER_SIZE (64 * 1024)
+#define DNS_CONTROL_REQUEST_SIZE 512
+#define DNS_CONTROL_TIMEOUT_SEC 5   // a client that stalls longer is dropped
+#define DNS_CONTROL_DUMP_CHUNK 256  // cache entries per pass of the loop
+#define DNS_CONTROL_DEFAULT_PATH "dns_server.sock"
+
+typedef enum {
+  DNS_CONTROL_IDLE = 0,
+  DNS_CONTROL_READING,
+  DNS_CONTROL_WRITING,
+} dns_control_state_t;
+
+typedef struct {
+  int listen_fd;
+  char path[108]; // sun_path
+
+  // the connection being served
+  int client_fd;
+  dns_control_state_t state;
+  time_t client_since; // or its last progress
+  char request[DNS_CONTROL_REQUEST_SIZE];
+  size_t request_length;
+  dns_metrics_buffer_t reply; // reused by every command
+  size_t sent;
+
+  // a cache dump in progress
+  bool dumping;
+  dns_cache_cursor_t cursor;
+  int dump_left; // entries still wanted, negative for all of them
+} dns_control_t;
+
+
+// listening on path, a stale socket left there is replaced. NULL when the
+// socket cannot be set up
+dns_control_t *dns_control_create(const char *path);
+// closes the socket and removes it from the filesystem
+void dns_control_free(dns_control_t *control);
+
+// adds the sockets to wait on, returns the new max fd
+int dns_control_watch(dns_control_t *control, fd_set *read_fds, fd_set *write_fds, int max_fd);
+// accepts and reads what select reported, the command line once a whole one
+// is in and NULL otherwise. the caller answers it in control->reply and
+// calls dns_control_respond
+const char *dns_control_ready(dns_control_t *control, const fd_set *read_fds);
+void dns_control_respond(dns_control_t *control);
+// writes what select reported writable, closes the connection when done.
+// true when a dump wants its next chunk: the caller appends it with
+// dns_control_dump_next and responds again
+bool dns_control_flush(dns_control_t *control, const fd_set *write_fds);
+
+// replies
+void dns_control_error(dns_control_t *control, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+// the dump header, max_entries <= 0 dumps everything
+void dns_control_dump_start(dns_control_t *control, int max_entries);
+void dns_control_dump_next(dns_control_t *control, const dns_cache_t *cache);
+
+
+#endif // DNS_CONTROL_H
@@ -0,0 +1,169 @@
+#ifndef DNS_LATENCY_H
+#define DNS_LATENCY_H
+
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+// latency histograms
+//
+// values are clock ticks, the TSC on x86 and nanoseconds elsewhere, and are
+// only turned into nanoseconds when read. buckets are log-linear in the
+// HDR style: values below DNS_HIST_SUB are exact, above that every power of
+// two is split into DNS_HIST_SUB buckets, so a bucket is never wider than
+// 1/16 of the values in it. recording is a count leading zeros, two shifts
+// and three plain stores.
+//
+// a histogram has one writer, the thread that owns it, and any number of
+// readers. workers keep a dns_latency_t each and readers merge them.
+
+#define DNS_HIST_SUB_BITS 4
+#define DNS_HIST_SUB (1u << DNS_HIST_SUB_BITS)
+#define DNS_HIST_MAX_BITS 40 // 2^40 ticks is minutes, anything longer is clamped
+#define DNS_HIST_BUCKETS (DNS_HIST_SUB * (DNS_HIST_MAX_BITS - DNS_HIST_SUB_BITS + 1))
+
+typedef struct {
+  _Atomic uint64_t count;
+  _Atomic uint64_t sum;
+  _Atomic uint64_t max;
+  _Atomic uint64_t buckets[DNS_HIST_BUCKETS];
+} dns_histogram_t;
+
+// where a query spends its time, total is parse to the end of encode
+typedef enum {
+  DNS_STAGE_PARSE = 0,
+  DNS_STAGE_CACHE,     // lookups and stores
+  DNS_STAGE_RESOLVE,   // trie, precompiled lookup, handing off to recursion
+  DNS_STAGE_ENCODE,
+  DNS_STAGE_SEND,
+  DNS_STAGE_RECURSIVE, // one upstream round trip
+  DNS_STAGE_TOTAL,
+  DNS_STAGE_COUNT
+} dns_stage_t;
+
+// how the query was answered
+typedef enum {
+  DNS_OUTCOME_CACHE_HIT = 0,
+  DNS_OUTCOME_AUTHORITATIVE,
+  DNS_OUTCOME_RECURSIVE,
+  DNS_OUTCOME_ERROR, // dropped, FORMERR, NOTIMP, SERVFAIL and the like
+  DNS_OUTCOME_COUNT
+} dns_outcome_t;
+
+typedef struct {
+  dns_histogram_t histograms[DNS_STAGE_COUNT][DNS_OUTCOME_COUNT];
+} dns_latency_t;
+
+// one query in flight, stages are summed until the outcome is known
+typedef struct {
+  bool enabled;
+  dns_outcome_t outcome;
+  uint32_t seen; // bit per stage marked
+  uint64_t start;
+  uint64_t last;
+  uint64_t stages[DNS_STAGE_COUNT];
+} dns_query_timer_t;
+
+typedef struct {
+  uint64_t count;
+  uint64_t p50_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+  uint64_t max_ns;
+  uint64_t mean_ns;
+} dns_latency_summary_t;
+
+
+static inline uint64_t dns_clock_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// measured once against CLOCK_MONOTONIC on first use, 1 without a TSC
+double dns_clock_ns_per_tick(void);
+
+static inline unsigned dns_histogram_bucket(uint64_t value) {
+  if (value < DNS_HIST_SUB) return (unsigned)value;
+  if (value >> DNS_HIST_MAX_BITS) value = (UINT64_C(1) << DNS_HIST_MAX_BITS) - 1;
+
+  unsigned msb = 63u - (unsigned)__builtin_clzll(value);
+  unsigned shift = msb - DNS_HIST_SUB_BITS;
+  return DNS_HIST_SUB * (shift + 1) + (unsigned)(value >> shift) - DNS_HIST_SUB;
+}
+
+// single writer, see above
+static inline void dns_histogram_record(dns_histogram_t *hist, uint64_t value) {
+  _Atomic uint64_t *bucket = &hist->buckets[dns_histogram_bucket(value)];
+  atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+  atomic_store_explicit(&hist->count, atomic_load_explicit(&hist->count, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+  atomic_store_explicit(&hist->sum, atomic_load_explicit(&hist->sum, memory_order_relaxed) + value,
+                        memory_order_relaxed);
+  if (value > atomic_load_explicit(&hist->max, memory_order_relaxed)) {
+    atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+  }
+}
+
+// largest value that lands in the same bucket as the q quantile, 0 when empty
+uint64_t dns_histogram_quantile(const dns_histogram_t *hist, double q);
+// smallest and largest value of a bucket
+uint64_t dns_histogram_bucket_low(unsigned bucket);
+uint64_t dns_histogram_bucket_high(unsigned bucket);
+void dns_histogram_merge(dns_histogram_t *dst, const dns_histogram_t *src);
+void dns_histogram_reset(dns_histogram_t *hist);
+
+dns_latency_t *dns_latency_create(void);
+void dns_latency_free(dns_latency_t *latency);
+void dns_latency_reset(dns_latency_t *latency);
+void dns_latency_merge(dns_latency_t *dst, const dns_latency_t *src);
+
+// a NULL latency records nothing
+static inline void dns_latency_record(dns_latency_t *latency, dns_stage_t stage,
+                                      dns_outcome_t outcome, uint64_t ticks) {
+  if (latency) dns_histogram_record(&latency->histograms[stage][outcome], ticks);
+}
+
+const char *dns_stage_name(dns_stage_t stage);
+const char *dns_outcome_name(dns_outcome_t outcome);
+void dns_latency_summary(const dns_latency_t *latency, dns_stage_t stage,
+                         dns_outcome_t outcome, dns_latency_summary_t *summary);
+// one line per stage and outcome that saw a query
+void dns_latency_print(const dns_latency_t *latency, FILE *output);
+
+// a disabled timer never reads the clock
+static inline void dns_query_timer_start(dns_query_timer_t *timer, bool enabled) {
+  timer->enabled = enabled;
+  timer->outcome = DNS_OUTCOME_ERROR;
+  timer->seen = 0;
+  timer->start = timer->last = enabled ? dns_clock_ticks() : 0;
+  for (int i = 0; i < DNS_STAGE_COUNT; ++i) timer->stages[i] = 0;
+}
+
+// the time since the previous mark goes to stage
+static inline void dns_query_timer_mark(dns_query_timer_t *timer, dns_stage_t stage) {
+  if (!timer->enabled) return;
+
+  uint64_t now = dns_clock_ticks();
+  timer->stages[stage] += now - timer->last;
+  timer->seen |= 1u << stage;
+  timer->last = now;
+}
+
+// every stage marked and the total, under the timer's outcome
+void dns_latency_record_timer(dns_latency_t *latency, const dns_query_timer_t *timer);
+
+
+#endif // DNS_LATENCY_H
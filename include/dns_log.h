@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <pthread.h>
 
@@ -48,6 +49,27 @@ void dns_log_set_timestamp(bool enabled);
 void dns_log_set_file_line(bool enabled);
 void dns_log_set_color(bool enabled);
 
+// async mode
+//
+// each thread formats its lines into a ring of its own, a writer thread
+// drains every ring to the log file and batches the lines into writev
+// calls. a thread never waits on another thread or on the file: when its
+// ring is full the line is dropped and counted, and the writer notes the
+// drops in the file. the first line a thread logs allocates its ring.
+#define DNS_LOG_RING_SLOTS 1024
+#define DNS_LOG_LINE_MAX 512 // longer lines are truncated
+#define DNS_LOG_BATCH 64 // lines per writev
+#define DNS_LOG_IDLE_NS 1000000 // the writer's nap when every ring is empty
+
+// appends to path, -1 when it cannot be opened
+int dns_log_start_async(const char *path);
+// writes out what is queued, then joins the writer and closes the file
+void dns_log_stop_async(void);
+bool dns_log_is_async(void);
+// waits until every line queued so far is written
+void dns_log_flush(void);
+uint64_t dns_log_dropped(void);
+
 dns_log_level_t dns_log_level_from_string(const char *str);
 const char *dns_log_level_to_string(dns_log_level_t level);
 void dns_log_write(dns_log_level_t level, const char *file, int line,
@@ -58,23 +80,67 @@ void dns_log_writev(dns_log_level_t level, const char *file, int line,
 bool dns_log_is_enabled(dns_log_level_t level);
 
 
-#define DNS_LOG_TRACE(...) \
-  dns_log_write(DNS_LOG_TRACE, __FILE__, __LINE__, __func__, __VA_ARGS__)
-
-#define DNS_LOG_DEBUG(...) \
-  dns_log_write(DNS_LOG_DEBUG, __FILE__, __LINE__, __func__, __VA_ARGS__)
-
-#define DNS_LOG_INFO(...) \
-  dns_log_write(DNS_LOG_INFO, __FILE__, __LINE__, __func__, __VA_ARGS__)
-
-#define DNS_LOG_WARN(...) \
-  dns_log_write(DNS_LOG_WARN, __FILE__, __LINE__, __func__, __VA_ARGS__)
-
-#define DNS_LOG_ERROR(...) \
-  dns_log_write(DNS_LOG_ERROR, __FILE__, __LINE__, __func__, __VA_ARGS__)
+// compile-time floor
+//
+// calls below DNS_LOG_COMPILE_LEVEL are compiled out along with their
+// arguments, release builds set it to DNS_LOG_LEVEL_INFO. the numbers match
+// dns_log_level_t, the preprocessor cannot see enum values
+#define DNS_LOG_LEVEL_TRACE 0
+#define DNS_LOG_LEVEL_DEBUG 1
+#define DNS_LOG_LEVEL_INFO 2
+#define DNS_LOG_LEVEL_WARN 3
+#define DNS_LOG_LEVEL_ERROR 4
+#define DNS_LOG_LEVEL_FATAL 5
+
+#ifndef DNS_LOG_COMPILE_LEVEL
+#define DNS_LOG_COMPILE_LEVEL DNS_LOG_LEVEL_TRACE
+#endif
+
+// arguments are only evaluated when the level is on at runtime
+#define DNS_LOG_AT(level, ...) \
+  do { \
+    if (dns_log_is_enabled(level)) dns_log_write(level, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+  } while(0)
 
-#define DNS_LOG_FATAL(...) \
-  dns_log_write(DNS_LOG_FATAL, __FILE__, __LINE__, __func__, __VA_ARGS__)
+// still type checked, never evaluated
+#define DNS_LOG_DISCARD(...) \
+  do { if (0) dns_log_write(DNS_LOG_OFF, NULL, 0, NULL, __VA_ARGS__); } while(0)
+
+#if DNS_LOG_COMPILE_LEVEL <= DNS_LOG_LEVEL_TRACE
+#define DNS_LOG_TRACE(...) DNS_LOG_AT(DNS_LOG_TRACE, __VA_ARGS__)
+#else
+#define DNS_LOG_TRACE(...) DNS_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if DNS_LOG_COMPILE_LEVEL <= DNS_LOG_LEVEL_DEBUG
+#define DNS_LOG_DEBUG(...) DNS_LOG_AT(DNS_LOG_DEBUG, __VA_ARGS__)
+#else
+#define DNS_LOG_DEBUG(...) DNS_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if DNS_LOG_COMPILE_LEVEL <= DNS_LOG_LEVEL_INFO
+#define DNS_LOG_INFO(...) DNS_LOG_AT(DNS_LOG_INFO, __VA_ARGS__)
+#else
+#define DNS_LOG_INFO(...) DNS_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if DNS_LOG_COMPILE_LEVEL <= DNS_LOG_LEVEL_WARN
+#define DNS_LOG_WARN(...) DNS_LOG_AT(DNS_LOG_WARN, __VA_ARGS__)
+#else
+#define DNS_LOG_WARN(...) DNS_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if DNS_LOG_COMPILE_LEVEL <= DNS_LOG_LEVEL_ERROR
+#define DNS_LOG_ERROR(...) DNS_LOG_AT(DNS_LOG_ERROR, __VA_ARGS__)
+#else
+#define DNS_LOG_ERROR(...) DNS_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if DNS_LOG_COMPILE_LEVEL <= DNS_LOG_LEVEL_FATAL
+#define DNS_LOG_FATAL(...) DNS_LOG_AT(DNS_LOG_FATAL, __VA_ARGS__)
+#else
+#define DNS_LOG_FATAL(...) DNS_LOG_DISCARD(__VA_ARGS__)
+#endif
 
 
 // conditional logging to avoid argument evaluation if level disabled
@@ -0,0 +1,93 @@
+#ifndef DNS_METRICS_H
+#define DNS_METRICS_H
+
+
+#include "dns_stats.h"
+#include "dns_latency.h"
+#include "dns_cache.h"
+#include "dns_trie.h"
+#include "dns_recursive.h"
+#include "dns_topk.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/select.h>
+#include <time.h>
+
+
+// prometheus text exposition over HTTP on localhost
+//
+// the listener lives in the server's select loop next to the DNS sockets,
+// one scrape is served at a time and further connections wait in the
+// backlog. a scrape reads counters, histograms and running totals only, it
+// takes no locks and walks nothing that grows with the cache or the zones.
+
+#define DNS_METRICS_BUFFER_SIZE (64 * 1024)
+#define DNS_METRICS_REQUEST_SIZE 1024
+#define DNS_METRICS_TIMEOUT_SEC 5 // a client that stalls longer is dropped
+
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+  bool overflow; // something did not fit, the scrape is answered with a 500
+} dns_metrics_buffer_t;
+
+typedef enum {
+  DNS_METRICS_IDLE = 0,
+  DNS_METRICS_READING,
+  DNS_METRICS_WRITING,
+} dns_metrics_state_t;
+
+typedef struct {
+  int listen_fd;
+  uint16_t port;
+
+  // the connection being served
+  int client_fd;
+  dns_metrics_state_t state;
+  time_t client_since;
+  char request[DNS_METRICS_REQUEST_SIZE];
+  size_t request_length;
+  char head[256];
+  size_t head_length;
+  size_t sent; // of head and body together
+
+  dns_metrics_buffer_t body; // reused by every scrape
+} dns_metrics_t;
+
+
+// listening on 127.0.0.1:port, NULL when the socket cannot be set up
+dns_metrics_t *dns_metrics_create(uint16_t port);
+void dns_metrics_free(dns_metrics_t *metrics);
+
+// adds the sockets to wait on, returns the new max fd
+int dns_metrics_watch(dns_metrics_t *metrics, fd_set *read_fds, fd_set *write_fds, int max_fd);
+// accepts and reads what select reported, true when a scrape is due. the
+// caller then fills metrics->body and calls dns_metrics_respond
+bool dns_metrics_ready(dns_metrics_t *metrics, const fd_set *read_fds);
+void dns_metrics_respond(dns_metrics_t *metrics);
+// writes what select reported writable, closes the connection when done
+void dns_metrics_flush(dns_metrics_t *metrics, const fd_set *write_fds);
+
+// exposition
+void dns_metrics_buffer_reset(dns_metrics_buffer_t *buf);
+void dns_metrics_appendf(dns_metrics_buffer_t *buf, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+// # HELP and # TYPE lines
+void dns_metrics_family(dns_metrics_buffer_t *buf, const char *name, const char *type,
+                        const char *help);
+
+// every counter as dns_<name>_total
+void dns_metrics_write_stats(dns_metrics_buffer_t *buf, const dns_stats_snapshot_t *snapshot);
+// dns_query_duration_seconds summaries per stage and outcome
+void dns_metrics_write_latency(dns_metrics_buffer_t *buf, const dns_latency_t *latency);
+void dns_metrics_write_cache(dns_metrics_buffer_t *buf, const dns_cache_t *cache);
+void dns_metrics_write_trie(dns_metrics_buffer_t *buf, const dns_trie_t *trie);
+// per root hint and one series for every other server
+void dns_metrics_write_upstreams(dns_metrics_buffer_t *buf, const dns_recursive_resolver_t *resolver);
+// the top DNS_TOPK_REPORT qnames, client networks and qtypes
+void dns_metrics_write_hitters(dns_metrics_buffer_t *buf, const dns_hitters_t *hitters);
+
+
+#endif // DNS_METRICS_H
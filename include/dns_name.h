@@ -0,0 +1,62 @@
+#ifndef DNS_NAME_H
+#define DNS_NAME_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+
+// canonical domain name
+//
+// the name is kept in wire form (length-prefixed labels ending in the root
+// label) with every letter lowercased, so two spellings of the same name are
+// the same bytes. label offsets and the hash are worked out once when the
+// name is built; comparing names is then a hash check and a memcmp, and
+// nothing on the lookup paths splits, lowercases or strcasecmps text again
+
+#define DNS_NAME_MAX_WIRE   255 // RFC 1035 2.3.4, root label included
+#define DNS_NAME_MAX_LABELS 127
+
+typedef struct {
+  uint8_t wire[DNS_NAME_MAX_WIRE];
+  uint8_t len;          // bytes in wire, root label included
+  uint8_t label_count;  // root label not counted
+  uint8_t label_offsets[DNS_NAME_MAX_LABELS]; // length byte of each label, leftmost first
+  uint32_t hash;
+} dns_name_t;
+
+
+// building, a name with no labels is the root
+void dns_name_init(dns_name_t *name);
+// lowercases the label in, -1 when it is empty, too long, holds a NUL or a
+// '.', or would push the name over 255 bytes
+int dns_name_append_label(dns_name_t *name, const uint8_t *label, size_t len);
+// writes the root label and the hash, the name is usable after this
+void dns_name_finish(dns_name_t *name);
+
+// dotted text, a trailing dot is optional and "" or "." is the root
+int dns_name_from_text(dns_name_t *name, const char *text);
+// dotted text without the trailing dot, the root is ""
+int dns_name_to_text(const dns_name_t *name, char *out, size_t out_len);
+
+bool dns_name_is_subdomain(const dns_name_t *name, const dns_name_t *parent);
+// the rightmost labels of name, 0 gives the root
+void dns_name_suffix(const dns_name_t *name, int labels, dns_name_t *suffix);
+
+
+// canonical names are equal exactly when their bytes are
+static inline bool dns_name_eq(const dns_name_t *a, const dns_name_t *b) {
+  return a->hash == b->hash && a->len == b->len && memcmp(a->wire, b->wire, a->len) == 0;
+}
+
+// label i counted from the left, not NUL terminated
+static inline const uint8_t *dns_name_label(const dns_name_t *name, int i, uint8_t *len) {
+  const uint8_t *label = name->wire + name->label_offsets[i];
+  *len = label[0];
+  return label + 1;
+}
+
+
+#endif // DNS_NAME_H
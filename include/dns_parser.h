@@ -3,6 +3,8 @@
 
 
 #include "dns_records.h"
+#include "dns_name.h"
+#include "dns_arena.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -15,6 +17,7 @@
 #define DNS_OPCODE_QUERY  0
 #define DNS_OPCODE_IQUERY 1
 #define DNS_OPCODE_STATUS 2
+#define DNS_OPCODE_UPDATE 5
 
 #define DNS_RCODE_NOERROR   0
 #define DNS_RCODE_FORMERROR 1
@@ -22,6 +25,11 @@
 #define DNS_RCODE_NXDOMAIN  3
 #define DNS_RCODE_NOTIMP    4
 #define DNS_RCODE_REFUSED   5
+#define DNS_RCODE_YXDOMAIN  6  // RFC 2136 update rcodes
+#define DNS_RCODE_YXRRSET   7
+#define DNS_RCODE_NXRRSET   8
+#define DNS_RCODE_NOTAUTH   9
+#define DNS_RCODE_NOTZONE   10
 
 
 // header
@@ -51,15 +59,114 @@ typedef struct {
   uint16_t qclass;
 } dns_question_t;
 
+// the question as it sits in the request. QNAME has to be uncompressed, a
+// pointer in the first name of a message has nothing valid to point at, so
+// name.len bytes at qname_offset are the name as the client spelled it and
+// name holds the same labels lowercased, at the same offsets
+typedef struct {
+  const uint8_t *msg;     // the request the view points into
+  uint16_t qname_offset;  // QNAME start in msg
+  dns_name_t name;        // canonical QNAME, the lookup key
+  uint16_t qtype;
+  uint16_t qclass;
+} dns_question_view_t;
+
+// resource record header, rdata is left in the buffer
+typedef struct {
+  char name[MAX_DOMAIN_NAME];
+  uint16_t type;
+  uint16_t rclass;
+  uint32_t ttl;
+  uint16_t rdlength;
+  size_t rdata_offset;
+} dns_rr_header_t;
+
+// EDNS(0) as the requestor sent it in an OPT record (RFC 6891)
+#define DNS_OPT_RR_LEN 11 // root owner, type, class, TTL and an empty rdata
+
+typedef struct {
+  bool present;
+  uint8_t version;
+  bool dnssec_ok;
+  uint16_t udp_size; // requestor's payload size, not clamped
+} dns_edns_t;
+
+// a record of a parsed message, types without a codec of their own (OPT,
+// DS, ...) come out as opaque rdata, rdata_offset still points at the wire
+typedef struct {
+  dns_name_t owner;
+  uint16_t type;
+  uint16_t rclass;
+  uint32_t ttl;
+  uint16_t rdlength;
+  uint16_t rdata_offset;
+  dns_rr_t *rr;
+} dns_message_rr_t;
+
 // message
 typedef struct {
     dns_header_t header;
     dns_question_t *questions;
-    dns_rr_t **answers;
-    dns_rr_t **authority;
-    dns_rr_t **additional;
+    // set by the server path, questions[0] may then only be filled on demand
+    dns_question_view_t question_view;
+    bool has_question_view;
+    // OPT of the request, set by the server path and dns_parse_message
+    dns_edns_t edns;
+    // filled by dns_parse_message, header counts give their lengths. the
+    // records and their rdata live in the arena handed to the parse and are
+    // gone once it is reset, dns_message_free leaves them alone
+    dns_message_rr_t *answers;
+    dns_message_rr_t *authority;
+    dns_message_rr_t *additional;
 } dns_message_t;
 
+// per message name compression table (RFC 1035 4.1.4)
+//
+// every name written through it records the offsets of its suffixes, later
+// names that share a suffix end in a 0xC0 pointer to it. suffixes are hashed
+// case-insensitively and chained per bucket, a hit is confirmed against the
+// bytes already in the message before a pointer is emitted.
+#define DNS_COMPRESS_MAX_ENTRIES 256
+#define DNS_COMPRESS_BUCKETS 64 // power of two
+#define DNS_COMPRESS_MAX_OFFSET 0x3FFF
+
+typedef struct {
+  uint32_t hash;
+  uint16_t offset; // of the suffix in the message
+  uint16_t next;   // index + 1 of the next entry in the bucket, 0 ends
+} dns_compress_entry_t;
+
+typedef struct {
+  uint16_t buckets[DNS_COMPRESS_BUCKETS]; // index + 1, 0 is empty
+  dns_compress_entry_t entries[DNS_COMPRESS_MAX_ENTRIES];
+  int count;
+
+  // when set, the offset of every pointer written through the table, owners
+  // and rdata names alike. left NULL by dns_compress_init
+  uint16_t *pointers;
+  int pointer_count;
+  int pointer_capacity;
+} dns_compress_t;
+
+// records encoded ahead of time, copied into a response as is
+//
+// a fragment is encoded right behind an anchor name, the owner for answers
+// or the zone apex for an authority SOA, with its names compressed against
+// that anchor and against each other. every compression pointer in the wire
+// bytes is listed in relocs, writing the fragment somewhere else rebases
+// them; at the offset it was encoded for nothing needs touching
+#define DNS_FRAGMENT_MAX_LEN 4096
+
+typedef struct {
+  uint16_t len;        // bytes of wire
+  uint16_t count;      // records, for the header counts
+  uint16_t base;       // offset the wire was encoded at
+  uint8_t anchor_len;  // anchor name sat at 12, gap bytes before base
+  uint16_t reloc_count;
+  uint16_t *relocs;    // offsets in wire of each pointer
+  uint8_t *wire;
+} dns_fragment_t;
+
 typedef struct {
   uint16_t query_id;
   uint8_t rcode;
@@ -77,11 +184,64 @@ void dns_message_free(dns_message_t *msg);
 int dns_parse_header(const uint8_t *buf, size_t len, dns_header_t *header);
 int dns_parse_question(const uint8_t *buf, size_t len, size_t *offset, dns_question_t *question);
 int dns_parse_name(const uint8_t *buf, size_t len, size_t *offset, char *name, size_t name_len);
+// the same walk, pointers included, into a canonical name
+int dns_parse_name_wire(const uint8_t *buf, size_t len, size_t *offset, dns_name_t *name);
+int dns_parse_question_view(const uint8_t *buf, size_t len, size_t *offset, dns_question_view_t *view);
+// dotted form, for the paths that still work on text
+int dns_question_view_to_question(const dns_question_view_t *view, dns_question_t *question);
+int dns_parse_rr_header(const uint8_t *buf, size_t len, size_t *offset, dns_rr_header_t *header);
+int dns_parse_rdata(const uint8_t *buf, size_t len, const dns_rr_header_t *header, dns_rr_t **rr);
+// header, question and every record in one pass, msg points into buf and
+// arena afterwards. -1 on anything malformed, rdata of the known types
+// included
+int dns_parse_message(const uint8_t *buf, size_t len, dns_arena_t *arena, dns_message_t *msg);
+
+// finds the OPT record among the records after the question, offset is the
+// end of the question. no OPT leaves edns->present false, -1 when the
+// records are malformed
+int dns_parse_edns(const uint8_t *buf, size_t len, size_t offset,
+                   const dns_header_t *header, dns_edns_t *edns);
 
 int dns_encode_header(uint8_t *buf, size_t len, const dns_header_t *header);
 int dns_encode_question(uint8_t *buf, size_t len, size_t *offset, const dns_question_t *question);
 int dns_encode_name(uint8_t *buf, size_t len, size_t *offset, const char *name);
 int dns_encode_rr(uint8_t *buf, size_t len, size_t *offset, const char *name, const dns_rr_t *rr);
+// an OPT record advertising udp_size, no options
+int dns_encode_opt(uint8_t *buf, size_t len, size_t *offset, uint16_t udp_size);
+
+// buf must be the start of the message, offsets in the table are relative to it
+void dns_compress_init(dns_compress_t *ctx);
+// drop entries at or past offset, for callers that rewind the message
+void dns_compress_truncate(dns_compress_t *ctx, size_t offset);
+// record the suffixes of an uncompressed name already written at offset
+void dns_compress_add_wire(dns_compress_t *ctx, const uint8_t *buf, size_t offset);
+// a NULL ctx writes the name uncompressed
+int dns_encode_name_compressed(uint8_t *buf, size_t len, size_t *offset,
+                               const char *name, dns_compress_t *ctx);
+int dns_encode_question_compressed(uint8_t *buf, size_t len, size_t *offset,
+                                   const dns_question_t *question, dns_compress_t *ctx);
+
+// TTL supplied by the caller, records shared with the trie or cache are never
+// rewritten. owner and rdata names go through ctx when it is not NULL
+int dns_encode_rr_ttl(uint8_t *buf, size_t len, size_t *offset, const char *name,
+                      const dns_rr_t *rr, uint32_t ttl, dns_compress_t *ctx);
+// returns the number of records written
+int dns_encode_rrset(uint8_t *buf, size_t len, size_t *offset, const char *name,
+                     const dns_rrset_t *rrset, uint32_t ttl, dns_compress_t *ctx);
+// every owner is a pointer to the name at owner_offset, usually the question
+int dns_encode_rrset_owner_at(uint8_t *buf, size_t len, size_t *offset, size_t owner_offset,
+                              const dns_rrset_t *rrset, uint32_t ttl, dns_compress_t *ctx);
+
+// every record of rrset owned by anchor, gap bytes sit between the anchor and
+// the records (4 for the qtype and qclass of a question). NULL when the set
+// encodes to more than DNS_FRAGMENT_MAX_LEN
+dns_fragment_t *dns_fragment_build(const dns_name_t *anchor, size_t gap,
+                                   const dns_rrset_t *rrset, uint32_t ttl);
+void dns_fragment_free(dns_fragment_t *fragment);
+// anchor_offset is where the anchor's labels start in buf, the tail of a
+// longer question name will do
+int dns_fragment_write(uint8_t *buf, size_t len, size_t *offset,
+                       const dns_fragment_t *fragment, size_t anchor_offset);
 
 int dns_parse_response_summary(const uint8_t *buf, size_t len, dns_response_summary_t *summary);
 int dns_build_error_response_header(uint8_t *buf, size_t capacity,
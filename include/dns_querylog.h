@@ -0,0 +1,123 @@
+#ifndef DNS_QUERYLOG_H
+#define DNS_QUERYLOG_H
+
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// binary query log
+//
+// one fixed-layout record per query, in the spirit of dnstap but without
+// the protobuf. a thread appends to a byte ring of its own, picked by its
+// stats row, so the query path copies a few hundred bytes and moves a
+// counter. threads past the last private ring share it under a spin lock.
+// a writer thread drains the rings into the log file with writev, rotates
+// it by size and keeps the last few. a full ring drops the record and
+// counts it, the query path never waits on the file.
+//
+// a file is DNS_QUERYLOG_MAGIC followed by records back to back. every
+// integer is big endian:
+//
+//   0  u16  record length, this field included
+//   2  u8   client address family, 4, 6 or 0 when unknown
+//   3  u8   outcome, dns_outcome_t
+//   4  u64  time the answer was ready, ns since the epoch
+//   12 u32  latency in ns, parse to encode
+//   16 u8[16] client address, v4 in the first 4 bytes
+//   32 u16  client port
+//   34 u16  query id
+//   36 u16  query flags, the second header word
+//   38 u16  response flags with the rcode, 0 when nothing was sent
+//   40 u16  response size, 0 when nothing was sent
+//   42 u16  qtype
+//   44 u16  qclass
+//   46 u8   qname length
+//   47 ...  qname in wire form as the client sent it
+
+#define DNS_QUERYLOG_MAGIC "DNSQLOG1"
+#define DNS_QUERYLOG_MAGIC_SIZE 8
+#define DNS_QUERYLOG_HEADER_SIZE 47
+#define DNS_QUERYLOG_RECORD_MAX (DNS_QUERYLOG_HEADER_SIZE + 255)
+
+#define DNS_QUERYLOG_RINGS 8
+#define DNS_QUERYLOG_RING_SIZE (256 * 1024) // bytes, a power of two
+#define DNS_QUERYLOG_IDLE_NS 1000000 // the writer's nap when every ring is empty
+#define DNS_QUERYLOG_CACHE_LINE 64
+
+typedef struct {
+  uint64_t time_ns;
+  uint32_t latency_ns;
+  uint8_t family;
+  uint8_t outcome;
+  uint8_t address[16];
+  uint16_t port;
+  uint16_t id;
+  uint16_t query_flags;
+  uint16_t response_flags;
+  uint16_t response_size;
+  uint16_t qtype;
+  uint16_t qclass;
+  uint8_t qname_length;
+  uint8_t qname[255];
+} dns_querylog_record_t;
+
+// single producer unless it is the shared last ring, the writer moves tail
+typedef struct {
+  _Alignas(DNS_QUERYLOG_CACHE_LINE) _Atomic size_t head;
+  atomic_flag lock; // the last ring only
+  _Alignas(DNS_QUERYLOG_CACHE_LINE) _Atomic size_t tail;
+  uint8_t data[DNS_QUERYLOG_RING_SIZE];
+} dns_querylog_ring_t;
+
+typedef struct {
+  char path[256];
+  uint32_t sample;       // one query in sample is logged, 1 logs all
+  uint64_t rotate_bytes; // a file is rotated once it grows past this, 0 never
+  uint32_t keep;         // rotated files kept as path.1 .. path.keep
+
+  _Atomic(dns_querylog_ring_t *) rings[DNS_QUERYLOG_RINGS]; // allocated on first use
+  _Atomic uint64_t records;
+  _Atomic uint64_t dropped;
+
+  // writer
+  int fd;
+  uint64_t file_bytes;
+  _Atomic bool running;
+  pthread_t writer;
+} dns_querylog_t;
+
+
+// opens path for appending and starts the writer, NULL on failure
+dns_querylog_t *dns_querylog_create(const char *path, uint32_t sample,
+                                    uint64_t rotate_bytes, uint32_t keep);
+// drains what is queued, then stops the writer and closes the file
+void dns_querylog_free(dns_querylog_t *log);
+
+// true for the queries that should be logged, a countdown per thread
+static inline bool dns_querylog_sample(const dns_querylog_t *log) {
+  static _Thread_local uint32_t countdown;
+  if (!log) return false;
+  if (countdown > 0) {
+    --countdown;
+    return false;
+  }
+  countdown = log->sample > 0 ? log->sample - 1 : 0;
+  return true;
+}
+
+// copies the record into the calling thread's ring, false when it was dropped
+bool dns_querylog_append(dns_querylog_t *log, const dns_querylog_record_t *record);
+// waits until every record appended so far is in the file
+void dns_querylog_flush(dns_querylog_t *log);
+
+// bytes written to dst, 0 when it does not fit
+size_t dns_querylog_encode(const dns_querylog_record_t *record, uint8_t *dst, size_t capacity);
+// bytes read from src, 0 when src holds no whole record
+size_t dns_querylog_decode(const uint8_t *src, size_t length, dns_querylog_record_t *record);
+
+
+#endif // DNS_QUERYLOG_H
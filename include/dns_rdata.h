@@ -0,0 +1,90 @@
+#ifndef DNS_RDATA_H
+#define DNS_RDATA_H
+
+
+#include "dns_records.h"
+#include "dns_parser.h"
+#include "dns_arena.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// rdata codec
+//
+// every type the server understands is one line in DNS_RDATA_TYPES, which
+// expands into the ops table below. each codec is a set of small functions
+// that only know their own type: wire to record, record to wire, fixing up
+// pointers after a record is copied, comparing rdata and reading the zone
+// file form. callers look the ops up once per record and call through
+// them, nothing else switches on the type. a type missing from the list is
+// carried as opaque bytes (RFC 3597) and still round trips.
+//
+// columns are the type and its codec, types with the same layout share one
+
+#define DNS_RDATA_TYPES(X) \
+  X(A,     a)              \
+  X(NS,    name)           \
+  X(CNAME, name)           \
+  X(SOA,   soa)            \
+  X(PTR,   name)           \
+  X(MX,    mx)             \
+  X(TXT,   txt)            \
+  X(AAAA,  aaaa)           \
+  X(SRV,   srv)            \
+  X(CAA,   caa)
+
+// one record's rdata in a message, names may point anywhere before end
+typedef struct {
+  const uint8_t *buf;
+  size_t len;         // of buf, compression pointers are bounded by it
+  size_t pos;         // advanced by the decoder
+  size_t end;         // of the rdata
+  dns_arena_t *arena; // NULL for heap records
+  uint16_t type;
+  uint16_t rclass;
+  uint32_t ttl;
+} dns_rdata_in_t;
+
+typedef struct {
+  uint16_t type;
+  const char *mnemonic; // NULL for the opaque ops, those print as TYPEnnn
+
+  // record sized to its rdata, -1 on malformed rdata
+  int (*decode)(dns_rdata_in_t *in, dns_rr_t **rr);
+  // rdata only, names go through ctx when the type allows compression
+  int (*encode)(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx);
+  // rdlength without compression, an upper bound for names given as text
+  size_t (*size)(const dns_rr_t *rr);
+  // dst is a byte copy of src, pointers into src->data are moved over
+  void (*rebase)(const dns_rr_t *src, dns_rr_t *dst);
+  bool (*equal)(const dns_rr_t *a, const dns_rr_t *b);
+  // presentation form with the tokens joined by single spaces, NULL if invalid
+  dns_rr_t *(*from_text)(uint16_t type, const char *text, uint32_t ttl);
+} dns_rdata_ops_t;
+
+
+// never NULL, types outside the list get the RFC 3597 ops
+const dns_rdata_ops_t *dns_rdata_ops(uint16_t type);
+
+// "MX" or "TYPE15", 0 when neither
+uint16_t dns_rdata_type_from_text(const char *text);
+// the mnemonic, TYPEnnn for the rest
+const char *dns_rdata_type_to_text(uint16_t type, char *buf, size_t len);
+
+// a record from the message arena when there is one, the heap otherwise
+dns_rr_t *dns_rdata_alloc(dns_arena_t *arena, uint16_t type, uint16_t rclass,
+                          uint32_t ttl, size_t data_len);
+// rdata at [offset, offset + rdlength) of buf, an empty rdata gives an empty
+// record of any type (update prerequisites and deletes)
+int dns_rdata_decode(const uint8_t *buf, size_t len, uint16_t type, uint16_t rclass,
+                     uint32_t ttl, size_t offset, uint16_t rdlength,
+                     dns_arena_t *arena, dns_rr_t **rr);
+// rdlength the rdata needs at most, compression only makes it shorter
+size_t dns_rdata_size(const dns_rr_t *rr);
+// rdlength and rdata
+int dns_rdata_encode(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr,
+                     dns_compress_t *ctx);
+
+
+#endif // DNS_RDATA_H
@@ -2,6 +2,7 @@
 #define DNS_RECORDS_H
 
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
@@ -24,17 +25,23 @@ typedef enum {
   DNS_TYPE_PTR = 12,
   DNS_TYPE_MX = 15,
   DNS_TYPE_TXT = 16,
-  DNS_TYPE_AAAA = 28
+  DNS_TYPE_AAAA = 28,
+  DNS_TYPE_SRV = 33,
+  DNS_TYPE_OPT = 41,  // EDNS pseudo-record, never stored
+  DNS_TYPE_ANY = 255, // QTYPE/update only
+  DNS_TYPE_CAA = 257
 } dns_record_type_t;
 
 typedef enum {
   DNS_CLASS_IN = 1, // Internet
   DNS_CLASS_CS = 2, // CSNET
   DNS_CLASS_CH = 3, // CHAOS
-  DNS_CLASS_HS = 4  // Hesiod
+  DNS_CLASS_HS = 4,  // Hesiod
+  DNS_CLASS_NONE = 254, // RFC 2136 update only
+  DNS_CLASS_ANY = 255
 } dns_class_t;
 
-// SOA Record
+// SOA Record, owned copy kept by a zone
 typedef struct {
   char mname[MAX_DOMAIN_NAME]; // primary name server
   char rname[MAX_DOMAIN_NAME]; // email
@@ -45,6 +52,17 @@ typedef struct {
   uint32_t minimum;
 } dns_soa_t;
 
+// SOA rdata, lives in the record's data[]
+typedef struct {
+  const char *mname;
+  const char *rname;
+  uint32_t serial;
+  uint32_t refresh;
+  uint32_t retry;
+  uint32_t expire;
+  uint32_t minimum;
+} dns_soa_rdata_t;
+
 // A Record (IPv4)
 typedef struct {
   uint32_t address; // byte order
@@ -57,35 +75,66 @@ typedef struct {
 
 // NS Record
 typedef struct {
-  char nsdname[MAX_DOMAIN_NAME];
+  const char *nsdname;
 } dns_ns_t;
 
-// CNAME Record
+// CNAME/PTR rdata
 typedef struct {
-  char cname[MAX_DOMAIN_NAME];
-} dns_cname_t;
+  const char *cname;
+} dns_cname_rdata_t;
 
 // MX Record
 typedef struct {
   uint16_t preference;
-  char exchange[MAX_DOMAIN_NAME];
+  const char *exchange;
 } dns_mx_t;
 
-// TXT Record
+// TXT Record, the character-strings as they are on the wire: a length byte
+// and up to 255 bytes each, so "a" "b" stays two strings (see dns_txt_next)
 typedef struct {
-  char *text;
-  size_t length;
+  const uint8_t *strings;
+  uint16_t length; // bytes in strings, the length bytes included
 } dns_txt_t;
 
+// SRV Record (RFC 2782)
+typedef struct {
+  uint16_t priority;
+  uint16_t weight;
+  uint16_t port;
+  const char *target;
+} dns_srv_t;
+
+// CAA Record (RFC 8659), the value follows the tag's NUL in data[] and is
+// not terminated, see dns_caa_value
+typedef struct {
+  const char *tag;
+  uint16_t value_len;
+  uint8_t flags;
+  uint8_t tag_len;
+} dns_caa_t;
+
+// any other type, kept as the wire rdata (RFC 3597)
+typedef struct {
+  const uint8_t *data;
+  uint16_t len;
+} dns_opaque_t;
+
 // Generic resource record data
+//
+// fixed-size values are stored inline, names and text point into the
+// record's trailing data[] so every record is a single allocation sized to
+// its actual rdata (see dns_rr_alloc)
 typedef union {
-  dns_soa_t soa;
+  dns_soa_rdata_t *soa;
   dns_a_t a;
   dns_aaaa_t aaaa;
   dns_ns_t ns;
-  dns_cname_t cname;
+  dns_cname_rdata_t cname;
   dns_mx_t mx;
   dns_txt_t txt;
+  dns_srv_t srv;
+  dns_caa_t caa;
+  dns_opaque_t opaque;
 } dns_rdata_t;
 
 // Resource record
@@ -93,16 +142,66 @@ typedef struct dns_rr {
   dns_record_type_t type;
   dns_class_t class;
   uint32_t ttl;
-  dns_rdata_t rdata;
+  uint32_t data_len; // bytes used in data[]
   dns_rr_t *next; // For RRsets (resource record sets)
+  dns_rdata_t rdata;
+  char data[];
 } dns_rr_t;
 
+static inline const uint8_t *dns_caa_value(const dns_rr_t *rr) {
+  return (const uint8_t *)rr->rdata.caa.tag + rr->rdata.caa.tag_len + 1;
+}
+
+// the character-string at *pos and moves past it, false after the last one
+static inline bool dns_txt_next(const dns_rr_t *rr, size_t *pos, const uint8_t **string, uint8_t *len) {
+  const dns_txt_t *txt = &rr->rdata.txt;
+  if (*pos >= txt->length) return false;
+
+  *len = txt->strings[*pos];
+  *string = txt->strings + *pos + 1;
+  *pos += 1u + *len;
+  return true;
+}
+
+// order the records of an RRset go out in (RFC 1794 style load sharing).
+// applied while encoding by picking the record to start at and wrapping
+// around the list, the list itself is never touched
+typedef enum {
+  DNS_RRSET_ORDER_FIXED = 0, // as stored
+  DNS_RRSET_ORDER_CYCLIC,    // every answer starts one record further on
+  DNS_RRSET_ORDER_RANDOM,    // every answer starts at a random record
+} dns_rrset_order_t;
+
+#define DNS_RRSET_ORDER_RULES 16
+
+// an order for the RRsets at one owner name, of one type or of every type
+typedef struct {
+  char name[MAX_DOMAIN_NAME];
+  uint16_t type; // 0 for every type at the name
+  dns_rrset_order_t order;
+} dns_rrset_order_rule_t;
+
+// the order a new RRset starts with: the rule for its name and type, then
+// the rule for its name, then the fallback
+typedef struct {
+  dns_rrset_order_t fallback;
+  int rule_count;
+  dns_rrset_order_rule_t rules[DNS_RRSET_ORDER_RULES];
+} dns_rrset_order_policy_t;
+
 // Resource Record Set
+//
+// reference counted, the trie, cache entries and resolution results all
+// point at the same RRset. an RRset with more than one reference is
+// immutable, writers copy it first (see dns_rrset_copy)
 typedef struct {
   dns_record_type_t type;
   uint32_t ttl; // all records in RRset must have same TTL
   dns_rr_t *records;
   size_t count;
+  atomic_uint refs;
+  dns_rrset_order_t order;
+  atomic_uint rotation; // cyclic position, bumped by readers of shared sets
 } dns_rrset_t;
 
 static inline void dns_safe_strncpy(char *dst, const char *src, size_t dst_size) {
@@ -134,10 +233,31 @@ static inline int dns_safe_strncpy_check(char *dst, const char *src, size_t dst_
 }
 
 dns_rr_t *dns_rr_create(dns_record_type_t type, dns_class_t cls, uint32_t ttl);
+dns_rr_t *dns_rr_alloc(dns_record_type_t type, dns_class_t cls, uint32_t ttl, size_t data_len);
+dns_rr_t *dns_rr_clone(const dns_rr_t *rr);
 void dns_rr_free(dns_rr_t *rr);
 dns_rrset_t *dns_rrset_create(dns_record_type_t type, uint32_t ttl);
-void dns_rrset_free(dns_rrset_t *rrset);
+dns_rrset_t *dns_rrset_copy(const dns_rrset_t *rrset);
+dns_rrset_t *dns_rrset_ref(dns_rrset_t *rrset);
+void dns_rrset_free(dns_rrset_t *rrset); // drops one reference
+bool dns_rrset_is_shared(const dns_rrset_t *rrset);
 bool dns_rrset_add(dns_rrset_t *rrset, dns_rr_t *rr);
+// record an encode of rrset starts at, the rest follow and wrap to the head.
+// advances the rotation, so call it once per answer
+const dns_rr_t *dns_rrset_first(const dns_rrset_t *rrset);
+// the record after rr in rotated order, NULL once back at first
+static inline const dns_rr_t *dns_rrset_next(const dns_rrset_t *rrset,
+                                             const dns_rr_t *first, const dns_rr_t *rr) {
+  const dns_rr_t *next = rr->next ? rr->next : rrset->records;
+  return next == first ? NULL : next;
+}
+// "fixed", "cyclic" or "random", -1 for anything else
+int dns_rrset_order_from_text(const char *text, dns_rrset_order_t *order);
+// a rule for name and type replaces an earlier one, -1 once the table is full
+int dns_rrset_order_policy_add(dns_rrset_order_policy_t *policy, const char *name, uint16_t type,
+                               dns_rrset_order_t order);
+dns_rrset_order_t dns_rrset_order_policy_lookup(const dns_rrset_order_policy_t *policy,
+                                                const char *name, uint16_t type);
 
 dns_rr_t *dns_rr_create_a(uint32_t address, uint32_t ttl);
 dns_rr_t *dns_rr_create_a_str(const char *ip_str, uint32_t ttl);
@@ -145,8 +265,17 @@ dns_rr_t *dns_rr_create_aaaa(const uint8_t address[16], uint32_t ttl);
 dns_rr_t *dns_rr_create_aaaa_str(const char *ip_str, uint32_t ttl);
 dns_rr_t *dns_rr_create_ns(const char *nsdname, uint32_t ttl);
 dns_rr_t *dns_rr_create_cname(const char *cname, uint32_t ttl);
+dns_rr_t *dns_rr_create_ptr(const char *ptrdname, uint32_t ttl);
 dns_rr_t *dns_rr_create_mx(uint16_t preference, const char *exchange, uint32_t ttl);
+// one text, cut into 255 byte character-strings when it is longer
 dns_rr_t *dns_rr_create_txt(const char *text, uint32_t ttl);
+// a character-string each, NULL when one is over 255 bytes
+dns_rr_t *dns_rr_create_txt_strings(const char *const *strings, size_t count, uint32_t ttl);
+dns_rr_t *dns_rr_create_srv(uint16_t priority, uint16_t weight, uint16_t port,
+                            const char *target, uint32_t ttl);
+dns_rr_t *dns_rr_create_caa(uint8_t flags, const char *tag,
+                            const uint8_t *value, size_t value_len, uint32_t ttl);
+dns_rr_t *dns_rr_create_opaque(uint16_t type, const uint8_t *rdata, size_t len, uint32_t ttl);
 dns_rr_t *dns_rr_create_soa(const char *mname,
                             const char *rname,
                             uint32_t serial,
@@ -156,7 +285,11 @@ dns_rr_t *dns_rr_create_soa(const char *mname,
                             uint32_t minimum,
                             uint32_t ttl);
 
+bool dns_rr_rdata_equal(const dns_rr_t *a, const dns_rr_t *b);
+
 void dns_normalize_domain(const char *input, char *output);
+// ASCII case-insensitive, NULL compares equal to the root
+bool dns_name_equal(const char *a, const char *b);
 bool dns_is_subdomain(const char *domain, const char *parent);
 
 
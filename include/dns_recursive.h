@@ -5,6 +5,9 @@
 #include "dns_records.h"
 #include "dns_parser.h"
 #include "dns_error.h"
+#include "dns_stats.h"
+#include "dns_latency.h"
+#include <stdatomic.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <time.h>
@@ -14,6 +17,7 @@
 #define DNS_MAX_RECURSION_DEPTH   16
 #define DNS_RECURSIVE_TIMEOUT_SEC 5
 #define DNS_MAX_UPSTREAM_SERVERS  8
+#define DNS_RECURSIVE_ARENA_CHUNK (16 * 1024)
 
 
 typedef struct {
@@ -23,10 +27,10 @@ typedef struct {
   bool has_ipv4;
   bool has_ipv6;
 
-  // stats
-  uint32_t queries_sent;
-  uint32_t responses_received;
-  uint32_t timeouts;
+  // stats, bumped by whichever thread handles the query
+  _Atomic uint64_t queries_sent;
+  _Atomic uint64_t responses_received;
+  _Atomic uint64_t timeouts;
   time_t last_used;
 } dns_nameserver_t;
 
@@ -38,11 +42,14 @@ typedef struct {
 
 typedef struct {
   uint16_t query_id;
-  char qname[MAX_DOMAIN_NAME];
+  char qname[MAX_DOMAIN_NAME]; // as the client spelled it, sent upstream
+  dns_name_t name;             // canonical qname, a response must echo it
   uint16_t qtype;
   uint16_t qclass;
 
   time_t start_time;
+  uint64_t sent_ticks; // of the query in flight upstream
+  dns_nameserver_t *upstream; // stats of the server it went to
   int recursion_depth;
   dns_upstream_list_t current_servers;
 
@@ -54,6 +61,7 @@ typedef struct {
 
 typedef struct {
   dns_nameserver_t root_servers[DNS_ROOT_HINTS_COUNT];
+  dns_nameserver_t other_upstreams; // stats for every server past the roots
   int socket_fd; // UDP socket for outbound queries
 
   // query tracking
@@ -63,12 +71,11 @@ typedef struct {
   // response forwarding
   int main_server_socket;
 
-  // stats
-  uint64_t recursive_queries;
-  uint64_t cache_hits;
-  uint64_t cache_misses;
-  uint64_t forwarded_queries;
-  uint64_t failed_queries;
+  // holds the parse of the response being handled
+  dns_arena_t *parse_arena;
+
+  dns_stats_t *stats; // the RECURSIVE_ and FORWARDED_ counters
+  dns_latency_t *latency; // the server's, round trips go in as recursive
 } dns_recursive_resolver_t;
 
 
@@ -104,10 +111,13 @@ int dns_recursive_forward_response(dns_recursive_resolver_t *resolver,
 int dns_recursive_send_error_response(dns_recursive_resolver_t *resolver,
                                      const dns_recursive_query_t *query,
                                      uint8_t rcode);
-int dns_extract_nameservers_from_authority(const uint8_t *buffer,
-                                           size_t len,
-                                           dns_upstream_list_t *servers);
+// referral targets with glue from a parsed response, fallbacks without
+int dns_recursive_extract_nameservers(const dns_message_t *msg,
+                                      dns_upstream_list_t *servers);
 // utility
+// the root hint with addr, other_upstreams for anything else
+dns_nameserver_t *dns_recursive_upstream(dns_recursive_resolver_t *resolver,
+                                         const struct sockaddr_in *addr);
 dns_nameserver_t *dns_recursive_select_server(dns_upstream_list_t *list);
 int dns_recursive_send_query(dns_recursive_resolver_t *resolver,
                              const dns_question_t *question,
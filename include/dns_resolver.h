@@ -7,9 +7,11 @@
 #include "dns_trie.h"
 #include "dns_error.h"
 #include "dns_cache.h"
+#include "dns_stats.h"
 
 
 #define DNS_MAX_CNAME_CHAIN 16
+#define DNS_MAX_SECTION_RRSETS DNS_CACHE_MAX_RRSETS
 
 
 typedef struct {
@@ -17,35 +19,105 @@ typedef struct {
   int count;
 } dns_cname_chain_t;
 
+typedef enum {
+  DNS_SECTION_ANSWER,
+  DNS_SECTION_AUTHORITY,
+  DNS_SECTION_ADDITIONAL,
+} dns_section_id_t;
+
+// an RRset as it appears in a response, the RRset itself is shared with the
+// trie or the cache and never modified, owner and TTL are applied on encode
+typedef struct {
+  dns_rrset_t *rrset; // one reference held by the result
+  const char *owner;  // NULL for the query name
+  uint32_t ttl;
+} dns_section_rrset_t;
+
 typedef struct {
-  dns_rr_t *answer_list;
-  dns_rr_t *authority_list;
-  dns_rr_t *additional_list;
+  dns_section_rrset_t rrsets[DNS_MAX_SECTION_RRSETS];
+  int rrset_count;
+} dns_section_t;
+
+typedef struct {
+  dns_section_t answer;
+  dns_section_t authority;
+  dns_section_t additional;
+
+  // record counts for the header
   int answer_count;
   int authority_count;
   int additional_count;
   uint8_t rcode;
   bool authoritative;
   char authority_zone_name[MAX_DOMAIN_NAME];
+
+  // NXDOMAIN and wildcard answers turn on the query name's closest
+  // encloser, the labels of its name. -1 for answers at the name itself
+  int encloser_labels;
 } dns_resolution_result_t;
 
+// an authoritative answer that is only fragments, nothing referenced is
+// counted, it stays valid until the trie is next changed
+typedef struct {
+  const dns_fragment_t *answer;    // NULL for NXDOMAIN and NODATA
+  const dns_fragment_t *authority; // zone SOA for NXDOMAIN and NODATA
+  uint8_t rcode;
+} dns_precompiled_answer_t;
+
 typedef struct {
   dns_trie_t *trie;
   dns_cache_t *cache;
   bool cache_enabled;
 
-  // stats
-  uint64_t queries;
-  uint64_t cache_hits;
-  uint64_t cache_misses;
+  dns_stats_t *stats; // the RESOLVER_ counters
 } dns_resolver_t;
 
 
 dns_resolution_result_t *dns_resolution_result_create(void);
 void dns_resolution_result_free(dns_resolution_result_t *result);
+
+// for results on the stack, clear drops every RRset reference
+void dns_resolution_result_init(dns_resolution_result_t *result);
+void dns_resolution_result_clear(dns_resolution_result_t *result);
+bool dns_resolution_result_add(dns_resolution_result_t *result,
+        dns_section_id_t section,
+        dns_rrset_t *rrset,
+        const char *owner,
+        uint32_t ttl);
+// answers from a cache hit, with the remaining TTL
+void dns_resolution_result_from_cache(dns_resolution_result_t *result,
+        const dns_cache_result_t *cache_result);
+// positive answers by reference, NXDOMAIN with the SOA minimum as TTL.
+// answers that follow a CNAME turn on names other than the query's and are
+// not kept, nothing would drop them when the target changes
+int dns_resolution_cache_store(dns_cache_t *cache,
+        const dns_question_t *question,
+        const dns_resolution_result_t *result);
 int dns_resolve_query_full(dns_trie_t *trie,
         const dns_question_t *question, dns_resolution_result_t *result,
         dns_error_t *err);
+// the same answer for a question still in the request buffer, falls back to
+// the text path only to follow a CNAME
+int dns_resolve_query_view(dns_trie_t *trie,
+        const dns_question_view_t *view, dns_resolution_result_t *result,
+        dns_error_t *err);
+// true when the answer is fully covered by compiled fragments: an exact
+// match in an authoritative zone, no CNAME to follow. anything else goes
+// through dns_resolve_query_view
+bool dns_resolve_precompiled(dns_trie_t *trie,
+        const dns_question_view_t *view, dns_precompiled_answer_t *answer);
+
+// additional section processing (RFC 1035 3.3.9, RFC 2782): A and AAAA
+// for the names NS, MX and SRV records in the answer and authority point
+// at, when we are authoritative for them. the owners point into those
+// records, which the result holds a reference to. returns the RRsets added
+int dns_resolve_additional(dns_trie_t *trie, dns_resolution_result_t *result);
+// answers whose records name other hosts, precompiled fragments carry no
+// additional section so these take the slow path unless it is not wanted
+bool dns_type_has_additional(uint16_t qtype);
+// minimal responses, the answer alone when there is one. negative answers
+// keep their SOA, resolvers need it to cache them
+void dns_resolution_result_minimize(dns_resolution_result_t *result);
 
 // CNAME chain resolution
 int dns_resolve_cname_chain(dns_trie_t *trie,
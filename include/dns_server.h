@@ -8,14 +8,31 @@
 #include "dns_resolver.h"
 #include "dns_recursive.h"
 #include "dns_resolver.h"
+#include "dns_update.h"
+#include "dns_stats.h"
+#include "dns_latency.h"
+#include "dns_metrics.h"
+#include "dns_log.h"
+#include "dns_querylog.h"
+#include "dns_control.h"
+#include "dns_zone_file.h"
 #include <arpa/inet.h>
 
 
 #define DNS_DEFAULT_PORT 5353
 #define DNS_MAX_PACKET_SIZE 512
+#define DNS_EDNS_UDP_SIZE 1232 // advertised and never exceeded, fits an unfragmented IPv6 packet
 #define DNS_BUFFER_SIZE 4096
+#define DNS_MAX_UPDATE_CLIENTS 8
 
 
+// why a response came out short, a response can carry several
+typedef enum {
+  DNS_TRUNC_ANSWER    = 1 << 0, // TC, an answer RRset did not fit
+  DNS_TRUNC_AUTHORITY = 1 << 1, // TC, the SOA of a negative answer did not fit
+  DNS_TRUNC_OPTIONAL  = 1 << 2, // authority or additional data left out, no TC
+} dns_truncation_t;
+
 typedef struct {
   int socket_fd;
   uint16_t port;
@@ -26,16 +43,27 @@ typedef struct {
   bool running;
   bool enable_recursion;
   bool enable_cache;
+  bool minimal_responses; // no authority or additional data beyond what is required
+
+  // RFC 2136 updates are refused unless the client is listed here
+  struct in_addr update_clients[DNS_MAX_UPDATE_CLIENTS];
+  int update_client_count;
+
+  dns_stats_t *stats; // the server's own counters, see dns_server_stats
+  dns_latency_t *latency; // per stage and outcome, NULL when turned off
+  dns_hitters_t *hitters; // busiest qnames, clients and qtypes, NULL when turned off
+
+  uint16_t metrics_port;  // 0 leaves the metrics listener off
+  dns_metrics_t *metrics; // open while the server is started
+
+  dns_querylog_t *querylog; // binary query log, NULL when off
 
-  // stats
-  uint64_t queries_received;
-  uint64_t queries_processed;
-  uint64_t queries_failed;
-  uint64_t responses_sent;
-  uint64_t authoritative_responses;
-  uint64_t recursive_responses;
-  uint64_t cache_hits;
-  uint64_t cache_misses;
+  char control_path[108];   // empty leaves the control socket off
+  dns_control_t *control;   // open while the server is started
+
+  // what a reload reads again, set by dns_server_load_zone
+  char zone_file[256];
+  char zone_name[MAX_DOMAIN_NAME];
 } dns_server_t;
 
 typedef struct {
@@ -49,6 +77,7 @@ typedef struct {
   uint8_t *buffer;
   size_t length;
   size_t capacity;
+  dns_outcome_t outcome; // set by dns_process_query
 } dns_response_t;
 
 typedef struct {
@@ -58,10 +87,29 @@ typedef struct {
   char zone_file[256];
   uint32_t recursion_timeout;
   uint16_t max_recursion_depth;
+  bool minimal_responses;
+  dns_rrset_order_policy_t rrset_order; // of the zone data, fixed by default
+  bool latency_histograms;
+  bool heavy_hitters; // top qnames, client networks and qtypes in the stats
+  uint16_t metrics_port; // prometheus scrapes on 127.0.0.1, 0 is off
+  dns_log_level_t log_level;
+  char log_file[256]; // logged to asynchronously when set, stdout otherwise
+
+  // binary query log, off without a file
+  char querylog_file[256];
+  uint32_t querylog_sample; // one query in this many
+  uint32_t querylog_rotate_mb;
+  uint32_t querylog_keep; // rotated files kept
+
+  char control_socket[108]; // unix socket for dns_control, off when empty
 
   // upstream forwarders (optional)
   char upstream_servers[8][64]; // ip:port format
   int upstream_count;
+
+  // clients allowed to send dynamic updates (optional)
+  char allow_update[DNS_MAX_UPDATE_CLIENTS][64];
+  int allow_update_count;
 } dns_server_config_t;
 
 
@@ -77,6 +125,21 @@ void dns_server_free(dns_server_t *server);
 int dns_server_start(dns_server_t *server);
 void dns_server_stop(dns_server_t *server);
 int dns_server_run(dns_server_t *server);
+int dns_server_allow_update(dns_server_t *server, const char *ip);
+// every counter of the server, its cache and its recursive resolver
+void dns_server_stats(const dns_server_t *server, dns_stats_snapshot_t *snapshot);
+// the whole scrape: counters, latency, cache, trie and upstreams
+void dns_server_write_metrics(const dns_server_t *server, dns_metrics_buffer_t *buf);
+// runs one control command, the reply goes to control->reply
+void dns_server_control(dns_server_t *server, dns_control_t *control, const char *command);
+
+// loads a zone into a fresh trie and swaps it in on success, the old zone
+// data keeps answering when the file does not load. dynamic updates made
+// since the last load are gone with the old trie
+int dns_server_load_zone(dns_server_t *server, const char *filename, const char *zone_name,
+                         zone_load_result_t *result);
+// the zone last given to dns_server_load_zone, read again
+int dns_server_reload_zone(dns_server_t *server, zone_load_result_t *result);
 
 // request/response handling
 dns_response_t *dns_response_create(size_t capacity);
@@ -90,11 +153,26 @@ int dns_server_handle_recursive_query(dns_server_t *server,
                                       uint16_t query_id);
 int dns_recursive_cleanup_expired_queries(dns_recursive_resolver_t *resolver);
 
-// helper to build response from resolution result
+// bytes a response to query may take, capacity bounds it as well
+size_t dns_response_budget(const dns_message_t *query, size_t capacity);
+
+// helper to build response from resolution result. whole RRsets are packed
+// in section order up to dns_response_budget, TC is only set when an answer
+// or the SOA of a negative answer is left out
 int dns_build_response(const dns_message_t *query,
                        const dns_resolution_result_t *resolution,
                        uint8_t *buffer, size_t capacity, size_t *length,
                        dns_error_t *err);
+// the same, truncation gets the dns_truncation_t reasons that applied
+int dns_build_response_sized(const dns_message_t *query,
+                             const dns_resolution_result_t *resolution,
+                             uint8_t *buffer, size_t capacity, size_t *length,
+                             unsigned *truncation, dns_error_t *err);
+// header, the question as the client sent it and a copy of each fragment,
+// -1 when it does not fit and the caller should take the slow path
+int dns_build_precompiled_response(const dns_message_t *query,
+                                   const dns_precompiled_answer_t *answer,
+                                   uint8_t *buffer, size_t capacity, size_t *length);
 
 
 #endif // DNS_SERVER_H
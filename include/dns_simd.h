@@ -0,0 +1,61 @@
+#ifndef DNS_SIMD_H
+#define DNS_SIMD_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// byte kernels for domain names
+//
+// each kernel has a scalar version and, on x86-64, SSE2 and AVX2 versions.
+// the best level the CPU supports is picked once at startup, callers go
+// through the dns_simd_* wrappers and never see which one runs. lengths are
+// explicit, none of the kernels look for a NUL.
+
+typedef enum {
+  DNS_SIMD_SCALAR = 0,
+  DNS_SIMD_SSE2,
+  DNS_SIMD_AVX2,
+} dns_simd_level_t;
+
+typedef struct {
+  void (*lower)(char *dst, const char *src, size_t len);
+  size_t (*find_byte)(const char *src, size_t len, char c);
+  bool (*case_equal)(const char *a, const char *b, size_t len);
+  bool (*label_valid)(const uint8_t *label, size_t len);
+} dns_simd_ops_t;
+
+extern dns_simd_ops_t dns_simd_ops;
+
+
+dns_simd_level_t dns_simd_level(void);
+dns_simd_level_t dns_simd_best_level(void);
+const char *dns_simd_level_name(dns_simd_level_t level);
+// for tests and benchmarks, falls back to scalar when the CPU lacks the level
+dns_simd_level_t dns_simd_set_level(dns_simd_level_t level);
+
+
+// ASCII lowercase of len bytes, dst may equal src
+static inline void dns_simd_lower(char *dst, const char *src, size_t len) {
+  dns_simd_ops.lower(dst, src, len);
+}
+
+// index of the first c in src, len when there is none
+static inline size_t dns_simd_find_byte(const char *src, size_t len, char c) {
+  return dns_simd_ops.find_byte(src, len, c);
+}
+
+// ASCII case-insensitive equality of two len byte strings
+static inline bool dns_simd_case_equal(const char *a, const char *b, size_t len) {
+  return dns_simd_ops.case_equal(a, b, len);
+}
+
+// a wire label that survives the trip to dotted text: no NUL and no '.'
+static inline bool dns_simd_label_valid(const uint8_t *label, size_t len) {
+  return dns_simd_ops.label_valid(label, len);
+}
+
+
+#endif // DNS_SIMD_H
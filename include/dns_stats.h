@@ -0,0 +1,130 @@
+#ifndef DNS_STATS_H
+#define DNS_STATS_H
+
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+// counters
+//
+// every counter in the server is one line in DNS_STATS_COUNTERS. a stats
+// object keeps one row of them per thread, each row on its own cache lines,
+// so the hot path only ever writes memory no other thread writes. readers
+// sum the rows into a snapshot. the first DNS_STATS_SHARDS - 1 threads get
+// a row of their own and bump it with a plain load and store, later ones
+// share the last row and pay for an atomic add.
+//
+// a snapshot sums every counter once, each is exact at some point during the
+// read, related counters (hits and misses, say) can be one query apart
+//
+// columns are the enum suffix, the snapshot field and a line of help text
+
+#define DNS_STATS_COUNTERS(X)                                                                                 \
+  X(QUERIES_RECEIVED,        queries_received,        "requests read off the socket")                         \
+  X(QUERIES_PROCESSED,       queries_processed,       "requests answered")                                    \
+  X(QUERIES_FAILED,          queries_failed,          "requests dropped or answered with an error")           \
+  X(RESPONSES_SENT,          responses_sent,          "responses written to the socket")                      \
+  X(AUTHORITATIVE_RESPONSES, authoritative_responses, "answers from zone data")                               \
+  X(RECURSIVE_RESPONSES,     recursive_responses,     "answers relayed from upstream")                        \
+  X(CACHE_HITS,              cache_hits,              "answers served from the cache")                        \
+  X(CACHE_MISSES,            cache_misses,            "questions the cache could not answer")                 \
+  X(TRUNCATED_ANSWER,        truncated_answer,        "responses with TC, answer did not fit")                \
+  X(TRUNCATED_AUTHORITY,     truncated_authority,     "responses with TC, negative SOA did not fit")          \
+  X(TRIMMED_OPTIONAL,        trimmed_optional,        "responses with authority or additional data left out") \
+  X(UPDATES_APPLIED,         updates_applied,         "RFC 2136 updates applied")                             \
+  X(UPDATES_REFUSED,         updates_refused,         "RFC 2136 updates refused")                             \
+  X(CACHE_LOOKUPS,           cache_lookups,           "cache lookups")                                        \
+  X(CACHE_LOOKUP_HITS,       cache_lookup_hits,       "cache lookups that found an entry")                    \
+  X(CACHE_LOOKUP_MISSES,     cache_lookup_misses,     "cache lookups that found nothing")                     \
+  X(CACHE_EXPIRED,           cache_expired,           "cache entries found expired")                          \
+  X(CACHE_EVICTIONS,         cache_evictions,         "cache entries evicted")                                \
+  X(CACHE_INSERTIONS,        cache_insertions,        "cache entries stored")                                 \
+  X(CACHE_POSITIVE_HITS,     cache_positive_hits,     "cache hits on records")                                \
+  X(CACHE_NEGATIVE_HITS,     cache_negative_hits,     "cache hits on negative answers")                       \
+  X(CACHE_NXDOMAIN_HITS,     cache_nxdomain_hits,     "cache hits on NXDOMAIN")                               \
+  X(CACHE_NODATA_HITS,       cache_nodata_hits,       "cache hits on NODATA")                                 \
+  X(RESOLVER_QUERIES,        resolver_queries,        "resolver queries")                                     \
+  X(RESOLVER_CACHE_HITS,     resolver_cache_hits,     "resolver queries answered from the cache")             \
+  X(RESOLVER_CACHE_MISSES,   resolver_cache_misses,   "resolver queries the cache missed")                    \
+  X(RECURSIVE_QUERIES,       recursive_queries,       "recursive lookups started")                            \
+  X(FORWARDED_QUERIES,       forwarded_queries,       "upstream answers relayed to the client")               \
+  X(RECURSIVE_FAILED,        recursive_failed,        "recursive lookups that failed")
+
+typedef enum {
+#define DNS_STAT_ENUM(id, field, help) DNS_STAT_##id,
+  DNS_STATS_COUNTERS(DNS_STAT_ENUM)
+#undef DNS_STAT_ENUM
+  DNS_STAT_COUNT
+} dns_stat_t;
+
+#define DNS_STATS_SHARDS 32
+#define DNS_STATS_CACHE_LINE 64
+
+// one thread's row, padded so no two rows share a line
+typedef struct {
+  _Alignas(DNS_STATS_CACHE_LINE) _Atomic uint64_t values[DNS_STAT_COUNT];
+} dns_stats_shard_t;
+
+typedef struct {
+  dns_stats_shard_t shards[DNS_STATS_SHARDS];
+} dns_stats_t;
+
+typedef struct {
+  union {
+    uint64_t values[DNS_STAT_COUNT];
+    struct {
+#define DNS_STAT_FIELD(id, field, help) uint64_t field;
+      DNS_STATS_COUNTERS(DNS_STAT_FIELD)
+#undef DNS_STAT_FIELD
+    };
+  };
+} dns_stats_snapshot_t;
+
+
+dns_stats_t *dns_stats_create(void);
+void dns_stats_free(dns_stats_t *stats);
+// zeroes every row, increments racing with it may be lost
+void dns_stats_reset(dns_stats_t *stats);
+
+// sum of every row, a NULL stats gives zeroes
+void dns_stats_snapshot(const dns_stats_t *stats, dns_stats_snapshot_t *snapshot);
+// snapshot of stats added into an existing one, for objects that each count
+// their own part of the table
+void dns_stats_accumulate(const dns_stats_t *stats, dns_stats_snapshot_t *snapshot);
+uint64_t dns_stats_get(const dns_stats_t *stats, dns_stat_t stat);
+
+const char *dns_stats_name(dns_stat_t stat);
+const char *dns_stats_help(dns_stat_t stat);
+// "name value" lines for the counters that are not zero
+void dns_stats_print(const dns_stats_snapshot_t *snapshot, FILE *output);
+
+// row of the calling thread, claimed on first use
+extern _Thread_local int dns_stats_thread_row;
+int dns_stats_claim_row(void);
+
+static inline void dns_stats_add(dns_stats_t *stats, dns_stat_t stat, uint64_t n) {
+  if (!stats) return;
+
+  int row = dns_stats_thread_row;
+  if (row < 0) row = dns_stats_claim_row();
+
+  _Atomic uint64_t *value = &stats->shards[row].values[stat];
+  if (row < DNS_STATS_SHARDS - 1) {
+    // the only writer of the row, readers see either value
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+  } else {
+    atomic_fetch_add_explicit(value, n, memory_order_relaxed);
+  }
+}
+
+static inline void dns_stats_inc(dns_stats_t *stats, dns_stat_t stat) {
+  dns_stats_add(stats, stat, 1);
+}
+
+
+#endif // DNS_STATS_H
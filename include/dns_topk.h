@@ -0,0 +1,105 @@
+#ifndef DNS_TOPK_H
+#define DNS_TOPK_H
+
+
+#include "dns_name.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+
+// heavy hitters
+//
+// Space-Saving over a stream of keys: DNS_TOPK_CAPACITY counters, and a key
+// that is not tracked takes over the smallest one, inheriting its count as
+// the error. a key seen more than total / DNS_TOPK_CAPACITY times is always
+// tracked, and no count is over the truth by more than its error. counters
+// hang off a list of buckets of equal count in ascending order, so an update
+// is a hash probe and a move to the next bucket: constant time, and nothing
+// is allocated after init.
+//
+// a tracker is not thread safe. the server's trackers are fed and read by
+// the thread running its loop, the one that renders scrapes as well.
+
+#define DNS_TOPK_CAPACITY 128
+#define DNS_TOPK_INDEX_SIZE 256 // hash chains, a power of two
+#define DNS_TOPK_KEY_MAX 255
+#define DNS_TOPK_REPORT 10      // entries shown per tracker
+
+#define DNS_HITTERS_V4_PREFIX 24 // clients are counted by network
+#define DNS_HITTERS_V6_PREFIX 56
+
+typedef struct {
+  uint8_t key[DNS_TOPK_KEY_MAX];
+  uint8_t key_length;
+  uint64_t count; // an upper bound
+  uint64_t error; // count - error is a lower bound
+  uint32_t hash;
+  int hash_next;  // chain in index, -1 at the end
+  int bucket;
+  int prev;       // siblings in the bucket
+  int next;
+} dns_topk_counter_t;
+
+typedef struct {
+  uint64_t count;
+  int first; // counters, -1 when the bucket is free
+  int prev;  // neighbouring buckets by count, ascending
+  int next;
+} dns_topk_bucket_t;
+
+typedef struct {
+  dns_topk_counter_t counters[DNS_TOPK_CAPACITY];
+  dns_topk_bucket_t buckets[DNS_TOPK_CAPACITY + 1]; // one spare while a counter moves
+  int index[DNS_TOPK_INDEX_SIZE];
+  int free_bucket;
+  int min_bucket; // -1 while empty
+  int max_bucket;
+  int used;       // counters in use
+  uint64_t total; // keys added
+} dns_topk_t;
+
+typedef struct {
+  const uint8_t *key; // into the tracker, good until the next add
+  uint8_t key_length;
+  uint64_t count;
+  uint64_t error;
+} dns_topk_entry_t;
+
+void dns_topk_init(dns_topk_t *topk);
+// keys longer than DNS_TOPK_KEY_MAX are cut to it
+void dns_topk_add(dns_topk_t *topk, const void *key, size_t length);
+// up to max entries, highest count first, returns how many
+int dns_topk_top(const dns_topk_t *topk, dns_topk_entry_t *entries, int max);
+
+
+// what the server tracks, one tracker per kind of key
+typedef enum {
+  DNS_HITTERS_QNAME = 0, // canonical wire form
+  DNS_HITTERS_CLIENT,    // address family, then the prefix bytes
+  DNS_HITTERS_QTYPE,     // big endian
+  DNS_HITTERS_COUNT,
+} dns_hitters_kind_t;
+
+typedef struct {
+  dns_topk_t trackers[DNS_HITTERS_COUNT];
+} dns_hitters_t;
+
+dns_hitters_t *dns_hitters_create(void);
+void dns_hitters_free(dns_hitters_t *hitters);
+
+// one query, a client of another family than v4 or v6 is left out
+void dns_hitters_record(dns_hitters_t *hitters, const dns_name_t *qname, uint16_t qtype,
+                        const struct sockaddr_storage *client);
+
+const char *dns_hitters_kind_name(dns_hitters_kind_t kind);
+// "example.com.", "192.0.2.0/24" or "AAAA"
+const char *dns_hitters_key_text(dns_hitters_kind_t kind, const dns_topk_entry_t *entry,
+                                 char *buf, size_t len);
+// the top DNS_TOPK_REPORT of every tracker
+void dns_hitters_print(const dns_hitters_t *hitters, FILE *output);
+
+
+#endif // DNS_TOPK_H
@@ -3,20 +3,27 @@
 
 
 #include "dns_records.h"
+#include "dns_parser.h"
+#include "dns_arena.h"
 #include <stdbool.h>
 
 
-#define RRSET_MAP_SIZE 16
+#define DNS_WILDCARD_LABEL "*"
+#define DNS_TRIE_ARENA_CHUNK (64 * 1024)
+#define DNS_TRIE_SLAB_BYTES 8192
 
 
 typedef struct rrset_entry rrset_entry_t;
 typedef struct dns_trie_node dns_trie_node_t;
+typedef struct dns_trie_slab dns_trie_slab_t;
 typedef struct dns_trie dns_trie_t;
 
 
 typedef struct {
   char zone_name[MAX_DOMAIN_NAME];
   dns_soa_t *soa;
+  dns_rrset_t *soa_rrset; // soa as a record for negative answers, TTL is the minimum
+  dns_fragment_t *soa_fragment; // soa_rrset encoded behind the apex
   dns_rrset_t *ns_records;
   bool authoritative;
 } dns_zone_t;
@@ -24,55 +31,112 @@ typedef struct {
 typedef struct rrset_entry {
   dns_record_type_t type;
   dns_rrset_t *rrset;
-  rrset_entry_t *next;
+  dns_fragment_t *fragment; // answer behind the owner name, NULL until compiled
 } rrset_entry_t;
 
+// rrsets at a node keyed by type, a name rarely has more than a handful so
+// a linear scan beats hashing. created on the first rrset, capacity grows
+// 1 -> 3 -> 7 -> ... so each map fills its arena size class
 typedef struct {
-  rrset_entry_t *buckets[RRSET_MAP_SIZE];
+  uint32_t count;
+  uint32_t capacity;
+  rrset_entry_t entries[];
 } rrset_map_t;
 
 typedef struct dns_trie_node {
   char label[MAX_LABEL_LEN + 1];
+  uint8_t label_len;
   dns_trie_node_t **children;
   size_t children_count;
   size_t children_capacity;
 
-  rrset_map_t *rrsets; // rrsets at this node
+  rrset_map_t *rrsets; // rrsets at this node, NULL until the first one
   dns_zone_t *zone;
 
   // CNAME handling; mutually exclusive with other records
-  dns_cname_t *cname;
-  uint32_t cname_ttl;
+  dns_rrset_t *cname;
 
   bool is_delegation;
+  bool in_use;                // false while on the free list
+  dns_trie_node_t *next_free;
 } dns_trie_node_t;
 
+// nodes are carved out of fixed size slabs so teardown and statistics are a
+// linear scan instead of a recursive walk
+#define DNS_TRIE_SLAB_NODES \
+  ((DNS_TRIE_SLAB_BYTES - sizeof(void *) - sizeof(size_t)) / sizeof(dns_trie_node_t))
+
+typedef struct dns_trie_slab {
+  dns_trie_slab_t *next;
+  size_t used;
+  dns_trie_node_t nodes[DNS_TRIE_SLAB_NODES];
+} dns_trie_slab_t;
+
+// nodes, child arrays, maps and zones live in the arena, rrsets stay on the
+// heap because resolution results and the cache hold references to them
 typedef struct dns_trie {
-    dns_trie_node_t *root;
+  dns_trie_node_t *root;
+  dns_arena_t *arena;
+  dns_trie_slab_t *slabs;      // newest first
+  dns_trie_node_t *free_nodes; // pruned by dynamic update, reused first
+  size_t node_count;
+  dns_rrset_order_policy_t rrset_order; // gives the RRsets the trie creates their order
 } dns_trie_t;
 
+typedef enum {
+  DNS_TRIE_MATCH_NONE = 0, // name does not exist (NXDOMAIN)
+  DNS_TRIE_MATCH_EXACT,    // node for the name exists (may be an empty non-terminal)
+  DNS_TRIE_MATCH_WILDCARD, // RFC 4592 match on *.<closest encloser>
+} dns_trie_match_t;
+
+typedef struct {
+  dns_trie_match_t match;
+  dns_trie_node_t *node;             // exact node or wildcard source, NULL on NONE
+  dns_trie_node_t *closest_encloser; // deepest existing ancestor (or the node itself)
+  int encloser_labels;               // labels of the closest encloser's name
+  dns_zone_t *zone;                  // closest enclosing zone seen on the descent
+} dns_trie_match_result_t;
+
 
 dns_trie_t *dns_trie_create(void);
 void dns_trie_free(dns_trie_t *trie);
 
-dns_trie_node_t *dns_trie_node_create(const char *label);
-void dns_trie_node_free(dns_trie_node_t *node);
+dns_trie_node_t *dns_trie_node_create(dns_trie_t *trie, const char *label);
+void dns_trie_node_free(dns_trie_t *trie, dns_trie_node_t *node);
 
 // insert operations
 bool dns_trie_insert_rr(dns_trie_t *trie, const char *domain, dns_rr_t *rr);
 bool dns_trie_insert_zone(dns_trie_t *trie, const char *zone_name, dns_soa_t *soa, dns_rrset_t *ns_records);
 bool dns_trie_insert_cname(dns_trie_t *trie, const char *domain, const char *target, uint32_t ttl);
 
+// mutation (dynamic update), nodes left empty are pruned. an RRset still
+// referenced elsewhere is copied before it is changed
+bool dns_trie_update_rr(dns_trie_t *trie, const char *domain, dns_rr_t *rr);
+bool dns_trie_delete_rr(dns_trie_t *trie, const char *domain, const dns_rr_t *rr);
+bool dns_trie_delete_rrset(dns_trie_t *trie, const char *domain, dns_record_type_t type);
+bool dns_trie_delete_name(dns_trie_t *trie, const char *domain, bool keep_apex);
+
+// encode every rrset that has no fragment yet, run once the zones are loaded.
+// changes through dns_trie_update_rr and the deletes keep their node compiled,
+// bulk inserts leave it to this. returns the number of fragments built
+size_t dns_trie_compile(dns_trie_t *trie);
+
 // query operations
 dns_rrset_t *dns_trie_lookup(dns_trie_t *trie, const char *domain, dns_record_type_t type);
-dns_cname_t *dns_trie_lookup_cname(dns_trie_t *trie, const char *domain, uint32_t *ttl);
+dns_rrset_t *dns_trie_lookup_cname(dns_trie_t *trie, const char *domain, uint32_t *ttl);
 dns_zone_t *dns_trie_find_zone(dns_trie_t *trie, const char *domain);
+dns_trie_match_t dns_trie_find(dns_trie_t *trie, const char *domain, dns_trie_match_result_t *result);
+// the same descent keyed by a canonical name, the text forms convert and call it
+dns_trie_match_t dns_trie_find_name(dns_trie_t *trie, const dns_name_t *name,
+                                    dns_trie_match_result_t *result);
+bool dns_trie_name_in_use(dns_trie_t *trie, const char *domain);
 
 // utility functions
-rrset_map_t *rrset_map_create(void);
-void rrset_map_free(rrset_map_t *map);
-bool rrset_map_insert(rrset_map_t *map, dns_record_type_t type, dns_rrset_t *rrset);
-dns_rrset_t *rrset_map_lookup(rrset_map_t *map, dns_record_type_t type);
+bool rrset_map_insert(dns_trie_t *trie, dns_trie_node_t *node, dns_record_type_t type, dns_rrset_t *rrset);
+dns_rrset_t *rrset_map_lookup(const rrset_map_t *map, dns_record_type_t type);
+rrset_entry_t *rrset_map_entry(const rrset_map_t *map, dns_record_type_t type);
+bool rrset_map_remove(dns_trie_t *trie, dns_trie_node_t *node, dns_record_type_t type);
+bool rrset_map_is_empty(const rrset_map_t *map);
 bool dns_trie_is_empty(const dns_trie_t *trie);
 size_t dns_trie_get_record_count(const dns_trie_t *trie);
 const char *dns_trie_get_stats(const dns_trie_t *trie, char *buf, size_t len);
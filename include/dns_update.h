@@ -0,0 +1,50 @@
+#ifndef DNS_UPDATE_H
+#define DNS_UPDATE_H
+
+
+#include "dns_records.h"
+#include "dns_parser.h"
+#include "dns_trie.h"
+#include "dns_cache.h"
+#include "dns_error.h"
+
+
+// RFC 2136 dynamic update
+//
+// an UPDATE message reuses the header/section layout of a query:
+//   QDCOUNT -> ZOCOUNT (zone section, exactly one SOA question)
+//   ANCOUNT -> PRCOUNT (prerequisites)
+//   NSCOUNT -> UPCOUNT (updates)
+//   ARCOUNT -> ADCOUNT (additional data, ignored)
+//
+// changes are applied in place to the trie, only cache entries for the
+// touched names (and their ancestors up to the zone apex) are invalidated
+
+typedef struct {
+  uint8_t rcode;
+
+  // zone section, echoed back in the response when it parsed
+  bool has_zone;
+  dns_question_t zone;
+
+  int prerequisites_checked;
+  int records_added;
+  int records_deleted;
+} dns_update_result_t;
+
+
+int dns_update_process(dns_trie_t *trie,
+                       dns_cache_t *cache,
+                       const uint8_t *buf,
+                       size_t len,
+                       dns_update_result_t *result,
+                       dns_error_t *err);
+
+int dns_update_build_response(uint16_t id,
+                              const dns_update_result_t *result,
+                              uint8_t *buf,
+                              size_t capacity,
+                              size_t *length);
+
+
+#endif // DNS_UPDATE_H
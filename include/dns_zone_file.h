@@ -90,7 +90,7 @@ int zone_parse_record(zone_parser_t *parser, dns_rr_t **rr, char *owner_name);
 
 // token parsing
 int zone_get_next_token(zone_parser_t *parser, zone_token_t *token);
-bool zone_parse_rdata(const char *type_str, const char *rdata_str, dns_rr_t *rr);
+bool zone_parse_rdata(const char *type_str, const char *rdata_str, dns_rr_t **rr);
 
 // directive handling
 zone_directive_t zone_parse_directive(const char *line);
@@ -0,0 +1,145 @@
+#include "dns_arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+#define CHUNK_HEADER ((sizeof(dns_arena_chunk_t) + DNS_ARENA_ALIGN - 1) & ~(size_t)(DNS_ARENA_ALIGN - 1))
+
+
+static inline char *chunk_data(dns_arena_chunk_t *chunk) {
+  return (char *)chunk + CHUNK_HEADER;
+}
+
+// index into free_lists, -1 when the block gets a chunk of its own
+static int size_class(size_t size) {
+  int cls = DNS_ARENA_MIN_CLASS;
+  while (cls <= DNS_ARENA_MAX_CLASS && ((size_t)1 << cls) < size) ++cls;
+  return (cls > DNS_ARENA_MAX_CLASS) ? -1 : cls - DNS_ARENA_MIN_CLASS;
+}
+
+static dns_arena_chunk_t *chunk_create(dns_arena_t *arena, size_t size) {
+  dns_arena_chunk_t *chunk = calloc(1, CHUNK_HEADER + size);
+  if (!chunk) return NULL;
+
+  chunk->size = size;
+  chunk->used = 0;
+  arena->bytes_reserved += CHUNK_HEADER + size;
+  return chunk;
+}
+
+dns_arena_t *dns_arena_create(size_t chunk_size) {
+  dns_arena_t *arena = calloc(1, sizeof(dns_arena_t));
+  if (!arena) return NULL;
+
+  // a chunk must hold at least one block of the largest class
+  size_t min_chunk = (size_t)1 << DNS_ARENA_MAX_CLASS;
+  arena->chunk_size = (chunk_size < min_chunk) ? min_chunk : chunk_size;
+  return arena;
+}
+
+void dns_arena_destroy(dns_arena_t *arena) {
+  if (!arena) return;
+
+  dns_arena_chunk_t *chunk = arena->chunks;
+  while (chunk) {
+    dns_arena_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
+
+static void *alloc_large(dns_arena_t *arena, size_t size) {
+  dns_arena_chunk_t *chunk = chunk_create(arena, size);
+  if (!chunk) return NULL;
+  chunk->used = size;
+
+  // keep the bump chunk at the head of the list
+  if (arena->chunks) {
+    chunk->next = arena->chunks->next;
+    arena->chunks->next = chunk;
+  } else {
+    arena->chunks = chunk;
+  }
+
+  arena->bytes_in_use += size;
+  return chunk_data(chunk);
+}
+
+void *dns_arena_alloc(dns_arena_t *arena, size_t size) {
+  if (!arena || size == 0) return NULL;
+
+  int cls = size_class(size);
+  if (cls < 0) return alloc_large(arena, size);
+
+  size_t block_size = (size_t)1 << (cls + DNS_ARENA_MIN_CLASS);
+
+  dns_arena_block_t *block = arena->free_lists[cls];
+  if (block) {
+    arena->free_lists[cls] = block->next;
+    memset(block, 0, block_size);
+    arena->bytes_in_use += block_size;
+    return block;
+  }
+
+  dns_arena_chunk_t *chunk = arena->chunks;
+  if (!chunk || chunk->size - chunk->used < block_size) {
+    chunk = chunk_create(arena, arena->chunk_size);
+    if (!chunk) return NULL;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+
+  // every class is a multiple of the alignment, so used stays aligned
+  void *ptr = chunk_data(chunk) + chunk->used;
+  chunk->used += block_size;
+  arena->bytes_in_use += block_size;
+  return ptr;
+}
+
+void dns_arena_release(dns_arena_t *arena, void *ptr, size_t size) {
+  if (!arena || !ptr || size == 0) return;
+
+  int cls = size_class(size);
+  if (cls < 0) {
+    // large chunks stay reserved until the arena goes away
+    arena->bytes_in_use -= size;
+    return;
+  }
+
+  dns_arena_block_t *block = ptr;
+  block->next = arena->free_lists[cls];
+  arena->free_lists[cls] = block;
+  arena->bytes_in_use -= (size_t)1 << (cls + DNS_ARENA_MIN_CLASS);
+}
+
+void dns_arena_reset(dns_arena_t *arena) {
+  if (!arena) return;
+
+  // keep the oldest regular chunk, it is the last one of chunk_size on the list
+  dns_arena_chunk_t *keep = NULL;
+  for (dns_arena_chunk_t *chunk = arena->chunks; chunk; chunk = chunk->next) {
+    if (chunk->size == arena->chunk_size) keep = chunk;
+  }
+
+  dns_arena_chunk_t *chunk = arena->chunks;
+  while (chunk) {
+    dns_arena_chunk_t *next = chunk->next;
+    if (chunk != keep) {
+      arena->bytes_reserved -= CHUNK_HEADER + chunk->size;
+      free(chunk);
+    }
+    chunk = next;
+  }
+
+  if (keep) {
+    memset(chunk_data(keep), 0, keep->used);
+    keep->used = 0;
+    keep->next = NULL;
+  }
+
+  arena->chunks = keep;
+  memset(arena->free_lists, 0, sizeof(arena->free_lists));
+  arena->bytes_in_use = 0;
+}
@@ -1,40 +1,30 @@
 #include "dns_cache.h"
+#include "dns_rdata.h"
+#include "dns_log.h"
 #include <bits/time.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 
 
-// DJB2 hash function
-static unsigned int dns_cache_hash(const char *qname,
-                                   dns_record_type_t qtype,
-                                   dns_class_t qclass) {
-  unsigned int hash = 5381;
-
-  for (const char *p = qname; *p; ++p) {
-    char c = (*p >= 'A' && *p <= 'Z') ? (*p + 32) : *p;
-    hash = ((hash << 5) + hash) + c;
-  }
-
-  // mix-in type and class
-  hash = ((hash << 5) + hash) + qtype;
-  hash = ((hash << 5) + hash) + qclass;
-
-  return hash % DNS_CACHE_HASH_SIZE;
+// bucket by name only: every type cached for a name lands in the same
+// chain, so invalidating a name touches a single bucket
+static unsigned int dns_cache_bucket(const dns_name_t *name) {
+  return name->hash % DNS_CACHE_HASH_SIZE;
 }
 
 static bool dns_cache_key_match(const dns_cache_entry_t *entry,
-                                const char *qname,
+                                const dns_name_t *name,
                                 dns_record_type_t qtype,
                                 dns_class_t qclass) {
   return (entry->qtype == qtype
        && entry->qclass == qclass
-       && strcasecmp(entry->qname, qname) == 0);
+       && dns_name_eq(&entry->name, name));
 }
+
 dns_cache_t *dns_cache_create(size_t max_entries) {
   dns_cache_t *cache = calloc(1, sizeof(dns_cache_t));
   if (!cache) return NULL;
@@ -45,6 +35,7 @@ dns_cache_t *dns_cache_create(size_t max_entries) {
   // hash table
   for (int i = 0; i < DNS_CACHE_HASH_SIZE; ++i) {
     cache->hash_table[i] = NULL;
+    cache->encloser_table[i] = NULL;
   }
 
   // LRU
@@ -57,21 +48,46 @@ dns_cache_t *dns_cache_create(size_t max_entries) {
   cache->negative_ttl = 300; // 5 minutes
   cache->enable_negative_cache = true;
 
-  memset(&cache->stats, 0, sizeof(dns_cache_stats_t));
+  cache->stats = dns_stats_create();
+  if (!cache->stats) {
+    free(cache);
+    return NULL;
+  }
 
   return cache;
 }
 
+static void dns_cache_entry_drop_rrsets(dns_cache_entry_t *entry) {
+  for (int i = 0; i < entry->rrset_count; ++i) {
+    dns_rrset_free(entry->rrsets[i]);
+  }
+  free(entry->rrsets);
+
+  entry->rrsets = NULL;
+  entry->rrset_count = 0;
+  entry->record_count = 0;
+}
+
 static void dns_cache_entry_free(dns_cache_entry_t *entry) {
   if (!entry) return;
 
-  // free records if its a positive entry
-  if (entry->entry_type == DNS_CACHE_TYPE_POSITIVE && entry->records) {
-    dns_rr_free(entry->records);
-  }
+  dns_cache_entry_drop_rrsets(entry);
   free(entry);
 }
 
+// add (sign 1) or take back (sign -1) what an entry contributes to the
+// running totals, around every link, unlink and in place update
+static void dns_cache_account(dns_cache_t *cache, const dns_cache_entry_t *entry, int sign) {
+  if (entry->entry_type == DNS_CACHE_TYPE_POSITIVE) {
+    cache->positive_entries += sign;
+  } else {
+    cache->negative_entries += sign;
+  }
+  cache->record_count += sign * entry->record_count;
+  cache->timestamp_sum += sign * (int64_t)entry->timestamp;
+  cache->expiration_sum += sign * (int64_t)entry->expiration;
+}
+
 void dns_cache_free(dns_cache_t *cache) {
   if (!cache) return;
 
@@ -85,6 +101,7 @@ void dns_cache_free(dns_cache_t *cache) {
     }
   }
 
+  dns_stats_free(cache->stats);
   free(cache);
 }
 
@@ -100,6 +117,7 @@ void dns_cache_clear(dns_cache_t *cache) {
       entry = next;
     }
     cache->hash_table[i] = NULL;
+    cache->encloser_table[i] = NULL; // chains through the entries just freed
   }
 
   // reset LRU
@@ -107,6 +125,11 @@ void dns_cache_clear(dns_cache_t *cache) {
   cache->lru_tail = NULL;
 
   cache->current_entries = 0;
+  cache->positive_entries = 0;
+  cache->negative_entries = 0;
+  cache->record_count = 0;
+  cache->timestamp_sum = 0;
+  cache->expiration_sum = 0;
 }
 
 static void *dns_cache_maintenance_thread(void *arg) {
@@ -124,7 +147,7 @@ static void *dns_cache_maintenance_thread(void *arg) {
 
     int removed = dns_cache_remove_expired(maintainer->cache);
     if (removed > 0) {
-      printf("[cache maintainer] removed %d expired entries\n", removed);
+      DNS_LOG_DEBUG("[cache maintainer] removed %d expired entries", removed);
     }
   }
   pthread_mutex_unlock(&maintainer->mutex);
@@ -218,19 +241,11 @@ dns_cache_result_t *dns_cache_lookup_safe(dns_cache_t *cache,
   return result;
 }
 
-const dns_cache_stats_t *dns_cache_get_stats(const dns_cache_t *cache) {
-  return cache ? &cache->stats : NULL;
-}
-
-void dns_cache_reset_stats(dns_cache_t *cache) {
-  if (!cache) return;
-  memset(&cache->stats, 0, sizeof(dns_cache_stats_t));
-}
-
 void dns_cache_print_stats(const dns_cache_t *cache, FILE *output) {
   if (!cache || !output) return;
 
-  const dns_cache_stats_t *stats = &cache->stats;
+  dns_stats_snapshot_t stats;
+  dns_stats_snapshot(cache->stats, &stats);
 
   fprintf(output, "=== DNS Cache Statistics ===\n");
   fprintf(output, "Entries: %zu / %zu (%.1f%% full)\n",
@@ -238,25 +253,28 @@ void dns_cache_print_stats(const dns_cache_t *cache, FILE *output) {
           cache->max_entries,
           (cache->current_entries * 100.0) / cache->max_entries);
   fprintf(output, "\nQuery Statistics:\n");
-  fprintf(output, "  Total queries: %lu\n", stats->queries);
+  fprintf(output, "  Total queries: %lu\n", stats.cache_lookups);
   fprintf(output, "  Cache hits:    %lu (%.1f%%)\n",
-          stats->hits,
+          stats.cache_lookup_hits,
           dns_cache_hit_rate(cache));
-  fprintf(output, "  Cache misses:  %lu\n", stats->misses);
-  fprintf(output, "  Expired:       %lu\n", stats->expired);
+  fprintf(output, "  Cache misses:  %lu\n", stats.cache_lookup_misses);
+  fprintf(output, "  Expired:       %lu\n", stats.cache_expired);
   fprintf(output, "\nHit Breakdown:\n");
-  fprintf(output, "  Positive:      %lu\n", stats->positive_hits);
-  fprintf(output, "  Negative:      %lu\n", stats->negative_hits);
-  fprintf(output, "    NXDOMAIN:    %lu\n", stats->nxdomain_hits);
-  fprintf(output, "    NODATA:      %lu\n", stats->nodata_hits);
+  fprintf(output, "  Positive:      %lu\n", stats.cache_positive_hits);
+  fprintf(output, "  Negative:      %lu\n", stats.cache_negative_hits);
+  fprintf(output, "    NXDOMAIN:    %lu\n", stats.cache_nxdomain_hits);
+  fprintf(output, "    NODATA:      %lu\n", stats.cache_nodata_hits);
   fprintf(output, "\nMaintenance:\n");
-  fprintf(output, "  Insertions:    %lu\n", stats->insertions);
-  fprintf(output, "  Evictions:     %lu\n", stats->evictions);
+  fprintf(output, "  Insertions:    %lu\n", stats.cache_insertions);
+  fprintf(output, "  Evictions:     %lu\n", stats.cache_evictions);
 }
 
 float dns_cache_hit_rate(const dns_cache_t *cache) {
-  if (!cache || cache->stats.queries == 0) return 0.0f;
-  return (cache->stats.hits * 100.0f) / cache->stats.queries;
+  if (!cache) return 0.0f;
+
+  uint64_t lookups = dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUPS);
+  if (lookups == 0) return 0.0f;
+  return (dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUP_HITS) * 100.0f) / lookups;
 }
 
 int dns_cache_get_summary(const dns_cache_t *cache, dns_cache_summary_t *summary) {
@@ -268,60 +286,39 @@ int dns_cache_get_summary(const dns_cache_t *cache, dns_cache_summary_t *summary
   summary->max_entries = cache->max_entries;
   summary->utilization_pct = (cache->current_entries * 100.0) / cache->max_entries;
   summary->hit_rate_pct = dns_cache_hit_rate(cache);
-  summary->total_queries = cache->stats.queries;
-
-
-  time_t now = time(NULL);
-  time_t oldest = 0;
-  time_t newest = now;
-
-  uint64_t total_remaining_ttl = 0;
-  int entry_count = 0;
-
-  for (int i = 0; i < DNS_CACHE_HASH_SIZE; ++i) {
-    dns_cache_entry_t *entry = cache->hash_table[i];
-    while (entry) {
-      if (entry->entry_type == DNS_CACHE_TYPE_POSITIVE) {
-        summary->positive_entries++;
-      } else {
-        summary->negative_entries++;
-      }
-
-      // update oldest/newest
-      time_t age = now - entry->timestamp;
-      if (oldest == 0 || age > oldest) oldest = age;
-      if (age < newest) newest = age;
-
-      if (entry->expiration > now) total_remaining_ttl += (entry->expiration - now);
-
-      ++entry_count;
-      entry = entry->next;
-    }
+  summary->total_queries = dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUPS);
+
+  // running totals, kept up by every insert and removal
+  summary->positive_entries = cache->positive_entries;
+  summary->negative_entries = cache->negative_entries;
+  summary->record_count = cache->record_count;
+
+  size_t count = cache->current_entries;
+  if (count > 0) {
+    int64_t now = time(NULL);
+    int64_t remaining = cache->expiration_sum - now * (int64_t)count;
+    summary->avg_entry_age = (time_t)((now * (int64_t)count - cache->timestamp_sum) / (int64_t)count);
+    summary->avg_remaining_ttl = remaining > 0 ? (uint32_t)(remaining / (int64_t)count) : 0;
   }
 
-  summary->oldest_entry_age = oldest;
-  summary->newest_entry_age = newest;
-  summary->avg_remaining_ttl = entry_count > 0 ? (uint32_t)(total_remaining_ttl / entry_count) : 0;
-
   return 0;
 }
 
 size_t dns_cache_memory_usage(const dns_cache_t *cache) {
   if (!cache) return 0;
 
-  size_t total = sizeof(dns_cache_t);
+  size_t total = sizeof(dns_cache_t) + sizeof(dns_stats_t);
 
   for (int i = 0; i < DNS_CACHE_HASH_SIZE; ++i) {
     dns_cache_entry_t *entry = cache->hash_table[i];
     while (entry) {
       total += sizeof(dns_cache_entry_t);
 
-      if (entry->entry_type == DNS_CACHE_TYPE_POSITIVE) {
-        for (dns_rr_t *rr = entry->records; rr != NULL; rr = rr->next) {
-          total += sizeof(dns_rr_t);
-          if (rr->type == DNS_TYPE_TXT && rr->rdata.txt.text) {
-            total += rr->rdata.txt.length;
-          }
+      // RRsets shared with the trie are counted here as well
+      for (int j = 0; j < entry->rrset_count; ++j) {
+        total += sizeof(dns_rrset_t) + sizeof(dns_rrset_t *);
+        for (dns_rr_t *rr = entry->rrsets[j]->records; rr != NULL; rr = rr->next) {
+          total += sizeof(dns_rr_t) + rr->data_len;
         }
       }
 
@@ -332,51 +329,98 @@ size_t dns_cache_memory_usage(const dns_cache_t *cache) {
   return total;
 }
 
-int dns_cache_dump_entries(const dns_cache_t *cache, FILE *output, int max_entries) {
-  if (!cache || !output) return -1;
+// orders the entries of a bucket for a walk, any total order over the key does
+static int dns_cache_key_compare(const dns_cache_entry_t *entry,
+                                 const dns_name_t *name,
+                                 dns_record_type_t qtype,
+                                 dns_class_t qclass) {
+  uint8_t len = entry->name.len < name->len ? entry->name.len : name->len;
+  int order = memcmp(entry->name.wire, name->wire, len);
+  if (order != 0) return order;
+  if (entry->name.len != name->len) return entry->name.len < name->len ? -1 : 1;
+  if (entry->qtype != qtype) return entry->qtype < qtype ? -1 : 1;
+  if (entry->qclass != qclass) return entry->qclass < qclass ? -1 : 1;
+  return 0;
+}
 
-  int count = 0;
-  time_t now = time(NULL);
+const dns_cache_entry_t *dns_cache_next_entry(const dns_cache_t *cache, dns_cache_cursor_t *cursor) {
+  if (!cache || !cursor) return NULL;
 
-  fprintf(output, "%-40s %-6s %-8s %-10s %-10s\n",
-          "QNAME", "TYPE", "CLASS", "TTL_LEFT", "STATUS");
-  fprintf(output, "%-40s %-6s %-8s %-10s %-10s\n",
-          "----------------------------------------", "------", "--------", "----------", "----------");
+  while (cursor->bucket >= 0 && cursor->bucket < DNS_CACHE_HASH_SIZE) {
+    // the smallest key in the bucket past the one handed out last
+    const dns_cache_entry_t *next = NULL;
+    for (const dns_cache_entry_t *entry = cache->hash_table[cursor->bucket]; entry; entry = entry->next) {
+      if (cursor->started
+          && dns_cache_key_compare(entry, &cursor->name, cursor->qtype, cursor->qclass) <= 0) {
+        continue;
+      }
+      if (!next || dns_cache_key_compare(entry, &next->name, next->qtype, next->qclass) < 0) {
+        next = entry;
+      }
+    }
 
-  for (int i = 0; i < DNS_CACHE_HASH_SIZE && (max_entries <= 0 || count < max_entries); ++i) {
-    dns_cache_entry_t *entry = cache->hash_table[i];
+    if (next) {
+      cursor->started = true;
+      cursor->name = next->name;
+      cursor->qtype = next->qtype;
+      cursor->qclass = next->qclass;
+      return next;
+    }
+    ++cursor->bucket;
+    cursor->started = false;
+  }
 
-    while (entry && (max_entries <= 0 || count < max_entries)) {
-      const char *type_str;
-      switch (entry->qtype) {
-        case DNS_TYPE_A: type_str = "A"; break;
-        case DNS_TYPE_AAAA: type_str = "AAAA"; break;
-        case DNS_TYPE_NS: type_str = "NS"; break;
-        case DNS_TYPE_CNAME: type_str = "CNAME"; break;
-        case DNS_TYPE_MX: type_str = "MX"; break;
-        case DNS_TYPE_SOA: type_str = "SOA"; break;
-        case DNS_TYPE_TXT: type_str = "TXT"; break;
-        default: type_str = "UNSUPPORTED";
-      }
+  return NULL;
+}
 
-      const char *status;
-      switch (entry->entry_type) {
-        case DNS_CACHE_TYPE_POSITIVE: status = "POSITIVE"; break;
-        case DNS_CACHE_TYPE_NXDOMAIN: status = "NXDOMAIN"; break;
-        case DNS_CACHE_TYPE_NODATA: status = "NODATA"; break;
-        default: status = "UNKNOWN";
-      }
+int dns_cache_format_header(char *buf, size_t len) {
+  return snprintf(buf, len, "%-40s %-6s %-8s %-10s %-10s\n%-40s %-6s %-8s %-10s %-10s\n",
+                  "QNAME", "TYPE", "CLASS", "TTL_LEFT", "STATUS",
+                  "----------------------------------------", "------", "--------",
+                  "----------", "----------");
+}
 
-      int32_t ttl_left = (int32_t)(entry->expiration - now);
-      if (ttl_left < 0) ttl_left = 0;
+int dns_cache_format_entry(const dns_cache_entry_t *entry, time_t now, char *buf, size_t len) {
+  if (!entry || !buf) return -1;
 
-      fprintf(output, "%-40s %-6s %-8s %-10d %-10s\n",
-              entry->qname, type_str, "IN", ttl_left, status);
+  char type_buf[16];
+  const char *type_str = dns_rdata_type_to_text(entry->qtype, type_buf, sizeof(type_buf));
 
-      ++count;
-      entry = entry->next;
+  const char *status;
+  switch (entry->entry_type) {
+    case DNS_CACHE_TYPE_POSITIVE: status = "POSITIVE"; break;
+    case DNS_CACHE_TYPE_NXDOMAIN: status = "NXDOMAIN"; break;
+    case DNS_CACHE_TYPE_NODATA: status = "NODATA"; break;
+    default: status = "UNKNOWN";
+  }
 
-    }
+  int32_t ttl_left = (int32_t)(entry->expiration - now);
+  if (ttl_left < 0) ttl_left = 0;
+
+  char qname[MAX_DOMAIN_NAME];
+  dns_name_to_text(&entry->name, qname, sizeof(qname));
+
+  return snprintf(buf, len, "%-40s %-6s %-8s %-10d %-10s\n",
+                  qname, type_str, "IN", ttl_left, status);
+}
+
+int dns_cache_dump_entries(const dns_cache_t *cache, FILE *output, int max_entries) {
+  if (!cache || !output) return -1;
+
+  int count = 0;
+  time_t now = time(NULL);
+  char line[DNS_CACHE_DUMP_LINE_MAX];
+
+  dns_cache_format_header(line, sizeof(line));
+  fputs(line, output);
+
+  dns_cache_cursor_t cursor = {0};
+  const dns_cache_entry_t *entry;
+  while ((max_entries <= 0 || count < max_entries)
+         && (entry = dns_cache_next_entry(cache, &cursor)) != NULL) {
+    dns_cache_format_entry(entry, now, line, sizeof(line));
+    fputs(line, output);
+    ++count;
   }
 
   return count;
@@ -454,13 +498,37 @@ static void dns_cache_lru_remove(dns_cache_t *cache, dns_cache_entry_t *entry) {
   entry->lru_next = NULL;
 }
 
+static void dns_cache_encloser_unlink(dns_cache_t *cache, dns_cache_entry_t *entry) {
+  if (!entry->enclosed) return;
+
+  if (entry->encloser_prev) {
+    entry->encloser_prev->encloser_next = entry->encloser_next;
+  } else {
+    cache->encloser_table[entry->encloser_bucket] = entry->encloser_next;
+  }
+  if (entry->encloser_next) entry->encloser_next->encloser_prev = entry->encloser_prev;
+
+  entry->enclosed = false;
+  entry->encloser_prev = NULL;
+  entry->encloser_next = NULL;
+}
+
+// everything but the collision chain, which the caller has unlinked from
+static void dns_cache_entry_release(dns_cache_t *cache, dns_cache_entry_t *entry) {
+  dns_cache_lru_remove(cache, entry);
+  dns_cache_encloser_unlink(cache, entry);
+  dns_cache_account(cache, entry, -1);
+  dns_cache_entry_free(entry);
+  cache->current_entries--;
+}
+
 static bool dns_cache_evict_lru(dns_cache_t *cache) {
   if (!cache || !cache->lru_tail) return false;
 
   dns_cache_entry_t *victim = cache->lru_tail;
 
   // remove victim from hash table
-  unsigned int hash = dns_cache_hash(victim->qname, victim->qtype, victim->qclass);
+  unsigned int hash = dns_cache_bucket(&victim->name);
   dns_cache_entry_t **curr = &cache->hash_table[hash];
 
   while (*curr) {
@@ -472,11 +540,8 @@ static bool dns_cache_evict_lru(dns_cache_t *cache) {
   }
 
   // evict the victim
-  dns_cache_lru_remove(cache, victim);
-  dns_cache_entry_free(victim);
-
-  cache->current_entries--;
-  cache->stats.evictions++;
+  dns_cache_entry_release(cache, victim);
+  dns_stats_inc(cache->stats, DNS_STAT_CACHE_EVICTIONS);
 
   return true;
 }
@@ -504,103 +569,61 @@ static uint32_t dns_cache_entry_remaining_ttl(const dns_cache_entry_t *entry) {
   return (uint32_t)(entry->expiration - now);
 }
 
-static dns_rr_t *dns_cache_copy_records(const dns_rr_t *records) {
-  if (!records) return NULL;
-
-  // deep copy the linked list of records
-  dns_rr_t *head = NULL;
-  dns_rr_t *tail = NULL;
-
-  for (const dns_rr_t *src = records; src != NULL; src = src->next) {
-    dns_rr_t *copy = dns_rr_create(src->type, src->class, src->ttl);
-    if (!copy) {
-      dns_rr_free(head);
-      return NULL;
-    }
-
-    // copy rdata based on type
-    switch (src->type) {
-      case DNS_TYPE_A:
-        copy->rdata.a = src->rdata.a;
-        break;
-
-      case DNS_TYPE_AAAA:
-        copy->rdata.aaaa = src->rdata.aaaa;
-        break;
-
-      case DNS_TYPE_NS:
-        copy->rdata.ns = src->rdata.ns;
-        break;
-
-      case DNS_TYPE_CNAME:
-        copy->rdata.cname = src->rdata.cname;
-        break;
-
-      case DNS_TYPE_MX:
-        copy->rdata.mx = src->rdata.mx;
-        break;
-
-      case DNS_TYPE_SOA:
-        copy->rdata.soa = src->rdata.soa;
-        break;
-
-      case DNS_TYPE_TXT:
-        if (src->rdata.txt.text) {
-          copy->rdata.txt.text = malloc(src->rdata.txt.length);
-          if (copy->rdata.txt.text) {
-            memcpy(copy->rdata.txt.text, src->rdata.txt.text, src->rdata.txt.length);
-            copy->rdata.txt.length = src->rdata.txt.length;
-          }
-        }
-        break;
+// referenced copy of the caller's array
+static int dns_cache_entry_set_rrsets(dns_cache_entry_t *entry,
+                                      dns_rrset_t *const *rrsets,
+                                      int rrset_count) {
+  dns_rrset_t **refs = malloc(rrset_count * sizeof(dns_rrset_t *));
+  if (!refs) return -1;
 
-      default: break;
-    }
+  dns_cache_entry_drop_rrsets(entry);
 
-    // add to list
-    if (!head) {
-      head = copy;
-      tail = copy;
-    } else {
-      tail->next = copy;
-      tail = copy;
-    }
+  int record_count = 0;
+  for (int i = 0; i < rrset_count; ++i) {
+    refs[i] = dns_rrset_ref(rrsets[i]);
+    record_count += (int)rrsets[i]->count;
   }
 
-  return head;
+  entry->rrsets = refs;
+  entry->rrset_count = rrset_count;
+  entry->record_count = record_count;
+  return 0;
 }
 
-int dns_cache_insert(dns_cache_t *cache,
-                     const char *qname,
-                     dns_record_type_t qtype,
-                     dns_class_t qclass,
-                     const dns_rr_t *records,
-                     int record_count,
-                     uint32_t ttl) {
-  if (!cache || !qname || !records || record_count <= 0) return -1;
+int dns_cache_insert_rrsets(dns_cache_t *cache,
+                            const char *qname,
+                            dns_record_type_t qtype,
+                            dns_class_t qclass,
+                            dns_rrset_t *const *rrsets,
+                            int rrset_count,
+                            uint32_t ttl) {
+  if (!cache || !qname || !rrsets) return -1;
+  if (rrset_count <= 0 || rrset_count > DNS_CACHE_MAX_RRSETS) return -1;
 
   ttl = dns_cache_clamp_ttl(cache, ttl);
   if (ttl == 0) return 0; // do not cache zero TTL
 
-  unsigned int hash = dns_cache_hash(qname, qtype, qclass);
+  dns_name_t name;
+  if (dns_name_from_text(&name, qname) < 0) return -1;
+  unsigned int hash = dns_cache_bucket(&name);
 
   // check if entry already exist
   dns_cache_entry_t *existing = cache->hash_table[hash];
   while (existing) {
-    if (dns_cache_key_match(existing, qname, qtype, qclass)) {
-      // update existing entry
-      if (existing->records) {
-        dns_rr_free(existing->records);
+    if (dns_cache_key_match(existing, &name, qtype, qclass)) {
+      // update existing entry, whatever it turned on before is the caller's to say
+      dns_cache_encloser_unlink(cache, existing);
+      dns_cache_account(cache, existing, -1);
+      if (dns_cache_entry_set_rrsets(existing, rrsets, rrset_count) < 0) {
+        dns_cache_account(cache, existing, 1);
+        return -1;
       }
 
-      existing->records = dns_cache_copy_records(records);
-      if (!existing->records) return -1;
-
-      existing->record_count = record_count;
       existing->entry_type = DNS_CACHE_TYPE_POSITIVE;
       existing->timestamp = time(NULL);
       existing->expiration = existing->timestamp + ttl;
       existing->original_ttl = ttl;
+      dns_cache_account(cache, existing, 1);
 
       // move to front of LRU (MRU entry)
       dns_cache_lru_touch(cache, existing);
@@ -620,18 +643,16 @@ int dns_cache_insert(dns_cache_t *cache,
   dns_cache_entry_t *entry = calloc(1, sizeof(dns_cache_entry_t));
   if (!entry) return -1;
 
-  dns_safe_strncpy(entry->qname, qname, sizeof(entry->qname));
+  entry->name = name;
   entry->qtype = qtype;
   entry->qclass = qclass;
   entry->entry_type = DNS_CACHE_TYPE_POSITIVE;
 
-  entry->records = dns_cache_copy_records(records);
-  if (!entry->records) {
+  if (dns_cache_entry_set_rrsets(entry, rrsets, rrset_count) < 0) {
     free(entry);
     return -1;
   }
 
-  entry->record_count = record_count;
   entry->timestamp = time(NULL);
   entry->expiration = entry->timestamp + ttl;
   entry->original_ttl = ttl;
@@ -644,10 +665,53 @@ int dns_cache_insert(dns_cache_t *cache,
   dns_cache_lru_add(cache, entry);
 
   cache->current_entries++;
-  cache->stats.insertions++;
+  dns_cache_account(cache, entry, 1);
+  dns_stats_inc(cache->stats, DNS_STAT_CACHE_INSERTIONS);
   return 0;
 }
 
+// records from the wire (recursive answers, tests) are grouped into one
+// RRset per run of the same type, copied once here
+int dns_cache_insert(dns_cache_t *cache,
+                     const char *qname,
+                     dns_record_type_t qtype,
+                     dns_class_t qclass,
+                     const dns_rr_t *records,
+                     int record_count,
+                     uint32_t ttl) {
+  if (!cache || !qname || !records || record_count <= 0) return -1;
+
+  dns_rrset_t *rrsets[DNS_CACHE_MAX_RRSETS];
+  dns_rr_t **tail = NULL;
+  int rrset_count = 0;
+  int ret = -1;
+
+  for (const dns_rr_t *src = records; src != NULL; src = src->next) {
+    if (rrset_count == 0 || rrsets[rrset_count - 1]->type != src->type) {
+      if (rrset_count == DNS_CACHE_MAX_RRSETS) goto cleanup;
+
+      dns_rrset_t *rrset = dns_rrset_create(src->type, src->ttl);
+      if (!rrset) goto cleanup;
+      rrsets[rrset_count++] = rrset;
+      tail = &rrset->records;
+    }
+
+    dns_rr_t *copy = dns_rr_clone(src);
+    if (!copy) goto cleanup;
+    *tail = copy;
+    tail = &copy->next;
+    rrsets[rrset_count - 1]->count++;
+  }
+
+  ret = dns_cache_insert_rrsets(cache, qname, qtype, qclass, rrsets, rrset_count, ttl);
+
+cleanup:
+  for (int i = 0; i < rrset_count; ++i) {
+    dns_rrset_free(rrsets[i]);
+  }
+  return ret;
+}
+
 int dns_cache_insert_negative(dns_cache_t *cache,
                               const char *qname,
                               dns_record_type_t qtype,
@@ -665,23 +729,25 @@ int dns_cache_insert_negative(dns_cache_t *cache,
   ttl = dns_cache_clamp_ttl(cache, ttl);
   if (ttl == 0) return 0;
 
-  unsigned int hash = dns_cache_hash(qname, qtype, qclass);
+  dns_name_t name;
+  if (dns_name_from_text(&name, qname) < 0) return -1;
+  unsigned int hash = dns_cache_bucket(&name);
 
   // check if entry already exist
   dns_cache_entry_t *existing = cache->hash_table[hash];
   while (existing) {
-    if (dns_cache_key_match(existing, qname, qtype, qclass)) {
-      // update existing entry
-      if (existing->records) {
-        dns_rr_free(existing->records);
-      }
+    if (dns_cache_key_match(existing, &name, qtype, qclass)) {
+      // update existing entry, whatever it turned on before is the caller's to say
+      dns_cache_encloser_unlink(cache, existing);
+      dns_cache_account(cache, existing, -1);
+      dns_cache_entry_drop_rrsets(existing);
 
       existing->rcode = rcode;
       existing->entry_type = type;
-      existing->record_count = 0;
       existing->timestamp = time(NULL);
       existing->expiration = existing->timestamp + ttl;
       existing->original_ttl = ttl;
+      dns_cache_account(cache, existing, 1);
 
       // move to front of LRU (MRU entry)
       dns_cache_lru_touch(cache, existing);
@@ -701,13 +767,11 @@ int dns_cache_insert_negative(dns_cache_t *cache,
   dns_cache_entry_t *entry = calloc(1, sizeof(dns_cache_entry_t));
   if (!entry) return -1;
 
-  dns_safe_strncpy(entry->qname, qname, sizeof(entry->qname));
+  entry->name = name;
   entry->qtype = qtype;
   entry->qclass = qclass;
   entry->entry_type = type;
   entry->rcode = rcode;
-  entry->records = NULL;
-  entry->record_count = 0;
   entry->timestamp = time(NULL);
   entry->expiration = entry->timestamp + ttl;
   entry->original_ttl = ttl;
@@ -720,84 +784,130 @@ int dns_cache_insert_negative(dns_cache_t *cache,
   dns_cache_lru_add(cache, entry);
 
   cache->current_entries++;
-  cache->stats.insertions++;
+  dns_cache_account(cache, entry, 1);
+  dns_stats_inc(cache->stats, DNS_STAT_CACHE_INSERTIONS);
   return 0;
 }
 
-dns_cache_result_t *dns_cache_lookup(dns_cache_t *cache,
-                                     const char *qname,
-                                     dns_record_type_t qtype,
-                                     dns_class_t qclass) {
-  if (!cache || !qname) return NULL;
+// fill result from a matching entry, false when it has expired
+static bool dns_cache_entry_result(dns_cache_t *cache,
+                                   dns_cache_entry_t *entry,
+                                   dns_cache_result_t *result) {
+  if (dns_cache_entry_expired(entry)) {
+    dns_stats_inc(cache->stats, DNS_STAT_CACHE_EXPIRED);
+    dns_stats_inc(cache->stats, DNS_STAT_CACHE_LOOKUP_MISSES);
+    return false;
+  }
 
-  cache->stats.queries++;
+  result->found = true;
+  result->type = entry->entry_type;
+  result->rcode = entry->rcode;
+  result->remaining_ttl = dns_cache_entry_remaining_ttl(entry);
 
-  unsigned int hash = dns_cache_hash(qname, qtype, qclass);
-  dns_cache_entry_t *entry = cache->hash_table[hash];
+  // positive entries hand out references, TTLs are applied when encoding
+  for (int i = 0; i < entry->rrset_count; ++i) {
+    result->rrsets[i] = dns_rrset_ref(entry->rrsets[i]);
+  }
+  result->rrset_count = entry->rrset_count;
+  result->record_count = entry->record_count;
 
-  // search collision chain
-  while (entry) {
-    if (dns_cache_key_match(entry, qname, qtype, qclass)) {
-      // check if expired
-      if (dns_cache_entry_expired(entry)) {
-        cache->stats.expired++;
-        cache->stats.misses++;
-        return NULL;
-      }
+  // update stats
+  dns_stats_inc(cache->stats, DNS_STAT_CACHE_LOOKUP_HITS);
+  if (entry->entry_type == DNS_CACHE_TYPE_POSITIVE) {
+    dns_stats_inc(cache->stats, DNS_STAT_CACHE_POSITIVE_HITS);
+  } else {
+    dns_stats_inc(cache->stats, DNS_STAT_CACHE_NEGATIVE_HITS);
+    if (entry->entry_type == DNS_CACHE_TYPE_NXDOMAIN) {
+      dns_stats_inc(cache->stats, DNS_STAT_CACHE_NXDOMAIN_HITS);
+    } else if (entry->entry_type == DNS_CACHE_TYPE_NODATA) {
+      dns_stats_inc(cache->stats, DNS_STAT_CACHE_NODATA_HITS);
+    }
+  }
 
-      // prepare result
-      dns_cache_result_t *result = calloc(1, sizeof(dns_cache_result_t));
-      if (!result) {
-        cache->stats.misses++;
-        return NULL;
-      }
+  dns_cache_lru_touch(cache, entry);
+  return true;
+}
 
-      result->found = true;
-      result->type = entry->entry_type;
-      result->rcode = entry->rcode;
-      result->remaining_ttl = dns_cache_entry_remaining_ttl(entry);
+static void dns_cache_result_reset(dns_cache_t *cache, dns_cache_result_t *result) {
+  result->found = false;
+  result->rrset_count = 0;
+  result->record_count = 0;
 
-      // if its a positive entry, copy records
-      if (entry->entry_type == DNS_CACHE_TYPE_POSITIVE && entry->records) {
-        result->records = dns_cache_copy_records(entry->records);
-        result->record_count = entry->record_count;
+  dns_stats_inc(cache->stats, DNS_STAT_CACHE_LOOKUPS);
+}
 
-        for (dns_rr_t *rr = result->records; rr != NULL; rr = rr->next) {
-          rr->ttl = result->remaining_ttl;
-        }
-      } else {
-        result->records = NULL;
-        result->record_count = 0;
-      }
+bool dns_cache_lookup_into(dns_cache_t *cache,
+                           const char *qname,
+                           dns_record_type_t qtype,
+                           dns_class_t qclass,
+                           dns_cache_result_t *result) {
+  if (!cache || !qname || !result) return false;
+
+  dns_name_t name;
+  if (dns_name_from_text(&name, qname) < 0) {
+    dns_cache_result_reset(cache, result);
+    dns_stats_inc(cache->stats, DNS_STAT_CACHE_LOOKUP_MISSES);
+    return false;
+  }
 
-      // update stats
-      cache->stats.hits++;
-      if (entry->entry_type == DNS_CACHE_TYPE_POSITIVE) {
-        cache->stats.positive_hits++;
-      } else {
-        cache->stats.negative_hits++;
-        if (entry->entry_type == DNS_CACHE_TYPE_NXDOMAIN) {
-          cache->stats.nxdomain_hits++;
-        } else if (entry->entry_type == DNS_CACHE_TYPE_NODATA) {
-          cache->stats.nodata_hits++;
-        }
-      }
+  return dns_cache_lookup_name(cache, &name, qtype, qclass, result);
+}
 
-      dns_cache_lru_touch(cache, entry);
-      return result;
-    }
+bool dns_cache_lookup_name(dns_cache_t *cache,
+                           const dns_name_t *name,
+                           dns_record_type_t qtype,
+                           dns_class_t qclass,
+                           dns_cache_result_t *result) {
+  if (!cache || !name || !result) return false;
 
-    entry = entry->next;
+  dns_cache_result_reset(cache, result);
+
+  // search collision chain
+  for (dns_cache_entry_t *entry = cache->hash_table[dns_cache_bucket(name)]; entry; entry = entry->next) {
+    if (dns_cache_key_match(entry, name, qtype, qclass)) {
+      return dns_cache_entry_result(cache, entry, result);
+    }
   }
 
   // not found
-  cache->stats.misses++;
-  return NULL;
+  dns_stats_inc(cache->stats, DNS_STAT_CACHE_LOOKUP_MISSES);
+  return false;
+}
+
+dns_cache_result_t *dns_cache_lookup(dns_cache_t *cache,
+                                     const char *qname,
+                                     dns_record_type_t qtype,
+                                     dns_class_t qclass) {
+  if (!cache || !qname) return NULL;
+
+  dns_cache_result_t *result = calloc(1, sizeof(dns_cache_result_t));
+  if (!result) {
+    dns_stats_inc(cache->stats, DNS_STAT_CACHE_LOOKUP_MISSES);
+    return NULL;
+  }
+
+  if (!dns_cache_lookup_into(cache, qname, qtype, qclass, result)) {
+    free(result);
+    return NULL;
+  }
+
+  return result;
+}
+
+void dns_cache_result_clear(dns_cache_result_t *result) {
+  if (!result) return;
+
+  for (int i = 0; i < result->rrset_count; ++i) {
+    dns_rrset_free(result->rrsets[i]);
+  }
+  result->rrset_count = 0;
+  result->record_count = 0;
+  result->found = false;
 }
 
 void dns_cache_result_free(dns_cache_result_t *result) {
   if (!result) return;
-  if (result->records) dns_rr_free(result->records);
+  dns_cache_result_clear(result);
   free(result);
 }
 
@@ -814,10 +924,7 @@ int dns_cache_remove_expired(dns_cache_t *cache) {
 
       if (now >= entry->expiration) {
         *curr = entry->next; // remove from collision chain
-        dns_cache_lru_remove(cache, entry); // remove from LRU list
-        dns_cache_entry_free(entry);
-
-        cache->current_entries--;
+        dns_cache_entry_release(cache, entry);
         ++removed_count;
       } else {
         curr = &(*curr)->next;
@@ -834,17 +941,16 @@ int dns_cache_remove_entry(dns_cache_t *cache,
                            dns_class_t qclass) {
   if (!cache || !qname) return -1;
 
-  unsigned int hash = dns_cache_hash(qname, qtype, qclass);
-  dns_cache_entry_t **curr = &cache->hash_table[hash];
+  dns_name_t name;
+  if (dns_name_from_text(&name, qname) < 0) return -1;
+  dns_cache_entry_t **curr = &cache->hash_table[dns_cache_bucket(&name)];
 
   while (*curr) {
     dns_cache_entry_t *entry = *curr;
 
-    if (dns_cache_key_match(entry, qname, qtype, qclass)) {
+    if (dns_cache_key_match(entry, &name, qtype, qclass)) {
         *curr = entry->next; // remove from collision chain
-        dns_cache_lru_remove(cache, entry); // remove from LRU list
-        dns_cache_entry_free(entry);
-        cache->current_entries--;
+        dns_cache_entry_release(cache, entry);
         return 0;
     }
 
@@ -853,3 +959,116 @@ int dns_cache_remove_entry(dns_cache_t *cache,
 
   return -1;
 }
+
+int dns_cache_remove_name(dns_cache_t *cache, const char *qname) {
+  if (!cache || !qname) return -1;
+
+  dns_name_t name;
+  if (dns_name_from_text(&name, qname) < 0) return -1;
+
+  int removed = 0;
+  dns_cache_entry_t **curr = &cache->hash_table[dns_cache_bucket(&name)];
+
+  while (*curr) {
+    dns_cache_entry_t *entry = *curr;
+
+    if (dns_name_eq(&entry->name, &name)) {
+      *curr = entry->next;
+      dns_cache_entry_release(cache, entry);
+      ++removed;
+    } else {
+      curr = &(*curr)->next;
+    }
+  }
+
+  return removed;
+}
+
+int dns_cache_remove_suffix(dns_cache_t *cache, const char *suffix) {
+  if (!cache || !suffix) return -1;
+
+  dns_name_t parent;
+  if (dns_name_from_text(&parent, suffix) < 0) return -1;
+
+  int removed = 0;
+  for (int i = 0; i < DNS_CACHE_HASH_SIZE; ++i) {
+    dns_cache_entry_t **curr = &cache->hash_table[i];
+    while (*curr) {
+      dns_cache_entry_t *entry = *curr;
+
+      if (dns_name_is_subdomain(&entry->name, &parent)) {
+        *curr = entry->next;
+        dns_cache_entry_release(cache, entry);
+        ++removed;
+      } else {
+        curr = &(*curr)->next;
+      }
+    }
+  }
+
+  return removed;
+}
+
+int dns_cache_set_encloser(dns_cache_t *cache,
+                           const char *qname,
+                           dns_record_type_t qtype,
+                           dns_class_t qclass,
+                           int encloser_labels) {
+  if (!cache || !qname) return -1;
+
+  dns_name_t name;
+  if (dns_name_from_text(&name, qname) < 0) return -1;
+  if (encloser_labels < 0 || encloser_labels > name.label_count) return -1;
+
+  for (dns_cache_entry_t *entry = cache->hash_table[dns_cache_bucket(&name)]; entry; entry = entry->next) {
+    if (!dns_cache_key_match(entry, &name, qtype, qclass)) continue;
+
+    dns_name_t encloser;
+    dns_name_suffix(&name, encloser_labels, &encloser);
+
+    dns_cache_encloser_unlink(cache, entry);
+    entry->enclosed = true;
+    entry->encloser_labels = (uint8_t)encloser_labels;
+    entry->encloser_bucket = dns_cache_bucket(&encloser);
+    entry->encloser_prev = NULL;
+    entry->encloser_next = cache->encloser_table[entry->encloser_bucket];
+    if (entry->encloser_next) entry->encloser_next->encloser_prev = entry;
+    cache->encloser_table[entry->encloser_bucket] = entry;
+    return 0;
+  }
+
+  return -1;
+}
+
+// the entry out of its collision chain, its bucket is known from the name
+static void dns_cache_unchain(dns_cache_t *cache, dns_cache_entry_t *entry) {
+  dns_cache_entry_t **curr = &cache->hash_table[dns_cache_bucket(&entry->name)];
+  while (*curr && *curr != entry) curr = &(*curr)->next;
+  if (*curr) *curr = entry->next;
+}
+
+int dns_cache_remove_enclosed(dns_cache_t *cache, const char *encloser, const char *below) {
+  if (!cache || !encloser) return -1;
+
+  dns_name_t parent;
+  dns_name_t scope;
+  if (dns_name_from_text(&parent, encloser) < 0) return -1;
+  if (below && dns_name_from_text(&scope, below) < 0) return -1;
+
+  int removed = 0;
+  dns_cache_entry_t *entry = cache->encloser_table[dns_cache_bucket(&parent)];
+  while (entry) {
+    dns_cache_entry_t *next = entry->encloser_next;
+
+    dns_name_t entry_encloser;
+    dns_name_suffix(&entry->name, entry->encloser_labels, &entry_encloser);
+    if (dns_name_eq(&entry_encloser, &parent) && (!below || dns_name_is_subdomain(&entry->name, &scope))) {
+      dns_cache_unchain(cache, entry);
+      dns_cache_entry_release(cache, entry);
+      ++removed;
+    }
+    entry = next;
+  }
+
+  return removed;
+}
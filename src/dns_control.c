@@ -0,0 +1,272 @@
+#include "dns_control.h"
+#include "dns_log.h"
+#include "dns_records.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0) return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+dns_control_t *dns_control_create(const char *path) {
+  if (!path || !*path) return NULL;
+
+  struct sockaddr_un addr = {0};
+  if (strlen(path) >= sizeof(addr.sun_path)) return NULL;
+
+  dns_control_t *control = calloc(1, sizeof(dns_control_t));
+  if (!control) goto err_alloc;
+
+  dns_safe_strncpy(control->path, path, sizeof(control->path));
+  control->client_fd = -1;
+
+  control->reply.data = malloc(DNS_CONTROL_BUFFER_SIZE);
+  if (!control->reply.data) goto err_buffer;
+  control->reply.capacity = DNS_CONTROL_BUFFER_SIZE;
+
+  control->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (control->listen_fd < 0) {
+    DNS_LOG_ERROR("control socket creation failed: %s", strerror(errno));
+    goto err_socket;
+  }
+
+  // a socket left behind by a server that did not shut down cleanly
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+  addr.sun_family = AF_UNIX;
+  dns_safe_strncpy(addr.sun_path, path, sizeof(addr.sun_path));
+  if (bind(control->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    DNS_LOG_ERROR("control bind to %s failed: %s", path, strerror(errno));
+    goto err_setup;
+  }
+
+  // commands can flush the cache and reload zones, the owner only
+  if (chmod(path, 0600) < 0
+      || listen(control->listen_fd, 8) < 0
+      || set_nonblocking(control->listen_fd) < 0) {
+    DNS_LOG_ERROR("control listen on %s failed: %s", path, strerror(errno));
+    unlink(path);
+    goto err_setup;
+  }
+
+  return control;
+
+err_setup:
+  close(control->listen_fd);
+err_socket:
+  free(control->reply.data);
+err_buffer:
+  free(control);
+err_alloc:
+  return NULL;
+}
+
+static void client_close(dns_control_t *control) {
+  if (control->client_fd >= 0) close(control->client_fd);
+
+  control->client_fd = -1;
+  control->state = DNS_CONTROL_IDLE;
+  control->request_length = 0;
+  control->sent = 0;
+  control->dumping = false;
+}
+
+void dns_control_free(dns_control_t *control) {
+  if (!control) return;
+
+  client_close(control);
+  if (control->listen_fd >= 0) {
+    close(control->listen_fd);
+    unlink(control->path);
+  }
+  free(control->reply.data);
+  free(control);
+}
+
+int dns_control_watch(dns_control_t *control, fd_set *read_fds, fd_set *write_fds, int max_fd) {
+  if (!control) return max_fd;
+
+  // a stalled client would keep every other command waiting
+  if (control->client_fd >= 0
+      && time(NULL) - control->client_since > DNS_CONTROL_TIMEOUT_SEC) {
+    client_close(control);
+  }
+
+  int fd = control->listen_fd;
+  if (control->state == DNS_CONTROL_IDLE) {
+    FD_SET(fd, read_fds);
+  } else {
+    fd = control->client_fd;
+    FD_SET(fd, control->state == DNS_CONTROL_READING ? read_fds : write_fds);
+  }
+
+  return fd > max_fd ? fd : max_fd;
+}
+
+const char *dns_control_ready(dns_control_t *control, const fd_set *read_fds) {
+  if (!control || !read_fds) return NULL;
+
+  if (control->state == DNS_CONTROL_IDLE) {
+    if (!FD_ISSET(control->listen_fd, read_fds)) return NULL;
+
+    int fd = accept(control->listen_fd, NULL, NULL);
+    if (fd < 0) return NULL;
+    if (set_nonblocking(fd) < 0) {
+      close(fd);
+      return NULL;
+    }
+
+    control->client_fd = fd;
+    control->client_since = time(NULL);
+    control->state = DNS_CONTROL_READING;
+    // the command usually follows the connect right away, try it now
+  } else if (control->state != DNS_CONTROL_READING || !FD_ISSET(control->client_fd, read_fds)) {
+    return NULL;
+  }
+
+  bool closed = false;
+  while (control->request_length < sizeof(control->request) - 1) {
+    ssize_t n = recv(control->client_fd,
+                     control->request + control->request_length,
+                     sizeof(control->request) - 1 - control->request_length,
+                     0);
+    if (n > 0) {
+      control->request_length += (size_t)n;
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (n < 0 && errno == EINTR) continue;
+
+    // the client may shut down its side once the command is written
+    closed = n == 0 && control->request_length > 0;
+    if (!closed) {
+      client_close(control);
+      return NULL;
+    }
+    break;
+  }
+  control->request[control->request_length] = '\0';
+
+  char *end = strchr(control->request, '\n');
+  if (!end && !closed) {
+    if (control->request_length == sizeof(control->request) - 1) {
+      dns_metrics_buffer_reset(&control->reply);
+      dns_control_error(control, "command too long");
+      dns_control_respond(control);
+    }
+    return NULL;
+  }
+
+  if (end) {
+    *end = '\0';
+    if (end > control->request && end[-1] == '\r') end[-1] = '\0';
+  }
+
+  dns_metrics_buffer_reset(&control->reply);
+  return control->request;
+}
+
+void dns_control_respond(dns_control_t *control) {
+  if (!control || control->state == DNS_CONTROL_IDLE) return;
+
+  if (control->reply.overflow) {
+    control->dumping = false;
+    dns_metrics_buffer_reset(&control->reply);
+    dns_control_error(control, "reply did not fit the buffer");
+  }
+
+  control->sent = 0;
+  control->state = DNS_CONTROL_WRITING;
+  dns_control_flush(control, NULL);
+}
+
+bool dns_control_flush(dns_control_t *control, const fd_set *write_fds) {
+  if (!control || control->state != DNS_CONTROL_WRITING) return false;
+  if (write_fds && !FD_ISSET(control->client_fd, write_fds)) return false;
+
+  while (control->sent < control->reply.length) {
+    ssize_t n = send(control->client_fd,
+                     control->reply.data + control->sent,
+                     control->reply.length - control->sent,
+                     MSG_NOSIGNAL);
+    if (n > 0) {
+      control->sent += (size_t)n;
+      control->client_since = time(NULL); // a long dump is fine while it moves
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false; // select says when
+
+    client_close(control);
+    return false;
+  }
+
+  if (control->dumping) {
+    dns_metrics_buffer_reset(&control->reply);
+    control->sent = 0;
+    return true;
+  }
+
+  client_close(control);
+  return false;
+}
+
+void dns_control_error(dns_control_t *control, const char *fmt, ...) {
+  if (!control) return;
+
+  char message[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(message, sizeof(message), fmt, args);
+  va_end(args);
+
+  dns_metrics_appendf(&control->reply, "error: %s\n", message);
+}
+
+void dns_control_dump_start(dns_control_t *control, int max_entries) {
+  if (!control) return;
+
+  char header[2 * DNS_CACHE_DUMP_LINE_MAX];
+  dns_cache_format_header(header, sizeof(header));
+  dns_metrics_appendf(&control->reply, "%s", header);
+
+  control->dumping = true;
+  control->cursor = (dns_cache_cursor_t){0};
+  control->dump_left = max_entries > 0 ? max_entries : -1;
+}
+
+void dns_control_dump_next(dns_control_t *control, const dns_cache_t *cache) {
+  if (!control || !control->dumping) return;
+
+  time_t now = time(NULL);
+  char line[DNS_CACHE_DUMP_LINE_MAX];
+
+  for (int i = 0; i < DNS_CONTROL_DUMP_CHUNK && control->dump_left != 0; ++i) {
+    if (control->reply.capacity - control->reply.length < sizeof(line)) return;
+
+    const dns_cache_entry_t *entry = dns_cache_next_entry(cache, &control->cursor);
+    if (!entry) {
+      control->dumping = false;
+      return;
+    }
+
+    dns_cache_format_entry(entry, now, line, sizeof(line));
+    dns_metrics_appendf(&control->reply, "%s", line);
+    if (control->dump_left > 0) --control->dump_left;
+  }
+
+  // a full chunk may have been the last one, the next pass finds out
+  if (control->dump_left == 0) control->dumping = false;
+}
@@ -0,0 +1,210 @@
+#include "dns_latency.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const char *const stage_names[DNS_STAGE_COUNT] = {
+  "parse", "cache", "resolve", "encode", "send", "recursive", "total",
+};
+
+static const char *const outcome_names[DNS_OUTCOME_COUNT] = {
+  "cache_hit", "authoritative", "recursive", "error",
+};
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static double ns_per_tick = 1.0;
+
+static uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void calibrate(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  // 10ms against the monotonic clock, plenty for the 1/16 the buckets give
+  struct timespec pause = {0, 10 * 1000 * 1000};
+  uint64_t ns0 = monotonic_ns();
+  uint64_t ticks0 = dns_clock_ticks();
+  nanosleep(&pause, NULL);
+  uint64_t ns1 = monotonic_ns();
+  uint64_t ticks1 = dns_clock_ticks();
+
+  if (ticks1 > ticks0 && ns1 > ns0) ns_per_tick = (double)(ns1 - ns0) / (double)(ticks1 - ticks0);
+#endif
+}
+
+double dns_clock_ns_per_tick(void) {
+  pthread_once(&calibrate_once, calibrate);
+  return ns_per_tick;
+}
+
+uint64_t dns_histogram_bucket_low(unsigned bucket) {
+  if (bucket < DNS_HIST_SUB) return bucket;
+
+  unsigned shift = bucket / DNS_HIST_SUB - 1;
+  return (uint64_t)(bucket % DNS_HIST_SUB + DNS_HIST_SUB) << shift;
+}
+
+uint64_t dns_histogram_bucket_high(unsigned bucket) {
+  if (bucket < DNS_HIST_SUB) return bucket;
+
+  unsigned shift = bucket / DNS_HIST_SUB - 1;
+  return dns_histogram_bucket_low(bucket) + (UINT64_C(1) << shift) - 1;
+}
+
+uint64_t dns_histogram_quantile(const dns_histogram_t *hist, double q) {
+  if (!hist) return 0;
+
+  uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+  if (count == 0) return 0;
+
+  if (q < 0.0) q = 0.0;
+  if (q > 1.0) q = 1.0;
+  // rank of the quantile, rounded up
+  double exact = q * (double)count;
+  uint64_t rank = (uint64_t)exact;
+  if ((double)rank < exact || rank == 0) ++rank;
+
+  // the count is read first, buckets bumped since then can only push the
+  // walk past rank sooner
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < DNS_HIST_BUCKETS; ++i) {
+    seen += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    if (seen >= rank) {
+      uint64_t high = dns_histogram_bucket_high(i);
+      uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+      return high < max ? high : max;
+    }
+  }
+  return atomic_load_explicit(&hist->max, memory_order_relaxed);
+}
+
+void dns_histogram_merge(dns_histogram_t *dst, const dns_histogram_t *src) {
+  if (!dst || !src) return;
+
+  for (unsigned i = 0; i < DNS_HIST_BUCKETS; ++i) {
+    atomic_fetch_add_explicit(&dst->buckets[i],
+                              atomic_load_explicit(&src->buckets[i], memory_order_relaxed),
+                              memory_order_relaxed);
+  }
+  atomic_fetch_add_explicit(&dst->count, atomic_load_explicit(&src->count, memory_order_relaxed),
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&dst->sum, atomic_load_explicit(&src->sum, memory_order_relaxed),
+                            memory_order_relaxed);
+
+  uint64_t max = atomic_load_explicit(&src->max, memory_order_relaxed);
+  if (max > atomic_load_explicit(&dst->max, memory_order_relaxed)) {
+    atomic_store_explicit(&dst->max, max, memory_order_relaxed);
+  }
+}
+
+void dns_histogram_reset(dns_histogram_t *hist) {
+  if (!hist) return;
+
+  for (unsigned i = 0; i < DNS_HIST_BUCKETS; ++i) {
+    atomic_store_explicit(&hist->buckets[i], 0, memory_order_relaxed);
+  }
+  atomic_store_explicit(&hist->count, 0, memory_order_relaxed);
+  atomic_store_explicit(&hist->sum, 0, memory_order_relaxed);
+  atomic_store_explicit(&hist->max, 0, memory_order_relaxed);
+}
+
+dns_latency_t *dns_latency_create(void) {
+  dns_latency_t *latency = malloc(sizeof(dns_latency_t));
+  if (!latency) return NULL;
+
+  dns_latency_reset(latency);
+  return latency;
+}
+
+void dns_latency_free(dns_latency_t *latency) {
+  free(latency);
+}
+
+void dns_latency_reset(dns_latency_t *latency) {
+  if (!latency) return;
+
+  for (int stage = 0; stage < DNS_STAGE_COUNT; ++stage) {
+    for (int outcome = 0; outcome < DNS_OUTCOME_COUNT; ++outcome) {
+      dns_histogram_reset(&latency->histograms[stage][outcome]);
+    }
+  }
+}
+
+void dns_latency_merge(dns_latency_t *dst, const dns_latency_t *src) {
+  if (!dst || !src) return;
+
+  for (int stage = 0; stage < DNS_STAGE_COUNT; ++stage) {
+    for (int outcome = 0; outcome < DNS_OUTCOME_COUNT; ++outcome) {
+      dns_histogram_merge(&dst->histograms[stage][outcome], &src->histograms[stage][outcome]);
+    }
+  }
+}
+
+void dns_latency_record_timer(dns_latency_t *latency, const dns_query_timer_t *timer) {
+  if (!latency || !timer || !timer->enabled) return;
+
+  for (int stage = 0; stage < DNS_STAGE_COUNT; ++stage) {
+    if (timer->seen & (1u << stage)) {
+      dns_latency_record(latency, stage, timer->outcome, timer->stages[stage]);
+    }
+  }
+  dns_latency_record(latency, DNS_STAGE_TOTAL, timer->outcome, timer->last - timer->start);
+}
+
+const char *dns_stage_name(dns_stage_t stage) {
+  return stage < DNS_STAGE_COUNT ? stage_names[stage] : NULL;
+}
+
+const char *dns_outcome_name(dns_outcome_t outcome) {
+  return outcome < DNS_OUTCOME_COUNT ? outcome_names[outcome] : NULL;
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks, double scale) {
+  return (uint64_t)((double)ticks * scale + 0.5);
+}
+
+void dns_latency_summary(const dns_latency_t *latency, dns_stage_t stage,
+                         dns_outcome_t outcome, dns_latency_summary_t *summary) {
+  if (!summary) return;
+
+  memset(summary, 0, sizeof(*summary));
+  if (!latency || stage >= DNS_STAGE_COUNT || outcome >= DNS_OUTCOME_COUNT) return;
+
+  const dns_histogram_t *hist = &latency->histograms[stage][outcome];
+  summary->count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+  if (summary->count == 0) return;
+
+  double scale = dns_clock_ns_per_tick();
+  summary->p50_ns = ticks_to_ns(dns_histogram_quantile(hist, 0.50), scale);
+  summary->p99_ns = ticks_to_ns(dns_histogram_quantile(hist, 0.99), scale);
+  summary->p999_ns = ticks_to_ns(dns_histogram_quantile(hist, 0.999), scale);
+  summary->max_ns = ticks_to_ns(atomic_load_explicit(&hist->max, memory_order_relaxed), scale);
+  summary->mean_ns = ticks_to_ns(atomic_load_explicit(&hist->sum, memory_order_relaxed)
+                                 / summary->count, scale);
+}
+
+void dns_latency_print(const dns_latency_t *latency, FILE *output) {
+  if (!latency || !output) return;
+
+  fprintf(output, "%-10s %-14s %10s %10s %10s %10s %10s\n",
+          "stage", "outcome", "count", "p50 ns", "p99 ns", "p999 ns", "max ns");
+  for (int stage = 0; stage < DNS_STAGE_COUNT; ++stage) {
+    for (int outcome = 0; outcome < DNS_OUTCOME_COUNT; ++outcome) {
+      dns_latency_summary_t summary;
+      dns_latency_summary(latency, stage, outcome, &summary);
+      if (summary.count == 0) continue;
+
+      fprintf(output, "%-10s %-14s %10lu %10lu %10lu %10lu %10lu\n",
+              stage_names[stage],
+              outcome_names[outcome],
+              (unsigned long)summary.count,
+              (unsigned long)summary.p50_ns,
+              (unsigned long)summary.p99_ns,
+              (unsigned long)summary.p999_ns,
+              (unsigned long)summary.max_ns);
+    }
+  }
+}
@@ -1,8 +1,14 @@
 #include "dns_log.h"
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -37,6 +43,46 @@ static const char *level_names[] = {
 };
 
 
+#define DNS_LOG_CACHE_LINE 64
+
+typedef struct {
+  uint16_t length;
+  char text[DNS_LOG_LINE_MAX];
+} dns_log_slot_t;
+
+// single producer, single consumer: the owning thread moves head, the
+// writer moves tail
+typedef struct dns_log_ring {
+  _Alignas(DNS_LOG_CACHE_LINE) _Atomic size_t head;
+  _Atomic bool busy; // the owner is between checking the mode and publishing
+  _Alignas(DNS_LOG_CACHE_LINE) _Atomic size_t tail;
+  _Atomic bool orphaned; // the owner exited, the next new thread takes it over
+  struct dns_log_ring *next;
+
+  dns_log_slot_t slots[DNS_LOG_RING_SLOTS];
+} dns_log_ring_t;
+
+static struct {
+  _Atomic bool enabled; // producers go to their rings
+  _Atomic bool running; // the writer is up
+  int fd;
+  pthread_t writer;
+
+  // pushed at the front, never unlinked until dns_log_shutdown
+  _Atomic(dns_log_ring_t *) rings;
+  _Atomic unsigned generation; // bumped when the rings are freed
+
+  _Atomic uint64_t dropped;
+  uint64_t reported; // drops already noted in the file, writer only
+} g_async = {.fd = -1};
+
+static _Thread_local dns_log_ring_t *t_ring;
+static _Thread_local unsigned t_generation;
+
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+
+
 dns_logger_t *dns_log_get_logger(void) {
   return &g_logger;
 }
@@ -59,6 +105,18 @@ void dns_log_init(void) {
 }
 
 void dns_log_shutdown(void) {
+  dns_log_stop_async();
+
+  // no thread is logging any more, stale t_ring pointers are told apart by
+  // the generation
+  dns_log_ring_t *ring = atomic_exchange(&g_async.rings, NULL);
+  atomic_fetch_add(&g_async.generation, 1);
+  while (ring) {
+    dns_log_ring_t *next = ring->next;
+    free(ring);
+    ring = next;
+  }
+
   if (!g_logger.initialized) return;
 
   pthread_mutex_lock(&g_logger.mutex);
@@ -70,6 +128,7 @@ void dns_log_shutdown(void) {
 
   pthread_mutex_unlock(&g_logger.mutex);
   pthread_mutex_destroy(&g_logger.mutex);
+  g_logger.initialized = false;
 }
 
 void dns_log_set_level(dns_log_level_t level) {
@@ -100,6 +159,265 @@ void dns_log_set_color(bool enabled) {
   g_logger.color_enabled = enabled;
 }
 
+// formatted once a second per thread, localtime is not thread safe
+static const char *log_timestamp(void) {
+  static _Thread_local time_t stamp_time = -1;
+  static _Thread_local char stamp[32];
+
+  time_t now = time(NULL);
+  if (now != stamp_time) {
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+    stamp_time = now;
+  }
+  return stamp;
+}
+
+static void log_ring_release(void *data) {
+  // the rings may have been freed since this thread last logged
+  if (t_generation != atomic_load(&g_async.generation)) return;
+  dns_log_ring_t *ring = data;
+  atomic_store_explicit(&ring->orphaned, true, memory_order_release);
+}
+
+static void log_ring_key_create(void) {
+  pthread_key_create(&ring_key, log_ring_release);
+}
+
+static dns_log_ring_t *log_ring_claim(void) {
+  pthread_once(&ring_key_once, log_ring_key_create);
+  unsigned generation = atomic_load(&g_async.generation);
+
+  // take over a ring from a thread that has exited
+  dns_log_ring_t *ring = atomic_load_explicit(&g_async.rings, memory_order_acquire);
+  for (; ring; ring = ring->next) {
+    bool orphaned = true;
+    if (atomic_compare_exchange_strong(&ring->orphaned, &orphaned, false)) break;
+  }
+
+  if (!ring) {
+    ring = aligned_alloc(DNS_LOG_CACHE_LINE, sizeof(dns_log_ring_t));
+    if (!ring) return NULL;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->busy, false);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->orphaned, false);
+
+    ring->next = atomic_load(&g_async.rings);
+    while (!atomic_compare_exchange_weak(&g_async.rings, &ring->next, ring)) {}
+  }
+
+  t_ring = ring;
+  t_generation = generation;
+  pthread_setspecific(ring_key, ring);
+  return ring;
+}
+
+// what dns_log_writev prints, minus the color, as one line in dst
+static size_t log_format(char *dst, size_t capacity, dns_log_level_t level, const char *file,
+                         int line, const char *func, const char *fmt, va_list args) {
+  size_t length = 0;
+  int n = 0;
+
+  // the last byte is kept for the newline
+  capacity -= 1;
+
+  if (g_logger.include_timestamp) {
+    n = snprintf(dst + length, capacity - length, "%s ", log_timestamp());
+    length = (n < 0) ? length : length + (size_t)n;
+  }
+  if (g_logger.include_level && length < capacity) {
+    n = snprintf(dst + length, capacity - length, "%-5s ", level_names[level]);
+    length = (n < 0) ? length : length + (size_t)n;
+  }
+  if (g_logger.include_file_line && file && length < capacity) {
+    const char *fname = strrchr(file, '/');
+    fname = fname ? fname + 1 : file;
+    n = snprintf(dst + length, capacity - length, "[%s:%d] ", fname, line);
+    length = (n < 0) ? length : length + (size_t)n;
+  }
+  if (func && level <= DNS_LOG_DEBUG && length < capacity) {
+    n = snprintf(dst + length, capacity - length, "%s(): ", func);
+    length = (n < 0) ? length : length + (size_t)n;
+  }
+  if (length < capacity) {
+    n = vsnprintf(dst + length, capacity - length, fmt, args);
+    length = (n < 0) ? length : length + (size_t)n;
+  }
+
+  // snprintf reports what it would have written
+  if (length > capacity - 1) length = capacity - 1;
+  dst[length++] = '\n';
+  return length;
+}
+
+// false when async mode went off under us and the line is the caller's to write
+static bool log_async(dns_log_level_t level, const char *file, int line,
+                      const char *func, const char *fmt, va_list args) {
+  dns_log_ring_t *ring = t_ring;
+  if (!ring || t_generation != atomic_load(&g_async.generation)) {
+    ring = log_ring_claim();
+    if (!ring) {
+      atomic_fetch_add_explicit(&g_async.dropped, 1, memory_order_relaxed);
+      return true;
+    }
+  }
+
+  // pairs with dns_log_stop_async: either it sees busy and waits for the
+  // line, or this thread sees the mode off
+  atomic_store(&ring->busy, true);
+  if (!atomic_load(&g_async.enabled)) {
+    atomic_store(&ring->busy, false);
+    return false;
+  }
+
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail >= DNS_LOG_RING_SLOTS) {
+    atomic_fetch_add_explicit(&g_async.dropped, 1, memory_order_relaxed);
+  } else {
+    dns_log_slot_t *slot = &ring->slots[head % DNS_LOG_RING_SLOTS];
+    slot->length = (uint16_t)log_format(slot->text, sizeof(slot->text), level, file, line,
+                                        func, fmt, args);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  }
+
+  atomic_store_explicit(&ring->busy, false, memory_order_release);
+  return true;
+}
+
+// writev until everything is out, short writes resume where they stopped
+static void log_writev_all(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t n = writev(fd, iov, count);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= (ssize_t)iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = (char*)iov->iov_base + n;
+      iov->iov_len -= (size_t)n;
+    }
+  }
+}
+
+// one pass over every ring, returns the lines written
+static size_t log_drain(void) {
+  size_t written = 0;
+
+  dns_log_ring_t *ring = atomic_load_explicit(&g_async.rings, memory_order_acquire);
+  for (; ring; ring = ring->next) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while (tail != head) {
+      struct iovec iov[DNS_LOG_BATCH];
+      int count = 0;
+      for (; tail + count != head && count < DNS_LOG_BATCH; ++count) {
+        size_t slot = (tail + count) % DNS_LOG_RING_SLOTS;
+        iov[count].iov_base = ring->slots[slot].text;
+        iov[count].iov_len = ring->slots[slot].length;
+      }
+
+      log_writev_all(g_async.fd, iov, count);
+      tail += count;
+      written += count;
+      atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+  }
+
+  uint64_t dropped = atomic_load_explicit(&g_async.dropped, memory_order_relaxed);
+  if (dropped != g_async.reported) {
+    char notice[128];
+    int n = snprintf(notice, sizeof(notice), "%s WARN  log rings full, %llu lines dropped\n",
+                     log_timestamp(), (unsigned long long)(dropped - g_async.reported));
+    struct iovec iov = {notice, (size_t)n};
+    log_writev_all(g_async.fd, &iov, 1);
+    g_async.reported = dropped;
+  }
+
+  return written;
+}
+
+static void *log_writer(void *arg) {
+  (void)arg;
+
+  struct timespec idle = {0, DNS_LOG_IDLE_NS};
+  while (atomic_load(&g_async.running)) {
+    if (log_drain() == 0) nanosleep(&idle, NULL);
+  }
+
+  // whatever was published before dns_log_stop_async turned the mode off
+  log_drain();
+  return NULL;
+}
+
+int dns_log_start_async(const char *path) {
+  if (!path || atomic_load(&g_async.running)) return -1;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) return -1;
+
+  g_async.fd = fd;
+  g_async.reported = atomic_load(&g_async.dropped);
+  atomic_store(&g_async.running, true);
+  if (pthread_create(&g_async.writer, NULL, log_writer, NULL) != 0) {
+    atomic_store(&g_async.running, false);
+    close(fd);
+    g_async.fd = -1;
+    return -1;
+  }
+
+  atomic_store(&g_async.enabled, true);
+  return 0;
+}
+
+void dns_log_stop_async(void) {
+  if (!atomic_load(&g_async.running)) return;
+
+  atomic_store(&g_async.enabled, false);
+
+  // threads that saw the mode on finish their line first
+  dns_log_ring_t *ring = atomic_load(&g_async.rings);
+  for (; ring; ring = ring->next) {
+    while (atomic_load(&ring->busy)) sched_yield();
+  }
+
+  atomic_store(&g_async.running, false);
+  pthread_join(g_async.writer, NULL);
+
+  close(g_async.fd);
+  g_async.fd = -1;
+}
+
+bool dns_log_is_async(void) {
+  return atomic_load(&g_async.enabled);
+}
+
+void dns_log_flush(void) {
+  struct timespec idle = {0, DNS_LOG_IDLE_NS};
+
+  dns_log_ring_t *ring = atomic_load_explicit(&g_async.rings, memory_order_acquire);
+  for (; ring; ring = ring->next) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    while (atomic_load(&g_async.running) &&
+           atomic_load_explicit(&ring->tail, memory_order_acquire) < head) {
+      nanosleep(&idle, NULL);
+    }
+  }
+}
+
+uint64_t dns_log_dropped(void) {
+  return atomic_load_explicit(&g_async.dropped, memory_order_relaxed);
+}
+
 dns_log_level_t dns_log_level_from_string(const char *str) {
   if (!str) return DNS_LOG_INFO;
 
@@ -133,6 +451,11 @@ void dns_log_writev(dns_log_level_t level, const char *file, int line,
                     const char *func, const char *fmt, va_list args) {
   if (!dns_log_is_enabled(level)) return;
 
+  if (atomic_load_explicit(&g_async.enabled, memory_order_relaxed) &&
+      log_async(level, file, line, func, fmt, args)) {
+    return;
+  }
+
   // lazily initialize
   if (!g_logger.initialized) dns_log_init();
 
@@ -141,13 +464,7 @@ void dns_log_writev(dns_log_level_t level, const char *file, int line,
 
   pthread_mutex_lock(&g_logger.mutex);
 
-  if (g_logger.include_timestamp) {
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_buf[32];
-    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm_info);
-    fprintf(out, "%s ", time_buf);
-  }
+  if (g_logger.include_timestamp) fprintf(out, "%s ", log_timestamp());
 
   if (g_logger.include_level) {
     if (g_logger.color_enabled && level < DNS_LOG_OFF) {
@@ -186,7 +503,7 @@ void dns_log_hexdump(dns_log_level_t level, const char *prefix,
   char ascii[ascii_bufsz + 1];
 
   for (size_t i = 0; i < len; i += 16) {
-    int pos = snprintf(line + pos, sizeof(line) - pos, "%s %04zx: ", prefix ? prefix : "", i);;
+    int pos = snprintf(line, sizeof(line), "%s %04zx: ", prefix ? prefix : "", i);
 
     for (size_t j = 0; j < 16; ++j) {
       if (i + j < len) {
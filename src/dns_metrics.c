@@ -0,0 +1,456 @@
+#include "dns_metrics.h"
+#include "dns_log.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0) return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+dns_metrics_t *dns_metrics_create(uint16_t port) {
+  dns_metrics_t *metrics = calloc(1, sizeof(dns_metrics_t));
+  if (!metrics) goto err_alloc;
+
+  metrics->port = port;
+  metrics->client_fd = -1;
+
+  metrics->body.data = malloc(DNS_METRICS_BUFFER_SIZE);
+  if (!metrics->body.data) goto err_buffer;
+  metrics->body.capacity = DNS_METRICS_BUFFER_SIZE;
+
+  metrics->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (metrics->listen_fd < 0) {
+    DNS_LOG_ERROR("metrics socket creation failed: %s", strerror(errno));
+    goto err_socket;
+  }
+
+  int opt = 1;
+  if (setsockopt(metrics->listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    DNS_LOG_ERROR("metrics setsockopt failed: %s", strerror(errno));
+    goto err_setup;
+  }
+
+  // never reachable from outside the host
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+
+  if (bind(metrics->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    DNS_LOG_ERROR("metrics bind failed: %s", strerror(errno));
+    goto err_setup;
+  }
+  if (listen(metrics->listen_fd, 8) < 0 || set_nonblocking(metrics->listen_fd) < 0) {
+    DNS_LOG_ERROR("metrics listen failed: %s", strerror(errno));
+    goto err_setup;
+  }
+
+  return metrics;
+
+err_setup:
+  close(metrics->listen_fd);
+err_socket:
+  free(metrics->body.data);
+err_buffer:
+  free(metrics);
+err_alloc:
+  return NULL;
+}
+
+static void client_close(dns_metrics_t *metrics) {
+  if (metrics->client_fd >= 0) close(metrics->client_fd);
+
+  metrics->client_fd = -1;
+  metrics->state = DNS_METRICS_IDLE;
+  metrics->request_length = 0;
+  metrics->head_length = 0;
+  metrics->sent = 0;
+}
+
+void dns_metrics_free(dns_metrics_t *metrics) {
+  if (!metrics) return;
+
+  client_close(metrics);
+  if (metrics->listen_fd >= 0) close(metrics->listen_fd);
+  free(metrics->body.data);
+  free(metrics);
+}
+
+int dns_metrics_watch(dns_metrics_t *metrics, fd_set *read_fds, fd_set *write_fds, int max_fd) {
+  if (!metrics) return max_fd;
+
+  // a stalled client would keep every other scrape waiting
+  if (metrics->client_fd >= 0
+      && time(NULL) - metrics->client_since > DNS_METRICS_TIMEOUT_SEC) {
+    client_close(metrics);
+  }
+
+  int fd = metrics->listen_fd;
+  if (metrics->state == DNS_METRICS_IDLE) {
+    FD_SET(fd, read_fds);
+  } else {
+    fd = metrics->client_fd;
+    FD_SET(fd, metrics->state == DNS_METRICS_READING ? read_fds : write_fds);
+  }
+
+  return fd > max_fd ? fd : max_fd;
+}
+
+static void respond_status(dns_metrics_t *metrics, const char *status, const char *message) {
+  dns_metrics_buffer_reset(&metrics->body);
+  dns_metrics_appendf(&metrics->body, "%s\n", message);
+
+  metrics->head_length = (size_t)snprintf(metrics->head, sizeof(metrics->head),
+                                          "HTTP/1.0 %s\r\n"
+                                          "Content-Type: text/plain\r\n"
+                                          "Content-Length: %zu\r\n"
+                                          "Connection: close\r\n\r\n",
+                                          status,
+                                          metrics->body.length);
+  metrics->sent = 0;
+  metrics->state = DNS_METRICS_WRITING;
+  dns_metrics_flush(metrics, NULL);
+}
+
+// true once the request line and headers are in
+static bool request_complete(const dns_metrics_t *metrics) {
+  const char *end = metrics->request + metrics->request_length;
+  for (const char *p = metrics->request; p + 1 < end; ++p) {
+    if (p[0] == '\n' && p[1] == '\n') return true;
+    if (p + 3 < end && memcmp(p, "\r\n\r\n", 4) == 0) return true;
+  }
+  return false;
+}
+
+static bool request_is_scrape(const dns_metrics_t *metrics) {
+  static const char prefix[] = "GET /metrics";
+  size_t n = sizeof(prefix) - 1;
+
+  if (metrics->request_length <= n || memcmp(metrics->request, prefix, n) != 0) return false;
+  return metrics->request[n] == ' ' || metrics->request[n] == '?' || metrics->request[n] == '\r';
+}
+
+bool dns_metrics_ready(dns_metrics_t *metrics, const fd_set *read_fds) {
+  if (!metrics || !read_fds) return false;
+
+  if (metrics->state == DNS_METRICS_IDLE) {
+    if (!FD_ISSET(metrics->listen_fd, read_fds)) return false;
+
+    int fd = accept(metrics->listen_fd, NULL, NULL);
+    if (fd < 0) return false;
+    if (set_nonblocking(fd) < 0) {
+      close(fd);
+      return false;
+    }
+
+    metrics->client_fd = fd;
+    metrics->client_since = time(NULL);
+    metrics->state = DNS_METRICS_READING;
+    // the request usually came with the handshake, try it right away
+  } else if (metrics->state != DNS_METRICS_READING || !FD_ISSET(metrics->client_fd, read_fds)) {
+    return false;
+  }
+
+  while (metrics->request_length < sizeof(metrics->request)) {
+    ssize_t n = recv(metrics->client_fd,
+                     metrics->request + metrics->request_length,
+                     sizeof(metrics->request) - metrics->request_length,
+                     0);
+    if (n > 0) {
+      metrics->request_length += (size_t)n;
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (n < 0 && errno == EINTR) continue;
+
+    // closed or failed before the request was in
+    client_close(metrics);
+    return false;
+  }
+
+  if (!request_complete(metrics)) {
+    if (metrics->request_length == sizeof(metrics->request)) {
+      respond_status(metrics, "431 Request Header Fields Too Large", "request too large");
+    }
+    return false;
+  }
+
+  if (!request_is_scrape(metrics)) {
+    respond_status(metrics, "404 Not Found", "only /metrics is served here");
+    return false;
+  }
+
+  dns_metrics_buffer_reset(&metrics->body);
+  return true;
+}
+
+void dns_metrics_respond(dns_metrics_t *metrics) {
+  if (!metrics || metrics->state != DNS_METRICS_READING) return;
+
+  if (metrics->body.overflow) {
+    respond_status(metrics, "500 Internal Server Error", "metrics did not fit the buffer");
+    return;
+  }
+
+  metrics->head_length = (size_t)snprintf(metrics->head, sizeof(metrics->head),
+                                          "HTTP/1.0 200 OK\r\n"
+                                          "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                          "Content-Length: %zu\r\n"
+                                          "Connection: close\r\n\r\n",
+                                          metrics->body.length);
+  metrics->sent = 0;
+  metrics->state = DNS_METRICS_WRITING;
+  dns_metrics_flush(metrics, NULL);
+}
+
+void dns_metrics_flush(dns_metrics_t *metrics, const fd_set *write_fds) {
+  if (!metrics || metrics->state != DNS_METRICS_WRITING) return;
+  if (write_fds && !FD_ISSET(metrics->client_fd, write_fds)) return;
+
+  size_t total = metrics->head_length + metrics->body.length;
+  while (metrics->sent < total) {
+    const char *data;
+    size_t length;
+    if (metrics->sent < metrics->head_length) {
+      data = metrics->head + metrics->sent;
+      length = metrics->head_length - metrics->sent;
+    } else {
+      data = metrics->body.data + (metrics->sent - metrics->head_length);
+      length = total - metrics->sent;
+    }
+
+    ssize_t n = send(metrics->client_fd, data, length, MSG_NOSIGNAL);
+    if (n > 0) {
+      metrics->sent += (size_t)n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return; // select says when
+
+    break;
+  }
+
+  client_close(metrics);
+}
+
+void dns_metrics_buffer_reset(dns_metrics_buffer_t *buf) {
+  if (!buf) return;
+
+  buf->length = 0;
+  buf->overflow = false;
+}
+
+void dns_metrics_appendf(dns_metrics_buffer_t *buf, const char *fmt, ...) {
+  if (!buf || buf->overflow) return;
+
+  size_t room = buf->capacity - buf->length;
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf->data + buf->length, room, fmt, args);
+  va_end(args);
+
+  if (n < 0 || (size_t)n >= room) {
+    buf->overflow = true;
+    return;
+  }
+  buf->length += (size_t)n;
+}
+
+void dns_metrics_family(dns_metrics_buffer_t *buf, const char *name, const char *type,
+                        const char *help) {
+  dns_metrics_appendf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void dns_metrics_write_stats(dns_metrics_buffer_t *buf, const dns_stats_snapshot_t *snapshot) {
+  if (!buf || !snapshot) return;
+
+  for (int i = 0; i < DNS_STAT_COUNT; ++i) {
+    char name[96];
+    snprintf(name, sizeof(name), "dns_%s_total", dns_stats_name(i));
+    dns_metrics_family(buf, name, "counter", dns_stats_help(i));
+    dns_metrics_appendf(buf, "%s %lu\n", name, (unsigned long)snapshot->values[i]);
+  }
+}
+
+static double ticks_to_seconds(uint64_t ticks, double ns_per_tick) {
+  return (double)ticks * ns_per_tick / 1e9;
+}
+
+void dns_metrics_write_latency(dns_metrics_buffer_t *buf, const dns_latency_t *latency) {
+  if (!buf || !latency) return;
+
+  static const double quantiles[] = {0.5, 0.99, 0.999};
+  double ns_per_tick = dns_clock_ns_per_tick();
+
+  dns_metrics_family(buf, "dns_query_duration_seconds", "summary",
+                     "time spent per pipeline stage, by how the query was answered");
+  for (int stage = 0; stage < DNS_STAGE_COUNT; ++stage) {
+    for (int outcome = 0; outcome < DNS_OUTCOME_COUNT; ++outcome) {
+      const dns_histogram_t *hist = &latency->histograms[stage][outcome];
+      uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+      if (count == 0) continue;
+
+      const char *stage_name = dns_stage_name(stage);
+      const char *outcome_name = dns_outcome_name(outcome);
+      for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+        dns_metrics_appendf(buf,
+                            "dns_query_duration_seconds{stage=\"%s\",outcome=\"%s\",quantile=\"%g\"} %.9f\n",
+                            stage_name,
+                            outcome_name,
+                            quantiles[i],
+                            ticks_to_seconds(dns_histogram_quantile(hist, quantiles[i]), ns_per_tick));
+      }
+      dns_metrics_appendf(buf,
+                          "dns_query_duration_seconds_sum{stage=\"%s\",outcome=\"%s\"} %.9f\n",
+                          stage_name,
+                          outcome_name,
+                          ticks_to_seconds(atomic_load_explicit(&hist->sum, memory_order_relaxed),
+                                           ns_per_tick));
+      dns_metrics_appendf(buf,
+                          "dns_query_duration_seconds_count{stage=\"%s\",outcome=\"%s\"} %lu\n",
+                          stage_name,
+                          outcome_name,
+                          (unsigned long)count);
+    }
+  }
+}
+
+void dns_metrics_write_cache(dns_metrics_buffer_t *buf, const dns_cache_t *cache) {
+  if (!buf || !cache) return;
+
+  dns_cache_summary_t summary;
+  if (dns_cache_get_summary(cache, &summary) < 0) return;
+
+  dns_metrics_family(buf, "dns_cache_entries", "gauge", "entries in the cache");
+  dns_metrics_appendf(buf, "dns_cache_entries{type=\"positive\"} %lu\n",
+                      (unsigned long)summary.positive_entries);
+  dns_metrics_appendf(buf, "dns_cache_entries{type=\"negative\"} %lu\n",
+                      (unsigned long)summary.negative_entries);
+
+  dns_metrics_family(buf, "dns_cache_capacity_entries", "gauge", "entries the cache holds before evicting");
+  dns_metrics_appendf(buf, "dns_cache_capacity_entries %zu\n", summary.max_entries);
+
+  dns_metrics_family(buf, "dns_cache_records", "gauge", "records held by positive entries");
+  dns_metrics_appendf(buf, "dns_cache_records %lu\n", (unsigned long)summary.record_count);
+
+  dns_metrics_family(buf, "dns_cache_average_ttl_remaining_seconds", "gauge",
+                     "mean TTL left over the cached entries");
+  dns_metrics_appendf(buf, "dns_cache_average_ttl_remaining_seconds %u\n", summary.avg_remaining_ttl);
+
+  dns_metrics_family(buf, "dns_cache_average_age_seconds", "gauge", "mean age of the cached entries");
+  dns_metrics_appendf(buf, "dns_cache_average_age_seconds %ld\n", (long)summary.avg_entry_age);
+}
+
+void dns_metrics_write_trie(dns_metrics_buffer_t *buf, const dns_trie_t *trie) {
+  if (!buf || !trie) return;
+
+  dns_metrics_family(buf, "dns_trie_nodes", "gauge", "names in the zone trie, empty non-terminals included");
+  dns_metrics_appendf(buf, "dns_trie_nodes %zu\n", trie->node_count);
+
+  if (trie->arena) {
+    dns_metrics_family(buf, "dns_trie_arena_bytes", "gauge", "zone trie arena memory");
+    dns_metrics_appendf(buf, "dns_trie_arena_bytes{state=\"in_use\"} %zu\n", trie->arena->bytes_in_use);
+    dns_metrics_appendf(buf, "dns_trie_arena_bytes{state=\"reserved\"} %zu\n", trie->arena->bytes_reserved);
+  }
+}
+
+static void write_upstream_counter(dns_metrics_buffer_t *buf, const char *name,
+                                   const dns_nameserver_t *server, uint64_t value) {
+  dns_metrics_appendf(buf, "%s{server=\"%s\"} %lu\n", name, server->name, (unsigned long)value);
+}
+
+void dns_metrics_write_upstreams(dns_metrics_buffer_t *buf, const dns_recursive_resolver_t *resolver) {
+  if (!buf || !resolver) return;
+
+  int active = 0;
+  for (int i = 0; i < 256; ++i) {
+    if (resolver->active_queries[i].query_id != 0) ++active;
+  }
+  dns_metrics_family(buf, "dns_recursive_active_queries", "gauge", "recursive lookups in flight");
+  dns_metrics_appendf(buf, "dns_recursive_active_queries %d\n", active);
+
+  static const struct {
+    const char *name;
+    const char *help;
+  } families[] = {
+    {"dns_upstream_queries_sent_total", "queries sent to the upstream server"},
+    {"dns_upstream_responses_received_total", "responses received from the upstream server"},
+    {"dns_upstream_timeouts_total", "lookups that timed out waiting on the upstream server"},
+  };
+
+  for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); ++f) {
+    dns_metrics_family(buf, families[f].name, "counter", families[f].help);
+
+    for (int i = 0; i <= DNS_ROOT_HINTS_COUNT; ++i) {
+      const dns_nameserver_t *server = i < DNS_ROOT_HINTS_COUNT ? &resolver->root_servers[i]
+                                                                : &resolver->other_upstreams;
+      if (server->name[0] == '\0') continue; // root hints not loaded
+
+      const _Atomic uint64_t *counter = f == 0 ? &server->queries_sent
+                                      : f == 1 ? &server->responses_received
+                                               : &server->timeouts;
+      write_upstream_counter(buf, families[f].name, server,
+                             atomic_load_explicit(counter, memory_order_relaxed));
+    }
+  }
+}
+
+// label values only need the backslash, the quote and newlines escaped
+static void label_escape(const char *in, char *out, size_t len) {
+  size_t n = 0;
+  for (; *in && n + 2 < len; ++in) {
+    if (*in == '\\' || *in == '"') {
+      out[n++] = '\\';
+      out[n++] = *in;
+    } else if (*in == '\n') {
+      out[n++] = '\\';
+      out[n++] = 'n';
+    } else {
+      out[n++] = *in;
+    }
+  }
+  out[n] = '\0';
+}
+
+void dns_metrics_write_hitters(dns_metrics_buffer_t *buf, const dns_hitters_t *hitters) {
+  if (!buf || !hitters) return;
+
+  static const struct {
+    const char *name;
+    const char *help;
+  } families[] = {
+    {"dns_top_queries", "queries of the busiest keys, an upper bound off by at most the error"},
+    {"dns_top_queries_error", "how far dns_top_queries may be over"},
+  };
+
+  dns_topk_entry_t entries[DNS_TOPK_REPORT];
+  char key[DNS_TOPK_KEY_MAX * 4 + 1];
+  char label[sizeof(key) * 2];
+  for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); ++f) {
+    dns_metrics_family(buf, families[f].name, "gauge", families[f].help);
+
+    for (int kind = 0; kind < DNS_HITTERS_COUNT; ++kind) {
+      const char *kind_name = dns_hitters_kind_name(kind);
+      int n = dns_topk_top(&hitters->trackers[kind], entries, DNS_TOPK_REPORT);
+
+      for (int i = 0; i < n; ++i) {
+        dns_hitters_key_text(kind, &entries[i], key, sizeof(key));
+        label_escape(key, label, sizeof(label));
+        dns_metrics_appendf(buf, "%s{kind=\"%s\",rank=\"%d\",key=\"%s\"} %lu\n",
+                            families[f].name, kind_name, i + 1, label,
+                            (unsigned long)(f == 0 ? entries[i].count : entries[i].error));
+      }
+    }
+  }
+}
@@ -0,0 +1,130 @@
+#include "dns_name.h"
+#include "dns_simd.h"
+
+
+// mixes the wire bytes eight at a time, they are already lowercase so no
+// folding is needed. the tail is zero padded, len keeps "a" and "a\0" apart
+static uint32_t name_hash(const uint8_t *wire, size_t len) {
+  uint64_t hash = 0x9E3779B97F4A7C15ull ^ len;
+  size_t i = 0;
+
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, wire + i, 8);
+    hash = (hash ^ word) * 0x100000001B3ull;
+    hash ^= hash >> 29;
+  }
+  if (i < len) {
+    uint64_t word = 0;
+    memcpy(&word, wire + i, len - i);
+    hash = (hash ^ word) * 0x100000001B3ull;
+  }
+
+  // callers take the low bits for bucket indexes
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDull;
+  hash ^= hash >> 33;
+  return (uint32_t)hash;
+}
+
+void dns_name_init(dns_name_t *name) {
+  name->len = 0;
+  name->label_count = 0;
+  name->hash = 0;
+}
+
+int dns_name_append_label(dns_name_t *name, const uint8_t *label, size_t len) {
+  if (len == 0 || len > 63) return -1;
+  if (name->label_count == DNS_NAME_MAX_LABELS) return -1;
+
+  // length byte, the label and the root label still to come
+  if ((size_t)name->len + 1 + len + 1 > DNS_NAME_MAX_WIRE) return -1;
+  if (!dns_simd_label_valid(label, len)) return -1;
+
+  name->label_offsets[name->label_count++] = name->len;
+  name->wire[name->len] = (uint8_t)len;
+  dns_simd_lower((char *)name->wire + name->len + 1, (const char *)label, len);
+  name->len = (uint8_t)(name->len + 1 + len);
+  return 0;
+}
+
+void dns_name_finish(dns_name_t *name) {
+  name->wire[name->len++] = 0;
+  name->hash = name_hash(name->wire, name->len);
+}
+
+int dns_name_from_text(dns_name_t *name, const char *text) {
+  if (!name || !text) return -1;
+
+  dns_name_init(name);
+
+  size_t len = strnlen(text, DNS_NAME_MAX_WIRE + 1);
+  if (len > DNS_NAME_MAX_WIRE) return -1;
+  if (len > 0 && text[len - 1] == '.') --len; // fully qualified
+
+  for (size_t pos = 0; pos < len; ) {
+    size_t label_len = dns_simd_find_byte(text + pos, len - pos, '.');
+    if (dns_name_append_label(name, (const uint8_t *)text + pos, label_len) < 0) return -1;
+    pos += label_len + 1;
+
+    // "a." was trimmed above, a dot here means an empty label follows
+    if (pos == len) return -1;
+  }
+
+  dns_name_finish(name);
+  return 0;
+}
+
+int dns_name_to_text(const dns_name_t *name, char *out, size_t out_len) {
+  if (!name || !out || out_len == 0) return -1;
+
+  // the length bytes become dots, the first one and the root byte fall away
+  size_t text_len = (name->label_count > 0) ? (size_t)name->len - 2 : 0;
+  if (text_len + 1 > out_len) return -1;
+
+  size_t pos = 0;
+  for (int i = 0; i < name->label_count; ++i) {
+    uint8_t label_len;
+    const uint8_t *label = dns_name_label(name, i, &label_len);
+    if (i > 0) out[pos++] = '.';
+    memcpy(out + pos, label, label_len);
+    pos += label_len;
+  }
+  out[pos] = '\0';
+  return 0;
+}
+
+bool dns_name_is_subdomain(const dns_name_t *name, const dns_name_t *parent) {
+  if (!name || !parent || parent->len > name->len) return false;
+
+  // parent has to start on a label boundary of name
+  size_t offset = name->len - parent->len;
+  if (offset == 0) return memcmp(name->wire, parent->wire, name->len) == 0;
+
+  for (int i = 1; i < name->label_count; ++i) {
+    if (name->label_offsets[i] == offset) {
+      return memcmp(name->wire + offset, parent->wire, parent->len) == 0;
+    }
+    if (name->label_offsets[i] > offset) break;
+  }
+
+  // the root is every name's parent
+  return parent->len == 1;
+}
+
+void dns_name_suffix(const dns_name_t *name, int labels, dns_name_t *suffix) {
+  if (labels > name->label_count) labels = name->label_count;
+  if (labels < 0) labels = 0;
+
+  // the suffix is the tail of the wire, offsets move down by where it starts
+  int first = name->label_count - labels;
+  size_t start = labels > 0 ? name->label_offsets[first] : (size_t)name->len - 1;
+
+  suffix->len = (uint8_t)(name->len - start);
+  suffix->label_count = (uint8_t)labels;
+  memcpy(suffix->wire, name->wire + start, suffix->len);
+  for (int i = 0; i < labels; ++i) {
+    suffix->label_offsets[i] = (uint8_t)(name->label_offsets[first + i] - start);
+  }
+  suffix->hash = name_hash(suffix->wire, suffix->len);
+}
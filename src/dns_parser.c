@@ -1,4 +1,6 @@
 #include "dns_parser.h"
+#include "dns_rdata.h"
+#include "dns_simd.h"
 #include <netinet/in.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -24,26 +26,6 @@ void dns_message_free(dns_message_t *msg) {
   if (!msg) return;
 
   free(msg->questions);
-
-  if (msg->answers) {
-    for (int i = 0; i < msg->header.ancount; ++i) {
-      dns_rr_free(msg->answers[i]);
-    }
-    free(msg->answers);
-  }
-  if (msg->authority) {
-    for (int i = 0; i < msg->header.nscount; ++i) {
-      dns_rr_free(msg->authority[i]);
-    }
-    free(msg->authority);
-  }
-  if (msg->additional) {
-    for (int i = 0; i < msg->header.arcount; ++i) {
-      dns_rr_free(msg->additional[i]);
-    }
-    free(msg->additional);
-  }
-
   free(msg);
 }
 
@@ -89,6 +71,99 @@ int dns_parse_question(const uint8_t *buf, size_t len, size_t *offset, dns_quest
   return 0;
 }
 
+int dns_parse_question_view(const uint8_t *buf, size_t len, size_t *offset, dns_question_view_t *view) {
+  if (!buf || !offset || !view) return -1;
+
+  size_t start = *offset;
+  size_t pos = start;
+  dns_name_init(&view->name);
+
+  while (pos < len && buf[pos] != 0) {
+    uint8_t label_len = buf[pos];
+
+    // also rejects compression pointers
+    if (label_len > MAX_LABEL_LEN) return -1;
+    if (pos + 1 + label_len >= len) return -1;
+    if (dns_name_append_label(&view->name, buf + pos + 1, label_len) < 0) return -1;
+
+    pos += 1 + label_len;
+  }
+  if (pos >= len) return -1;
+  ++pos; // root label
+  dns_name_finish(&view->name);
+
+  view->msg = buf;
+  view->qname_offset = (uint16_t)start;
+
+  if (dns_read_uint16(buf, len, &pos, &view->qtype) < 0) return -1;
+  if (dns_read_uint16(buf, len, &pos, &view->qclass) < 0) return -1;
+
+  *offset = pos;
+  return 0;
+}
+
+// text keeps the client's spelling, upstream queries and logs show it as sent
+int dns_question_view_to_question(const dns_question_view_t *view, dns_question_t *question) {
+  if (!view || !question) return -1;
+
+  const uint8_t *qname = view->msg + view->qname_offset;
+  size_t pos = 0;
+  for (int i = 0; i < view->name.label_count; ++i) {
+    const uint8_t *label = qname + view->name.label_offsets[i];
+    size_t label_len = label[0];
+    if (pos + label_len + 1 > sizeof(question->qname)) return -1;
+
+    if (i > 0) question->qname[pos++] = '.';
+    memcpy(question->qname + pos, label + 1, label_len);
+    pos += label_len;
+  }
+  question->qname[pos] = '\0';
+
+  question->qtype = view->qtype;
+  question->qclass = view->qclass;
+  return 0;
+}
+
+int dns_parse_name_wire(const uint8_t *buf, size_t len, size_t *offset, dns_name_t *name) {
+  if (!buf || !offset || !name) return -1;
+
+  size_t pos = *offset;
+  size_t end = 0;
+  bool jumped = false;
+  int jumps = 0;
+
+  dns_name_init(name);
+
+  while (pos < len) {
+    uint8_t label_len = buf[pos];
+
+    if ((label_len & 0xC0) == 0xC0) {
+      if (pos + 1 >= len) return -1;
+      if (!jumped) {
+        end = pos + 2;
+        jumped = true;
+      }
+
+      pos = ((size_t)(label_len & 0x3F) << 8) | buf[pos + 1];
+      if (++jumps > 10) return -1; // protect against loops
+      continue;
+    }
+
+    if (label_len == 0) {
+      dns_name_finish(name);
+      *offset = jumped ? end : pos + 1;
+      return 0;
+    }
+
+    if (label_len > MAX_LABEL_LEN) return -1;
+    if (pos + 1 + label_len >= len) return -1;
+    if (dns_name_append_label(name, buf + pos + 1, label_len) < 0) return -1;
+    pos += 1 + label_len;
+  }
+
+  return -1;
+}
+
 int dns_parse_name(const uint8_t *buf, size_t len, size_t *offset, char *name, size_t name_len) {
   size_t pos = *offset;
   size_t name_pos = 0;
@@ -141,6 +216,8 @@ int dns_parse_name(const uint8_t *buf, size_t len, size_t *offset, char *name, s
     if (label_len > 63) return -1;
     if (pos + 1 + label_len >= len) return -1;
     if (name_pos + label_len + 1 >= name_len) return -1;
+    // a NUL or '.' inside a label has no dotted form
+    if (!dns_simd_label_valid(buf + pos + 1, label_len)) return -1;
 
     ++pos;
     memcpy(name + name_pos, buf + pos, label_len);
@@ -154,6 +231,152 @@ int dns_parse_name(const uint8_t *buf, size_t len, size_t *offset, char *name, s
   // return name_pos > 0 ? name_pos - 1 : 0;
 }
 
+int dns_parse_rr_header(const uint8_t *buf, size_t len, size_t *offset, dns_rr_header_t *header) {
+  if (!buf || !offset || !header) return -1;
+
+  if (dns_parse_name(buf, len, offset, header->name, sizeof(header->name)) < 0) return -1;
+  if (dns_read_uint16(buf, len, offset, &header->type) < 0) return -1;
+  if (dns_read_uint16(buf, len, offset, &header->rclass) < 0) return -1;
+  if (dns_read_uint32(buf, len, offset, &header->ttl) < 0) return -1;
+  if (dns_read_uint16(buf, len, offset, &header->rdlength) < 0) return -1;
+
+  if (*offset + header->rdlength > len) return -1;
+  header->rdata_offset = *offset;
+  *offset += header->rdlength;
+  return 0;
+}
+
+int dns_parse_rdata(const uint8_t *buf, size_t len, const dns_rr_header_t *header, dns_rr_t **rr) {
+  if (!buf || !header || !rr) return -1;
+
+  return dns_rdata_decode(buf, len, header->type, header->rclass, header->ttl,
+                          header->rdata_offset, header->rdlength, NULL, rr);
+}
+
+static int parse_section(const uint8_t *buf, size_t len, size_t *offset, uint16_t count,
+                         dns_arena_t *arena, dns_message_rr_t **out) {
+  *out = NULL;
+  if (count == 0) return 0;
+
+  // a record is at least a root owner and ten fixed bytes, a bogus count
+  // must not turn into a large allocation
+  if (*offset > len || (size_t)count * 11 > len - *offset) return -1;
+
+  dns_message_rr_t *rrs = dns_arena_alloc(arena, (size_t)count * sizeof(dns_message_rr_t));
+  if (!rrs) return -1;
+
+  for (uint16_t i = 0; i < count; ++i) {
+    dns_message_rr_t *rr = &rrs[i];
+    if (dns_parse_name_wire(buf, len, offset, &rr->owner) < 0) return -1;
+    if (dns_read_uint16(buf, len, offset, &rr->type) < 0) return -1;
+    if (dns_read_uint16(buf, len, offset, &rr->rclass) < 0) return -1;
+    if (dns_read_uint32(buf, len, offset, &rr->ttl) < 0) return -1;
+    if (dns_read_uint16(buf, len, offset, &rr->rdlength) < 0) return -1;
+    if (*offset + rr->rdlength > len) return -1;
+
+    rr->rdata_offset = (uint16_t)*offset;
+    if (dns_rdata_decode(buf, len, rr->type, rr->rclass, rr->ttl,
+                         *offset, rr->rdlength, arena, &rr->rr) < 0) {
+      return -1;
+    }
+    *offset += rr->rdlength;
+  }
+
+  *out = rrs;
+  return 0;
+}
+
+int dns_parse_message(const uint8_t *buf, size_t len, dns_arena_t *arena, dns_message_t *msg) {
+  if (!buf || !arena || !msg) return -1;
+
+  // offsets are kept in 16 bits
+  if (len > UINT16_MAX) return -1;
+
+  msg->questions = NULL;
+  msg->has_question_view = false;
+  msg->answers = NULL;
+  msg->authority = NULL;
+  msg->additional = NULL;
+  memset(&msg->edns, 0, sizeof(msg->edns));
+
+  if (dns_parse_header(buf, len, &msg->header) < 0) return -1;
+
+  size_t offset = 12;
+  if (msg->header.qdcount > 1) return -1;
+  if (msg->header.qdcount == 1) {
+    if (dns_parse_question_view(buf, len, &offset, &msg->question_view) < 0) return -1;
+    msg->has_question_view = true;
+  }
+
+  if (parse_section(buf, len, &offset, msg->header.ancount, arena, &msg->answers) < 0) return -1;
+  if (parse_section(buf, len, &offset, msg->header.nscount, arena, &msg->authority) < 0) return -1;
+  if (parse_section(buf, len, &offset, msg->header.arcount, arena, &msg->additional) < 0) return -1;
+
+  for (uint16_t i = 0; i < msg->header.arcount; ++i) {
+    const dns_message_rr_t *rr = &msg->additional[i];
+    if (rr->type != DNS_TYPE_OPT || rr->owner.len != 1) continue;
+
+    msg->edns.present = true;
+    msg->edns.udp_size = rr->rclass;
+    msg->edns.version = (uint8_t)(rr->ttl >> 16);
+    msg->edns.dnssec_ok = (rr->ttl & 0x8000) != 0;
+    break;
+  }
+
+  return 0;
+}
+
+// past a name without expanding it, pointers end the name
+static int skip_name(const uint8_t *buf, size_t len, size_t *offset) {
+  size_t pos = *offset;
+  while (pos < len) {
+    uint8_t label_len = buf[pos];
+    if (label_len == 0) {
+      *offset = pos + 1;
+      return 0;
+    }
+    if ((label_len & 0xC0) == 0xC0) {
+      if (pos + 2 > len) return -1;
+      *offset = pos + 2;
+      return 0;
+    }
+    if (label_len & 0xC0) return -1;
+    pos += 1 + label_len;
+  }
+  return -1;
+}
+
+int dns_parse_edns(const uint8_t *buf, size_t len, size_t offset,
+                   const dns_header_t *header, dns_edns_t *edns) {
+  if (!buf || !header || !edns) return -1;
+  memset(edns, 0, sizeof(*edns));
+
+  // OPT only lives in the additional section, the rest is skipped over
+  int skip = header->ancount + header->nscount;
+  int total = skip + header->arcount;
+  for (int i = 0; i < total; ++i) {
+    size_t owner = offset;
+    if (skip_name(buf, len, &offset) < 0) return -1;
+    if (offset + 10 > len) return -1;
+
+    const uint8_t *fixed = buf + offset;
+    uint16_t type = (uint16_t)(fixed[0] << 8 | fixed[1]);
+    uint16_t rdlength = (uint16_t)(fixed[8] << 8 | fixed[9]);
+    offset += 10;
+    if (offset + rdlength > len) return -1;
+    offset += rdlength;
+
+    if (i < skip || type != DNS_TYPE_OPT || buf[owner] != 0) continue;
+
+    edns->present = true;
+    edns->udp_size = (uint16_t)(fixed[2] << 8 | fixed[3]);
+    edns->version = fixed[5];
+    edns->dnssec_ok = (fixed[6] & 0x80) != 0;
+    return 0;
+  }
+  return 0;
+}
+
 int dns_encode_header(uint8_t *buf, size_t len, const dns_header_t *header) {
   if (len < 12) return  -1;
 
@@ -250,80 +473,403 @@ int dns_encode_name(uint8_t *buf, size_t len, size_t *offset, const char *name)
   return 0;
 }
 
-int dns_encode_rr(uint8_t *buf, size_t len, size_t *offset, const char *name, const dns_rr_t *rr) {
-  if (dns_encode_name(buf, len, offset, name) < 0) {
-    return -1;
+// one label of a textual name
+typedef struct {
+  const char *start;
+  uint8_t len;
+} name_label_t;
+
+#define MAX_NAME_LABELS (MAX_DOMAIN_NAME / 2)
+
+// split and validate like dns_encode_name, returns the label count or -1
+static int split_labels(const char *name, name_label_t *labels) {
+  int count = 0;
+  const char *p = name;
+
+  while (*p) {
+    const char *label_start = p;
+    while (*p && *p != '.') ++p;
+
+    size_t label_len = (size_t)(p - label_start);
+    if (validate_label_length(label_len) < 0) return -1;
+    if (count == MAX_NAME_LABELS) return -1;
+
+    labels[count].start = label_start;
+    labels[count].len = (uint8_t)label_len;
+    ++count;
+
+    if (!*p) break;
+    ++p;
   }
-  if (*offset + 10 > len) return -1;
 
-  if (dns_write_uint16(buf, len, offset, rr->type) < 0) return -1;
-  if (dns_write_uint16(buf, len, offset, rr->class) < 0) return -1;
-  if (dns_write_uint32(buf, len, offset, rr->ttl) < 0) return -1;
+  // wire length is the text length plus the leading length byte and root
+  if (validate_name_length((size_t)(p - name) + 2) < 0) return -1;
+  return count;
+}
+
+static inline uint8_t fold(uint8_t c) {
+  return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + 32) : c;
+}
 
-  size_t rdlength_offset = *offset;
-  *offset += 2;  // TODO: rdlength
+// suffix hash built from the root outwards, so each suffix extends the next.
+// only the length and the outer bytes of each label are mixed in, every hit
+// is checked against the message anyway
+static uint32_t hash_label(uint32_t hash, const name_label_t *label) {
+  uint32_t key = label->len
+    | (uint32_t)fold((uint8_t)label->start[0]) << 8
+    | (uint32_t)fold((uint8_t)label->start[label->len / 2]) << 16
+    | (uint32_t)fold((uint8_t)label->start[label->len - 1]) << 24;
+  hash = (hash ^ key) * 0x9E3779B1u;
+  return hash ^ (hash >> 15);
+}
 
-  size_t rdata_start = *offset;
+// does the name at offset in the message spell out labels[0..count)?
+static bool wire_suffix_equal(const uint8_t *buf, size_t len, size_t pos,
+                              const name_label_t *labels, int count) {
+  int label = 0;
+  int jumps = 0;
 
-  // encode rdata based on type
-  switch (rr->type) {
-    case DNS_TYPE_A:
-      if (*offset + 4 > len) return -1;
-      memcpy(buf + *offset, &rr->rdata.a.address, 4);
-      *offset += 4;
-      break;
+  while (pos < len) {
+    uint8_t label_len = buf[pos];
 
-    case DNS_TYPE_NS: // TODO
-    case DNS_TYPE_CNAME: // TODO
-    case DNS_TYPE_PTR: {
-      const char *domain = (rr->type == DNS_TYPE_NS)
-        ? rr->rdata.ns.nsdname
-        : rr->rdata.cname.cname;
-      if (dns_encode_name(buf, len, offset, domain) < 0) return -1;
-      break;
+    if ((label_len & 0xC0) == 0xC0) {
+      if (pos + 1 >= len || ++jumps > 16) return false;
+      size_t pointer = ((size_t)(label_len & 0x3F) << 8) | buf[pos + 1];
+      if (pointer >= pos) return false;
+      pos = pointer;
+      continue;
     }
 
-    case DNS_TYPE_SOA: {
-      // SOA record format:
-      // MNAME (domain name)
-      // RNAME (domain name)
-      // SERIAL (4 bytes)
-      // REFRESH (4 bytes)
-      // RETRY (4 bytes)
-      // EXPIRE (4 bytes)
-      // MINIMUM (4 bytes)
-
-      if (dns_encode_name(buf, len, offset, rr->rdata.soa.mname) < 0) return -1;
-      if (dns_encode_name(buf, len, offset, rr->rdata.soa.rname) < 0) return -1;
-      if (*offset + 20 > len) return -1; // 5 * 4 bytes for the numbers
-
-      uint32_t serial = htonl(rr->rdata.soa.serial);
-      uint32_t refresh = htonl(rr->rdata.soa.refresh);
-      uint32_t retry = htonl(rr->rdata.soa.retry);
-      uint32_t expire = htonl(rr->rdata.soa.expire);
-      uint32_t minimum = htonl(rr->rdata.soa.minimum);
-
-      memcpy(buf + *offset, &serial, 4);   *offset += 4;
-      memcpy(buf + *offset, &refresh, 4);  *offset += 4;
-      memcpy(buf + *offset, &retry, 4);    *offset += 4;
-      memcpy(buf + *offset, &expire, 4);   *offset += 4;
-      memcpy(buf + *offset, &minimum, 4);  *offset += 4;
-      break;
+    if (label_len == 0) return label == count;
+    if (label == count || label_len != labels[label].len) return false;
+    if (pos + 1 + label_len > len) return false;
+
+    const uint8_t *wire = buf + pos + 1;
+    for (uint8_t i = 0; i < label_len; ++i) {
+      if (fold(wire[i]) != fold((uint8_t)labels[label].start[i])) return false;
+    }
+
+    pos += 1 + label_len;
+    ++label;
+  }
+
+  return false;
+}
+
+void dns_compress_init(dns_compress_t *ctx) {
+  if (!ctx) return;
+  memset(ctx->buckets, 0, sizeof(ctx->buckets));
+  ctx->count = 0;
+  ctx->pointers = NULL;
+  ctx->pointer_count = 0;
+  ctx->pointer_capacity = 0;
+}
+
+static void compress_note_pointer(dns_compress_t *ctx, size_t offset) {
+  if (!ctx || !ctx->pointers || ctx->pointer_count == ctx->pointer_capacity) return;
+  ctx->pointers[ctx->pointer_count++] = (uint16_t)offset;
+}
+
+void dns_compress_truncate(dns_compress_t *ctx, size_t offset) {
+  if (!ctx) return;
+
+  // entries are added in message order and each one heads its bucket when
+  // it is added, so popping from the end restores the chains
+  while (ctx->count > 0 && ctx->entries[ctx->count - 1].offset >= offset) {
+    dns_compress_entry_t *entry = &ctx->entries[--ctx->count];
+    ctx->buckets[entry->hash & (DNS_COMPRESS_BUCKETS - 1)] = entry->next;
+  }
+  while (ctx->pointer_count > 0 && ctx->pointers[ctx->pointer_count - 1] >= offset) {
+    --ctx->pointer_count;
+  }
+}
+
+static int compress_find(const dns_compress_t *ctx, const uint8_t *buf, size_t len,
+                         uint32_t hash, const name_label_t *labels, int count) {
+  uint16_t index = ctx->buckets[hash & (DNS_COMPRESS_BUCKETS - 1)];
+  while (index) {
+    const dns_compress_entry_t *entry = &ctx->entries[index - 1];
+    if (entry->hash == hash && wire_suffix_equal(buf, len, entry->offset, labels, count)) {
+      return entry->offset;
     }
+    index = entry->next;
+  }
+  return -1;
+}
+
+static void compress_add(dns_compress_t *ctx, uint32_t hash, size_t offset) {
+  if (ctx->count == DNS_COMPRESS_MAX_ENTRIES || offset > DNS_COMPRESS_MAX_OFFSET) return;
+
+  size_t bucket = hash & (DNS_COMPRESS_BUCKETS - 1);
+  dns_compress_entry_t *entry = &ctx->entries[ctx->count++];
+  entry->hash = hash;
+  entry->offset = (uint16_t)offset;
+  entry->next = ctx->buckets[bucket];
+  ctx->buckets[bucket] = (uint16_t)ctx->count;
+}
+
+void dns_compress_add_wire(dns_compress_t *ctx, const uint8_t *buf, size_t offset) {
+  if (!ctx || !buf) return;
+
+  name_label_t labels[MAX_NAME_LABELS];
+  size_t starts[MAX_NAME_LABELS];
+  int count = 0;
 
-    case DNS_TYPE_AAAA:
-      if (*offset + 16 > len) return -1;
-      memcpy(buf + *offset, &rr->rdata.aaaa.address, 16);
-      *offset += 16;
+  size_t pos = offset;
+  while (buf[pos] != 0 && (buf[pos] & 0xC0) == 0 && count < MAX_NAME_LABELS) {
+    labels[count].start = (const char *)buf + pos + 1;
+    labels[count].len = buf[pos];
+    starts[count] = pos;
+    ++count;
+    pos += 1 + buf[pos];
+  }
+
+  // a name ending in a pointer is not handled here, the question never does
+  if (buf[pos] != 0) return;
+
+  uint32_t hashes[MAX_NAME_LABELS];
+  uint32_t hash = 2166136261u;
+  for (int i = count - 1; i >= 0; --i) {
+    hash = hash_label(hash, &labels[i]);
+    hashes[i] = hash;
+  }
+  for (int i = 0; i < count; ++i) {
+    compress_add(ctx, hashes[i], starts[i]);
+  }
+}
+
+int dns_encode_name_compressed(uint8_t *buf, size_t len, size_t *offset,
+                               const char *name, dns_compress_t *ctx) {
+  if (!ctx) return dns_encode_name(buf, len, offset, name);
+  if (!buf || !offset || !name) return -1;
+
+  name_label_t labels[MAX_NAME_LABELS];
+  int count = split_labels(name, labels);
+  if (count < 0) return -1;
+
+  uint32_t hashes[MAX_NAME_LABELS];
+  uint32_t hash = 2166136261u;
+  for (int i = count - 1; i >= 0; --i) {
+    hash = hash_label(hash, &labels[i]);
+    hashes[i] = hash;
+  }
+
+  // longest suffix already in the message
+  int match = count;
+  int pointer = -1;
+  for (int i = 0; i < count; ++i) {
+    pointer = compress_find(ctx, buf, *offset, hashes[i], labels + i, count - i);
+    if (pointer >= 0) {
+      match = i;
       break;
+    }
+  }
 
-    default:
-      return -1;  // unsupported type
+  size_t pos = *offset;
+  for (int i = 0; i < match; ++i) {
+    if (pos + labels[i].len + 1 >= len) return -1;
+    compress_add(ctx, hashes[i], pos);
+    buf[pos++] = labels[i].len;
+    memcpy(buf + pos, labels[i].start, labels[i].len);
+    pos += labels[i].len;
   }
 
-  uint16_t rdlength = htons(*offset - rdata_start);
-  memcpy(buf + rdlength_offset, &rdlength, 2);
+  if (pointer >= 0) {
+    if (pos + 2 > len) return -1;
+    compress_note_pointer(ctx, pos);
+    buf[pos++] = (uint8_t)(0xC0 | (pointer >> 8));
+    buf[pos++] = (uint8_t)(pointer & 0xFF);
+  } else {
+    if (pos >= len) return -1;
+    buf[pos++] = 0;
+  }
+
+  *offset = pos;
+  return 0;
+}
+
+int dns_encode_question_compressed(uint8_t *buf, size_t len, size_t *offset,
+                                   const dns_question_t *question, dns_compress_t *ctx) {
+  if (!question) return -1;
+
+  if (dns_encode_name_compressed(buf, len, offset, question->qname, ctx) < 0) return -1;
+  if (dns_write_uint16(buf, len, offset, question->qtype) < 0) return -1;
+  if (dns_write_uint16(buf, len, offset, question->qclass) < 0) return -1;
+
+  return 0;
+}
+
+int dns_encode_rr(uint8_t *buf, size_t len, size_t *offset, const char *name, const dns_rr_t *rr) {
+  return dns_encode_rr_ttl(buf, len, offset, name, rr, rr->ttl, NULL);
+}
+
+int dns_encode_opt(uint8_t *buf, size_t len, size_t *offset, uint16_t udp_size) {
+  if (!buf || !offset || *offset + DNS_OPT_RR_LEN > len) return -1;
+
+  // the class carries the payload size, the TTL the extended flags
+  buf[(*offset)++] = 0;
+  dns_write_uint16(buf, len, offset, DNS_TYPE_OPT);
+  dns_write_uint16(buf, len, offset, udp_size);
+  dns_write_uint32(buf, len, offset, 0);
+  dns_write_uint16(buf, len, offset, 0);
+  return 0;
+}
+
+static int encode_rr_body(uint8_t *buf, size_t len, size_t *offset,
+                          const dns_rr_t *rr, uint32_t ttl, dns_compress_t *ctx);
+
+int dns_encode_rrset_owner_at(uint8_t *buf, size_t len, size_t *offset, size_t owner_offset,
+                              const dns_rrset_t *rrset, uint32_t ttl, dns_compress_t *ctx) {
+  if (!rrset || owner_offset > DNS_COMPRESS_MAX_OFFSET) return -1;
+
+  int count = 0;
+  const dns_rr_t *first = dns_rrset_first(rrset);
+  for (const dns_rr_t *rr = first; rr; rr = dns_rrset_next(rrset, first, rr)) {
+    if (*offset + 2 > len) return -1;
+    compress_note_pointer(ctx, *offset);
+    buf[*offset] = (uint8_t)(0xC0 | (owner_offset >> 8));
+    buf[*offset + 1] = (uint8_t)(owner_offset & 0xFF);
+    *offset += 2;
+
+    if (encode_rr_body(buf, len, offset, rr, ttl, ctx) < 0) return -1;
+    ++count;
+  }
+  return count;
+}
+
+int dns_encode_rrset(uint8_t *buf, size_t len, size_t *offset, const char *name,
+                     const dns_rrset_t *rrset, uint32_t ttl, dns_compress_t *ctx) {
+  if (!rrset) return -1;
+
+  // with a table, records after the first reuse the first owner as is,
+  // whether that was a pointer or labels ending at owner_start
+  size_t owner_start = *offset;
+  int count = 0;
+  const dns_rr_t *first = dns_rrset_first(rrset);
+  for (const dns_rr_t *rr = first; rr; rr = dns_rrset_next(rrset, first, rr)) {
+    if (count == 0 || !ctx || owner_start > DNS_COMPRESS_MAX_OFFSET) {
+      if (dns_encode_name_compressed(buf, len, offset, name, ctx) < 0) return -1;
+    } else {
+      if (*offset + 2 > len) return -1;
+      compress_note_pointer(ctx, *offset);
+      bool is_pointer = (buf[owner_start] & 0xC0) == 0xC0;
+      buf[*offset] = is_pointer ? buf[owner_start] : (uint8_t)(0xC0 | (owner_start >> 8));
+      buf[*offset + 1] = is_pointer ? buf[owner_start + 1] : (uint8_t)(owner_start & 0xFF);
+      *offset += 2;
+    }
+
+    if (encode_rr_body(buf, len, offset, rr, ttl, ctx) < 0) return -1;
+    ++count;
+  }
+  return count;
+}
+
+int dns_encode_rr_ttl(uint8_t *buf, size_t len, size_t *offset, const char *name,
+                      const dns_rr_t *rr, uint32_t ttl, dns_compress_t *ctx) {
+  if (dns_encode_name_compressed(buf, len, offset, name, ctx) < 0) {
+    return -1;
+  }
+  return encode_rr_body(buf, len, offset, rr, ttl, ctx);
+}
+
+// type, class, TTL, rdlength and rdata following an owner name
+static int encode_rr_body(uint8_t *buf, size_t len, size_t *offset,
+                          const dns_rr_t *rr, uint32_t ttl, dns_compress_t *ctx) {
+  if (*offset + 10 > len) return -1;
+
+  if (dns_write_uint16(buf, len, offset, rr->type) < 0) return -1;
+  if (dns_write_uint16(buf, len, offset, rr->class) < 0) return -1;
+  if (dns_write_uint32(buf, len, offset, ttl) < 0) return -1;
+
+  return dns_rdata_encode(buf, len, offset, rr, ctx);
+}
+
+dns_fragment_t *dns_fragment_build(const dns_name_t *anchor, size_t gap,
+                                   const dns_rrset_t *rrset, uint32_t ttl) {
+  if (!anchor || !rrset || !rrset->records) return NULL;
+
+  // a message as it will look up to the records: header, anchor, gap
+  size_t base = 12 + anchor->len + gap;
+  if (base > DNS_COMPRESS_MAX_OFFSET) return NULL;
+
+  // owner pointer, fixed fields and rdata of each record, known before
+  // encoding so an oversized set never gets that far
+  size_t bound = 0;
+  const dns_rr_t *first = dns_rrset_first(rrset);
+  for (const dns_rr_t *rr = first; rr; rr = dns_rrset_next(rrset, first, rr)) {
+    bound += 2 + 10 + dns_rdata_size(rr);
+  }
+  if (bound > DNS_FRAGMENT_MAX_LEN) return NULL;
+  size_t capacity = base + bound;
+
+  uint8_t *scratch = calloc(1, capacity);
+  if (!scratch) return NULL;
+  memcpy(scratch + 12, anchor->wire, anchor->len);
+
+  // every pointer takes two bytes of the fragment
+  uint16_t relocs[DNS_FRAGMENT_MAX_LEN / 2];
+  dns_compress_t ctx;
+  dns_compress_init(&ctx);
+  dns_compress_add_wire(&ctx, scratch, 12);
+  ctx.pointers = relocs;
+  ctx.pointer_capacity = DNS_FRAGMENT_MAX_LEN / 2;
+
+  dns_fragment_t *fragment = NULL;
+  size_t offset = base;
+  int count = dns_encode_rrset_owner_at(scratch, capacity, &offset, 12, rrset, ttl, &ctx);
+  if (count <= 0) goto cleanup;
+
+  size_t len = offset - base;
+  uint16_t reloc_count = (uint16_t)ctx.pointer_count;
+  for (uint16_t i = 0; i < reloc_count; ++i) relocs[i] = (uint16_t)(relocs[i] - base);
+
+  // one block, the reloc table and the wire bytes follow the struct
+  fragment = malloc(sizeof(dns_fragment_t) + reloc_count * sizeof(uint16_t) + len);
+  if (!fragment) goto cleanup;
+
+  fragment->len = (uint16_t)len;
+  fragment->count = (uint16_t)count;
+  fragment->base = (uint16_t)base;
+  fragment->anchor_len = anchor->len;
+  fragment->reloc_count = reloc_count;
+  fragment->relocs = (uint16_t *)(fragment + 1);
+  fragment->wire = (uint8_t *)(fragment->relocs + reloc_count);
+  memcpy(fragment->relocs, relocs, reloc_count * sizeof(uint16_t));
+  memcpy(fragment->wire, scratch + base, len);
+
+cleanup:
+  free(scratch);
+  return fragment;
+}
+
+void dns_fragment_free(dns_fragment_t *fragment) {
+  free(fragment);
+}
+
+int dns_fragment_write(uint8_t *buf, size_t len, size_t *offset,
+                       const dns_fragment_t *fragment, size_t anchor_offset) {
+  if (!buf || !offset || !fragment) return -1;
+  if (*offset + fragment->len > len) return -1;
+
+  size_t start = *offset;
+  memcpy(buf + start, fragment->wire, fragment->len);
+
+  // pointers below base went to the anchor, the rest into the fragment
+  if (start != fragment->base || anchor_offset != 12) {
+    for (uint16_t i = 0; i < fragment->reloc_count; ++i) {
+      uint8_t *slot = buf + start + fragment->relocs[i];
+      size_t target = ((size_t)(slot[0] & 0x3F) << 8) | slot[1];
+      target = (target < fragment->base)
+        ? anchor_offset + (target - 12)
+        : start + (target - fragment->base);
+      if (target > DNS_COMPRESS_MAX_OFFSET) return -1;
+
+      slot[0] = (uint8_t)(0xC0 | (target >> 8));
+      slot[1] = (uint8_t)(target & 0xFF);
+    }
+  }
 
+  *offset = start + fragment->len;
   return 0;
 }
 
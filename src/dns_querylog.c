@@ -0,0 +1,366 @@
+#include "dns_querylog.h"
+#include "dns_stats.h"
+#include "dns_records.h"
+#include "dns_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, (uint16_t)(v >> 16));
+  put16(p + 2, (uint16_t)v);
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+  put32(p, (uint32_t)(v >> 32));
+  put32(p + 4, (uint32_t)v);
+}
+
+static uint16_t get16(const uint8_t *p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t *p) {
+  return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static uint64_t get64(const uint8_t *p) {
+  return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+size_t dns_querylog_encode(const dns_querylog_record_t *record, uint8_t *dst, size_t capacity) {
+  if (!record || !dst) return 0;
+
+  size_t length = DNS_QUERYLOG_HEADER_SIZE + record->qname_length;
+  if (length > capacity) return 0;
+
+  put16(dst, (uint16_t)length);
+  dst[2] = record->family;
+  dst[3] = record->outcome;
+  put64(dst + 4, record->time_ns);
+  put32(dst + 12, record->latency_ns);
+  memcpy(dst + 16, record->address, 16);
+  put16(dst + 32, record->port);
+  put16(dst + 34, record->id);
+  put16(dst + 36, record->query_flags);
+  put16(dst + 38, record->response_flags);
+  put16(dst + 40, record->response_size);
+  put16(dst + 42, record->qtype);
+  put16(dst + 44, record->qclass);
+  dst[46] = record->qname_length;
+  memcpy(dst + DNS_QUERYLOG_HEADER_SIZE, record->qname, record->qname_length);
+  return length;
+}
+
+size_t dns_querylog_decode(const uint8_t *src, size_t length, dns_querylog_record_t *record) {
+  if (!src || !record || length < DNS_QUERYLOG_HEADER_SIZE) return 0;
+
+  size_t record_length = get16(src);
+  if (record_length < DNS_QUERYLOG_HEADER_SIZE || record_length > length) return 0;
+  if (record_length != DNS_QUERYLOG_HEADER_SIZE + (size_t)src[46]) return 0;
+
+  record->family = src[2];
+  record->outcome = src[3];
+  record->time_ns = get64(src + 4);
+  record->latency_ns = get32(src + 12);
+  memcpy(record->address, src + 16, 16);
+  record->port = get16(src + 32);
+  record->id = get16(src + 34);
+  record->query_flags = get16(src + 36);
+  record->response_flags = get16(src + 38);
+  record->response_size = get16(src + 40);
+  record->qtype = get16(src + 42);
+  record->qclass = get16(src + 44);
+  record->qname_length = src[46];
+  memcpy(record->qname, src + DNS_QUERYLOG_HEADER_SIZE, record->qname_length);
+  return record_length;
+}
+
+
+// rings
+
+static dns_querylog_ring_t *querylog_ring(dns_querylog_t *log, int index) {
+  dns_querylog_ring_t *ring = atomic_load_explicit(&log->rings[index], memory_order_acquire);
+  if (ring) return ring;
+
+  dns_querylog_ring_t *fresh = aligned_alloc(DNS_QUERYLOG_CACHE_LINE, sizeof(dns_querylog_ring_t));
+  if (!fresh) return NULL;
+  atomic_init(&fresh->head, 0);
+  atomic_flag_clear(&fresh->lock);
+  atomic_init(&fresh->tail, 0);
+
+  // the shared ring can be raced for, the loser uses the winner's
+  if (!atomic_compare_exchange_strong(&log->rings[index], &ring, fresh)) {
+    free(fresh);
+    return ring;
+  }
+  return fresh;
+}
+
+bool dns_querylog_append(dns_querylog_t *log, const dns_querylog_record_t *record) {
+  if (!log || !record) return false;
+
+  uint8_t buf[DNS_QUERYLOG_RECORD_MAX];
+  size_t length = dns_querylog_encode(record, buf, sizeof(buf));
+  if (length == 0) return false;
+
+  int row = dns_stats_thread_row;
+  if (row < 0) row = dns_stats_claim_row();
+  int index = row < DNS_QUERYLOG_RINGS - 1 ? row : DNS_QUERYLOG_RINGS - 1;
+  bool shared = index == DNS_QUERYLOG_RINGS - 1;
+
+  dns_querylog_ring_t *ring = querylog_ring(log, index);
+  if (!ring) goto err_dropped;
+
+  if (shared) {
+    while (atomic_flag_test_and_set_explicit(&ring->lock, memory_order_acquire)) {}
+  }
+
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (DNS_QUERYLOG_RING_SIZE - (head - tail) < length) {
+    if (shared) atomic_flag_clear_explicit(&ring->lock, memory_order_release);
+    goto err_dropped;
+  }
+
+  // a record may wrap around the end of the ring
+  size_t at = head % DNS_QUERYLOG_RING_SIZE;
+  size_t first = DNS_QUERYLOG_RING_SIZE - at;
+  if (first >= length) {
+    memcpy(ring->data + at, buf, length);
+  } else {
+    memcpy(ring->data + at, buf, first);
+    memcpy(ring->data, buf + first, length - first);
+  }
+  atomic_store_explicit(&ring->head, head + length, memory_order_release);
+
+  if (shared) atomic_flag_clear_explicit(&ring->lock, memory_order_release);
+  atomic_fetch_add_explicit(&log->records, 1, memory_order_relaxed);
+  return true;
+
+err_dropped:
+  atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+  return false;
+}
+
+
+// writer
+
+static int querylog_open(dns_querylog_t *log) {
+  log->fd = open(log->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (log->fd < 0) return -1;
+
+  struct stat st;
+  log->file_bytes = fstat(log->fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+
+  // a file carried over from a previous run already starts with the magic
+  if (log->file_bytes == 0) {
+    if (write(log->fd, DNS_QUERYLOG_MAGIC, DNS_QUERYLOG_MAGIC_SIZE) != DNS_QUERYLOG_MAGIC_SIZE) {
+      close(log->fd);
+      log->fd = -1;
+      return -1;
+    }
+    log->file_bytes = DNS_QUERYLOG_MAGIC_SIZE;
+  }
+  return 0;
+}
+
+// path becomes path.1, path.1 becomes path.2 and so on, the oldest goes
+static void querylog_rotate(dns_querylog_t *log) {
+  close(log->fd);
+  log->fd = -1;
+
+  char from[sizeof(log->path) + 16];
+  char to[sizeof(log->path) + 16];
+  if (log->keep == 0) {
+    unlink(log->path);
+  } else {
+    for (uint32_t i = log->keep - 1; i > 0; --i) {
+      snprintf(from, sizeof(from), "%s.%u", log->path, i);
+      snprintf(to, sizeof(to), "%s.%u", log->path, i + 1);
+      rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", log->path);
+    rename(log->path, to);
+  }
+
+  if (querylog_open(log) < 0) {
+    DNS_LOG_ERROR("Failed to reopen query log %s: %s", log->path, strerror(errno));
+  }
+}
+
+// writev until everything is out, short writes resume where they stopped.
+// -1 with errno set when the file refused the rest, written says how far it got
+static int querylog_writev_all(int fd, struct iovec *iov, int count, size_t *written) {
+  *written = 0;
+  while (count > 0) {
+    ssize_t n = writev(fd, iov, count);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    *written += (size_t)n;
+
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= (ssize_t)iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = (uint8_t*)iov->iov_base + n;
+      iov->iov_len -= (size_t)n;
+    }
+  }
+  return 0;
+}
+
+// records in [tail, head) of the ring that did not make it whole into the
+// first written bytes
+static uint64_t querylog_unwritten(const dns_querylog_ring_t *ring, size_t tail, size_t head,
+                                   size_t written) {
+  uint64_t count = 0;
+  for (size_t at = tail; at < head;) {
+    size_t length = (size_t)ring->data[at % DNS_QUERYLOG_RING_SIZE] << 8
+                  | ring->data[(at + 1) % DNS_QUERYLOG_RING_SIZE];
+    if (length == 0) break;
+
+    at += length;
+    if (at - tail > written) ++count;
+  }
+  return count;
+}
+
+// one pass over every ring, returns the bytes taken off them
+static size_t querylog_drain(dns_querylog_t *log) {
+  size_t drained = 0;
+
+  for (int i = 0; i < DNS_QUERYLOG_RINGS; ++i) {
+    dns_querylog_ring_t *ring = atomic_load_explicit(&log->rings[i], memory_order_acquire);
+    if (!ring) continue;
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail) continue;
+
+    // a file lost to a failed write or rotation is tried again with new records
+    if (log->fd < 0 && querylog_open(log) == 0) {
+      DNS_LOG_INFO("Reopened query log %s", log->path);
+    }
+
+    // whole records only, so the two pieces go out in one call
+    size_t at = tail % DNS_QUERYLOG_RING_SIZE;
+    size_t length = head - tail;
+    struct iovec iov[2];
+    int count = 1;
+    iov[0].iov_base = ring->data + at;
+    iov[0].iov_len = length;
+    if (at + length > DNS_QUERYLOG_RING_SIZE) {
+      iov[0].iov_len = DNS_QUERYLOG_RING_SIZE - at;
+      iov[1].iov_base = ring->data;
+      iov[1].iov_len = length - iov[0].iov_len;
+      count = 2;
+    }
+
+    size_t written = 0;
+    if (log->fd >= 0 && querylog_writev_all(log->fd, iov, count, &written) < 0) {
+      DNS_LOG_ERROR("Failed to write query log %s: %s", log->path, strerror(errno));
+      close(log->fd);
+      log->fd = -1;
+    }
+    log->file_bytes += written;
+
+    // what the file did not take is dropped, not logged
+    uint64_t lost = querylog_unwritten(ring, tail, head, written);
+    if (lost > 0) {
+      atomic_fetch_sub_explicit(&log->records, lost, memory_order_relaxed);
+      atomic_fetch_add_explicit(&log->dropped, lost, memory_order_relaxed);
+    }
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+    drained += length;
+
+    if (log->fd >= 0 && log->rotate_bytes > 0 && log->file_bytes >= log->rotate_bytes) {
+      querylog_rotate(log);
+    }
+  }
+
+  return drained;
+}
+
+static void *querylog_writer(void *arg) {
+  dns_querylog_t *log = arg;
+
+  struct timespec idle = {0, DNS_QUERYLOG_IDLE_NS};
+  while (atomic_load(&log->running)) {
+    if (querylog_drain(log) == 0) nanosleep(&idle, NULL);
+  }
+
+  querylog_drain(log);
+  return NULL;
+}
+
+dns_querylog_t *dns_querylog_create(const char *path, uint32_t sample,
+                                    uint64_t rotate_bytes, uint32_t keep) {
+  if (!path || !*path) return NULL;
+
+  dns_querylog_t *log = calloc(1, sizeof(dns_querylog_t));
+  if (!log) goto err_alloc;
+
+  dns_safe_strncpy(log->path, path, sizeof(log->path));
+  log->sample = sample > 0 ? sample : 1;
+  log->rotate_bytes = rotate_bytes;
+  log->keep = keep;
+  for (int i = 0; i < DNS_QUERYLOG_RINGS; ++i) atomic_init(&log->rings[i], NULL);
+
+  if (querylog_open(log) < 0) goto err_open;
+
+  atomic_store(&log->running, true);
+  if (pthread_create(&log->writer, NULL, querylog_writer, log) != 0) goto err_thread;
+
+  return log;
+
+err_thread:
+  close(log->fd);
+err_open:
+  free(log);
+err_alloc:
+  return NULL;
+}
+
+void dns_querylog_free(dns_querylog_t *log) {
+  if (!log) return;
+
+  // records appended before this call are drained on the way out
+  atomic_store(&log->running, false);
+  pthread_join(log->writer, NULL);
+
+  if (log->fd >= 0) close(log->fd);
+  for (int i = 0; i < DNS_QUERYLOG_RINGS; ++i) free(atomic_load(&log->rings[i]));
+  free(log);
+}
+
+void dns_querylog_flush(dns_querylog_t *log) {
+  if (!log) return;
+
+  struct timespec idle = {0, DNS_QUERYLOG_IDLE_NS};
+  for (int i = 0; i < DNS_QUERYLOG_RINGS; ++i) {
+    dns_querylog_ring_t *ring = atomic_load_explicit(&log->rings[i], memory_order_acquire);
+    if (!ring) continue;
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    while (atomic_load_explicit(&ring->tail, memory_order_acquire) < head) {
+      nanosleep(&idle, NULL);
+    }
+  }
+}
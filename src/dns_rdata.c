@@ -0,0 +1,800 @@
+#include "dns_rdata.h"
+#include "dns_simd.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+dns_rr_t *dns_rdata_alloc(dns_arena_t *arena, uint16_t type, uint16_t rclass,
+                          uint32_t ttl, size_t data_len) {
+  if (!arena) return dns_rr_alloc((dns_record_type_t)type, (dns_class_t)rclass, ttl, data_len);
+
+  dns_rr_t *rr = dns_arena_alloc(arena, sizeof(dns_rr_t) + data_len);
+  if (!rr) return NULL;
+
+  // arena memory is not cleared, an empty rdata must still read as empty
+  memset(rr, 0, sizeof(dns_rr_t));
+  rr->type = (dns_record_type_t)type;
+  rr->class = (dns_class_t)rclass;
+  rr->ttl = ttl;
+  rr->data_len = (uint32_t)data_len;
+  return rr;
+}
+
+static void rdata_discard(dns_arena_t *arena, dns_rr_t *rr) {
+  if (!arena) {
+    dns_rr_free(rr);
+  } else {
+    dns_arena_release(arena, rr, sizeof(dns_rr_t) + rr->data_len);
+  }
+}
+
+static dns_rr_t *rdata_new(dns_rdata_in_t *in, size_t data_len) {
+  return dns_rdata_alloc(in->arena, in->type, in->rclass, in->ttl, data_len);
+}
+
+static const char *pack(dns_rr_t *rr, size_t *pos, const void *src, size_t size) {
+  char *dst = rr->data + *pos;
+  memcpy(dst, src, size);
+  *pos += size;
+  return dst;
+}
+
+// pointers into src->data are moved to the same offset in dst->data
+static const char *rebase_ptr(const dns_rr_t *src, dns_rr_t *dst, const void *ptr) {
+  const char *p = ptr;
+  if (!p || p < src->data || p >= src->data + src->data_len) return p;
+  return dst->data + (p - src->data);
+}
+
+static void rebase_none(const dns_rr_t *src, dns_rr_t *dst) {
+  (void)src;
+  (void)dst;
+}
+
+// uncompressed wire length of a presentation name, escapes only make the
+// text longer so this never comes out short
+static size_t name_size(const char *name) {
+  if (!name) return 0;
+
+  size_t len = strlen(name);
+  if (len == 0 || (len == 1 && name[0] == '.')) return 1;
+  len += name[len - 1] == '.' ? 1 : 2;
+  return len < DNS_NAME_MAX_WIRE ? len : DNS_NAME_MAX_WIRE;
+}
+
+// a pointer may lead anywhere in the message, running past the rdata is
+// caught once the decoder returns
+static int decode_name_text(dns_rdata_in_t *in, char *name) {
+  return dns_parse_name(in->buf, in->len, &in->pos, name, MAX_DOMAIN_NAME);
+}
+
+static int decode_u16(dns_rdata_in_t *in, uint16_t *value) {
+  return dns_read_uint16(in->buf, in->end, &in->pos, value);
+}
+
+// "123 rest" -> 123, text left at "rest"
+static bool text_u16(const char **text, uint16_t *value) {
+  char *end;
+  unsigned long parsed = strtoul(*text, &end, 10);
+  if (end == *text || parsed > UINT16_MAX) return false;
+
+  while (*end == ' ') ++end;
+  *value = (uint16_t)parsed;
+  *text = end;
+  return true;
+}
+
+
+// A
+
+static int decode_a(dns_rdata_in_t *in, dns_rr_t **rr) {
+  if (in->end - in->pos != 4) return -1;
+
+  dns_rr_t *out = rdata_new(in, 0);
+  if (!out) return -1;
+  memcpy(&out->rdata.a.address, in->buf + in->pos, 4);
+  in->pos += 4;
+
+  *rr = out;
+  return 0;
+}
+
+static int encode_a(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx) {
+  (void)ctx;
+  if (*offset + 4 > len) return -1;
+  memcpy(buf + *offset, &rr->rdata.a.address, 4);
+  *offset += 4;
+  return 0;
+}
+
+static size_t size_a(const dns_rr_t *rr) {
+  (void)rr;
+  return 4;
+}
+
+static bool equal_a(const dns_rr_t *a, const dns_rr_t *b) {
+  return a->rdata.a.address == b->rdata.a.address;
+}
+
+static dns_rr_t *from_text_a(uint16_t type, const char *text, uint32_t ttl) {
+  (void)type;
+  struct in_addr addr;
+  if (inet_aton(text, &addr) == 0) return NULL;
+  return dns_rr_create_a(addr.s_addr, ttl);
+}
+
+#define rebase_a rebase_none
+
+
+// AAAA
+
+static int decode_aaaa(dns_rdata_in_t *in, dns_rr_t **rr) {
+  if (in->end - in->pos != 16) return -1;
+
+  dns_rr_t *out = rdata_new(in, 0);
+  if (!out) return -1;
+  memcpy(out->rdata.aaaa.address, in->buf + in->pos, 16);
+  in->pos += 16;
+
+  *rr = out;
+  return 0;
+}
+
+static int encode_aaaa(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx) {
+  (void)ctx;
+  if (*offset + 16 > len) return -1;
+  memcpy(buf + *offset, rr->rdata.aaaa.address, 16);
+  *offset += 16;
+  return 0;
+}
+
+static size_t size_aaaa(const dns_rr_t *rr) {
+  (void)rr;
+  return 16;
+}
+
+static bool equal_aaaa(const dns_rr_t *a, const dns_rr_t *b) {
+  return memcmp(a->rdata.aaaa.address, b->rdata.aaaa.address, 16) == 0;
+}
+
+static dns_rr_t *from_text_aaaa(uint16_t type, const char *text, uint32_t ttl) {
+  (void)type;
+  return dns_rr_create_aaaa_str(text, ttl);
+}
+
+#define rebase_aaaa rebase_none
+
+
+// NS, CNAME and PTR, a single name (ns.nsdname aliases cname.cname)
+
+static int decode_name(dns_rdata_in_t *in, dns_rr_t **rr) {
+  char name[MAX_DOMAIN_NAME];
+  if (decode_name_text(in, name) < 0) return -1;
+
+  size_t size = strlen(name) + 1;
+  dns_rr_t *out = rdata_new(in, size);
+  if (!out) return -1;
+
+  size_t pos = 0;
+  out->rdata.cname.cname = pack(out, &pos, name, size);
+  *rr = out;
+  return 0;
+}
+
+static int encode_name(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx) {
+  if (!rr->rdata.cname.cname) return -1;
+  return dns_encode_name_compressed(buf, len, offset, rr->rdata.cname.cname, ctx);
+}
+
+static size_t size_name(const dns_rr_t *rr) {
+  return name_size(rr->rdata.cname.cname);
+}
+
+static void rebase_name(const dns_rr_t *src, dns_rr_t *dst) {
+  dst->rdata.cname.cname = rebase_ptr(src, dst, src->rdata.cname.cname);
+}
+
+static bool equal_name(const dns_rr_t *a, const dns_rr_t *b) {
+  return dns_name_equal(a->rdata.cname.cname, b->rdata.cname.cname);
+}
+
+static dns_rr_t *from_text_name(uint16_t type, const char *text, uint32_t ttl) {
+  size_t size = strnlen(text, MAX_DOMAIN_NAME - 1) + 1;
+  dns_rr_t *rr = dns_rr_alloc((dns_record_type_t)type, DNS_CLASS_IN, ttl, size);
+  if (!rr) return NULL;
+
+  memcpy(rr->data, text, size - 1);
+  rr->data[size - 1] = '\0';
+  rr->rdata.cname.cname = rr->data;
+  return rr;
+}
+
+
+// MX
+
+static int decode_mx(dns_rdata_in_t *in, dns_rr_t **rr) {
+  uint16_t preference;
+  char exchange[MAX_DOMAIN_NAME];
+  if (decode_u16(in, &preference) < 0) return -1;
+  if (decode_name_text(in, exchange) < 0) return -1;
+
+  size_t size = strlen(exchange) + 1;
+  dns_rr_t *out = rdata_new(in, size);
+  if (!out) return -1;
+
+  size_t pos = 0;
+  out->rdata.mx.preference = preference;
+  out->rdata.mx.exchange = pack(out, &pos, exchange, size);
+  *rr = out;
+  return 0;
+}
+
+static int encode_mx(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx) {
+  if (!rr->rdata.mx.exchange) return -1;
+  if (dns_write_uint16(buf, len, offset, rr->rdata.mx.preference) < 0) return -1;
+  return dns_encode_name_compressed(buf, len, offset, rr->rdata.mx.exchange, ctx);
+}
+
+static size_t size_mx(const dns_rr_t *rr) {
+  return 2 + name_size(rr->rdata.mx.exchange);
+}
+
+static void rebase_mx(const dns_rr_t *src, dns_rr_t *dst) {
+  dst->rdata.mx.exchange = rebase_ptr(src, dst, src->rdata.mx.exchange);
+}
+
+static bool equal_mx(const dns_rr_t *a, const dns_rr_t *b) {
+  return a->rdata.mx.preference == b->rdata.mx.preference
+      && dns_name_equal(a->rdata.mx.exchange, b->rdata.mx.exchange);
+}
+
+static dns_rr_t *from_text_mx(uint16_t type, const char *text, uint32_t ttl) {
+  (void)type;
+  uint16_t preference;
+  if (!text_u16(&text, &preference) || *text == '\0') return NULL;
+  return dns_rr_create_mx(preference, text, ttl);
+}
+
+
+// SOA, the fixed fields go first in data[] so they stay aligned
+
+static int decode_soa(dns_rdata_in_t *in, dns_rr_t **rr) {
+  char mname[MAX_DOMAIN_NAME];
+  char rname[MAX_DOMAIN_NAME];
+  uint32_t fields[5];
+  if (decode_name_text(in, mname) < 0) return -1;
+  if (decode_name_text(in, rname) < 0) return -1;
+  for (int i = 0; i < 5; ++i) {
+    if (dns_read_uint32(in->buf, in->end, &in->pos, &fields[i]) < 0) return -1;
+  }
+
+  size_t mname_size = strlen(mname) + 1;
+  size_t rname_size = strlen(rname) + 1;
+  dns_rr_t *out = rdata_new(in, sizeof(dns_soa_rdata_t) + mname_size + rname_size);
+  if (!out) return -1;
+
+  dns_soa_rdata_t *soa = (dns_soa_rdata_t *)out->data;
+  size_t pos = sizeof(dns_soa_rdata_t);
+  soa->mname = pack(out, &pos, mname, mname_size);
+  soa->rname = pack(out, &pos, rname, rname_size);
+  soa->serial  = fields[0];
+  soa->refresh = fields[1];
+  soa->retry   = fields[2];
+  soa->expire  = fields[3];
+  soa->minimum = fields[4];
+  out->rdata.soa = soa;
+
+  *rr = out;
+  return 0;
+}
+
+static int encode_soa(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx) {
+  const dns_soa_rdata_t *soa = rr->rdata.soa;
+  if (!soa) return -1;
+
+  if (dns_encode_name_compressed(buf, len, offset, soa->mname, ctx) < 0) return -1;
+  if (dns_encode_name_compressed(buf, len, offset, soa->rname, ctx) < 0) return -1;
+  if (*offset + 20 > len) return -1; // 5 * 4 bytes for the numbers
+
+  dns_write_uint32(buf, len, offset, soa->serial);
+  dns_write_uint32(buf, len, offset, soa->refresh);
+  dns_write_uint32(buf, len, offset, soa->retry);
+  dns_write_uint32(buf, len, offset, soa->expire);
+  dns_write_uint32(buf, len, offset, soa->minimum);
+  return 0;
+}
+
+static size_t size_soa(const dns_rr_t *rr) {
+  const dns_soa_rdata_t *soa = rr->rdata.soa;
+  if (!soa) return 0;
+  return name_size(soa->mname) + name_size(soa->rname) + 20;
+}
+
+static void rebase_soa(const dns_rr_t *src, dns_rr_t *dst) {
+  if (!src->rdata.soa) return;
+
+  dst->rdata.soa = (dns_soa_rdata_t *)rebase_ptr(src, dst, src->rdata.soa);
+  dst->rdata.soa->mname = rebase_ptr(src, dst, src->rdata.soa->mname);
+  dst->rdata.soa->rname = rebase_ptr(src, dst, src->rdata.soa->rname);
+}
+
+static bool equal_soa(const dns_rr_t *a, const dns_rr_t *b) {
+  const dns_soa_rdata_t *sa = a->rdata.soa;
+  const dns_soa_rdata_t *sb = b->rdata.soa;
+  if (!sa || !sb) return sa == sb;
+
+  return dns_name_equal(sa->mname, sb->mname)
+      && dns_name_equal(sa->rname, sb->rname)
+      && sa->serial == sb->serial
+      && sa->refresh == sb->refresh
+      && sa->retry == sb->retry
+      && sa->expire == sb->expire
+      && sa->minimum == sb->minimum;
+}
+
+static dns_rr_t *from_text_soa(uint16_t type, const char *text, uint32_t ttl) {
+  (void)type;
+  char mname[MAX_DOMAIN_NAME];
+  char rname[MAX_DOMAIN_NAME];
+  uint32_t serial, refresh, retry, expire, minimum;
+
+  if (sscanf(text, "%254s %254s %u %u %u %u %u",
+             mname, rname, &serial, &refresh, &retry, &expire, &minimum) != 7) {
+    return NULL;
+  }
+  return dns_rr_create_soa(mname, rname, serial, refresh, retry, expire, minimum, ttl);
+}
+
+
+// TXT, the character-strings are kept as on the wire and copied out whole
+
+static int decode_txt(dns_rdata_in_t *in, dns_rr_t **rr) {
+  // every string has to end inside the rdata
+  size_t pos = in->pos;
+  while (pos < in->end) pos += 1u + in->buf[pos];
+  if (pos != in->end) return -1;
+
+  size_t rdlength = in->end - in->pos;
+  dns_rr_t *out = rdata_new(in, rdlength);
+  if (!out) return -1;
+
+  size_t data_pos = 0;
+  out->rdata.txt.strings = (const uint8_t *)pack(out, &data_pos, in->buf + in->pos, rdlength);
+  out->rdata.txt.length = (uint16_t)rdlength;
+  in->pos = in->end;
+
+  *rr = out;
+  return 0;
+}
+
+static int encode_txt(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx) {
+  (void)ctx;
+  const dns_txt_t *txt = &rr->rdata.txt;
+  if (!txt->strings && txt->length > 0) return -1;
+
+  // at least one string, a record without any goes out as a single empty one
+  if (txt->length == 0) {
+    if (*offset + 1 > len) return -1;
+    buf[(*offset)++] = 0;
+    return 0;
+  }
+
+  if (*offset + txt->length > len) return -1;
+  memcpy(buf + *offset, txt->strings, txt->length);
+  *offset += txt->length;
+  return 0;
+}
+
+static size_t size_txt(const dns_rr_t *rr) {
+  return rr->rdata.txt.length > 0 ? rr->rdata.txt.length : 1;
+}
+
+static void rebase_txt(const dns_rr_t *src, dns_rr_t *dst) {
+  dst->rdata.txt.strings = (const uint8_t *)rebase_ptr(src, dst, src->rdata.txt.strings);
+}
+
+// string boundaries are part of the data, "a" "b" is not "ab"
+static bool equal_txt(const dns_rr_t *a, const dns_rr_t *b) {
+  return a->rdata.txt.length == b->rdata.txt.length
+      && (a->rdata.txt.length == 0
+          || memcmp(a->rdata.txt.strings, b->rdata.txt.strings, a->rdata.txt.length) == 0);
+}
+
+// RFC 1035 5.1: strings separated by spaces, quoted ones may hold spaces,
+// \X is X and \DDD a byte
+static dns_rr_t *from_text_txt(uint16_t type, const char *text, uint32_t ttl) {
+  (void)type;
+  size_t text_len = strlen(text);
+  if (text_len > UINT16_MAX) return NULL;
+
+  // the wire form is never longer than the text plus a length byte
+  uint8_t *wire = malloc(text_len + 1);
+  if (!wire) return NULL;
+
+  size_t pos = 0;
+  const char *p = text;
+  while (*p == ' ') ++p;
+  do {
+    bool quoted = *p == '"';
+    if (quoted) ++p;
+
+    size_t length_at = pos++;
+    size_t length = 0;
+    while (*p && (quoted ? *p != '"' : *p != ' ')) {
+      uint8_t c = (uint8_t)*p++;
+      if (c == '\\' && *p) {
+        if (isdigit((unsigned char)p[0]) && isdigit((unsigned char)p[1]) && isdigit((unsigned char)p[2])) {
+          int value = (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+          if (value > UINT8_MAX) goto fail;
+          c = (uint8_t)value;
+          p += 3;
+        } else {
+          c = (uint8_t)*p++;
+        }
+      }
+      if (++length > 255) goto fail;
+      wire[pos++] = c;
+    }
+    if (quoted && *p++ != '"') goto fail;
+    wire[length_at] = (uint8_t)length;
+
+    while (*p == ' ') ++p;
+  } while (*p);
+
+  dns_rr_t *rr = dns_rr_alloc(DNS_TYPE_TXT, DNS_CLASS_IN, ttl, pos);
+  if (!rr) goto fail;
+
+  memcpy(rr->data, wire, pos);
+  rr->rdata.txt.strings = (const uint8_t *)rr->data;
+  rr->rdata.txt.length = (uint16_t)pos;
+  free(wire);
+  return rr;
+
+fail:
+  free(wire);
+  return NULL;
+}
+
+
+// SRV, the target is never compressed (RFC 2782)
+
+static int decode_srv(dns_rdata_in_t *in, dns_rr_t **rr) {
+  uint16_t priority, weight, port;
+  char target[MAX_DOMAIN_NAME];
+  if (decode_u16(in, &priority) < 0) return -1;
+  if (decode_u16(in, &weight) < 0) return -1;
+  if (decode_u16(in, &port) < 0) return -1;
+  if (decode_name_text(in, target) < 0) return -1;
+
+  size_t size = strlen(target) + 1;
+  dns_rr_t *out = rdata_new(in, size);
+  if (!out) return -1;
+
+  size_t pos = 0;
+  out->rdata.srv.priority = priority;
+  out->rdata.srv.weight = weight;
+  out->rdata.srv.port = port;
+  out->rdata.srv.target = pack(out, &pos, target, size);
+  *rr = out;
+  return 0;
+}
+
+static int encode_srv(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx) {
+  (void)ctx;
+  const dns_srv_t *srv = &rr->rdata.srv;
+  if (!srv->target || *offset + 6 > len) return -1;
+
+  dns_write_uint16(buf, len, offset, srv->priority);
+  dns_write_uint16(buf, len, offset, srv->weight);
+  dns_write_uint16(buf, len, offset, srv->port);
+  return dns_encode_name(buf, len, offset, srv->target);
+}
+
+static size_t size_srv(const dns_rr_t *rr) {
+  return 6 + name_size(rr->rdata.srv.target);
+}
+
+static void rebase_srv(const dns_rr_t *src, dns_rr_t *dst) {
+  dst->rdata.srv.target = rebase_ptr(src, dst, src->rdata.srv.target);
+}
+
+static bool equal_srv(const dns_rr_t *a, const dns_rr_t *b) {
+  return a->rdata.srv.priority == b->rdata.srv.priority
+      && a->rdata.srv.weight == b->rdata.srv.weight
+      && a->rdata.srv.port == b->rdata.srv.port
+      && dns_name_equal(a->rdata.srv.target, b->rdata.srv.target);
+}
+
+static dns_rr_t *from_text_srv(uint16_t type, const char *text, uint32_t ttl) {
+  (void)type;
+  uint16_t priority, weight, port;
+  if (!text_u16(&text, &priority) || !text_u16(&text, &weight) || !text_u16(&text, &port)) {
+    return NULL;
+  }
+  if (*text == '\0') return NULL;
+  return dns_rr_create_srv(priority, weight, port, text, ttl);
+}
+
+
+// CAA, flags, a length prefixed tag and the value up to rdlength
+
+static int decode_caa(dns_rdata_in_t *in, dns_rr_t **rr) {
+  size_t rdlength = in->end - in->pos;
+  if (rdlength < 2) return -1;
+
+  const uint8_t *rdata = in->buf + in->pos;
+  uint8_t tag_len = rdata[1];
+  if (tag_len == 0 || 2u + tag_len > rdlength) return -1;
+
+  size_t value_len = rdlength - 2 - tag_len;
+  dns_rr_t *out = rdata_new(in, (size_t)tag_len + 1 + value_len);
+  if (!out) return -1;
+
+  size_t pos = 0;
+  out->rdata.caa.flags = rdata[0];
+  out->rdata.caa.tag_len = tag_len;
+  out->rdata.caa.value_len = (uint16_t)value_len;
+  out->rdata.caa.tag = pack(out, &pos, rdata + 2, tag_len);
+  out->data[pos++] = '\0';
+  pack(out, &pos, rdata + 2 + tag_len, value_len);
+  in->pos = in->end;
+
+  *rr = out;
+  return 0;
+}
+
+static int encode_caa(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx) {
+  (void)ctx;
+  const dns_caa_t *caa = &rr->rdata.caa;
+  if (!caa->tag || caa->tag_len == 0) return -1;
+  if (*offset + 2 + caa->tag_len + caa->value_len > len) return -1;
+
+  buf[(*offset)++] = caa->flags;
+  buf[(*offset)++] = caa->tag_len;
+  memcpy(buf + *offset, caa->tag, caa->tag_len);
+  *offset += caa->tag_len;
+  memcpy(buf + *offset, dns_caa_value(rr), caa->value_len);
+  *offset += caa->value_len;
+  return 0;
+}
+
+static size_t size_caa(const dns_rr_t *rr) {
+  return 2u + rr->rdata.caa.tag_len + rr->rdata.caa.value_len;
+}
+
+static void rebase_caa(const dns_rr_t *src, dns_rr_t *dst) {
+  dst->rdata.caa.tag = rebase_ptr(src, dst, src->rdata.caa.tag);
+}
+
+// tags are case-insensitive (RFC 8659 4.1), values are not
+static bool equal_caa(const dns_rr_t *a, const dns_rr_t *b) {
+  const dns_caa_t *ca = &a->rdata.caa;
+  const dns_caa_t *cb = &b->rdata.caa;
+  if (!ca->tag || !cb->tag) return ca->tag == cb->tag;
+
+  return ca->flags == cb->flags
+      && ca->tag_len == cb->tag_len
+      && ca->value_len == cb->value_len
+      && dns_simd_case_equal(ca->tag, cb->tag, ca->tag_len)
+      && memcmp(dns_caa_value(a), dns_caa_value(b), ca->value_len) == 0;
+}
+
+// flags tag value, the value may be quoted
+static dns_rr_t *from_text_caa(uint16_t type, const char *text, uint32_t ttl) {
+  (void)type;
+  uint16_t flags;
+  if (!text_u16(&text, &flags) || flags > UINT8_MAX) return NULL;
+
+  const char *space = strchr(text, ' ');
+  if (!space || space == text) return NULL;
+
+  char tag[UINT8_MAX + 1];
+  size_t tag_len = (size_t)(space - text);
+  if (tag_len > UINT8_MAX) return NULL;
+  memcpy(tag, text, tag_len);
+  tag[tag_len] = '\0';
+
+  const char *value = space + 1;
+  size_t value_len = strlen(value);
+  if (value_len >= 2 && value[0] == '"' && value[value_len - 1] == '"') {
+    ++value;
+    value_len -= 2;
+  }
+
+  return dns_rr_create_caa((uint8_t)flags, tag, (const uint8_t *)value, value_len, ttl);
+}
+
+
+// any other type (RFC 3597)
+
+static int decode_opaque(dns_rdata_in_t *in, dns_rr_t **rr) {
+  size_t rdlength = in->end - in->pos;
+  dns_rr_t *out = rdata_new(in, rdlength);
+  if (!out) return -1;
+
+  size_t pos = 0;
+  out->rdata.opaque.data = (const uint8_t *)pack(out, &pos, in->buf + in->pos, rdlength);
+  out->rdata.opaque.len = (uint16_t)rdlength;
+  in->pos = in->end;
+
+  *rr = out;
+  return 0;
+}
+
+static int encode_opaque(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr, dns_compress_t *ctx) {
+  (void)ctx;
+  if (*offset + rr->rdata.opaque.len > len) return -1;
+  if (rr->rdata.opaque.len > 0) memcpy(buf + *offset, rr->rdata.opaque.data, rr->rdata.opaque.len);
+  *offset += rr->rdata.opaque.len;
+  return 0;
+}
+
+static size_t size_opaque(const dns_rr_t *rr) {
+  return rr->rdata.opaque.len;
+}
+
+static void rebase_opaque(const dns_rr_t *src, dns_rr_t *dst) {
+  dst->rdata.opaque.data = (const uint8_t *)rebase_ptr(src, dst, src->rdata.opaque.data);
+}
+
+static bool equal_opaque(const dns_rr_t *a, const dns_rr_t *b) {
+  return a->rdata.opaque.len == b->rdata.opaque.len
+      && (a->rdata.opaque.len == 0
+          || memcmp(a->rdata.opaque.data, b->rdata.opaque.data, a->rdata.opaque.len) == 0);
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = (char)tolower((unsigned char)c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// \# length hex, spaces allowed between the hex digits
+static dns_rr_t *from_text_opaque(uint16_t type, const char *text, uint32_t ttl) {
+  if (strncmp(text, "\\#", 2) != 0) return NULL;
+  text += 2;
+  while (*text == ' ') ++text;
+
+  uint16_t rdlength;
+  if (!text_u16(&text, &rdlength)) return NULL;
+
+  uint8_t *rdata = malloc(rdlength ? rdlength : 1);
+  if (!rdata) return NULL;
+
+  size_t count = 0;
+  int high = -1;
+  for (; *text; ++text) {
+    if (*text == ' ') continue;
+
+    int nibble = hex_value(*text);
+    if (nibble < 0 || count == rdlength) goto fail;
+    if (high < 0) {
+      high = nibble;
+    } else {
+      rdata[count++] = (uint8_t)(high << 4 | nibble);
+      high = -1;
+    }
+  }
+  if (count != rdlength || high >= 0) goto fail;
+
+  dns_rr_t *rr = dns_rr_create_opaque(type, rdata, rdlength, ttl);
+  free(rdata);
+  return rr;
+
+fail:
+  free(rdata);
+  return NULL;
+}
+
+
+enum {
+#define X(TYPE, codec) RDATA_INDEX_##TYPE,
+  DNS_RDATA_TYPES(X)
+#undef X
+  RDATA_INDEX_COUNT
+};
+
+static const dns_rdata_ops_t rdata_ops[RDATA_INDEX_COUNT] = {
+#define X(TYPE, codec)                                                  \
+  [RDATA_INDEX_##TYPE] = {DNS_TYPE_##TYPE, #TYPE, decode_##codec,       \
+                          encode_##codec, size_##codec, rebase_##codec,  \
+                          equal_##codec, from_text_##codec},
+  DNS_RDATA_TYPES(X)
+#undef X
+};
+
+static const dns_rdata_ops_t opaque_ops = {
+  0, NULL, decode_opaque, encode_opaque, size_opaque, rebase_opaque, equal_opaque,
+  from_text_opaque
+};
+
+const dns_rdata_ops_t *dns_rdata_ops(uint16_t type) {
+  // dense enough for the compiler to make it a jump table
+  switch (type) {
+#define X(TYPE, codec) case DNS_TYPE_##TYPE: return &rdata_ops[RDATA_INDEX_##TYPE];
+    DNS_RDATA_TYPES(X)
+#undef X
+    default: return &opaque_ops;
+  }
+}
+
+uint16_t dns_rdata_type_from_text(const char *text) {
+  if (!text) return 0;
+
+  for (int i = 0; i < RDATA_INDEX_COUNT; ++i) {
+    if (strcasecmp(text, rdata_ops[i].mnemonic) == 0) return rdata_ops[i].type;
+  }
+
+  // generic form for types without a mnemonic (RFC 3597 5)
+  if (strncasecmp(text, "TYPE", 4) == 0 && isdigit((unsigned char)text[4])) {
+    char *end;
+    unsigned long type = strtoul(text + 4, &end, 10);
+    if (*end == '\0' && type > 0 && type <= UINT16_MAX) return (uint16_t)type;
+  }
+
+  return 0;
+}
+
+const char *dns_rdata_type_to_text(uint16_t type, char *buf, size_t len) {
+  const dns_rdata_ops_t *ops = dns_rdata_ops(type);
+  if (ops->mnemonic) return ops->mnemonic;
+
+  snprintf(buf, len, "TYPE%u", type);
+  return buf;
+}
+
+int dns_rdata_decode(const uint8_t *buf, size_t len, uint16_t type, uint16_t rclass,
+                     uint32_t ttl, size_t offset, uint16_t rdlength,
+                     dns_arena_t *arena, dns_rr_t **rr) {
+  if (!buf || !rr) return -1;
+
+  size_t end = offset + rdlength;
+  if (end > len) return -1;
+
+  if (rdlength == 0) {
+    *rr = dns_rdata_alloc(arena, type, rclass, ttl, 0);
+    return *rr ? 0 : -1;
+  }
+
+  dns_rdata_in_t in = {
+    .buf = buf, .len = len, .pos = offset, .end = end,
+    .arena = arena, .type = type, .rclass = rclass, .ttl = ttl
+  };
+  dns_rr_t *out = NULL;
+  if (dns_rdata_ops(type)->decode(&in, &out) < 0) return -1;
+
+  // names must not run past rdlength
+  if (in.pos > end) {
+    rdata_discard(arena, out);
+    return -1;
+  }
+
+  *rr = out;
+  return 0;
+}
+
+size_t dns_rdata_size(const dns_rr_t *rr) {
+  if (!rr) return 0;
+  return dns_rdata_ops(rr->type)->size(rr);
+}
+
+int dns_rdata_encode(uint8_t *buf, size_t len, size_t *offset, const dns_rr_t *rr,
+                     dns_compress_t *ctx) {
+  if (!buf || !offset || !rr || *offset + 2 > len) return -1;
+
+  size_t rdlength_offset = *offset;
+  *offset += 2;
+  if (dns_rdata_ops(rr->type)->encode(buf, len, offset, rr, ctx) < 0) return -1;
+
+  size_t rdlength = *offset - rdlength_offset - 2;
+  if (rdlength > UINT16_MAX) return -1;
+
+  buf[rdlength_offset] = (uint8_t)(rdlength >> 8);
+  buf[rdlength_offset + 1] = (uint8_t)(rdlength & 0xFF);
+  return 0;
+}
@@ -1,34 +1,64 @@
 #include "dns_records.h"
+#include "dns_rdata.h"
+#include "dns_simd.h"
 #include <arpa/inet.h>
-#include <ctype.h>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 
 
-dns_rr_t *dns_rr_create(dns_record_type_t type, dns_class_t cls, uint32_t ttl) {
-  dns_rr_t *rr = calloc(1, sizeof(dns_rr_t));
+dns_rr_t *dns_rr_alloc(dns_record_type_t type, dns_class_t cls, uint32_t ttl, size_t data_len) {
+  dns_rr_t *rr = calloc(1, sizeof(dns_rr_t) + data_len);
   if (!rr) return NULL;
 
   rr->type = type;
   rr->class = cls;
   rr->ttl = ttl;
+  rr->data_len = (uint32_t) data_len;
   rr->next = NULL;
   return rr;
 }
 
-void dns_rr_free(dns_rr_t *rr) {
-  if (!rr) return;
+dns_rr_t *dns_rr_create(dns_record_type_t type, dns_class_t cls, uint32_t ttl) {
+  return dns_rr_alloc(type, cls, ttl, 0);
+}
 
-  if (rr->type == DNS_TYPE_TXT && rr->rdata.txt.text) {
-    free(rr->rdata.txt.text);
-  }
-  if (rr->next) {
-    dns_rr_free(rr->next);
-  }
+// names are stored at their actual length, truncated like dns_safe_strncpy
+static size_t dns_rr_name_size(const char *name) {
+  return strnlen(name, MAX_DOMAIN_NAME - 1) + 1;
+}
+
+static const char *dns_rr_pack_name(dns_rr_t *rr, size_t *pos, const char *name) {
+  size_t size = dns_rr_name_size(name);
+  char *dst = rr->data + *pos;
+
+  memcpy(dst, name, size - 1);
+  dst[size - 1] = '\0';
+  *pos += size;
+  return dst;
+}
+
+dns_rr_t *dns_rr_clone(const dns_rr_t *rr) {
+  if (!rr) return NULL;
+
+  size_t size = sizeof(dns_rr_t) + rr->data_len;
+  dns_rr_t *copy = malloc(size);
+  if (!copy) return NULL;
 
-  free(rr);
+  memcpy(copy, rr, size);
+  copy->next = NULL;
+  dns_rdata_ops(rr->type)->rebase(rr, copy);
+  return copy;
+}
+
+void dns_rr_free(dns_rr_t *rr) {
+  // frees the whole chain, iteratively so long RRsets cannot blow the stack
+  while (rr) {
+    dns_rr_t *next = rr->next;
+    free(rr);
+    rr = next;
+  }
 }
 
 dns_rrset_t *dns_rrset_create(dns_record_type_t type, uint32_t ttl) {
@@ -39,15 +69,52 @@ dns_rrset_t *dns_rrset_create(dns_record_type_t type, uint32_t ttl) {
   rrset->ttl = ttl;
   rrset->records = NULL;
   rrset->count = 0;
+  atomic_init(&rrset->refs, 1);
+  rrset->order = DNS_RRSET_ORDER_FIXED;
+  atomic_init(&rrset->rotation, 0);
+  return rrset;
+}
+
+dns_rrset_t *dns_rrset_copy(const dns_rrset_t *rrset) {
+  if (!rrset) return NULL;
+
+  dns_rrset_t *copy = dns_rrset_create(rrset->type, rrset->ttl);
+  if (!copy) return NULL;
+  copy->order = rrset->order;
+
+  // keep the record order
+  dns_rr_t **tail = &copy->records;
+  for (const dns_rr_t *rr = rrset->records; rr; rr = rr->next) {
+    dns_rr_t *clone = dns_rr_clone(rr);
+    if (!clone) {
+      dns_rrset_free(copy);
+      return NULL;
+    }
+    *tail = clone;
+    tail = &clone->next;
+    copy->count++;
+  }
+
+  return copy;
+}
+
+dns_rrset_t *dns_rrset_ref(dns_rrset_t *rrset) {
+  if (rrset) atomic_fetch_add_explicit(&rrset->refs, 1, memory_order_relaxed);
   return rrset;
 }
 
 void dns_rrset_free(dns_rrset_t *rrset) {
   if (!rrset) return;
+  if (atomic_fetch_sub_explicit(&rrset->refs, 1, memory_order_acq_rel) != 1) return;
+
   dns_rr_free(rrset->records);
   free(rrset);
 }
 
+bool dns_rrset_is_shared(const dns_rrset_t *rrset) {
+  return rrset && atomic_load_explicit(&rrset->refs, memory_order_acquire) > 1;
+}
+
 bool dns_rrset_add(dns_rrset_t *rrset, dns_rr_t *rr) {
   if (!rrset || !rr) return false;
   // check record type
@@ -63,6 +130,98 @@ bool dns_rrset_add(dns_rrset_t *rrset, dns_rr_t *rr) {
   return true;
 }
 
+// xorshift32, one stream per thread so workers never share state
+static uint32_t rotation_random(void) {
+  static _Thread_local uint32_t state;
+  if (state == 0) {
+    state = (uint32_t)time(NULL) ^ (uint32_t)(uintptr_t)&state;
+    if (state == 0) state = 0x9E3779B9u;
+  }
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+const dns_rr_t *dns_rrset_first(const dns_rrset_t *rrset) {
+  if (!rrset || !rrset->records) return NULL;
+  if (rrset->order == DNS_RRSET_ORDER_FIXED || rrset->count < 2) return rrset->records;
+
+  size_t start;
+  if (rrset->order == DNS_RRSET_ORDER_CYCLIC) {
+    // the counter is the only thing readers of a shared set write, the cast
+    // drops the const of the set and not of an object defined const
+    atomic_uint *rotation = (atomic_uint *)&rrset->rotation;
+    start = atomic_fetch_add_explicit(rotation, 1, memory_order_relaxed) % rrset->count;
+  } else {
+    start = rotation_random() % rrset->count;
+  }
+
+  const dns_rr_t *rr = rrset->records;
+  while (start-- > 0 && rr->next) rr = rr->next;
+  return rr;
+}
+
+int dns_rrset_order_from_text(const char *text, dns_rrset_order_t *order) {
+  if (!text || !order) return -1;
+
+  if (strcmp(text, "fixed") == 0) {
+    *order = DNS_RRSET_ORDER_FIXED;
+  } else if (strcmp(text, "cyclic") == 0) {
+    *order = DNS_RRSET_ORDER_CYCLIC;
+  } else if (strcmp(text, "random") == 0) {
+    *order = DNS_RRSET_ORDER_RANDOM;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+int dns_rrset_order_policy_add(dns_rrset_order_policy_t *policy, const char *name, uint16_t type,
+                               dns_rrset_order_t order) {
+  if (!policy || !name) return -1;
+
+  char normalized[MAX_DOMAIN_NAME];
+  dns_normalize_domain(name, normalized);
+
+  dns_rrset_order_rule_t *rule = NULL;
+  for (int i = 0; i < policy->rule_count; ++i) {
+    if (policy->rules[i].type == type && dns_name_equal(policy->rules[i].name, normalized)) {
+      rule = &policy->rules[i];
+      break;
+    }
+  }
+  if (!rule) {
+    if (policy->rule_count == DNS_RRSET_ORDER_RULES) return -1;
+    rule = &policy->rules[policy->rule_count++];
+    dns_safe_strncpy(rule->name, normalized, sizeof(rule->name));
+    rule->type = type;
+  }
+
+  rule->order = order;
+  return 0;
+}
+
+dns_rrset_order_t dns_rrset_order_policy_lookup(const dns_rrset_order_policy_t *policy,
+                                                const char *name, uint16_t type) {
+  if (!policy) return DNS_RRSET_ORDER_FIXED;
+  if (!name || policy->rule_count == 0) return policy->fallback;
+
+  char normalized[MAX_DOMAIN_NAME];
+  dns_normalize_domain(name, normalized);
+
+  // only read while RRsets are created, a short scan is enough
+  dns_rrset_order_t order = policy->fallback;
+  for (int i = 0; i < policy->rule_count; ++i) {
+    const dns_rrset_order_rule_t *rule = &policy->rules[i];
+    if (!dns_name_equal(rule->name, normalized)) continue;
+
+    if (rule->type == type) return rule->order;
+    if (rule->type == 0) order = rule->order;
+  }
+  return order;
+}
+
 dns_rr_t *dns_rr_create_a(uint32_t address, uint32_t ttl) {
   dns_rr_t *rr = dns_rr_create(DNS_TYPE_A, DNS_CLASS_IN, ttl);
   if (!rr) return NULL;
@@ -93,52 +252,146 @@ dns_rr_t *dns_rr_create_aaaa_str(const char *ip_str, uint32_t ttl) {
   return dns_rr_create_aaaa(addr.s6_addr, ttl);
 }
 
-dns_rr_t *dns_rr_create_ns(const char *nsdname, uint32_t ttl) {
-  if (!nsdname) return NULL;
+static dns_rr_t *dns_rr_create_name(dns_record_type_t type, const char *name, uint32_t ttl) {
+  if (!name) return NULL;
 
-  dns_rr_t *rr = dns_rr_create(DNS_TYPE_NS, DNS_CLASS_IN, ttl);
+  dns_rr_t *rr = dns_rr_alloc(type, DNS_CLASS_IN, ttl, dns_rr_name_size(name));
   if (!rr) return NULL;
 
-  dns_safe_strncpy(rr->rdata.ns.nsdname, nsdname, sizeof(rr->rdata.ns.nsdname));
+  size_t pos = 0;
+  rr->rdata.cname.cname = dns_rr_pack_name(rr, &pos, name);
   return rr;
 }
 
-dns_rr_t *dns_rr_create_cname(const char *cname, uint32_t ttl) {
-  if (!cname) return NULL;
-
-  dns_rr_t *rr = dns_rr_create(DNS_TYPE_CNAME, DNS_CLASS_IN, ttl);
+dns_rr_t *dns_rr_create_ns(const char *nsdname, uint32_t ttl) {
+  dns_rr_t *rr = dns_rr_create_name(DNS_TYPE_NS, nsdname, ttl);
   if (!rr) return NULL;
 
-  dns_safe_strncpy(rr->rdata.cname.cname, cname, sizeof(rr->rdata.cname.cname));
+  rr->rdata.ns.nsdname = rr->data;
   return rr;
 }
 
+dns_rr_t *dns_rr_create_cname(const char *cname, uint32_t ttl) {
+  return dns_rr_create_name(DNS_TYPE_CNAME, cname, ttl);
+}
+
+dns_rr_t *dns_rr_create_ptr(const char *ptrdname, uint32_t ttl) {
+  return dns_rr_create_name(DNS_TYPE_PTR, ptrdname, ttl);
+}
+
 dns_rr_t *dns_rr_create_mx(uint16_t preference, const char *exchange, uint32_t ttl) {
   if (!exchange) return NULL;
 
-  dns_rr_t *rr = dns_rr_create(DNS_TYPE_MX, DNS_CLASS_IN, ttl);
+  dns_rr_t *rr = dns_rr_alloc(DNS_TYPE_MX, DNS_CLASS_IN, ttl, dns_rr_name_size(exchange));
   if (!rr) return NULL;
 
+  size_t pos = 0;
   rr->rdata.mx.preference = preference;
-  dns_safe_strncpy(rr->rdata.mx.exchange, exchange, sizeof(rr->rdata.mx.exchange));
+  rr->rdata.mx.exchange = dns_rr_pack_name(rr, &pos, exchange);
   return rr;
 }
 
 dns_rr_t *dns_rr_create_txt(const char *text, uint32_t ttl) {
   if (!text) return NULL;
 
-  dns_rr_t *rr = dns_rr_create(DNS_TYPE_TXT, DNS_CLASS_IN, ttl);
+  // at least one string, empty text is a single empty one
+  size_t len = strlen(text);
+  size_t count = len > 0 ? (len + 254) / 255 : 1;
+  if (len + count > UINT16_MAX) return NULL;
+
+  dns_rr_t *rr = dns_rr_alloc(DNS_TYPE_TXT, DNS_CLASS_IN, ttl, len + count);
   if (!rr) return NULL;
 
-  size_t len = strlen(text);
-  rr->rdata.txt.text = malloc(len + 1);
-  if (!rr->rdata.txt.text) {
-    dns_rr_free(rr);
-    return NULL;
+  uint8_t *out = (uint8_t *)rr->data;
+  size_t pos = 0;
+  do {
+    size_t chunk = len > 255 ? 255 : len;
+    out[pos++] = (uint8_t)chunk;
+    memcpy(out + pos, text, chunk);
+    pos += chunk;
+    text += chunk;
+    len -= chunk;
+  } while (len > 0);
+
+  rr->rdata.txt.strings = out;
+  rr->rdata.txt.length = (uint16_t)pos;
+  return rr;
+}
+
+dns_rr_t *dns_rr_create_txt_strings(const char *const *strings, size_t count, uint32_t ttl) {
+  if (!strings || count == 0) return NULL;
+
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (!strings[i]) return NULL;
+    size_t len = strlen(strings[i]);
+    if (len > 255) return NULL;
+    total += 1 + len;
   }
+  if (total > UINT16_MAX) return NULL;
+
+  dns_rr_t *rr = dns_rr_alloc(DNS_TYPE_TXT, DNS_CLASS_IN, ttl, total);
+  if (!rr) return NULL;
+
+  uint8_t *out = (uint8_t *)rr->data;
+  size_t pos = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size_t len = strlen(strings[i]);
+    out[pos++] = (uint8_t)len;
+    memcpy(out + pos, strings[i], len);
+    pos += len;
+  }
+
+  rr->rdata.txt.strings = out;
+  rr->rdata.txt.length = (uint16_t)total;
+  return rr;
+}
+
+// the target is kept like the other names, encoded without compression
+dns_rr_t *dns_rr_create_srv(uint16_t priority, uint16_t weight, uint16_t port,
+                            const char *target, uint32_t ttl) {
+  if (!target) return NULL;
+
+  dns_rr_t *rr = dns_rr_alloc(DNS_TYPE_SRV, DNS_CLASS_IN, ttl, dns_rr_name_size(target));
+  if (!rr) return NULL;
 
-  memcpy(rr->rdata.txt.text, text, len + 1);
-  rr->rdata.txt.length = len;
+  size_t pos = 0;
+  rr->rdata.srv.priority = priority;
+  rr->rdata.srv.weight = weight;
+  rr->rdata.srv.port = port;
+  rr->rdata.srv.target = dns_rr_pack_name(rr, &pos, target);
+  return rr;
+}
+
+// the tag and its NUL, then the value bytes
+dns_rr_t *dns_rr_create_caa(uint8_t flags, const char *tag,
+                            const uint8_t *value, size_t value_len, uint32_t ttl) {
+  if (!tag || (!value && value_len > 0)) return NULL;
+
+  size_t tag_len = strlen(tag);
+  if (tag_len == 0 || tag_len > UINT8_MAX || value_len > UINT16_MAX - 2 - tag_len) return NULL;
+
+  dns_rr_t *rr = dns_rr_alloc(DNS_TYPE_CAA, DNS_CLASS_IN, ttl, tag_len + 1 + value_len);
+  if (!rr) return NULL;
+
+  memcpy(rr->data, tag, tag_len + 1);
+  if (value_len > 0) memcpy(rr->data + tag_len + 1, value, value_len);
+  rr->rdata.caa.flags = flags;
+  rr->rdata.caa.tag = rr->data;
+  rr->rdata.caa.tag_len = (uint8_t)tag_len;
+  rr->rdata.caa.value_len = (uint16_t)value_len;
+  return rr;
+}
+
+dns_rr_t *dns_rr_create_opaque(uint16_t type, const uint8_t *rdata, size_t len, uint32_t ttl) {
+  if ((!rdata && len > 0) || len > UINT16_MAX) return NULL;
+
+  dns_rr_t *rr = dns_rr_alloc((dns_record_type_t)type, DNS_CLASS_IN, ttl, len);
+  if (!rr) return NULL;
+
+  if (len > 0) memcpy(rr->data, rdata, len);
+  rr->rdata.opaque.data = (const uint8_t *)rr->data;
+  rr->rdata.opaque.len = (uint16_t)len;
   return rr;
 }
 
@@ -152,20 +405,39 @@ dns_rr_t *dns_rr_create_soa(const char *mname,
                             uint32_t ttl) {
   if (!mname || !rname) return NULL;
 
-  dns_rr_t *rr = dns_rr_create(DNS_TYPE_SOA, DNS_CLASS_IN, ttl);
+  // the fixed SOA fields go first so they stay aligned
+  size_t data_len = sizeof(dns_soa_rdata_t) + dns_rr_name_size(mname) + dns_rr_name_size(rname);
+  dns_rr_t *rr = dns_rr_alloc(DNS_TYPE_SOA, DNS_CLASS_IN, ttl, data_len);
   if (!rr) return NULL;
 
-  dns_safe_strncpy(rr->rdata.soa.mname, mname, sizeof(rr->rdata.soa.mname));
-  dns_safe_strncpy(rr->rdata.soa.rname, rname, sizeof(rr->rdata.soa.rname));
-  rr->rdata.soa.serial  = serial;
-  rr->rdata.soa.refresh = refresh;
-  rr->rdata.soa.retry   = retry;
-  rr->rdata.soa.expire  = expire;
-  rr->rdata.soa.minimum = minimum;
-
+  dns_soa_rdata_t *soa = (dns_soa_rdata_t *) rr->data;
+  size_t pos = sizeof(dns_soa_rdata_t);
+  soa->mname = dns_rr_pack_name(rr, &pos, mname);
+  soa->rname = dns_rr_pack_name(rr, &pos, rname);
+  soa->serial  = serial;
+  soa->refresh = refresh;
+  soa->retry   = retry;
+  soa->expire  = expire;
+  soa->minimum = minimum;
+
+  rr->rdata.soa = soa;
   return rr;
 }
 
+// records decoded without rdata (update deletes) have no names
+bool dns_name_equal(const char *a, const char *b) {
+  if (!a) a = "";
+  if (!b) b = "";
+
+  size_t len = strlen(a);
+  return strlen(b) == len && dns_simd_case_equal(a, b, len);
+}
+
+bool dns_rr_rdata_equal(const dns_rr_t *a, const dns_rr_t *b) {
+  if (!a || !b || a->type != b->type) return false;
+  return dns_rdata_ops(a->type)->equal(a, b);
+}
+
 void dns_normalize_domain(const char *input, char *output) {
   if (!input) {
     if (output) output[0] = '\0';
@@ -173,12 +445,8 @@ void dns_normalize_domain(const char *input, char *output) {
   }
   if (!output) return;
 
-  size_t len = strlen(input);
-  size_t right = 0;
-
-  for (size_t left = 0; left < len && right < MAX_DOMAIN_NAME - 1; ++left) {
-    output[right++] = tolower((unsigned char) input[left]);
-  }
+  size_t right = strnlen(input, MAX_DOMAIN_NAME - 1);
+  dns_simd_lower(output, input, right);
 
   // remove trailing dot if present
   if (right > 0 && output[right-1] == '.') --right;
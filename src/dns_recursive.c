@@ -1,5 +1,7 @@
 #include "dns_recursive.h"
 #include "dns_server.h"
+#include "dns_log.h"
+#include <errno.h>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +34,22 @@ dns_recursive_resolver_t *dns_recursive_create(void) {
   resolver->socket_fd = -1;
   resolver->next_query_id = 1;
 
+  // responses are parsed one at a time, the arena is reset for each
+  resolver->parse_arena = dns_arena_create(DNS_RECURSIVE_ARENA_CHUNK);
+  if (!resolver->parse_arena) {
+    free(resolver);
+    return NULL;
+  }
+
+  resolver->stats = dns_stats_create();
+  if (!resolver->stats) {
+    dns_arena_destroy(resolver->parse_arena);
+    free(resolver);
+    return NULL;
+  }
+
+  dns_safe_strncpy(resolver->other_upstreams.name, "other", sizeof(resolver->other_upstreams.name));
+
   // query tracking
   for (int i = 0; i < 256; ++i) {
     resolver->active_queries[i].query_id = 0; // inactive
@@ -43,6 +61,8 @@ dns_recursive_resolver_t *dns_recursive_create(void) {
 void dns_recursive_free(dns_recursive_resolver_t *resolver) {
   if (!resolver) return;
   if (resolver->socket_fd >= 0) close(resolver->socket_fd);
+  dns_arena_destroy(resolver->parse_arena);
+  dns_stats_free(resolver->stats);
   free(resolver);
 }
 
@@ -51,7 +71,7 @@ int dns_recursive_init_socket(dns_recursive_resolver_t *resolver) {
 
   resolver->socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
   if (resolver->socket_fd < 0) {
-    perror("Failed to create recursive resolver socket");
+    DNS_LOG_ERROR("Failed to create recursive resolver socket: %s", strerror(errno));
     return -1;
   }
 
@@ -65,7 +85,7 @@ int dns_recursive_init_socket(dns_recursive_resolver_t *resolver) {
                  SO_RCVTIMEO,
                  &timeout,
                  sizeof(timeout)) < 0) {
-    perror("Failed to set socket timeout");
+    DNS_LOG_ERROR("Failed to set socket timeout: %s", strerror(errno));
     close(resolver->socket_fd);
     resolver->socket_fd = -1;
     return -1;
@@ -89,13 +109,13 @@ int dns_recursive_load_root_hints(dns_recursive_resolver_t *resolver) {
     }
 
     server->has_ipv6 = false; // TODO: IPv6 support
-    server->queries_sent = 0;
-    server->responses_received = 0;
-    server->timeouts = 0;
+    atomic_store_explicit(&server->queries_sent, 0, memory_order_relaxed);
+    atomic_store_explicit(&server->responses_received, 0, memory_order_relaxed);
+    atomic_store_explicit(&server->timeouts, 0, memory_order_relaxed);
     server->last_used = 0;
   }
 
-  printf("Loaded %d root servers\n", DNS_ROOT_HINTS_COUNT);
+  DNS_LOG_INFO("Loaded %d root servers", DNS_ROOT_HINTS_COUNT);
   return 0;
 }
 
@@ -123,6 +143,22 @@ int dns_recursive_add_upstream_server(dns_upstream_list_t *list,
   return -1;
 }
 
+dns_nameserver_t *dns_recursive_upstream(dns_recursive_resolver_t *resolver,
+                                         const struct sockaddr_in *addr) {
+  if (!resolver) return NULL;
+  if (!addr || addr->sin_family != AF_INET) return &resolver->other_upstreams;
+
+  for (int i = 0; i < DNS_ROOT_HINTS_COUNT; ++i) {
+    const dns_nameserver_t *root = &resolver->root_servers[i];
+    if (root->has_ipv4
+        && root->ipv4.sin_addr.s_addr == addr->sin_addr.s_addr
+        && root->ipv4.sin_port == addr->sin_port) {
+      return &resolver->root_servers[i];
+    }
+  }
+  return &resolver->other_upstreams;
+}
+
 dns_nameserver_t *dns_recursive_select_server(dns_upstream_list_t *list) {
   if (!list || list->server_count == 0) return NULL;
 
@@ -189,14 +225,23 @@ int dns_recursive_send_query(dns_recursive_resolver_t *resolver,
                         addr,
                         addr_len);
   if (sent < 0) {
-    perror("Failed to send recursive query");
+    DNS_LOG_WARN("Failed to send recursive query: %s", strerror(errno));
     return -1;
   }
 
-  printf("Sent recursive query for %s to %s (ID: %u)\n",
-         question->qname,
-         server->name,
-         query_id);
+  // lists in a query are copies, the counters live on the resolver
+  dns_nameserver_t *upstream = dns_recursive_upstream(resolver, &server->ipv4);
+  atomic_fetch_add_explicit(&upstream->queries_sent, 1, memory_order_relaxed);
+  upstream->last_used = time(NULL);
+
+  dns_recursive_query_t *query = &resolver->active_queries[query_id & 0xFF];
+  query->sent_ticks = dns_clock_ticks();
+  query->upstream = upstream;
+
+  DNS_LOG_DEBUG("Sent recursive query for %s to %s (ID: %u)",
+                question->qname,
+                server->name,
+                query_id);
 
   return 0;
 }
@@ -209,7 +254,7 @@ int dns_recursive_load_root_hints_file(dns_recursive_resolver_t *resolver, const
 
   FILE *file = fopen(filename, "r");
   if (!file) {
-    printf("Root hints file not found, using local roots.hint\n");
+    DNS_LOG_WARN("Root hints file not found, using local roots.hint");
     return dns_recursive_load_root_hints(resolver);
   }
 
@@ -253,7 +298,7 @@ int dns_recursive_load_root_hints_file(dns_recursive_resolver_t *resolver, const
   }
 
   fclose(file);
-  printf("Loaded %d root servers from %s\n", server_count, filename);
+  DNS_LOG_INFO("Loaded %d root servers from %s", server_count, filename);
   return 0;
 }
 
@@ -264,6 +309,9 @@ int dns_recursive_resolve(dns_recursive_resolver_t *resolver,
                           uint16_t original_id) {
   if (!resolver || !question || !client_addr) return -1;
 
+  dns_name_t name;
+  if (dns_name_from_text(&name, question->qname) < 0) return -1;
+
   // generate unique query id
   uint16_t query_id = resolver->next_query_id++;
   if (resolver->next_query_id == 0) resolver->next_query_id = 1; // skip 0
@@ -272,6 +320,7 @@ int dns_recursive_resolve(dns_recursive_resolver_t *resolver,
   dns_recursive_query_t *query = &resolver->active_queries[query_id & 0xFF];
   query->query_id = query_id;
   dns_safe_strncpy(query->qname, question->qname, sizeof(query->qname));
+  query->name = name;
   query->qtype = question->qtype;
   query->qclass = question->qclass;
   query->start_time = time(NULL);
@@ -304,71 +353,95 @@ int dns_recursive_resolve(dns_recursive_resolver_t *resolver,
     return -1;
   }
 
-  resolver->recursive_queries++;
-  root_server->queries_sent++;
-  root_server->last_used = time(NULL);
+  dns_stats_inc(resolver->stats, DNS_STAT_RECURSIVE_QUERIES);
 
   return 0;
 }
 
+static bool dns_recursive_question_matches(const dns_recursive_query_t *query,
+                                           const dns_message_t *msg) {
+  if (!msg->has_question_view) return false;
+
+  const dns_question_view_t *question = &msg->question_view;
+  return question->qtype == query->qtype
+      && question->qclass == query->qclass
+      && dns_name_eq(&question->name, &query->name);
+}
+
 int dns_recursive_handle_response(dns_recursive_resolver_t *resolver,
                                  const uint8_t *response_buf,
                                  size_t response_len,
                                  const struct sockaddr_storage *server_addr) {
-  (void)server_addr; // suppress unused parameter warning
-
   if (!resolver || !response_buf || response_len < 12) return -1;
 
-  // parse response header
-  dns_response_summary_t summary;
-  if (dns_parse_response_summary(response_buf, response_len, &summary) < 0) {
+  // one parse serves the question check, the referral and the glue
+  dns_message_t msg;
+  dns_arena_reset(resolver->parse_arena);
+  if (dns_parse_message(response_buf, response_len, resolver->parse_arena, &msg) < 0) {
+    DNS_LOG_DEBUG("Dropped malformed response");
     return -1;
   }
+  const dns_header_t *header = &msg.header;
 
   // find matching query
-  dns_recursive_query_t *query = &resolver->active_queries[summary.query_id & 0xFF];
-  if (query->query_id != summary.query_id) {
-    printf("Received response for unknown query ID: %u\n", summary.query_id);
+  dns_recursive_query_t *query = &resolver->active_queries[header->id & 0xFF];
+  if (query->query_id != header->id) {
+    DNS_LOG_DEBUG("Received response for unknown query ID: %u", header->id);
+    return -1;
+  }
+
+  // the ID alone is 16 bits to guess, the question has to be ours as well
+  if (!dns_recursive_question_matches(query, &msg)) {
+    DNS_LOG_DEBUG("Dropped response with mismatched question for %s (ID: %u)",
+                  query->qname,
+                  header->id);
     return -1;
   }
 
-  printf("Received response for %s (ID: %u, RCODE: %u, Answers: %u, Authority: %u)\n",
-         query->qname,
-         summary.query_id,
-         summary.rcode,
-         summary.ancount,
-         summary.nscount);
+  // one round trip, errors other than NXDOMAIN are what the client gets
+  bool upstream_error = header->rcode != DNS_RCODE_NOERROR && header->rcode != DNS_RCODE_NXDOMAIN;
+  dns_latency_record(resolver->latency, DNS_STAGE_RECURSIVE,
+                     upstream_error ? DNS_OUTCOME_ERROR : DNS_OUTCOME_RECURSIVE,
+                     dns_clock_ticks() - query->sent_ticks);
+
+  DNS_LOG_DEBUG("Received response for %s (ID: %u, RCODE: %u, Answers: %u, Authority: %u)",
+                query->qname,
+                header->id,
+                header->rcode,
+                header->ancount,
+                header->nscount);
 
   // update server stats
-  for (int i = 0; i < query->current_servers.server_count; i++) {
-    dns_nameserver_t *server = &query->current_servers.servers[i];
-    server->responses_received++;
+  dns_nameserver_t *upstream = query->upstream;
+  if (server_addr && server_addr->ss_family == AF_INET) {
+    upstream = dns_recursive_upstream(resolver, (const struct sockaddr_in *)server_addr);
   }
+  if (upstream) atomic_fetch_add_explicit(&upstream->responses_received, 1, memory_order_relaxed);
 
-  if (summary.rcode == DNS_RCODE_NOERROR && summary.ancount > 0) {
+  if (header->rcode == DNS_RCODE_NOERROR && header->ancount > 0) {
     // found an answer, forward it back to the client
     dns_recursive_forward_response(resolver, query, response_buf, response_len);
 
     // query complete
     query->query_id = 0;
-    resolver->forwarded_queries++;
+    dns_stats_inc(resolver->stats, DNS_STAT_FORWARDED_QUERIES);
     return 0;
 
-  } else if (summary.rcode == DNS_RCODE_NOERROR && summary.nscount > 0) {
+  } else if (header->rcode == DNS_RCODE_NOERROR && header->nscount > 0) {
     // found a referral, extract nameservers and continue
     query->recursion_depth++;
 
     if (query->recursion_depth >= DNS_MAX_RECURSION_DEPTH) {
-      printf("Maximum recursion depth reached for %s\n", query->qname);
+      DNS_LOG_WARN("Maximum recursion depth reached for %s", query->qname);
       dns_recursive_send_error_response(resolver, query, DNS_RCODE_SERVFAIL);
       query->query_id = 0;
-      resolver->failed_queries++;
+      dns_stats_inc(resolver->stats, DNS_STAT_RECURSIVE_FAILED);
       return -1;
     }
 
     // get nameservers from authority section
     dns_upstream_list_t new_servers = {0};
-    if (dns_extract_nameservers_from_authority(response_buf, response_len, &new_servers) > 0) {
+    if (dns_recursive_extract_nameservers(&msg, &new_servers) > 0) {
       query->current_servers = new_servers;
 
       // query new nameserver
@@ -381,8 +454,6 @@ int dns_recursive_handle_response(dns_recursive_resolver_t *resolver,
       dns_nameserver_t *next_server = dns_recursive_select_server(&query->current_servers);
       if (next_server) {
         dns_recursive_send_query(resolver, &question, next_server, query->query_id);
-        next_server->queries_sent++;
-        next_server->last_used = time(NULL);
         return 0;
       }
     }
@@ -390,7 +461,7 @@ int dns_recursive_handle_response(dns_recursive_resolver_t *resolver,
     // failed recursion
     dns_recursive_send_error_response(resolver, query, DNS_RCODE_SERVFAIL);
     query->query_id = 0;
-    resolver->failed_queries++;
+    dns_stats_inc(resolver->stats, DNS_STAT_RECURSIVE_FAILED);
     return -1;
 
   } else {
@@ -398,8 +469,8 @@ int dns_recursive_handle_response(dns_recursive_resolver_t *resolver,
     dns_recursive_forward_response(resolver, query, response_buf, response_len);
     query->query_id = 0;
 
-    if (summary.rcode != DNS_RCODE_NXDOMAIN) {
-      resolver->failed_queries++;
+    if (header->rcode != DNS_RCODE_NXDOMAIN) {
+      dns_stats_inc(resolver->stats, DNS_STAT_RECURSIVE_FAILED);
     }
     return 0;
   }
@@ -435,11 +506,11 @@ int dns_recursive_forward_response(dns_recursive_resolver_t *resolver,
   free(response_copy);
 
   if (sent < 0) {
-    perror("Failed to forward recursive response");
+    DNS_LOG_WARN("Failed to forward recursive response: %s", strerror(errno));
     return -1;
   }
 
-  printf("Forwarded recursive response to client (original ID: %u)\n", query->original_id);
+  DNS_LOG_DEBUG("Forwarded recursive response to client (original ID: %u)", query->original_id);
   return 0;
 }
 
@@ -493,146 +564,69 @@ int dns_recursive_send_error_response(dns_recursive_resolver_t *resolver,
                         (struct sockaddr*) &query->client_addr,
                         query->client_addr_len);
   if (sent < 0) {
-    perror("Failed to send error response");
+    DNS_LOG_WARN("Failed to send error response: %s", strerror(errno));
     return -1;
   }
 
-  printf("Sent error response (RCODE: %u) to client for %s\n", rcode, query->qname);
+  DNS_LOG_DEBUG("Sent error response (RCODE: %u) to client for %s", rcode, query->qname);
   return 0;
 }
 
-int dns_extract_nameservers_from_authority(const uint8_t *buffer,
-                                           size_t len,
-                                           dns_upstream_list_t *servers) {
-  if (!buffer || !servers || len < 12) return -1;
-
-  dns_response_summary_t summary;
-  if (dns_parse_response_summary(buffer, len, &summary) < 0) return -1;
+int dns_recursive_extract_nameservers(const dns_message_t *msg,
+                                      dns_upstream_list_t *servers) {
+  if (!msg || !servers) return -1;
 
-  if (summary.nscount == 0) {
+  if (msg->header.nscount == 0) {
     // no authority section, use fallback servers
     dns_recursive_add_upstream_server(servers, "8.8.8.8", 53);
     dns_recursive_add_upstream_server(servers, "1.1.1.1", 53);
     return servers->server_count;
   }
 
-  size_t offset = 12;
-
-  // skip question section
-  for (int i = 0; i < summary.qdcount; ++i) {
-    dns_question_t question;
-    if (dns_parse_question(buffer, len, &offset, &question) < 0) {
-      return -1;
-    }
-  }
-
-  // skip answer section
-  for (int i = 0; i < summary.ancount; ++i) {
-    char name[MAX_DOMAIN_NAME];
-    if (dns_parse_name(buffer, len, &offset, name, sizeof(name)) < 0) {
-      return -1;
-    }
-
-    if (offset + 10 > len) return -1;
-    offset += 10; // skip type, class, ttl, rdlength
-
-    uint16_t rdlength;
-    memcpy(&rdlength, buffer + offset - 2, 2);
-
-    rdlength = ntohs(rdlength);
-
-    if (offset + rdlength > len) return -1;
-    offset += rdlength;
-  }
-
-  // parse authority section (NS records)
-  char ns_names[16][MAX_DOMAIN_NAME]; // store NS names for IP lookup
+  // NS targets from the authority section, canonical for matching glue
+  dns_name_t ns_names[16];
   int ns_count = 0;
 
-  for (int i = 0; i < summary.nscount && ns_count < 16; ++i) {
-    char name[MAX_DOMAIN_NAME];
-    if (dns_parse_name(buffer, len, &offset, name, sizeof(name)) < 0) {
-      break;
-    }
-    if (offset + 10 > len) break;
-
-    uint16_t type, class, rdlength;
-    uint32_t ttl;
+  for (int i = 0; i < msg->header.nscount && ns_count < 16; ++i) {
+    const dns_message_rr_t *rr = &msg->authority[i];
+    if (rr->type != DNS_TYPE_NS || !rr->rr) continue;
 
-    memcpy(&type, buffer + offset, 2);
-    offset += 2;
-    memcpy(&class, buffer + offset, 2);
-    offset += 2;
-    memcpy(&ttl, buffer + offset, 4);
-    offset += 4;
-    memcpy(&rdlength, buffer + offset, 2);
-    offset += 2;
-
-    type = ntohs(type);
-    rdlength = ntohs(rdlength);
-
-    if (type == DNS_TYPE_NS && offset + rdlength <= len) {
-      size_t ns_offset = offset;
-      if (dns_parse_name(buffer, len, &ns_offset, ns_names[ns_count], MAX_DOMAIN_NAME) == 0) {
-        printf("Found NS: %s\n", ns_names[ns_count]);
-        ++ns_count;
-      }
+    if (dns_name_from_text(&ns_names[ns_count], rr->rr->rdata.ns.nsdname) == 0) {
+      DNS_LOG_TRACE("Found NS: %s", rr->rr->rdata.ns.nsdname);
+      ++ns_count;
     }
-
-    offset += rdlength;
   }
 
-  // parse additional section for A records of NS servers
-  for (int i = 0; i < summary.arcount && servers->server_count < DNS_MAX_UPSTREAM_SERVERS; i++) {
-    char name[MAX_DOMAIN_NAME];
-    if (dns_parse_name(buffer, len, &offset, name, sizeof(name)) < 0) break;
+  // glue: A records in the additional section owned by one of them
+  for (int i = 0; i < msg->header.arcount && servers->server_count < DNS_MAX_UPSTREAM_SERVERS; ++i) {
+    const dns_message_rr_t *rr = &msg->additional[i];
+    if (rr->type != DNS_TYPE_A || !rr->rr) continue;
 
-    if (offset + 10 > len) break;
+    for (int j = 0; j < ns_count; ++j) {
+      if (dns_name_eq(&rr->owner, &ns_names[j])) {
+        // found IP for this nameserver
+        struct in_addr addr;
+        addr.s_addr = rr->rr->rdata.a.address;
 
-    uint16_t type, class, rdlength;
-    uint32_t ttl;
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr, ip_str, sizeof(ip_str));
 
-    memcpy(&type, buffer + offset, 2);
-    offset += 2;
-    memcpy(&class, buffer + offset, 2);
-    offset += 2;
-    memcpy(&ttl, buffer + offset, 4);
-    offset += 4;
-    memcpy(&rdlength, buffer + offset, 2);
-    offset += 2;
-
-    type = ntohs(type);
-    rdlength = ntohs(rdlength);
-
-    if (type == DNS_TYPE_A && rdlength == 4 && offset + 4 <= len) {
-      // check if A record matches any NS names
-      for (int j = 0; j < ns_count; j++) {
-        if (strcasecmp(name, ns_names[j]) == 0) {
-          // found IP for this nameserver
-          struct in_addr addr;
-          memcpy(&addr, buffer + offset, 4);
-
-          char ip_str[INET_ADDRSTRLEN];
-          inet_ntop(AF_INET, &addr, ip_str, sizeof(ip_str));
-
-          if (dns_recursive_add_upstream_server(servers, ip_str, 53) == 0) {
-            printf("Added nameserver: %s (%s)\n", name, ip_str);
-          }
-          break;
+        if (dns_recursive_add_upstream_server(servers, ip_str, 53) == 0) {
+          char name[MAX_DOMAIN_NAME];
+          dns_name_to_text(&rr->owner, name, sizeof(name));
+          DNS_LOG_TRACE("Added nameserver: %s (%s)", name, ip_str);
         }
+        break;
       }
     }
-
-    offset += rdlength;
   }
 
   // if we don't find any IPs, add fallback servers
   if (servers->server_count == 0) {
-    printf("No nameserver IPs found, using fallback servers\n");
+    DNS_LOG_DEBUG("No nameserver IPs found, using fallback servers");
     dns_recursive_add_upstream_server(servers, "8.8.8.8", 53);
     dns_recursive_add_upstream_server(servers, "1.1.1.1", 53);
   }
 
   return servers->server_count;
-
 }
@@ -7,71 +7,157 @@
 
 
 dns_resolution_result_t *dns_resolution_result_create(void) {
-  dns_resolution_result_t *result = calloc(1, sizeof(dns_resolution_result_t));
+  dns_resolution_result_t *result = malloc(sizeof(dns_resolution_result_t));
   if (!result) return NULL;
 
+  dns_resolution_result_init(result);
+  return result;
+}
+
+void dns_resolution_result_free(dns_resolution_result_t *result) {
+  if (!result) return;
+
+  dns_resolution_result_clear(result);
+  free(result);
+}
+
+void dns_resolution_result_init(dns_resolution_result_t *result) {
+  if (!result) return;
+
+  memset(result, 0, sizeof(*result));
   result->rcode = DNS_RCODE_NOERROR;
   result->authoritative = false;
-  return result;
+  result->encloser_labels = -1;
 }
 
-static void dns_rr_list_free(dns_rr_t *list) {
-  while (list) {
-    dns_rr_t *next = list->next;
-    list->next = NULL; // prevent recursive free
-    dns_rr_free(list);
-    list = next;
+static void dns_section_clear(dns_section_t *section) {
+  for (int i = 0; i < section->rrset_count; ++i) {
+    dns_rrset_free(section->rrsets[i].rrset);
   }
+  section->rrset_count = 0;
 }
 
-void dns_resolution_result_free(dns_resolution_result_t *result) {
+void dns_resolution_result_clear(dns_resolution_result_t *result) {
   if (!result) return;
 
-  dns_rr_list_free(result->answer_list);
-  dns_rr_list_free(result->authority_list);
-  dns_rr_list_free(result->additional_list);
-
-  free(result);
+  dns_section_clear(&result->answer);
+  dns_section_clear(&result->authority);
+  dns_section_clear(&result->additional);
+  dns_resolution_result_init(result);
 }
 
-static dns_rr_t *dns_rr_copy(const dns_rr_t *rr) {
-  if (!rr) return NULL;
+bool dns_resolution_result_add(dns_resolution_result_t *result,
+                               dns_section_id_t section,
+                               dns_rrset_t *rrset,
+                               const char *owner,
+                               uint32_t ttl) {
+  if (!result || !rrset) return false;
+
+  dns_section_t *target;
+  int *count;
+  switch (section) {
+    case DNS_SECTION_ANSWER:
+      target = &result->answer;
+      count = &result->answer_count;
+      break;
+    case DNS_SECTION_AUTHORITY:
+      target = &result->authority;
+      count = &result->authority_count;
+      break;
+    case DNS_SECTION_ADDITIONAL:
+      target = &result->additional;
+      count = &result->additional_count;
+      break;
+    default:
+      return false;
+  }
 
-  dns_rr_t *copy = dns_rr_create(rr->type, rr->class, rr->ttl);
-  if (!copy) return NULL;
+  if (target->rrset_count >= DNS_MAX_SECTION_RRSETS) return false;
 
-  memcpy(&copy->rdata, &rr->rdata, sizeof(dns_rdata_t));
+  dns_section_rrset_t *entry = &target->rrsets[target->rrset_count++];
+  entry->rrset = dns_rrset_ref(rrset);
+  entry->owner = owner;
+  entry->ttl = ttl;
+  *count += (int)rrset->count;
+  return true;
+}
 
-  // handle TXT case
-  if (rr->type == DNS_TYPE_TXT && rr->rdata.txt.text) {
-    copy->rdata.txt.text = malloc(rr->rdata.txt.length);
-    if (copy->rdata.txt.text) {
-      memcpy(copy->rdata.txt.text, rr->rdata.txt.text, rr->rdata.txt.length);
-      copy->rdata.txt.length = rr->rdata.txt.length;
-    } else {
-      dns_rr_free(copy);
-      return NULL;
+void dns_resolution_result_from_cache(dns_resolution_result_t *result,
+                                      const dns_cache_result_t *cache_result) {
+  if (!result || !cache_result) return;
+
+  if (cache_result->type == DNS_CACHE_TYPE_POSITIVE) {
+    // a cached chain keeps its order, each RRset belongs to the target before it
+    const char *owner = NULL;
+    for (int i = 0; i < cache_result->rrset_count; ++i) {
+      const dns_rrset_t *rrset = cache_result->rrsets[i];
+      dns_resolution_result_add(result, DNS_SECTION_ANSWER, cache_result->rrsets[i],
+                                owner, cache_result->remaining_ttl);
+      if (rrset->type == DNS_TYPE_CNAME && rrset->records) owner = rrset->records->rdata.cname.cname;
     }
+    result->rcode = DNS_RCODE_NOERROR;
+  } else if (cache_result->type == DNS_CACHE_TYPE_NXDOMAIN) {
+    result->rcode = DNS_RCODE_NXDOMAIN;
+  } else {
+    result->rcode = DNS_RCODE_NOERROR;
   }
-
-  return copy;
 }
 
-static bool dns_rr_list_append(dns_rr_t **list, int *count, dns_rr_t *rr) {
-  if (!list || !rr) return false;
+int dns_resolution_cache_store(dns_cache_t *cache,
+                               const dns_question_t *question,
+                               const dns_resolution_result_t *result) {
+  if (!cache || !question || !result) return -1;
 
-  if (!*list) {
-    *list = rr;
-  } else {
-    dns_rr_t *curr = *list;
-    while (curr->next) {
-      curr = curr->next;
+  const dns_section_t *answer = &result->answer;
+  if (answer->rrset_count > 0 && answer->rrsets[0].rrset->type == DNS_TYPE_CNAME
+      && question->qtype != DNS_TYPE_CNAME) {
+    return 0;
+  }
+
+  int stored = 0;
+  if (result->rcode == DNS_RCODE_NOERROR && result->answer.rrset_count > 0) {
+    dns_rrset_t *rrsets[DNS_MAX_SECTION_RRSETS];
+    uint32_t min_ttl = UINT32_MAX;
+
+    for (int i = 0; i < result->answer.rrset_count; ++i) {
+      rrsets[i] = result->answer.rrsets[i].rrset;
+      if (result->answer.rrsets[i].ttl < min_ttl) min_ttl = result->answer.rrsets[i].ttl;
+    }
+
+    if (min_ttl == 0) return 0;
+    stored = dns_cache_insert_rrsets(cache,
+                                     question->qname,
+                                     question->qtype,
+                                     question->qclass,
+                                     rrsets,
+                                     result->answer.rrset_count,
+                                     min_ttl);
+  } else if (result->rcode == DNS_RCODE_NXDOMAIN) {
+    // cache negative response (default 5 minutes)
+    uint32_t ttl = 300;
+
+    // get TTL from SOA if available
+    if (result->authority.rrset_count > 0) {
+      const dns_rrset_t *soa = result->authority.rrsets[0].rrset;
+      if (soa->type == DNS_TYPE_SOA && soa->records) ttl = soa->records->rdata.soa->minimum;
     }
-    curr->next = rr;
+
+    stored = dns_cache_insert_negative(cache,
+                                       question->qname,
+                                       question->qtype,
+                                       question->qclass,
+                                       DNS_CACHE_TYPE_NXDOMAIN,
+                                       DNS_RCODE_NXDOMAIN,
+                                       ttl);
+  } else {
+    return 0;
   }
 
-  if (count) (*count)++;
-  return true;
+  if (stored == 0 && result->encloser_labels >= 0) {
+    dns_cache_set_encloser(cache, question->qname, question->qtype, question->qclass,
+                           result->encloser_labels);
+  }
+  return stored;
 }
 
 int dns_resolve_query_full(dns_trie_t *trie,
@@ -91,7 +177,7 @@ int dns_resolve_query_full(dns_trie_t *trie,
   dns_zone_t *zone = dns_trie_find_zone(trie, question->qname);
   if (zone && zone->authoritative) result->authoritative = true;
 
-  // try CNAME chain resolution
+  // CNAME chain resolution, also covers the direct (and wildcard) lookup
   dns_cname_chain_t chain;
   int cname_result = dns_resolve_cname_chain(trie,
       question->qname,
@@ -106,44 +192,174 @@ int dns_resolve_query_full(dns_trie_t *trie,
     return 0;
   }
 
-  // no CNAME, try direct lookup
-  dns_rrset_t *rrset = dns_trie_lookup(trie, question->qname, question->qtype);
-  if (rrset) {
-    for (dns_rr_t *rr = rrset->records; rr != NULL; rr = rr->next) {
-      dns_rr_t *copy = dns_rr_copy(rr);
-      if (copy) {
-        dns_rr_list_append(&result->answer_list, &result->answer_count, copy);
-      }
+  // NXDOMAIN or NODATA, both carry the zone SOA
+  dns_add_authority_soa(trie, question->qname, result);
+  return 0;
+}
+
+static int add_zone_soa(const dns_zone_t *zone, dns_resolution_result_t *result) {
+  if (!zone || !zone->soa_rrset) return -1;
+
+  dns_safe_strncpy(result->authority_zone_name, zone->zone_name, sizeof(result->authority_zone_name));
+
+  // add SOA to authority section, owned by the zone apex
+  if (dns_resolution_result_add(result, DNS_SECTION_AUTHORITY, zone->soa_rrset,
+                                result->authority_zone_name, zone->soa_rrset->ttl)) {
+    if (zone->authoritative) result->authoritative = true;
+    return 0;
+  }
+
+  return -1;
+}
+
+int dns_resolve_query_view(dns_trie_t *trie,
+    const dns_question_view_t *view,
+    dns_resolution_result_t *result,
+    dns_error_t *err) {
+  if (!trie || !view || !result) return -1;
+
+  if (view->qtype == 0 || view->qclass != DNS_CLASS_IN) {
+    DNS_ERROR_SET(err, DNS_ERR_INVALID_QUESTION, "Invalid question type or class");
+    result->rcode = DNS_RCODE_FORMERROR;
+    return -1;
+  }
+
+  // one descent gives the node, the wildcard and the enclosing zone
+  dns_trie_match_result_t match;
+  dns_trie_find_name(trie, &view->name, &match);
+  dns_trie_node_t *node = match.node;
+
+  // chains work on names, hand those to the text path
+  if (node && node->cname) {
+    dns_question_t question;
+    if (dns_question_view_to_question(view, &question) < 0) {
+      DNS_ERROR_SET(err, DNS_ERR_INVALID_QUESTION, "Question name too long");
+      result->rcode = DNS_RCODE_FORMERROR;
+      return -1;
     }
+    return dns_resolve_query_full(trie, &question, result, err);
+  }
+
+  if (match.zone && match.zone->authoritative) result->authoritative = true;
 
+  if (match.match != DNS_TRIE_MATCH_EXACT) result->encloser_labels = match.encloser_labels;
+
+  dns_rrset_t *rrset = node ? rrset_map_lookup(node->rrsets, view->qtype) : NULL;
+  if (rrset) {
+    dns_resolution_result_add(result, DNS_SECTION_ANSWER, rrset, NULL, rrset->ttl);
     result->rcode = DNS_RCODE_NOERROR;
     return 0;
   }
 
-  // check if domain exists with a different record type (NODATA)
-  dns_rrset_t *any_rrset = NULL;
-  dns_record_type_t check_types[] = {
-    DNS_TYPE_A,
-    DNS_TYPE_AAAA,
-    DNS_TYPE_CNAME,
-    DNS_TYPE_NS,
-    DNS_TYPE_MX,
-  };
-  for (size_t i = 0; i < sizeof(check_types) / sizeof(check_types[0]); ++i) {
-    if (check_types[i] != question->qtype) {
-      any_rrset = dns_trie_lookup(trie, question->qname, check_types[i]);
-      if (any_rrset) {
-        result->rcode = DNS_RCODE_NOERROR;
-        break;
+  // NODATA when the name exists, NXDOMAIN otherwise, both carry the zone SOA
+  result->rcode = (match.match != DNS_TRIE_MATCH_NONE) ? DNS_RCODE_NOERROR : DNS_RCODE_NXDOMAIN;
+  add_zone_soa(match.zone, result);
+  return 0;
+}
+
+bool dns_resolve_precompiled(dns_trie_t *trie,
+    const dns_question_view_t *view,
+    dns_precompiled_answer_t *answer) {
+  if (!trie || !view || !answer) return false;
+  if (view->qtype == 0 || view->qclass != DNS_CLASS_IN) return false;
+
+  dns_trie_match_result_t match;
+  dns_trie_find_name(trie, &view->name, &match);
+
+  // wildcards are encoded behind their own name, not the query's
+  if (!match.zone || !match.zone->authoritative) return false;
+  if (match.match == DNS_TRIE_MATCH_WILDCARD) return false;
+  if (match.node && match.node->cname) return false;
+
+  rrset_entry_t *entry = match.node ? rrset_map_entry(match.node->rrsets, view->qtype) : NULL;
+  if (entry) {
+    if (!entry->fragment) return false;
+
+    answer->answer = entry->fragment;
+    answer->authority = NULL;
+    answer->rcode = DNS_RCODE_NOERROR;
+    return true;
+  }
+
+  // same split as dns_resolve_query_view, NODATA when the name exists
+  if (!match.zone->soa_fragment) return false;
+
+  answer->answer = NULL;
+  answer->authority = match.zone->soa_fragment;
+  answer->rcode = (match.match == DNS_TRIE_MATCH_EXACT) ? DNS_RCODE_NOERROR : DNS_RCODE_NXDOMAIN;
+  return true;
+}
+
+// the host a record hands the client, which it would otherwise look up next
+static const char *additional_target(const dns_rr_t *rr) {
+  switch (rr->type) {
+    case DNS_TYPE_NS: return rr->rdata.ns.nsdname;
+    case DNS_TYPE_MX: return rr->rdata.mx.exchange;
+    case DNS_TYPE_SRV: return rr->rdata.srv.target;
+    default: return NULL;
+  }
+}
+
+bool dns_type_has_additional(uint16_t qtype) {
+  return qtype == DNS_TYPE_NS || qtype == DNS_TYPE_MX || qtype == DNS_TYPE_SRV;
+}
+
+// targets repeat (two MX on one host), the trie hands out the same RRset
+static bool section_contains(const dns_section_t *section, const dns_rrset_t *rrset) {
+  for (int i = 0; i < section->rrset_count; ++i) {
+    if (section->rrsets[i].rrset == rrset) return true;
+  }
+  return false;
+}
+
+static int add_target_addresses(dns_trie_t *trie, const char *target,
+                                dns_resolution_result_t *result) {
+  dns_trie_match_result_t match;
+  dns_trie_find(trie, target, &match);
+
+  // only data we serve, a wildcard would invent addresses for any host
+  if (match.match != DNS_TRIE_MATCH_EXACT || !match.zone || !match.zone->authoritative) return 0;
+
+  static const dns_record_type_t types[] = {DNS_TYPE_A, DNS_TYPE_AAAA};
+  int added = 0;
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+    dns_rrset_t *rrset = rrset_map_lookup(match.node->rrsets, types[i]);
+    if (!rrset || !rrset->records || section_contains(&result->additional, rrset)) continue;
+
+    if (!dns_resolution_result_add(result, DNS_SECTION_ADDITIONAL, rrset, target, rrset->ttl)) break;
+    ++added;
+  }
+  return added;
+}
+
+int dns_resolve_additional(dns_trie_t *trie, dns_resolution_result_t *result) {
+  if (!trie || !result) return 0;
+
+  const dns_section_t *sections[] = {&result->answer, &result->authority};
+  int added = 0;
+  for (int s = 0; s < 2; ++s) {
+    const dns_section_t *section = sections[s];
+    for (int i = 0; i < section->rrset_count; ++i) {
+      if (!dns_type_has_additional(section->rrsets[i].rrset->type)) continue;
+
+      for (const dns_rr_t *rr = section->rrsets[i].rrset->records; rr; rr = rr->next) {
+        const char *target = additional_target(rr);
+        if (target) added += add_target_addresses(trie, target, result);
       }
     }
   }
+  return added;
+}
 
-  // if we get here, domain does not exist (NXDOMAIN)
-  if (!any_rrset) result->rcode = DNS_RCODE_NXDOMAIN;
+void dns_resolution_result_minimize(dns_resolution_result_t *result) {
+  if (!result) return;
 
-  dns_add_authority_soa(trie, question->qname, result);
-  return 0;
+  if (result->answer_count > 0) {
+    dns_section_clear(&result->authority);
+    result->authority_count = 0;
+  }
+  dns_section_clear(&result->additional);
+  result->additional_count = 0;
 }
 
 static bool is_in_cname_chain(const dns_cname_chain_t *chain, const char *name) {
@@ -167,6 +383,10 @@ int dns_resolve_cname_chain(dns_trie_t *trie,
   chain->count = 0;
   char curr_name[MAX_DOMAIN_NAME];
   dns_safe_strncpy(curr_name, start_name, sizeof(curr_name));
+
+  // past the first link the owner is the target of the CNAME before it, the
+  // result holds a reference to that RRset so the name outlives the call
+  const char *owner = NULL;
   while (chain->count < DNS_MAX_CNAME_CHAIN) {
     // check for loop
     if (is_in_cname_chain(chain, curr_name)) {
@@ -179,50 +399,43 @@ int dns_resolve_cname_chain(dns_trie_t *trie,
     dns_safe_strncpy(chain->names[chain->count], curr_name, sizeof(chain->names[chain->count]));
     chain->count++;
 
-    // look for CNAME at current name
-    uint32_t cname_ttl;
-    dns_cname_t *cname = dns_trie_lookup_cname(trie, curr_name, &cname_ttl);
-
-    if (cname) {
-      // found CNAME, add to answer section
-      dns_rr_t *cname_rr = dns_rr_create(DNS_TYPE_CNAME, DNS_CLASS_IN, cname_ttl);
-      if (!cname_rr) {
-        DNS_ERROR_SET(err, DNS_ERR_MEMORY_ALLOCATION, "Failed to create CNAME record");
-        result->rcode = DNS_RCODE_SERVFAIL;
-        return -1;
-      }
+    // a single descent finds the exact node or the wildcard that covers the name
+    dns_trie_match_result_t match;
+    dns_trie_find(trie, curr_name, &match);
+    dns_trie_node_t *node = match.node;
 
-      dns_safe_strncpy(cname_rr->rdata.cname.cname, cname->cname, sizeof(cname_rr->rdata.cname.cname));
-      dns_rr_list_append(&result->answer_list, &result->answer_count, cname_rr);
+    if (node && node->cname) {
+      // found CNAME, add to answer section (owner is the name being resolved)
+      dns_resolution_result_add(result, DNS_SECTION_ANSWER, node->cname, owner, node->cname->ttl);
 
       // follow the CNAME
-      dns_safe_strncpy(curr_name, cname->cname, sizeof(curr_name));
+      owner = node->cname->records->rdata.cname.cname;
+      dns_safe_strncpy(curr_name, owner, sizeof(curr_name));
       continue;
     }
 
     // no CNAME, look for the requested type
-    dns_rrset_t *rrset = dns_trie_lookup(trie, curr_name, qtype);
+    dns_rrset_t *rrset = node ? rrset_map_lookup(node->rrsets, qtype) : NULL;
     if (rrset) {
-      // found target records
-      for (dns_rr_t *rr = rrset->records; rr != NULL; rr = rr->next) {
-        dns_rr_t *copy = dns_rr_copy(rr);
-        if (copy) {
-          dns_rr_list_append(&result->answer_list, &result->answer_count, copy);
-        }
+      // found target records; wildcard answers are served from the source
+      // RRset as-is since the owner name is applied at encode time
+      dns_resolution_result_add(result, DNS_SECTION_ANSWER, rrset, owner, rrset->ttl);
+      if (chain->count == 1 && match.match == DNS_TRIE_MATCH_WILDCARD) {
+        result->encloser_labels = match.encloser_labels;
       }
       return 0;
     }
 
     // no CNAME and no target record
-    if (chain->count > 1) {
-      // if we followed at least one CNAME, NOERROR
+    if (chain->count > 1 || match.match != DNS_TRIE_MATCH_NONE) {
+      // followed at least one CNAME, or the name exists without this type (NODATA)
       result->rcode = DNS_RCODE_NOERROR;
-      return 0;
     } else {
-      // if this is the original query name, NXDOMAIN
+      // the original query name does not exist
       result->rcode = DNS_RCODE_NXDOMAIN;
-      return 0;
+      result->encloser_labels = match.encloser_labels;
     }
+    return 0;
   }
 
   // chain too long
@@ -237,23 +450,7 @@ int dns_add_authority_soa(dns_trie_t *trie,
                           dns_resolution_result_t *result) {
   if (!trie || !domain || !result) return -1;
 
-  dns_zone_t *zone = dns_trie_find_zone(trie, domain);
-  if (!zone || !zone->soa) return -1;
-
-  dns_rr_t *soa_rr = dns_rr_create(DNS_TYPE_SOA, DNS_CLASS_IN, zone->soa->minimum);
-  if (!soa_rr) return -1;
-
-  memcpy(&soa_rr->rdata.soa, zone->soa, sizeof(dns_soa_t));
-  dns_safe_strncpy(result->authority_zone_name, zone->zone_name, sizeof(result->authority_zone_name));
-
-  // add SOA to authority list
-  if (dns_rr_list_append(&result->authority_list, &result->authority_count, soa_rr)) {
-    if (zone->authoritative) result->authoritative = true;
-    return 0;
-  }
-
-  dns_rr_free(soa_rr);
-  return -1;
+  return add_zone_soa(dns_trie_find_zone(trie, domain), result);
 }
 
 static void dns_resolver_cache_store(dns_resolver_t *resolver,
@@ -262,41 +459,7 @@ static void dns_resolver_cache_store(dns_resolver_t *resolver,
   if (!resolver || !resolver->cache_enabled || !resolver->cache) return;
   if (!question || !result) return;
 
-  if (result->rcode == DNS_RCODE_NOERROR && result->answer_list) {
-    uint32_t min_ttl = UINT32_MAX;
-    int count = 0;
-
-    for (dns_rr_t *rr = result->answer_list; rr != NULL; rr = rr->next) {
-      if (rr->ttl < min_ttl) min_ttl = rr->ttl; // min(rr->ttl, min_ttl)
-      ++count;
-    }
-
-    if (min_ttl > 0 && count > 0) {
-      dns_cache_insert(resolver->cache,
-                       question->qname,
-                       question->qtype,
-                       question->qclass,
-                       result->answer_list,
-                       count,
-                       min_ttl);
-    }
-  } else if (result->rcode == DNS_RCODE_NXDOMAIN) {
-    // cache negative response (default 5 minutes)
-    uint32_t ttl = 300;
-
-    // get TTL from SOA if available
-    if (result->authority_list && result->authority_list->type == DNS_TYPE_SOA) {
-      ttl = result->authority_list->rdata.soa.minimum;
-    }
-
-    dns_cache_insert_negative(resolver->cache,
-                              question->qname,
-                              question->qtype,
-                              question->qclass,
-                              DNS_CACHE_TYPE_NXDOMAIN,
-                              DNS_RCODE_NXDOMAIN,
-                              ttl);
-  }
+  dns_resolution_cache_store(resolver->cache, question, result);
 }
 
 static bool dns_resolver_cache_lookup(dns_resolver_t *resolver,
@@ -305,32 +468,20 @@ static bool dns_resolver_cache_lookup(dns_resolver_t *resolver,
   if (!resolver || !resolver->cache_enabled || !resolver->cache) return false;
   if (!question || !result) return false;
 
-  dns_cache_result_t *cache_result = dns_cache_lookup(resolver->cache,
-                                                      question->qname,
-                                                      question->qtype,
-                                                      question->qclass);
-  if (!cache_result) {
-    resolver->cache_misses++;
+  dns_cache_result_t cache_result;
+  if (!dns_cache_lookup_into(resolver->cache,
+                             question->qname,
+                             question->qtype,
+                             question->qclass,
+                             &cache_result)) {
+    dns_stats_inc(resolver->stats, DNS_STAT_RESOLVER_CACHE_MISSES);
     return false;
   }
 
-  resolver->cache_hits++;
-
-  if (cache_result->type == DNS_CACHE_TYPE_POSITIVE) {
-    result->answer_list = cache_result->records;
-    result->answer_count = cache_result->record_count;
-    result->rcode = DNS_RCODE_NOERROR;
+  dns_stats_inc(resolver->stats, DNS_STAT_RESOLVER_CACHE_HITS);
 
-    cache_result->records = NULL; // prevent double-free
-  } else if (cache_result->type == DNS_CACHE_TYPE_NXDOMAIN) {
-    result->rcode = DNS_RCODE_NXDOMAIN;
-    result->answer_count = 0;
-  } else {
-    result->rcode = DNS_RCODE_NOERROR;
-    result->answer_count = 0;
-  }
-
-  dns_cache_result_free(cache_result);
+  dns_resolution_result_from_cache(result, &cache_result);
+  dns_cache_result_clear(&cache_result);
   return true;
 }
 
@@ -352,10 +503,15 @@ dns_resolver_t *dns_resolver_create(void) {
     return NULL;
   }
 
+  resolver->stats = dns_stats_create();
+  if (!resolver->stats) {
+    dns_cache_free(resolver->cache);
+    dns_trie_free(resolver->trie);
+    free(resolver);
+    return NULL;
+  }
+
   resolver->cache_enabled = true;
-  resolver->queries = 0;
-  resolver->cache_hits = 0;
-  resolver->cache_misses = 0;
   return resolver;
 }
 
@@ -364,6 +520,7 @@ void dns_resolver_free(dns_resolver_t *resolver) {
 
   if (resolver->trie) dns_trie_free(resolver->trie);
   if (resolver->cache) dns_cache_free(resolver->cache);
+  dns_stats_free(resolver->stats);
   free(resolver);
 }
 
@@ -378,7 +535,7 @@ int dns_resolver_query_with_cache(dns_resolver_t *resolver,
                                    dns_error_t *err) {
   if (!resolver || !question || !result) return -1;
 
-  resolver->queries++;
+  dns_stats_inc(resolver->stats, DNS_STAT_RESOLVER_QUERIES);
 
   // try cache first
   if (dns_resolver_cache_lookup(resolver, question, result)) {
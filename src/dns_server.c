@@ -1,6 +1,8 @@
 #include "dns_server.h"
+#include "dns_rdata.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/select.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -22,6 +24,12 @@ dns_server_config_t *dns_server_config_create(void) {
   config->recursion_timeout = DNS_RECURSIVE_TIMEOUT_SEC;
   config->max_recursion_depth = DNS_MAX_RECURSION_DEPTH;
   config->upstream_count = 0;
+  config->latency_histograms = true;
+  config->heavy_hitters = true;
+  config->log_level = DNS_LOG_INFO;
+  config->querylog_sample = 1;
+  config->querylog_rotate_mb = 64;
+  config->querylog_keep = 4;
 
   return config;
 }
@@ -30,12 +38,42 @@ void dns_server_config_free(dns_server_config_t *config) {
   if (config) free(config);
 }
 
+// "rrset_order <mode>" for every RRset, "rrset_order <name> <type|ANY> <mode>"
+// for the RRsets of one owner name
+static void config_rrset_order(dns_server_config_t *config, const char *line) {
+  char args[3][256];
+  int argc = sscanf(line, "%*s %255s %255s %255s", args[0], args[1], args[2]);
+
+  dns_rrset_order_t order;
+  if (argc == 1) {
+    if (dns_rrset_order_from_text(args[0], &order) < 0) {
+      DNS_LOG_WARN("Unknown rrset_order '%s', keeping records in zone order", args[0]);
+      return;
+    }
+    config->rrset_order.fallback = order;
+    return;
+  }
+  if (argc != 3) {
+    DNS_LOG_WARN("rrset_order takes a mode, or a name, a type and a mode");
+    return;
+  }
+
+  uint16_t type = strcasecmp(args[1], "ANY") == 0 ? 0 : dns_rdata_type_from_text(args[1]);
+  if (type == 0 && strcasecmp(args[1], "ANY") != 0) {
+    DNS_LOG_WARN("Unknown type '%s' in rrset_order for %s", args[1], args[0]);
+  } else if (dns_rrset_order_from_text(args[2], &order) < 0) {
+    DNS_LOG_WARN("Unknown rrset_order '%s' for %s", args[2], args[0]);
+  } else if (dns_rrset_order_policy_add(&config->rrset_order, args[0], type, order) < 0) {
+    DNS_LOG_WARN("More than %d rrset_order rules, %s is left out", DNS_RRSET_ORDER_RULES, args[0]);
+  }
+}
+
 int dns_server_config_load(dns_server_config_t *config, const char *config_file) {
   if (!config) return -1;
 
   FILE *file = fopen(config_file, "r");
   if (!file) {
-    printf("Config file not found, using defaults\n");
+    DNS_LOG_INFO("Config file not found, using defaults");
     return 0;
   }
 
@@ -51,6 +89,30 @@ int dns_server_config_load(dns_server_config_t *config, const char *config_file)
         config->port = (uint16_t) atoi(value);
       } else if (strcmp(key, "recursion") == 0) {
         config->enable_recursion = (strcmp(value, "yes") == 0 || strcmp(value, "true") == 0);
+      } else if (strcmp(key, "minimal_responses") == 0) {
+        config->minimal_responses = (strcmp(value, "yes") == 0 || strcmp(value, "true") == 0);
+      } else if (strcmp(key, "metrics_port") == 0) {
+        config->metrics_port = (uint16_t) atoi(value);
+      } else if (strcmp(key, "latency_histograms") == 0) {
+        config->latency_histograms = (strcmp(value, "yes") == 0 || strcmp(value, "true") == 0);
+      } else if (strcmp(key, "heavy_hitters") == 0) {
+        config->heavy_hitters = (strcmp(value, "yes") == 0 || strcmp(value, "true") == 0);
+      } else if (strcmp(key, "log_level") == 0) {
+        config->log_level = dns_log_level_from_string(value);
+      } else if (strcmp(key, "log_file") == 0) {
+        dns_safe_strncpy(config->log_file, value, sizeof(config->log_file));
+      } else if (strcmp(key, "querylog_file") == 0) {
+        dns_safe_strncpy(config->querylog_file, value, sizeof(config->querylog_file));
+      } else if (strcmp(key, "querylog_sample") == 0) {
+        config->querylog_sample = (uint32_t) strtoul(value, NULL, 10);
+      } else if (strcmp(key, "querylog_rotate_mb") == 0) {
+        config->querylog_rotate_mb = (uint32_t) strtoul(value, NULL, 10);
+      } else if (strcmp(key, "querylog_keep") == 0) {
+        config->querylog_keep = (uint32_t) strtoul(value, NULL, 10);
+      } else if (strcmp(key, "control_socket") == 0) {
+        dns_safe_strncpy(config->control_socket, value, sizeof(config->control_socket));
+      } else if (strcmp(key, "rrset_order") == 0) {
+        config_rrset_order(config, line);
       } else if (strcmp(key, "root_hints") == 0) {
         dns_safe_strncpy(config->root_hints_file, value, sizeof(config->root_hints_file));
       } else if (strcmp(key, "zone_file") == 0) {
@@ -58,12 +120,15 @@ int dns_server_config_load(dns_server_config_t *config, const char *config_file)
       } else if (strcmp(key, "forwarder") == 0 && config->upstream_count < 8) {
         dns_safe_strncpy(config->upstream_servers[config->upstream_count], value, sizeof(config->upstream_servers[config->upstream_count]));
         config->upstream_count++;
+      } else if (strcmp(key, "allow_update") == 0 && config->allow_update_count < DNS_MAX_UPDATE_CLIENTS) {
+        dns_safe_strncpy(config->allow_update[config->allow_update_count], value, sizeof(config->allow_update[config->allow_update_count]));
+        config->allow_update_count++;
       }
     }
   }
 
   fclose(file);
-  printf("Loaded configuration file from %s\n", config_file);
+  DNS_LOG_INFO("Loaded configuration file from %s", config_file);
   return 0;
 }
 
@@ -78,9 +143,26 @@ dns_server_t *dns_server_create_with_config(const dns_server_config_t *config) {
   server->port = config->port;
   server->enable_recursion = config->enable_recursion;
   server->enable_cache = true;
+  server->minimal_responses = config->minimal_responses;
+  server->metrics_port = config->metrics_port;
+  dns_safe_strncpy(server->control_path, config->control_socket, sizeof(server->control_path));
+
+  server->stats = dns_stats_create();
+  if (!server->stats) goto err_stats;
+
+  if (config->latency_histograms) {
+    server->latency = dns_latency_create();
+    if (!server->latency) goto err_latency;
+  }
+
+  if (config->heavy_hitters) {
+    server->hitters = dns_hitters_create();
+    if (!server->hitters) goto err_hitters;
+  }
 
   server->trie = dns_trie_create();
   if (!server->trie) goto err_trie;
+  server->trie->rrset_order = config->rrset_order;
 
   server->cache = dns_cache_create(DNS_CACHE_DEFAULT_SIZE);
   if (!server->cache) goto err_cache;
@@ -94,26 +176,44 @@ dns_server_t *dns_server_create_with_config(const dns_server_config_t *config) {
   if (config->enable_recursion) {
     server->recursive_resolver = dns_recursive_create();
     if (server->recursive_resolver) {
+      server->recursive_resolver->latency = server->latency;
       if (dns_recursive_init_socket(server->recursive_resolver) < 0) {
-        printf("WARNING: Failed to initialize recursive resolver socket\n");
+        DNS_LOG_WARN("Failed to initialize recursive resolver socket");
         server->enable_recursion = false;
       }
 
       // try to load root hints
       if (dns_recursive_load_root_hints_file(server->recursive_resolver,
                                              config->root_hints_file) < 0) {
-        printf("WARNING: Failed to load root hints, using built-in\n");
+        DNS_LOG_WARN("Failed to load root hints, using built-in");
         dns_recursive_load_root_hints(server->recursive_resolver);
       }
 
       // add upstream forwarders if configured
       if (config->upstream_count > 0) {
-        printf("Configuring %d upstream forwarders\n", config->upstream_count);
+        DNS_LOG_INFO("Configuring %d upstream forwarders", config->upstream_count);
         // TODO: implement forwarder mode
       }
     }
   }
 
+  for (int i = 0; i < config->allow_update_count; ++i) {
+    if (dns_server_allow_update(server, config->allow_update[i]) < 0) {
+      DNS_LOG_WARN("Ignoring invalid allow_update address %s", config->allow_update[i]);
+    }
+  }
+
+  if (strlen(config->querylog_file) > 0) {
+    server->querylog = dns_querylog_create(config->querylog_file, config->querylog_sample,
+                                           (uint64_t)config->querylog_rotate_mb << 20,
+                                           config->querylog_keep);
+    if (server->querylog) {
+      DNS_LOG_INFO("Logging 1 in %u queries to %s", server->querylog->sample, config->querylog_file);
+    } else {
+      DNS_LOG_WARN("Failed to open query log %s", config->querylog_file);
+    }
+  }
+
   return server;
 
 err_maintainer_start:
@@ -126,6 +226,12 @@ err_cache:
   dns_trie_free(server->trie);
   server->trie = NULL;
 err_trie:
+  dns_hitters_free(server->hitters);
+err_hitters:
+  dns_latency_free(server->latency);
+err_latency:
+  dns_stats_free(server->stats);
+err_stats:
   free(server);
 err_alloc:
   return NULL;
@@ -141,6 +247,15 @@ dns_server_t *dns_server_create(uint16_t port) {
   server->enable_recursion = false;
   server->enable_cache = true;
 
+  server->stats = dns_stats_create();
+  if (!server->stats) goto err_stats;
+
+  server->latency = dns_latency_create();
+  if (!server->latency) goto err_latency;
+
+  server->hitters = dns_hitters_create();
+  if (!server->hitters) goto err_hitters;
+
   server->trie = dns_trie_create();
   if (!server->trie) goto err_trie;
 
@@ -155,14 +270,15 @@ dns_server_t *dns_server_create(uint16_t port) {
   // create and initialize recursive resolver
   server->recursive_resolver = dns_recursive_create();
   if (!server->recursive_resolver) {
-    printf("WARNING: Failed to create recursive resolver\n");
+    DNS_LOG_WARN("Failed to create recursive resolver");
   } else {
+    server->recursive_resolver->latency = server->latency;
     if (dns_recursive_init_socket(server->recursive_resolver) < 0) {
-      printf("WARNING: Failed to initialize recursive resolver socket\n");
+      DNS_LOG_WARN("Failed to initialize recursive resolver socket");
     } else {
       server->enable_recursion = true;
       if (dns_recursive_load_root_hints(server->recursive_resolver) < 0) {
-        printf("WARNING: Failed to load root hints\n");
+        DNS_LOG_WARN("Failed to load root hints");
         server->enable_recursion = false;
       }
     }
@@ -180,6 +296,12 @@ err_cache:
   dns_trie_free(server->trie);
   server->trie = NULL;
 err_trie:
+  dns_hitters_free(server->hitters);
+err_hitters:
+  dns_latency_free(server->latency);
+err_latency:
+  dns_stats_free(server->stats);
+err_stats:
   free(server);
 err_alloc:
   return NULL;
@@ -189,6 +311,8 @@ void dns_server_free(dns_server_t *server) {
   if (!server) return;
 
   if (server->socket_fd >= 0) close(server->socket_fd);
+  dns_metrics_free(server->metrics);
+  dns_control_free(server->control);
 
   if (server->cache_maintainer) {
     dns_cache_maintainer_stop(server->cache_maintainer);
@@ -198,10 +322,193 @@ void dns_server_free(dns_server_t *server) {
   if (server->recursive_resolver) dns_recursive_free(server->recursive_resolver);
   if (server->cache) dns_cache_free(server->cache);
   if (server->trie) dns_trie_free(server->trie);
+  dns_latency_free(server->latency);
+  dns_hitters_free(server->hitters);
+  dns_stats_free(server->stats);
+  dns_querylog_free(server->querylog);
 
   free(server);
 }
 
+void dns_server_stats(const dns_server_t *server, dns_stats_snapshot_t *snapshot) {
+  if (!snapshot) return;
+
+  memset(snapshot, 0, sizeof(*snapshot));
+  if (!server) return;
+
+  // each object only counts its own rows of the table, so the sum is the lot
+  dns_stats_accumulate(server->stats, snapshot);
+  if (server->cache) dns_stats_accumulate(server->cache->stats, snapshot);
+  if (server->recursive_resolver) {
+    dns_stats_accumulate(server->recursive_resolver->stats, snapshot);
+  }
+}
+
+void dns_server_write_metrics(const dns_server_t *server, dns_metrics_buffer_t *buf) {
+  if (!server || !buf) return;
+
+  dns_stats_snapshot_t snapshot;
+  dns_server_stats(server, &snapshot);
+
+  dns_metrics_write_stats(buf, &snapshot);
+  dns_metrics_write_latency(buf, server->latency);
+  dns_metrics_write_cache(buf, server->cache);
+  dns_metrics_write_trie(buf, server->trie);
+  dns_metrics_write_upstreams(buf, server->recursive_resolver);
+  dns_metrics_write_hitters(buf, server->hitters);
+
+  if (server->querylog) {
+    dns_metrics_family(buf, "dns_querylog_records_total", "counter", "queries written to the query log");
+    dns_metrics_appendf(buf, "dns_querylog_records_total %lu\n",
+                        (unsigned long)atomic_load(&server->querylog->records));
+    dns_metrics_family(buf, "dns_querylog_dropped_total", "counter",
+                       "queries left out of the query log because a ring was full");
+    dns_metrics_appendf(buf, "dns_querylog_dropped_total %lu\n",
+                        (unsigned long)atomic_load(&server->querylog->dropped));
+  }
+
+  dns_metrics_family(buf, "dns_log_dropped_total", "counter", "log lines dropped because a ring was full");
+  dns_metrics_appendf(buf, "dns_log_dropped_total %lu\n", (unsigned long)dns_log_dropped());
+}
+
+static bool parse_u32(const char *text, uint32_t *value) {
+  char *end;
+  errno = 0;
+  unsigned long n = strtoul(text, &end, 10);
+  if (errno != 0 || end == text || *end != '\0' || n > UINT32_MAX || text[0] == '-') return false;
+
+  *value = (uint32_t)n;
+  return true;
+}
+
+static const char control_help[] =
+  "stats                        counters and gauges, the text of a metrics scrape\n"
+  "flush <name>                 drop every cached type of a name\n"
+  "flush_suffix <name>          drop a name and everything below it\n"
+  "flush_all                    empty the cache\n"
+  "dump [max]                   the cache entries, streamed\n"
+  "set_ttl_limits <min> <max>   clamp the TTLs of new cache entries\n"
+  "set_negative_ttl <ttl>       TTL of new negative cache entries\n"
+  "reload                       read the zone file again\n";
+
+void dns_server_control(dns_server_t *server, dns_control_t *control, const char *command) {
+  if (!server || !control || !command) return;
+
+  char line[DNS_CONTROL_REQUEST_SIZE];
+  dns_safe_strncpy(line, command, sizeof(line));
+
+  char *argv[4];
+  int argc = 0;
+  char *save = NULL;
+  for (char *arg = strtok_r(line, " \t", &save); arg; arg = strtok_r(NULL, " \t", &save)) {
+    if (argc == 4) {
+      dns_control_error(control, "too many arguments");
+      return;
+    }
+    argv[argc++] = arg;
+  }
+  if (argc == 0) {
+    dns_control_error(control, "empty command, try help");
+    return;
+  }
+
+  dns_metrics_buffer_t *reply = &control->reply;
+  const char *name = argv[0];
+  if (strcmp(name, "stats") != 0 && strcmp(name, "dump") != 0 && strcmp(name, "help") != 0) {
+    DNS_LOG_INFO("Control command: %s", command);
+  }
+
+  if (strcmp(name, "help") == 0) {
+    dns_metrics_appendf(reply, "%s", control_help);
+  } else if (strcmp(name, "stats") == 0 && argc == 1) {
+    dns_server_write_metrics(server, reply);
+  } else if ((strcmp(name, "flush") == 0 || strcmp(name, "flush_suffix") == 0) && argc == 2) {
+    int removed = strcmp(name, "flush") == 0 ? dns_cache_remove_name(server->cache, argv[1])
+                                             : dns_cache_remove_suffix(server->cache, argv[1]);
+    if (removed < 0) {
+      dns_control_error(control, "cannot flush '%s'", argv[1]);
+    } else {
+      dns_metrics_appendf(reply, "flushed %d entries\n", removed);
+    }
+  } else if (strcmp(name, "flush_all") == 0 && argc == 1 && server->cache) {
+    size_t removed = server->cache->current_entries;
+    dns_cache_clear(server->cache);
+    dns_metrics_appendf(reply, "flushed %zu entries\n", removed);
+  } else if (strcmp(name, "dump") == 0 && argc <= 2) {
+    uint32_t max = 0;
+    if (argc == 2 && (!parse_u32(argv[1], &max) || max > INT32_MAX)) {
+      dns_control_error(control, "bad entry count '%s'", argv[1]);
+      return;
+    }
+    dns_control_dump_start(control, (int)max);
+    dns_control_dump_next(control, server->cache);
+  } else if (strcmp(name, "set_ttl_limits") == 0 && argc == 3 && server->cache) {
+    uint32_t min_ttl;
+    uint32_t max_ttl;
+    if (!parse_u32(argv[1], &min_ttl) || !parse_u32(argv[2], &max_ttl) || min_ttl > max_ttl) {
+      dns_control_error(control, "bad TTL limits '%s' '%s'", argv[1], argv[2]);
+      return;
+    }
+    dns_cache_set_ttl_limits(server->cache, min_ttl, max_ttl);
+    dns_metrics_appendf(reply, "ttl limits %u to %u\n", min_ttl, max_ttl);
+  } else if (strcmp(name, "set_negative_ttl") == 0 && argc == 2 && server->cache) {
+    uint32_t ttl;
+    if (!parse_u32(argv[1], &ttl)) {
+      dns_control_error(control, "bad TTL '%s'", argv[1]);
+      return;
+    }
+    dns_cache_set_negative_ttl(server->cache, ttl);
+    dns_metrics_appendf(reply, "negative ttl %u\n", ttl);
+  } else if (strcmp(name, "reload") == 0 && argc == 1) {
+    zone_load_result_t result;
+    if (strlen(server->zone_file) == 0) {
+      dns_control_error(control, "no zone file was loaded");
+    } else if (dns_server_reload_zone(server, &result) < 0) {
+      dns_control_error(control, "%s did not load, the old zone is still served", server->zone_file);
+    } else {
+      dns_metrics_appendf(reply, "reloaded %s, %d records, %d errors\n",
+                          server->zone_name, result.records_loaded, result.errors_encountered);
+    }
+  } else {
+    dns_control_error(control, "unknown command or wrong arguments: %s, try help", name);
+  }
+}
+
+int dns_server_load_zone(dns_server_t *server, const char *filename, const char *zone_name,
+                         zone_load_result_t *result) {
+  if (!server || !filename || !zone_name || !result) return -1;
+
+  dns_trie_t *trie = dns_trie_create();
+  if (!trie) return -1;
+  if (server->trie) trie->rrset_order = server->trie->rrset_order;
+
+  if (zone_load_file(trie, filename, zone_name, result) < 0) {
+    dns_trie_free(trie);
+    return -1;
+  }
+
+  // answers handed out earlier hold references to their RRsets, not the trie
+  dns_trie_free(server->trie);
+  server->trie = trie;
+
+  // the cache only holds answers from the old zone, NXDOMAIN and wildcard
+  // answers included, none of them can be trusted against the new one
+  dns_cache_clear(server->cache);
+
+  if (filename != server->zone_file) {
+    dns_safe_strncpy(server->zone_file, filename, sizeof(server->zone_file));
+  }
+  if (zone_name != server->zone_name) {
+    dns_safe_strncpy(server->zone_name, zone_name, sizeof(server->zone_name));
+  }
+  return 0;
+}
+
+int dns_server_reload_zone(dns_server_t *server, zone_load_result_t *result) {
+  if (!server || strlen(server->zone_file) == 0) return -1;
+  return dns_server_load_zone(server, server->zone_file, server->zone_name, result);
+}
+
 int dns_server_start(dns_server_t *server) {
   if (!server) return -1;
   if (server->socket_fd >= 0) return -1; // already started
@@ -209,14 +516,14 @@ int dns_server_start(dns_server_t *server) {
   // create UDP socket
   server->socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
   if (server->socket_fd < 0) {
-    perror("socket creation failed");
+    DNS_LOG_ERROR("socket creation failed: %s", strerror(errno));
     return -1;
   }
 
   // set socket options
   int opt = 1;
   if (setsockopt(server->socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-    perror("setsockopt failed");
+    DNS_LOG_ERROR("setsockopt failed: %s", strerror(errno));
     close(server->socket_fd);
     server->socket_fd = -1;
     return -1;
@@ -229,14 +536,33 @@ int dns_server_start(dns_server_t *server) {
   server_addr.sin_port = htons(server->port);
 
   if (bind(server->socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-    perror("bind failed");
+    DNS_LOG_ERROR("bind failed: %s", strerror(errno));
     close(server->socket_fd);
     server->socket_fd = -1;
     return -1;
   }
 
+  // metrics are optional, the server runs without them
+  if (server->metrics_port > 0) {
+    server->metrics = dns_metrics_create(server->metrics_port);
+    if (server->metrics) {
+      DNS_LOG_INFO("Metrics on http://127.0.0.1:%d/metrics", server->metrics_port);
+    } else {
+      DNS_LOG_WARN("Failed to open metrics port %d", server->metrics_port);
+    }
+  }
+
+  if (strlen(server->control_path) > 0) {
+    server->control = dns_control_create(server->control_path);
+    if (server->control) {
+      DNS_LOG_INFO("Control socket at %s", server->control_path);
+    } else {
+      DNS_LOG_WARN("Failed to open control socket %s", server->control_path);
+    }
+  }
+
   server->running = true;
-  printf("DNS server listening on port %d\n", server->port);
+  DNS_LOG_INFO("DNS server listening on port %d", server->port);
   return 0;
 }
 
@@ -249,6 +575,58 @@ void dns_server_stop(dns_server_t *server) {
     close(server->socket_fd);
     server->socket_fd = -1;
   }
+
+  dns_metrics_free(server->metrics);
+  server->metrics = NULL;
+  dns_control_free(server->control);
+  server->control = NULL;
+}
+
+int dns_server_allow_update(dns_server_t *server, const char *ip) {
+  if (!server || !ip) return -1;
+  if (server->update_client_count >= DNS_MAX_UPDATE_CLIENTS) return -1;
+
+  struct in_addr addr;
+  if (inet_pton(AF_INET, ip, &addr) != 1) return -1;
+
+  server->update_clients[server->update_client_count++] = addr;
+  return 0;
+}
+
+static bool dns_server_update_allowed(const dns_server_t *server, const dns_request_t *request) {
+  if (request->client_addr.ss_family != AF_INET) return false;
+
+  const struct sockaddr_in *client = (const struct sockaddr_in *) &request->client_addr;
+  for (int i = 0; i < server->update_client_count; ++i) {
+    if (server->update_clients[i].s_addr == client->sin_addr.s_addr) return true;
+  }
+  return false;
+}
+
+static int dns_server_handle_update(dns_server_t *server,
+                                    const dns_request_t *request,
+                                    uint16_t id,
+                                    dns_response_t *response,
+                                    dns_error_t *err) {
+  dns_update_result_t result;
+
+  if (!dns_server_update_allowed(server, request)) {
+    memset(&result, 0, sizeof(result));
+    result.rcode = DNS_RCODE_REFUSED;
+    dns_stats_inc(server->stats, DNS_STAT_UPDATES_REFUSED);
+  } else if (dns_update_process(server->trie,
+                                server->enable_cache ? server->cache : NULL,
+                                request->buffer,
+                                request->length,
+                                &result,
+                                err) < 0) {
+    return -1;
+  } else if (result.rcode == DNS_RCODE_NOERROR) {
+    dns_stats_inc(server->stats, DNS_STAT_UPDATES_APPLIED);
+  }
+
+  return dns_update_build_response(id, &result, response->buffer,
+                                   response->capacity, &response->length);
 }
 
 dns_response_t *dns_response_create(size_t capacity) {
@@ -272,15 +650,75 @@ void dns_response_free(dns_response_t *response) {
   free(response);
 }
 
+// entries without an owner belong to the question name, which sits right
+// after the header either as text we encoded or as the bytes we copied
+static int encode_section_rrset(uint8_t *buffer, size_t capacity, size_t *offset,
+                                const dns_section_rrset_t *entry, const char *qname,
+                                dns_compress_t *compress) {
+  if (entry->owner || qname) {
+    const char *name = entry->owner ? entry->owner : qname;
+    return dns_encode_rrset(buffer, capacity, offset, name, entry->rrset, entry->ttl, compress);
+  }
+  return dns_encode_rrset_owner_at(buffer, capacity, offset, 12, entry->rrset, entry->ttl, compress);
+}
+
+// what the client can take: 512 without EDNS (RFC 1035 4.2.1), its own
+// size with it but never less than 512 nor more than we advertise
+size_t dns_response_budget(const dns_message_t *query, size_t capacity) {
+  size_t budget = DNS_MAX_PACKET_SIZE;
+  if (query && query->edns.present) {
+    budget = query->edns.udp_size;
+    if (budget < DNS_MAX_PACKET_SIZE) budget = DNS_MAX_PACKET_SIZE;
+    if (budget > DNS_EDNS_UDP_SIZE) budget = DNS_EDNS_UDP_SIZE;
+  }
+  return budget < capacity ? budget : capacity;
+}
+
+// whole RRsets while they fit under budget, each one is encoded in place
+// with compression and rolled back, table entries included, if it runs
+// over. a required section stops at the first set that does not fit since
+// the order carries meaning (CNAME chains), an optional one tries the rest.
+// returns the records written
+static int encode_section(uint8_t *buffer, size_t budget, size_t *offset,
+                          const dns_section_t *section, const char *qname,
+                          dns_compress_t *compress, bool required, bool *complete) {
+  int count = 0;
+  *complete = true;
+
+  for (int i = 0; i < section->rrset_count; ++i) {
+    size_t rrset_start = *offset;
+    int written = encode_section_rrset(buffer, budget, offset, &section->rrsets[i], qname, compress);
+    if (written < 0) {
+      *offset = rrset_start;
+      dns_compress_truncate(compress, rrset_start);
+      *complete = false;
+      if (required) break;
+      continue;
+    }
+    count += written;
+  }
+  return count;
+}
+
 int dns_build_response(const dns_message_t *query,
                        const dns_resolution_result_t *resolution,
                        uint8_t *buffer, size_t capacity, size_t *length,
                        dns_error_t *err) {
+  return dns_build_response_sized(query, resolution, buffer, capacity, length, NULL, err);
+}
+
+int dns_build_response_sized(const dns_message_t *query,
+                             const dns_resolution_result_t *resolution,
+                             uint8_t *buffer, size_t capacity, size_t *length,
+                             unsigned *truncation, dns_error_t *err) {
   if (!query || !resolution || !buffer || !length) return -1;
+  if (truncation) *truncation = 0;
 
-  size_t offset = 0;
+  // the OPT goes last but its room is set aside before any record
+  size_t budget = dns_response_budget(query, capacity);
+  size_t opt_len = query->edns.present ? DNS_OPT_RR_LEN : 0;
 
-  // build response header
+  // counts are filled in once the sections are written
   dns_header_t response_header = {
     .id = query->header.id,
     .qr = DNS_QR_RESPONSE,
@@ -291,95 +729,168 @@ int dns_build_response(const dns_message_t *query,
     .ra = 0, // we don't support recursion yet
     .rcode = resolution->rcode,
     .qdcount = 1,
-    .ancount = resolution->answer_count,
-    .nscount = resolution->authority_count,
-    .arcount = resolution->additional_count
   };
 
-  if (dns_encode_header(buffer, capacity, &response_header) < 0) {
+  if (dns_encode_header(buffer, budget, &response_header) < 0) {
     DNS_ERROR_SET(err, DNS_ERR_BUFFER_TOO_SMALL, "Failed to encode header");
     return -1;
   }
-  offset = 12;
-
-  // encode question section
-  if (dns_encode_question(buffer, capacity, &offset, query->questions) < 0) {
+  size_t offset = 12;
+
+  // names after the question point back into it where they can
+  dns_compress_t compress;
+  dns_compress_init(&compress);
+
+  // encode question section, a parsed request is echoed byte for byte
+  const dns_question_view_t *view = query->has_question_view ? &query->question_view : NULL;
+  if (view) {
+    size_t question_len = (size_t)view->name.len + 4;
+    if (offset + question_len + opt_len > budget) {
+      DNS_ERROR_SET(err, DNS_ERR_BUFFER_TOO_SMALL, "Failed to encode question");
+      return -1;
+    }
+    memcpy(buffer + offset, view->msg + view->qname_offset, question_len);
+    dns_compress_add_wire(&compress, buffer, offset);
+    offset += question_len;
+  } else if (dns_encode_question_compressed(buffer, budget - opt_len, &offset, query->questions, &compress) < 0) {
     DNS_ERROR_SET(err, DNS_ERR_BUFFER_TOO_SMALL, "Failed to encode question");
     return -1;
   }
 
-  // encode answer section
-  for (dns_rr_t *rr = resolution->answer_list; rr != NULL; rr = rr->next) {
-    if (dns_encode_rr(buffer, capacity, &offset, query->questions[0].qname, rr) < 0) {
-      // truncate response
-      response_header.tc = 1;
-      response_header.ancount = 0;
-      response_header.nscount = 0;
-      response_header.arcount = 0;
+  const char *qname = view ? NULL : query->questions[0].qname;
+  size_t records_budget = budget - opt_len;
+  unsigned reasons = 0;
+  bool complete;
+
+  // answers are required, a set left out means the client has to retry
+  response_header.ancount = (uint16_t)encode_section(buffer, records_budget, &offset,
+      &resolution->answer, qname, &compress, true, &complete);
+  if (!complete) {
+    response_header.tc = 1;
+    reasons |= DNS_TRUNC_ANSWER;
+  }
 
-      offset = 12;
-      dns_encode_header(buffer, capacity, &response_header);
-      offset = 12;
-      dns_encode_question(buffer, capacity, &offset, query->questions);
-      break;
+  // authority is required only as the SOA of a negative answer (RFC 2308)
+  if (!response_header.tc) {
+    bool required = resolution->answer_count == 0;
+    response_header.nscount = (uint16_t)encode_section(buffer, records_budget, &offset,
+        &resolution->authority, qname, &compress, required, &complete);
+    if (!complete && required) {
+      response_header.tc = 1;
+      reasons |= DNS_TRUNC_AUTHORITY;
+    } else if (!complete) {
+      reasons |= DNS_TRUNC_OPTIONAL;
     }
   }
 
-  // encode authority section (if not truncated)
+  // additional data is only a hint, what does not fit is left out quietly
   if (!response_header.tc) {
-    for (dns_rr_t *rr = resolution->authority_list; rr != NULL; rr = rr->next) {
-      const char *name;
-      // for SOA records in authority, use the zone name from the SOA
-      if (rr->type == DNS_TYPE_SOA && resolution->authority_zone_name[0] != '\0') {
-        name = resolution->authority_zone_name;
-      } else {
-        name = query->questions[0].qname;
-      }
+    response_header.arcount = (uint16_t)encode_section(buffer, records_budget, &offset,
+        &resolution->additional, qname, &compress, false, &complete);
+    if (!complete) reasons |= DNS_TRUNC_OPTIONAL;
+  }
 
-      if (dns_encode_rr(buffer, capacity, &offset, name, rr) < 0) {
-        // truncate if authority section doesn't fit
-        response_header.tc = 1;
-        response_header.nscount = 0;
-        response_header.arcount = 0;
+  if (opt_len) {
+    dns_encode_opt(buffer, budget, &offset, DNS_EDNS_UDP_SIZE);
+    ++response_header.arcount;
+  }
 
-        offset = 12;
-        dns_encode_header(buffer, capacity, &response_header);
+  dns_encode_header(buffer, budget, &response_header);
+  if (truncation) *truncation = reasons;
+  *length = offset;
+  return 0;
+}
 
-        // would need to re-encode everything, so just stop here
-        break;
-      }
-    }
-  }
+int dns_build_precompiled_response(const dns_message_t *query,
+                                   const dns_precompiled_answer_t *answer,
+                                   uint8_t *buffer, size_t capacity, size_t *length) {
+  if (!query || !answer || !buffer || !length || !query->has_question_view) return -1;
 
-  // encode additional section (if not truncated)
-  if (!response_header.tc) {
-    for (dns_rr_t *rr = resolution->additional_list; rr != NULL; rr = rr->next) {
-      if (dns_encode_rr(buffer, capacity, &offset, query->questions[0].qname, rr) < 0) {
-        // just skip additional records if they don't fit
-        response_header.arcount = 0;
-        break;
-      }
-    }
+  size_t budget = dns_response_budget(query, capacity);
+  size_t opt_len = query->edns.present ? DNS_OPT_RR_LEN : 0;
+
+  const dns_question_view_t *view = &query->question_view;
+  dns_header_t response_header = {
+    .id = query->header.id,
+    .qr = DNS_QR_RESPONSE,
+    .opcode = query->header.opcode,
+    .aa = 1,
+    .rd = query->header.rd,
+    .rcode = answer->rcode,
+    .qdcount = 1,
+    .ancount = answer->answer ? answer->answer->count : 0,
+    .nscount = answer->authority ? answer->authority->count : 0,
+    .arcount = opt_len ? 1 : 0,
+  };
+  if (dns_encode_header(buffer, budget, &response_header) < 0) return -1;
+
+  size_t offset = 12;
+  size_t question_len = (size_t)view->name.len + 4;
+  if (offset + question_len + opt_len > budget) return -1;
+  memcpy(buffer + offset, view->msg + view->qname_offset, question_len);
+  offset += question_len;
+
+  // each anchor is the question name or its tail, the zone apex. anything
+  // over the budget is left to the slow path, which knows how to truncate
+  size_t records_budget = budget - opt_len;
+  if (answer->answer) {
+    size_t anchor = 12 + view->name.len - answer->answer->anchor_len;
+    if (dns_fragment_write(buffer, records_budget, &offset, answer->answer, anchor) < 0) return -1;
+  }
+  if (answer->authority) {
+    size_t anchor = 12 + view->name.len - answer->authority->anchor_len;
+    if (dns_fragment_write(buffer, records_budget, &offset, answer->authority, anchor) < 0) return -1;
   }
+  if (opt_len) dns_encode_opt(buffer, budget, &offset, DNS_EDNS_UDP_SIZE);
 
   *length = offset;
   return 0;
 }
 
-int dns_process_query(dns_server_t *server,
-                      const dns_request_t *request,
-                      dns_response_t *response,
-                      dns_error_t *err) {
-  if (!server || !request || !response) return -1;
+// one counter per reason, a response can be short for more than one
+static void count_truncation(dns_server_t *server, unsigned truncation) {
+  if (truncation & DNS_TRUNC_ANSWER) dns_stats_inc(server->stats, DNS_STAT_TRUNCATED_ANSWER);
+  if (truncation & DNS_TRUNC_AUTHORITY) dns_stats_inc(server->stats, DNS_STAT_TRUNCATED_AUTHORITY);
+  if (truncation & DNS_TRUNC_OPTIONAL) dns_stats_inc(server->stats, DNS_STAT_TRIMMED_OPTIONAL);
+}
+
+// glue and targets from our own zones, or nothing extra at all
+static void shape_sections(dns_server_t *server, dns_resolution_result_t *resolution) {
+  if (server->minimal_responses) {
+    dns_resolution_result_minimize(resolution);
+  } else {
+    dns_resolve_additional(server->trie, resolution);
+  }
+}
+
+static void hitters_record(dns_server_t *server, const dns_request_t *request,
+                           const dns_message_t *query) {
+  if (query->has_question_view) {
+    dns_hitters_record(server->hitters, &query->question_view.name, query->question_view.qtype,
+                       &request->client_addr);
+    return;
+  }
 
+  // the text path, the name is made canonical the way the view would have
+  dns_name_t name;
+  bool named = dns_name_from_text(&name, query->questions[0].qname) == 0;
+  dns_hitters_record(server->hitters, named ? &name : NULL, query->questions[0].qtype,
+                     &request->client_addr);
+}
+
+static int process_query(dns_server_t *server,
+                         const dns_request_t *request,
+                         dns_response_t *response,
+                         dns_error_t *err,
+                         dns_query_timer_t *timer) {
   dns_error_init(err);
-  server->queries_received++;
+  dns_stats_inc(server->stats, DNS_STAT_QUERIES_RECEIVED);
 
   // parse request
   dns_message_t *query_msg = dns_message_create();
   if (!query_msg) {
     DNS_ERROR_SET(err, DNS_ERR_MEMORY_ALLOCATION, "Failed to allocate query message");
-    server->queries_failed++;
+    dns_stats_inc(server->stats, DNS_STAT_QUERIES_FAILED);
     return -1;
   }
 
@@ -388,7 +899,7 @@ int dns_process_query(dns_server_t *server,
   if (dns_parse_header(request->buffer, request->length, &query_msg->header) < 0) {
     DNS_ERROR_SET(err, DNS_ERR_INVALID_PACKET, "Failed to parse header");
     dns_message_free(query_msg);
-    server->queries_failed++;
+    dns_stats_inc(server->stats, DNS_STAT_QUERIES_FAILED);
     return -1;
   }
   offset = 12;
@@ -397,11 +908,25 @@ int dns_process_query(dns_server_t *server,
   if (query_msg->header.qr != DNS_QR_QUERY) {
     DNS_ERROR_SET(err, DNS_ERR_INVALID_PACKET, "Not a query packet");
     dns_message_free(query_msg);
-    server->queries_failed++;
+    dns_stats_inc(server->stats, DNS_STAT_QUERIES_FAILED);
     return -1;
   }
 
-  // validate: only standard query supported for now
+  if (query_msg->header.opcode == DNS_OPCODE_UPDATE) {
+    dns_query_timer_mark(timer, DNS_STAGE_PARSE);
+    int ret = dns_server_handle_update(server, request, query_msg->header.id, response, err);
+    dns_query_timer_mark(timer, DNS_STAGE_RESOLVE);
+    dns_message_free(query_msg);
+    if (ret < 0) {
+      dns_stats_inc(server->stats, DNS_STAT_QUERIES_FAILED);
+      return -1;
+    }
+    timer->outcome = DNS_OUTCOME_AUTHORITATIVE;
+    dns_stats_inc(server->stats, DNS_STAT_QUERIES_PROCESSED);
+    return 0;
+  }
+
+  // validate: only standard query and update supported for now
   if (query_msg->header.opcode != DNS_OPCODE_QUERY) {
     DNS_ERROR_SET(err, DNS_ERR_UNSUPPORTED_OPCODE, "Unsupported opcode");
 
@@ -412,13 +937,13 @@ int dns_process_query(dns_server_t *server,
                                         DNS_RCODE_NOTIMP,
                                         false) < 0) {
       dns_message_free(query_msg);
-      server->queries_failed++;
+      dns_stats_inc(server->stats, DNS_STAT_QUERIES_FAILED);
       return -1;
     }
     response->length = 12;
 
     dns_message_free(query_msg);
-    server->queries_processed++;
+    dns_stats_inc(server->stats, DNS_STAT_QUERIES_PROCESSED);
     return 0;
   }
 
@@ -433,13 +958,13 @@ int dns_process_query(dns_server_t *server,
                                         DNS_RCODE_FORMERROR,
                                         false) < 0) {
       dns_message_free(query_msg);
-      server->queries_failed++;
+      dns_stats_inc(server->stats, DNS_STAT_QUERIES_FAILED);
       return -1;
     }
     response->length = 12;
 
     dns_message_free(query_msg);
-    server->queries_processed++;
+    dns_stats_inc(server->stats, DNS_STAT_QUERIES_PROCESSED);
     return 0;
   }
 
@@ -448,12 +973,17 @@ int dns_process_query(dns_server_t *server,
   if (!query_msg->questions) {
     DNS_ERROR_SET(err, DNS_ERR_MEMORY_ALLOCATION, "Failed to allocate question");
     dns_message_free(query_msg);
-    server->queries_failed++;
+    dns_stats_inc(server->stats, DNS_STAT_QUERIES_FAILED);
     return -1;
   }
 
-  if (dns_parse_question(request->buffer, request->length, &offset,
-              &query_msg->questions[0]) < 0) {
+  // the question stays in the request buffer, text is only made on a cache miss
+  size_t question_offset = offset;
+  if (dns_parse_question_view(request->buffer, request->length, &offset,
+                              &query_msg->question_view) == 0) {
+    query_msg->has_question_view = true;
+  } else if (dns_parse_question(request->buffer, request->length, &question_offset,
+                                &query_msg->questions[0]) < 0) {
     DNS_ERROR_SET(err, DNS_ERR_INVALID_QUESTION, "Failed to parse question");
 
     // send FORMERR response
@@ -463,110 +993,105 @@ int dns_process_query(dns_server_t *server,
                                         DNS_RCODE_FORMERROR,
                                         false) < 0) {
       dns_message_free(query_msg);
-      server->queries_failed++;
+      dns_stats_inc(server->stats, DNS_STAT_QUERIES_FAILED);
       return -1;
     }
     response->length = 12;
 
     dns_message_free(query_msg);
-    server->queries_processed++;
+    dns_stats_inc(server->stats, DNS_STAT_QUERIES_PROCESSED);
     return 0;
   }
 
-  if (server->enable_cache && server->cache) {
-    dns_cache_result_t *cache_result = dns_cache_lookup(
-        server->cache,
-        query_msg->questions[0].qname,
-        query_msg->questions[0].qtype,
-        query_msg->questions[0].qclass);
-
-    if (cache_result && cache_result->found) {
-      server->cache_hits++;
-
-      dns_resolution_result_t *resolution = dns_resolution_result_create();
-      if (resolution) {
-        if (cache_result->type == DNS_CACHE_TYPE_POSITIVE) {
-          resolution->answer_list = cache_result->records;
-          resolution->answer_count = cache_result->record_count;
-          resolution->rcode = DNS_RCODE_NOERROR;
-          cache_result->records = NULL; // transfer ownership
-        } else if (cache_result->type == DNS_CACHE_TYPE_NXDOMAIN) {
-          resolution->rcode = DNS_RCODE_NXDOMAIN;
-        } else {
-          resolution->rcode = DNS_RCODE_NOERROR;
-        }
+  // a malformed record after the question only costs the client EDNS
+  size_t question_end = query_msg->has_question_view ? offset : question_offset;
+  dns_parse_edns(request->buffer, request->length, question_end,
+                 &query_msg->header, &query_msg->edns);
+  if (server->hitters) hitters_record(server, request, query_msg);
+  dns_query_timer_mark(timer, DNS_STAGE_PARSE);
+
+  // compiled authoritative data is copied out as is, ahead of the cache.
+  // fragments have no additional section, answers that want one go below
+  dns_precompiled_answer_t precompiled;
+  if (query_msg->has_question_view
+      && (server->minimal_responses || !dns_type_has_additional(query_msg->question_view.qtype))
+      && dns_resolve_precompiled(server->trie, &query_msg->question_view, &precompiled)) {
+    dns_query_timer_mark(timer, DNS_STAGE_RESOLVE);
+    int built = dns_build_precompiled_response(query_msg, &precompiled, response->buffer,
+                                               response->capacity, &response->length);
+    dns_query_timer_mark(timer, DNS_STAGE_ENCODE);
+    if (built == 0) {
+      dns_message_free(query_msg);
+      timer->outcome = DNS_OUTCOME_AUTHORITATIVE;
+      dns_stats_inc(server->stats, DNS_STAT_AUTHORITATIVE_RESPONSES);
+      dns_stats_inc(server->stats, DNS_STAT_QUERIES_PROCESSED);
+      return 0;
+    }
+  }
 
-        dns_build_response(query_msg,
-                           resolution,
-                           response->buffer,
-                           response->capacity,
-                           &response->length,
-                           err);
-        dns_resolution_result_free(resolution);
-        dns_cache_result_free(cache_result);
-        dns_message_free(query_msg);
-        server->queries_processed++;
-        return 0;
-      }
-      dns_cache_result_free(cache_result);
-    } else {
-      server->cache_misses++;
-      if (cache_result) {
-        dns_cache_result_free(cache_result);
-      }
+  // results live on the stack and only reference RRsets, answering does not allocate
+  dns_resolution_result_t result;
+  dns_resolution_result_t *resolution = &result;
+  dns_resolution_result_init(resolution);
+
+  if (server->enable_cache && server->cache) {
+    dns_cache_result_t cache_result;
+    bool hit = query_msg->has_question_view
+      ? dns_cache_lookup_name(server->cache,
+                              &query_msg->question_view.name,
+                              query_msg->question_view.qtype,
+                              query_msg->question_view.qclass,
+                              &cache_result)
+      : dns_cache_lookup_into(server->cache,
+                              query_msg->questions[0].qname,
+                              query_msg->questions[0].qtype,
+                              query_msg->questions[0].qclass,
+                              &cache_result);
+    dns_query_timer_mark(timer, DNS_STAGE_CACHE);
+    if (hit) {
+      dns_stats_inc(server->stats, DNS_STAT_CACHE_HITS);
+
+      dns_resolution_result_from_cache(resolution, &cache_result);
+      dns_cache_result_clear(&cache_result);
+      shape_sections(server, resolution);
+
+      unsigned truncation;
+      dns_build_response_sized(query_msg,
+                               resolution,
+                               response->buffer,
+                               response->capacity,
+                               &response->length,
+                               &truncation,
+                               err);
+      dns_query_timer_mark(timer, DNS_STAGE_ENCODE);
+      count_truncation(server, truncation);
+      dns_resolution_result_clear(resolution);
+      dns_message_free(query_msg);
+      timer->outcome = DNS_OUTCOME_CACHE_HIT;
+      dns_stats_inc(server->stats, DNS_STAT_QUERIES_PROCESSED);
+      return 0;
     }
+    dns_stats_inc(server->stats, DNS_STAT_CACHE_MISSES);
   }
 
   // resolve query - try authoritative first
-  dns_resolution_result_t *resolution = dns_resolution_result_create();
-  if (!resolution) {
-    DNS_ERROR_SET(err, DNS_ERR_MEMORY_ALLOCATION, "Failed to allocate resolution result");
-    dns_message_free(query_msg);
-    server->queries_failed++;
-    return -1;
-  }
 
   dns_error_t resolve_err;
   dns_error_init(&resolve_err);
 
-  int auth_result = dns_resolve_query_full(server->trie,
-                                           &query_msg->questions[0],
-                                           resolution,
-                                           &resolve_err);
-
-  if (server->enable_cache && server->cache && auth_result == 0) {
-    if (resolution->rcode == DNS_RCODE_NOERROR && resolution->answer_list) {
-      uint32_t min_ttl = UINT32_MAX;
-      int count = 0;
-
-      for (dns_rr_t *rr = resolution->answer_list; rr; rr = rr->next) {
-        if (rr->ttl < min_ttl) min_ttl = rr->ttl;
-        ++count;
-      }
+  // the cache, recursion and logging below still key on the text name
+  if (query_msg->has_question_view) {
+    dns_question_view_to_question(&query_msg->question_view, &query_msg->questions[0]);
+  }
 
-      if (min_ttl > 0 && count > 0) {
-        dns_cache_insert(server->cache,
-                         query_msg->questions[0].qname,
-                         query_msg->questions[0].qtype,
-                         query_msg->questions[0].qclass,
-                         resolution->answer_list,
-                         count,
-                         min_ttl);
-      }
-    } else if (resolution->rcode == DNS_RCODE_NXDOMAIN) {
-      uint32_t negative_ttl = 300; // default negative TTL
+  int auth_result = query_msg->has_question_view
+    ? dns_resolve_query_view(server->trie, &query_msg->question_view, resolution, &resolve_err)
+    : dns_resolve_query_full(server->trie, &query_msg->questions[0], resolution, &resolve_err);
+  dns_query_timer_mark(timer, DNS_STAGE_RESOLVE);
 
-      if (resolution->authority_list && resolution->authority_list->type == DNS_TYPE_SOA) {
-        negative_ttl = resolution->authority_list->rdata.soa.minimum;
-      }
-      dns_cache_insert_negative(server->cache,
-                                query_msg->questions[0].qname,
-                                query_msg->questions[0].qtype,
-                                query_msg->questions[0].qclass,
-                                DNS_CACHE_TYPE_NXDOMAIN,
-                                DNS_RCODE_NXDOMAIN,
-                                negative_ttl);
-    }
+  if (server->enable_cache && server->cache && auth_result == 0) {
+    dns_resolution_cache_store(server->cache, &query_msg->questions[0], resolution);
+    dns_query_timer_mark(timer, DNS_STAGE_CACHE);
   }
 
   // check if client requested recursion
@@ -581,9 +1106,9 @@ int dns_process_query(dns_server_t *server,
   }
 
   if (try_recursion) {
-    printf("Starting recursilve resolution for %s (type %u)\n",
-            query_msg->questions[0].qname,
-            query_msg->questions[0].qtype);
+    DNS_LOG_DEBUG("Starting recursive resolution for %s (type %u)",
+                  query_msg->questions[0].qname,
+                  query_msg->questions[0].qtype);
 
     // start asynchronous recursive resolution
     int recursive_result = dns_recursive_resolve(server->recursive_resolver,
@@ -591,48 +1116,56 @@ int dns_process_query(dns_server_t *server,
                                                  &request->client_addr,
                                                  request->client_addr_len,
                                                  query_msg->header.id);
+    dns_query_timer_mark(timer, DNS_STAGE_RESOLVE);
     if (recursive_result == 0) {
       // start async resolution, response will be sent when it completes
       dns_message_free(query_msg);
-      dns_resolution_result_free(resolution);
-      server->queries_processed++;
-      server->recursive_responses++;
+      dns_resolution_result_clear(resolution);
+      dns_stats_inc(server->stats, DNS_STAT_QUERIES_PROCESSED);
+      dns_stats_inc(server->stats, DNS_STAT_RECURSIVE_RESPONSES);
+      timer->outcome = DNS_OUTCOME_RECURSIVE;
 
       // don't send the response now, just mark it as empty
       response->length = 0;
       return 0;
     } else {
-      printf("Failed to start recursive resolution, falling back to authoritative\n");
+      DNS_LOG_WARN("Failed to start recursive resolution, falling back to authoritative");
     }
   }
 
   // recursive resolution failed to start, fall back to authoritative
-  server->authoritative_responses++;
+  dns_stats_inc(server->stats, DNS_STAT_AUTHORITATIVE_RESPONSES);
 
   if (auth_result < 0) {
     // resolution failed, but we still send a response
     if (resolve_err.code != DNS_ERR_NONE) {
       resolution->rcode = dns_error_to_rcode(resolve_err.code);
-      fprintf(stderr, "Resolution error: %s (%s:%d)\n",
-              resolve_err.message,
-              resolve_err.file,
-              resolve_err.line);
+      // the question is the client's, this is not the server's error
+      DNS_LOG_DEBUG("Resolution error: %s (%s:%d)",
+                    resolve_err.message,
+                    resolve_err.file,
+                    resolve_err.line);
     } else {
       resolution->rcode = DNS_RCODE_SERVFAIL;
     }
   }
 
+  shape_sections(server, resolution);
+
   // build response
   dns_error_t build_err;
   dns_error_init(&build_err);
 
-  if (dns_build_response(query_msg,
-                         resolution,
-                         response->buffer,
-                         response->capacity,
-                         &response->length,
-                         &build_err) < 0) {
-
+  unsigned truncation = 0;
+  timer->outcome = auth_result < 0 ? DNS_OUTCOME_ERROR : DNS_OUTCOME_AUTHORITATIVE;
+  if (dns_build_response_sized(query_msg,
+                               resolution,
+                               response->buffer,
+                               response->capacity,
+                               &response->length,
+                               &truncation,
+                               &build_err) < 0) {
+    timer->outcome = DNS_OUTCOME_ERROR;
 
     // failed to build response, send SERVFAIL
     if (dns_build_error_response_header(response->buffer,
@@ -641,7 +1174,13 @@ int dns_process_query(dns_server_t *server,
                                         DNS_RCODE_SERVFAIL,
                                         true) >= 0) {
       offset = 12;
-      dns_encode_question(response->buffer, response->capacity, &offset, query_msg->questions);
+      const dns_question_view_t *view = &query_msg->question_view;
+      if (query_msg->has_question_view && offset + view->name.len + 4u <= response->capacity) {
+        memcpy(response->buffer + offset, view->msg + view->qname_offset, view->name.len + 4u);
+        offset += view->name.len + 4u;
+      } else {
+        dns_encode_question(response->buffer, response->capacity, &offset, query_msg->questions);
+      }
       response->length = offset;
     } else {
       // error response failed, set minimal header
@@ -653,19 +1192,94 @@ int dns_process_query(dns_server_t *server,
       response->length = 12;
     }
 
-    fprintf(stderr, "Build error: %s (%s:%d)\n",
-            build_err.message,
-            build_err.file,
-            build_err.line);
+    DNS_LOG_WARN("Build error: %s (%s:%d)",
+                 build_err.message,
+                 build_err.file,
+                 build_err.line);
   }
 
+  dns_query_timer_mark(timer, DNS_STAGE_ENCODE);
+  count_truncation(server, truncation);
   dns_message_free(query_msg);
-  dns_resolution_result_free(resolution);
-  server->queries_processed++;
+  dns_resolution_result_clear(resolution);
+  dns_stats_inc(server->stats, DNS_STAT_QUERIES_PROCESSED);
 
   return 0;
 }
 
+// the query as the client sent it and what went back, straight off the wire
+static void querylog_record(dns_server_t *server, const dns_request_t *request,
+                            const dns_response_t *response, uint64_t ticks) {
+  dns_querylog_record_t record;
+  memset(&record, 0, sizeof(record));
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  record.time_ns = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+  double latency_ns = (double)ticks * dns_clock_ns_per_tick();
+  record.latency_ns = latency_ns < UINT32_MAX ? (uint32_t)latency_ns : UINT32_MAX;
+  record.outcome = (uint8_t)response->outcome;
+
+  if (request->client_addr.ss_family == AF_INET) {
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)&request->client_addr;
+    record.family = 4;
+    memcpy(record.address, &sin->sin_addr, 4);
+    record.port = ntohs(sin->sin_port);
+  } else if (request->client_addr.ss_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)&request->client_addr;
+    record.family = 6;
+    memcpy(record.address, &sin6->sin6_addr, 16);
+    record.port = ntohs(sin6->sin6_port);
+  }
+
+  const uint8_t *buf = request->buffer;
+  record.id = (uint16_t)((buf[0] << 8) | buf[1]);
+  record.query_flags = (uint16_t)((buf[2] << 8) | buf[3]);
+
+  // labels up to the root, a pointer or anything overlong leaves the name out
+  size_t offset = 12;
+  while (offset < request->length && buf[offset] != 0 && buf[offset] < 64
+         && offset - 12 + buf[offset] + 1 < sizeof(record.qname)) {
+    offset += buf[offset] + 1;
+  }
+  if (offset + 5 <= request->length && buf[offset] == 0) {
+    record.qname_length = (uint8_t)(offset - 12 + 1);
+    memcpy(record.qname, buf + 12, record.qname_length);
+    record.qtype = (uint16_t)((buf[offset + 1] << 8) | buf[offset + 2]);
+    record.qclass = (uint16_t)((buf[offset + 3] << 8) | buf[offset + 4]);
+  }
+
+  if (response->length >= 12) {
+    record.response_flags = (uint16_t)((response->buffer[2] << 8) | response->buffer[3]);
+    record.response_size = (uint16_t)response->length;
+  }
+
+  dns_querylog_append(server->querylog, &record);
+}
+
+int dns_process_query(dns_server_t *server,
+                      const dns_request_t *request,
+                      dns_response_t *response,
+                      dns_error_t *err) {
+  if (!server || !request || !response) return -1;
+
+  // queries that stop early (bad header, FORMERR, NOTIMP) count as errors
+  dns_query_timer_t timer;
+  dns_query_timer_start(&timer, server->latency != NULL);
+  bool logged = request->length >= 12 && dns_querylog_sample(server->querylog);
+  uint64_t log_start = logged ? dns_clock_ticks() : 0;
+
+  int ret = process_query(server, request, response, err, &timer);
+  if (ret < 0) timer.outcome = DNS_OUTCOME_ERROR;
+  if (!(timer.seen & (1u << DNS_STAGE_PARSE))) dns_query_timer_mark(&timer, DNS_STAGE_PARSE);
+
+  dns_latency_record_timer(server->latency, &timer);
+  response->outcome = timer.outcome;
+
+  if (logged) querylog_record(server, request, response, dns_clock_ticks() - log_start);
+  return ret;
+}
+
 int dns_server_handle_recursive_query(dns_server_t *server,
                                      const dns_question_t *question,
                                      const struct sockaddr_storage *client_addr,
@@ -675,7 +1289,7 @@ int dns_server_handle_recursive_query(dns_server_t *server,
     return -1;
   }
 
-  printf("Starting recusive resolution for %s\n", question->qname);
+  DNS_LOG_DEBUG("Starting recursive resolution for %s", question->qname);
   return dns_recursive_resolve(server->recursive_resolver,
                                question,
                                client_addr,
@@ -695,16 +1309,20 @@ int dns_recursive_cleanup_expired_queries(dns_recursive_resolver_t *resolver) {
     if (query->query_id != 0
         && (now - query->start_time) > DNS_RECURSIVE_TIMEOUT_SEC) {
 
-      printf("Cleaning up expired query for %s (ID: %u)\n",
-             query->qname,
-             query->query_id);
+      DNS_LOG_DEBUG("Cleaning up expired query for %s (ID: %u)",
+                    query->qname,
+                    query->query_id);
+
+      if (query->upstream) {
+        atomic_fetch_add_explicit(&query->upstream->timeouts, 1, memory_order_relaxed);
+      }
 
       // send timeout response to client
       dns_recursive_send_error_response(resolver, query, DNS_RCODE_SERVFAIL);
 
       // mark as inactive
       query->query_id = 0;
-      resolver->failed_queries++;
+      dns_stats_inc(resolver->stats, DNS_STAT_RECURSIVE_FAILED);
       ++cleaned;
     }
   }
@@ -724,10 +1342,14 @@ int dns_server_run(dns_server_t *server) {
 
   while (server->running) {
     fd_set read_fds;
+    fd_set write_fds;
     int max_fd = server->socket_fd;
 
     FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
     FD_SET(server->socket_fd, &read_fds);
+    max_fd = dns_metrics_watch(server->metrics, &read_fds, &write_fds, max_fd);
+    max_fd = dns_control_watch(server->control, &read_fds, &write_fds, max_fd);
 
     // add recursive resolver socket if it's available
     if (server->recursive_resolver && server->recursive_resolver->socket_fd >= 0) {
@@ -739,11 +1361,11 @@ int dns_server_run(dns_server_t *server) {
 
     // wait for activity on either socket
     struct timeval timeout = {1, 0}; // 1s timeout
-    int activity = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
+    int activity = select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout);
 
     if (activity < 0) {
       if (errno == EINTR) continue;
-      perror("select failed");
+      DNS_LOG_ERROR("select failed: %s", strerror(errno));
       break;
     }
 
@@ -779,6 +1401,7 @@ int dns_server_run(dns_server_t *server) {
           if (dns_process_query(server, &request, response, &err) == 0
               && response->length > 0) {
             // send response
+            uint64_t send_start = server->latency ? dns_clock_ticks() : 0;
             ssize_t sent = sendto(server->socket_fd,
                                   response->buffer,
                                   response->length,
@@ -786,7 +1409,11 @@ int dns_server_run(dns_server_t *server) {
                                   (struct sockaddr *)&request.client_addr,
                                   request.client_addr_len);
             if (sent > 0) {
-              server->responses_sent++;
+              dns_stats_inc(server->stats, DNS_STAT_RESPONSES_SENT);
+              if (server->latency) {
+                dns_latency_record(server->latency, DNS_STAGE_SEND, response->outcome,
+                                   dns_clock_ticks() - send_start);
+              }
             }
           }
 
@@ -815,6 +1442,29 @@ int dns_server_run(dns_server_t *server) {
                                       &server_addr);
       }
     }
+
+    // metrics scrapes, rendered on this thread so nothing needs a lock
+    if (server->metrics) {
+      if (dns_metrics_ready(server->metrics, &read_fds)) {
+        dns_server_write_metrics(server, &server->metrics->body);
+        dns_metrics_respond(server->metrics);
+      }
+      dns_metrics_flush(server->metrics, &write_fds);
+    }
+
+    // control commands, on this thread for the same reason. a dump goes out
+    // a chunk per pass so queries keep being answered in between
+    if (server->control) {
+      const char *command = dns_control_ready(server->control, &read_fds);
+      if (command) {
+        dns_server_control(server, server->control, command);
+        dns_control_respond(server->control);
+      }
+      if (dns_control_flush(server->control, &write_fds)) {
+        dns_control_dump_next(server->control, server->cache);
+        dns_control_respond(server->control);
+      }
+    }
   }
 
   return 0;
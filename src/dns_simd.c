@@ -0,0 +1,348 @@
+#include "dns_simd.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DNS_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+
+static inline uint8_t fold(uint8_t c) {
+  return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + 32) : c;
+}
+
+
+// scalar, eight bytes at a time in a word with a byte loop for the rest.
+// inlined into the vector versions as their tails
+
+#define ONES  0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+static inline uint64_t load64(const void *p) {
+  uint64_t w;
+  memcpy(&w, p, 8);
+  return w;
+}
+
+// high bit set in every byte of w that is 'A'..'Z'
+static inline uint64_t upper_mask64(uint64_t w) {
+  uint64_t low7 = w & ~HIGHS;
+  uint64_t ge_a = low7 + ONES * (0x80 - 'A');
+  uint64_t gt_z = low7 + ONES * (0x80 - 'Z' - 1);
+  return ge_a & ~gt_z & ~w & HIGHS;
+}
+
+static inline uint64_t fold64(uint64_t w) {
+  return w | (upper_mask64(w) >> 2);
+}
+
+// high bit set in every zero byte of w
+static inline uint64_t zero_mask64(uint64_t w) {
+  uint64_t nonzero = (((w & ~HIGHS) + ~HIGHS) | w) & HIGHS;
+  return nonzero ^ HIGHS;
+}
+
+static inline void lower_scalar(char *dst, const char *src, size_t len) {
+  if (len < 8) {
+    for (size_t i = 0; i < len; ++i) dst[i] = (char)fold((uint8_t)src[i]);
+    return;
+  }
+
+  // the last word overlaps the one before it, folding twice is harmless
+  for (size_t i = 0; i + 8 < len; i += 8) {
+    uint64_t w = fold64(load64(src + i));
+    memcpy(dst + i, &w, 8);
+  }
+  uint64_t w = fold64(load64(src + len - 8));
+  memcpy(dst + len - 8, &w, 8);
+}
+
+static inline size_t find_byte_scalar(const char *src, size_t len, char c) {
+  const char *hit = memchr(src, c, len);
+  return hit ? (size_t)(hit - src) : len;
+}
+
+static inline bool case_equal_scalar(const char *a, const char *b, size_t len) {
+  if (len < 8) {
+    for (size_t i = 0; i < len; ++i) {
+      if (fold((uint8_t)a[i]) != fold((uint8_t)b[i])) return false;
+    }
+    return true;
+  }
+
+  for (size_t i = 0; i + 8 < len; i += 8) {
+    if (fold64(load64(a + i)) != fold64(load64(b + i))) return false;
+  }
+  return fold64(load64(a + len - 8)) == fold64(load64(b + len - 8));
+}
+
+static inline bool word_label_valid(uint64_t w) {
+  return !(zero_mask64(w) | zero_mask64(w ^ (ONES * '.')));
+}
+
+static inline bool label_valid_scalar(const uint8_t *label, size_t len) {
+  if (len < 8) {
+    for (size_t i = 0; i < len; ++i) {
+      if (label[i] == 0 || label[i] == '.') return false;
+    }
+    return true;
+  }
+
+  for (size_t i = 0; i + 8 < len; i += 8) {
+    if (!word_label_valid(load64(label + i))) return false;
+  }
+  return word_label_valid(load64(label + len - 8));
+}
+
+static const dns_simd_ops_t scalar_ops = {
+  .lower = lower_scalar,
+  .find_byte = find_byte_scalar,
+  .case_equal = case_equal_scalar,
+  .label_valid = label_valid_scalar,
+};
+
+
+#ifdef DNS_SIMD_X86
+
+// SSE2, 16 bytes at a time. bytes >= 0x80 compare as negative, so the signed
+// range test for 'A'..'Z' leaves them alone. like the scalar versions, the
+// last block overlaps the one before it instead of falling back to bytes
+
+__attribute__((always_inline))
+static inline __m128i fold_sse2(__m128i v) {
+  __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+  return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((always_inline))
+static inline __m128i load128(const void *p) {
+  return _mm_loadu_si128((const __m128i *)p);
+}
+
+__attribute__((always_inline))
+static inline bool equal128(const char *a, const char *b) {
+  __m128i eq = _mm_cmpeq_epi8(fold_sse2(load128(a)), fold_sse2(load128(b)));
+  return _mm_movemask_epi8(eq) == 0xFFFF;
+}
+
+__attribute__((always_inline))
+static inline int find128(const char *src, __m128i needle) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(load128(src), needle));
+}
+
+__attribute__((always_inline))
+static inline bool label_valid128(const uint8_t *label) {
+  __m128i v = load128(label);
+  __m128i bad = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+  return _mm_movemask_epi8(bad) == 0;
+}
+
+static void lower_sse2(char *dst, const char *src, size_t len) {
+  if (len < 16) {
+    lower_scalar(dst, src, len);
+    return;
+  }
+
+  for (size_t i = 0; i + 16 < len; i += 16) {
+    _mm_storeu_si128((__m128i *)(dst + i), fold_sse2(load128(src + i)));
+  }
+  _mm_storeu_si128((__m128i *)(dst + len - 16), fold_sse2(load128(src + len - 16)));
+}
+
+static size_t find_byte_sse2(const char *src, size_t len, char c) {
+  if (len < 16) return find_byte_scalar(src, len, c);
+
+  // the blocks before the last one had no match, so its first hit is the answer
+  __m128i needle = _mm_set1_epi8(c);
+  for (size_t i = 0; i + 16 < len; i += 16) {
+    int mask = find128(src + i, needle);
+    if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+  }
+  int mask = find128(src + len - 16, needle);
+  return mask ? len - 16 + (size_t)__builtin_ctz((unsigned)mask) : len;
+}
+
+static bool case_equal_sse2(const char *a, const char *b, size_t len) {
+  if (len < 16) return case_equal_scalar(a, b, len);
+
+  for (size_t i = 0; i + 16 < len; i += 16) {
+    if (!equal128(a + i, b + i)) return false;
+  }
+  return equal128(a + len - 16, b + len - 16);
+}
+
+static bool label_valid_sse2(const uint8_t *label, size_t len) {
+  if (len < 16) return label_valid_scalar(label, len);
+
+  for (size_t i = 0; i + 16 < len; i += 16) {
+    if (!label_valid128(label + i)) return false;
+  }
+  return label_valid128(label + len - 16);
+}
+
+static const dns_simd_ops_t sse2_ops = {
+  .lower = lower_sse2,
+  .find_byte = find_byte_sse2,
+  .case_equal = case_equal_sse2,
+  .label_valid = label_valid_sse2,
+};
+
+
+// AVX2, 32 bytes at a time. names shorter than a block take the SSE2 path,
+// which is inlined here and so VEX encoded: no legacy SSE code runs while
+// the upper halves are dirty
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i fold_avx2(__m256i v) {
+  __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                                   _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+  return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i load256(const void *p) {
+  return _mm256_loadu_si256((const __m256i *)p);
+}
+
+__attribute__((target("avx2")))
+static void lower_avx2(char *dst, const char *src, size_t len) {
+  if (len < 32) {
+    if (len < 16) {
+      lower_scalar(dst, src, len);
+      return;
+    }
+    _mm_storeu_si128((__m128i *)dst, fold_sse2(load128(src)));
+    _mm_storeu_si128((__m128i *)(dst + len - 16), fold_sse2(load128(src + len - 16)));
+    return;
+  }
+
+  for (size_t i = 0; i + 32 < len; i += 32) {
+    _mm256_storeu_si256((__m256i *)(dst + i), fold_avx2(load256(src + i)));
+  }
+  _mm256_storeu_si256((__m256i *)(dst + len - 32), fold_avx2(load256(src + len - 32)));
+}
+
+__attribute__((target("avx2")))
+static size_t find_byte_avx2(const char *src, size_t len, char c) {
+  if (len < 32) {
+    if (len < 16) return find_byte_scalar(src, len, c);
+    __m128i needle = _mm_set1_epi8(c);
+    int mask = find128(src, needle);
+    if (mask) return (size_t)__builtin_ctz((unsigned)mask);
+    mask = find128(src + len - 16, needle);
+    return mask ? len - 16 + (size_t)__builtin_ctz((unsigned)mask) : len;
+  }
+
+  __m256i needle = _mm256_set1_epi8(c);
+  for (size_t i = 0; i + 32 < len; i += 32) {
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(load256(src + i), needle));
+    if (mask) return i + (size_t)__builtin_ctz(mask);
+  }
+  unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(load256(src + len - 32), needle));
+  return mask ? len - 32 + (size_t)__builtin_ctz(mask) : len;
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline bool equal256(const char *a, const char *b) {
+  __m256i eq = _mm256_cmpeq_epi8(fold_avx2(load256(a)), fold_avx2(load256(b)));
+  return (unsigned)_mm256_movemask_epi8(eq) == 0xFFFFFFFFu;
+}
+
+__attribute__((target("avx2")))
+static bool case_equal_avx2(const char *a, const char *b, size_t len) {
+  if (len < 32) {
+    if (len < 16) return case_equal_scalar(a, b, len);
+    return equal128(a, b) && equal128(a + len - 16, b + len - 16);
+  }
+
+  for (size_t i = 0; i + 32 < len; i += 32) {
+    if (!equal256(a + i, b + i)) return false;
+  }
+  return equal256(a + len - 32, b + len - 32);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline bool label_valid256(const uint8_t *label) {
+  __m256i v = load256(label);
+  __m256i bad = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+  return _mm256_movemask_epi8(bad) == 0;
+}
+
+__attribute__((target("avx2")))
+static bool label_valid_avx2(const uint8_t *label, size_t len) {
+  if (len < 32) {
+    if (len < 16) return label_valid_scalar(label, len);
+    return label_valid128(label) && label_valid128(label + len - 16);
+  }
+
+  for (size_t i = 0; i + 32 < len; i += 32) {
+    if (!label_valid256(label + i)) return false;
+  }
+  return label_valid256(label + len - 32);
+}
+
+static const dns_simd_ops_t avx2_ops = {
+  .lower = lower_avx2,
+  .find_byte = find_byte_avx2,
+  .case_equal = case_equal_avx2,
+  .label_valid = label_valid_avx2,
+};
+
+#endif // DNS_SIMD_X86
+
+
+// dispatch
+
+dns_simd_ops_t dns_simd_ops = {
+  .lower = lower_scalar,
+  .find_byte = find_byte_scalar,
+  .case_equal = case_equal_scalar,
+  .label_valid = label_valid_scalar,
+};
+
+static dns_simd_level_t current_level = DNS_SIMD_SCALAR;
+
+dns_simd_level_t dns_simd_best_level(void) {
+#ifdef DNS_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return DNS_SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2")) return DNS_SIMD_SSE2;
+#endif
+  return DNS_SIMD_SCALAR;
+}
+
+dns_simd_level_t dns_simd_set_level(dns_simd_level_t level) {
+  if (level > dns_simd_best_level()) level = DNS_SIMD_SCALAR;
+
+  const dns_simd_ops_t *ops = &scalar_ops;
+#ifdef DNS_SIMD_X86
+  if (level == DNS_SIMD_SSE2) ops = &sse2_ops;
+  if (level == DNS_SIMD_AVX2) ops = &avx2_ops;
+#endif
+
+  dns_simd_ops = *ops;
+  current_level = level;
+  return level;
+}
+
+dns_simd_level_t dns_simd_level(void) {
+  return current_level;
+}
+
+const char *dns_simd_level_name(dns_simd_level_t level) {
+  switch (level) {
+    case DNS_SIMD_SCALAR: return "scalar";
+    case DNS_SIMD_SSE2: return "sse2";
+    case DNS_SIMD_AVX2: return "avx2";
+  }
+  return "unknown";
+}
+
+// picked before main so the hot paths never check
+__attribute__((constructor))
+static void dns_simd_init(void) {
+  dns_simd_set_level(dns_simd_best_level());
+}
@@ -0,0 +1,99 @@
+#include "dns_stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+_Thread_local int dns_stats_thread_row = -1;
+
+// rows are handed out once per thread and never given back, threads past
+// the last private row share it
+static atomic_int next_row;
+
+static const char *const stat_names[DNS_STAT_COUNT] = {
+#define DNS_STAT_NAME(id, field, help) #field,
+  DNS_STATS_COUNTERS(DNS_STAT_NAME)
+#undef DNS_STAT_NAME
+};
+
+static const char *const stat_help[DNS_STAT_COUNT] = {
+#define DNS_STAT_HELP(id, field, help) help,
+  DNS_STATS_COUNTERS(DNS_STAT_HELP)
+#undef DNS_STAT_HELP
+};
+
+
+int dns_stats_claim_row(void) {
+  int row = atomic_fetch_add_explicit(&next_row, 1, memory_order_relaxed);
+  if (row > DNS_STATS_SHARDS - 1 || row < 0) row = DNS_STATS_SHARDS - 1;
+  dns_stats_thread_row = row;
+  return row;
+}
+
+dns_stats_t *dns_stats_create(void) {
+  // rows have to start on a line of their own, calloc only promises 16
+  dns_stats_t *stats = aligned_alloc(DNS_STATS_CACHE_LINE, sizeof(dns_stats_t));
+  if (!stats) return NULL;
+
+  dns_stats_reset(stats);
+  return stats;
+}
+
+void dns_stats_free(dns_stats_t *stats) {
+  free(stats);
+}
+
+void dns_stats_reset(dns_stats_t *stats) {
+  if (!stats) return;
+
+  for (int row = 0; row < DNS_STATS_SHARDS; ++row) {
+    for (int i = 0; i < DNS_STAT_COUNT; ++i) {
+      atomic_store_explicit(&stats->shards[row].values[i], 0, memory_order_relaxed);
+    }
+  }
+}
+
+void dns_stats_accumulate(const dns_stats_t *stats, dns_stats_snapshot_t *snapshot) {
+  if (!stats || !snapshot) return;
+
+  for (int row = 0; row < DNS_STATS_SHARDS; ++row) {
+    const dns_stats_shard_t *shard = &stats->shards[row];
+    for (int i = 0; i < DNS_STAT_COUNT; ++i) {
+      snapshot->values[i] += atomic_load_explicit(&shard->values[i], memory_order_relaxed);
+    }
+  }
+}
+
+void dns_stats_snapshot(const dns_stats_t *stats, dns_stats_snapshot_t *snapshot) {
+  if (!snapshot) return;
+
+  memset(snapshot, 0, sizeof(*snapshot));
+  dns_stats_accumulate(stats, snapshot);
+}
+
+uint64_t dns_stats_get(const dns_stats_t *stats, dns_stat_t stat) {
+  if (!stats || stat >= DNS_STAT_COUNT) return 0;
+
+  uint64_t total = 0;
+  for (int row = 0; row < DNS_STATS_SHARDS; ++row) {
+    const dns_stats_shard_t *shard = &stats->shards[row];
+    total += atomic_load_explicit(&shard->values[stat], memory_order_relaxed);
+  }
+  return total;
+}
+
+const char *dns_stats_name(dns_stat_t stat) {
+  return stat < DNS_STAT_COUNT ? stat_names[stat] : NULL;
+}
+
+const char *dns_stats_help(dns_stat_t stat) {
+  return stat < DNS_STAT_COUNT ? stat_help[stat] : NULL;
+}
+
+void dns_stats_print(const dns_stats_snapshot_t *snapshot, FILE *output) {
+  if (!snapshot || !output) return;
+
+  for (int i = 0; i < DNS_STAT_COUNT; ++i) {
+    if (snapshot->values[i] == 0) continue;
+    fprintf(output, "%-24s %lu\n", stat_names[i], (unsigned long)snapshot->values[i]);
+  }
+}
@@ -0,0 +1,334 @@
+#include "dns_topk.h"
+#include "dns_rdata.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// FNV-1a, keys are short and this runs once per key per query
+static uint32_t topk_hash(const uint8_t *key, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= key[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void dns_topk_init(dns_topk_t *topk) {
+  if (!topk) return;
+
+  memset(topk, 0, sizeof(*topk));
+  for (int i = 0; i < DNS_TOPK_INDEX_SIZE; ++i) topk->index[i] = -1;
+
+  // free buckets are chained through next
+  int buckets = (int)(sizeof(topk->buckets) / sizeof(topk->buckets[0]));
+  for (int i = 0; i < buckets; ++i) {
+    topk->buckets[i].first = -1;
+    topk->buckets[i].next = i + 1 < buckets ? i + 1 : -1;
+  }
+  topk->free_bucket = 0;
+  topk->min_bucket = -1;
+  topk->max_bucket = -1;
+}
+
+
+// buckets
+
+// a new bucket with count, linked in after prev or first when prev is -1
+static int bucket_insert(dns_topk_t *topk, int prev, uint64_t count) {
+  int b = topk->free_bucket;
+  dns_topk_bucket_t *bucket = &topk->buckets[b];
+  topk->free_bucket = bucket->next;
+
+  bucket->count = count;
+  bucket->first = -1;
+  bucket->prev = prev;
+  bucket->next = prev >= 0 ? topk->buckets[prev].next : topk->min_bucket;
+
+  if (bucket->next >= 0) {
+    topk->buckets[bucket->next].prev = b;
+  } else {
+    topk->max_bucket = b;
+  }
+  if (prev >= 0) {
+    topk->buckets[prev].next = b;
+  } else {
+    topk->min_bucket = b;
+  }
+  return b;
+}
+
+static void bucket_release(dns_topk_t *topk, int b) {
+  dns_topk_bucket_t *bucket = &topk->buckets[b];
+
+  if (bucket->prev >= 0) {
+    topk->buckets[bucket->prev].next = bucket->next;
+  } else {
+    topk->min_bucket = bucket->next;
+  }
+  if (bucket->next >= 0) {
+    topk->buckets[bucket->next].prev = bucket->prev;
+  } else {
+    topk->max_bucket = bucket->prev;
+  }
+
+  bucket->first = -1;
+  bucket->next = topk->free_bucket;
+  topk->free_bucket = b;
+}
+
+static void bucket_attach(dns_topk_t *topk, int b, int c) {
+  dns_topk_counter_t *counter = &topk->counters[c];
+  dns_topk_bucket_t *bucket = &topk->buckets[b];
+
+  counter->bucket = b;
+  counter->prev = -1;
+  counter->next = bucket->first;
+  if (bucket->first >= 0) topk->counters[bucket->first].prev = c;
+  bucket->first = c;
+}
+
+// leaves an emptied bucket in the list, the caller releases it
+static void bucket_detach(dns_topk_t *topk, int c) {
+  dns_topk_counter_t *counter = &topk->counters[c];
+
+  if (counter->prev >= 0) {
+    topk->counters[counter->prev].next = counter->next;
+  } else {
+    topk->buckets[counter->bucket].first = counter->next;
+  }
+  if (counter->next >= 0) topk->counters[counter->next].prev = counter->prev;
+}
+
+// one more for counter c, it moves to the bucket above
+static void counter_increment(dns_topk_t *topk, int c) {
+  int from = topk->counters[c].bucket;
+  uint64_t count = topk->buckets[from].count + 1;
+
+  int to = topk->buckets[from].next;
+  if (to < 0 || topk->buckets[to].count != count) to = bucket_insert(topk, from, count);
+
+  bucket_detach(topk, c);
+  if (topk->buckets[from].first < 0) bucket_release(topk, from);
+  bucket_attach(topk, to, c);
+  topk->counters[c].count = count;
+}
+
+
+// index
+
+static int index_find(const dns_topk_t *topk, const uint8_t *key, size_t length, uint32_t hash) {
+  for (int c = topk->index[hash & (DNS_TOPK_INDEX_SIZE - 1)]; c >= 0; c = topk->counters[c].hash_next) {
+    const dns_topk_counter_t *counter = &topk->counters[c];
+    if (counter->hash == hash && counter->key_length == length
+        && memcmp(counter->key, key, length) == 0) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+static void index_insert(dns_topk_t *topk, int c) {
+  int *head = &topk->index[topk->counters[c].hash & (DNS_TOPK_INDEX_SIZE - 1)];
+  topk->counters[c].hash_next = *head;
+  *head = c;
+}
+
+static void index_remove(dns_topk_t *topk, int c) {
+  int *link = &topk->index[topk->counters[c].hash & (DNS_TOPK_INDEX_SIZE - 1)];
+  while (*link != c) link = &topk->counters[*link].hash_next;
+  *link = topk->counters[c].hash_next;
+}
+
+void dns_topk_add(dns_topk_t *topk, const void *key, size_t length) {
+  if (!topk || (!key && length > 0)) return;
+  if (length > DNS_TOPK_KEY_MAX) length = DNS_TOPK_KEY_MAX;
+
+  ++topk->total;
+  uint32_t hash = topk_hash(key, length);
+
+  int c = index_find(topk, key, length, hash);
+  if (c >= 0) {
+    counter_increment(topk, c);
+    return;
+  }
+
+  int c_new;
+  if (topk->used < DNS_TOPK_CAPACITY) {
+    // a free counter starts at one
+    c_new = topk->used++;
+    int b = topk->min_bucket;
+    if (b < 0 || topk->buckets[b].count != 1) b = bucket_insert(topk, -1, 1);
+    bucket_attach(topk, b, c_new);
+    topk->counters[c_new].count = 1;
+    topk->counters[c_new].error = 0;
+  } else {
+    // the smallest counter goes to the new key, what it had becomes the error
+    c_new = topk->buckets[topk->min_bucket].first;
+    index_remove(topk, c_new);
+    topk->counters[c_new].error = topk->counters[c_new].count;
+    counter_increment(topk, c_new);
+  }
+
+  dns_topk_counter_t *counter = &topk->counters[c_new];
+  memcpy(counter->key, key, length);
+  counter->key_length = (uint8_t)length;
+  counter->hash = hash;
+  index_insert(topk, c_new);
+}
+
+int dns_topk_top(const dns_topk_t *topk, dns_topk_entry_t *entries, int max) {
+  if (!topk || !entries) return 0;
+
+  int n = 0;
+  for (int b = topk->max_bucket; b >= 0 && n < max; b = topk->buckets[b].prev) {
+    for (int c = topk->buckets[b].first; c >= 0 && n < max; c = topk->counters[c].next) {
+      const dns_topk_counter_t *counter = &topk->counters[c];
+      entries[n].key = counter->key;
+      entries[n].key_length = counter->key_length;
+      entries[n].count = counter->count;
+      entries[n].error = counter->error;
+      ++n;
+    }
+  }
+  return n;
+}
+
+
+// server trackers
+
+dns_hitters_t *dns_hitters_create(void) {
+  dns_hitters_t *hitters = malloc(sizeof(dns_hitters_t));
+  if (!hitters) return NULL;
+
+  for (int i = 0; i < DNS_HITTERS_COUNT; ++i) dns_topk_init(&hitters->trackers[i]);
+  return hitters;
+}
+
+void dns_hitters_free(dns_hitters_t *hitters) {
+  free(hitters);
+}
+
+void dns_hitters_record(dns_hitters_t *hitters, const dns_name_t *qname, uint16_t qtype,
+                        const struct sockaddr_storage *client) {
+  if (!hitters) return;
+
+  if (qname) dns_topk_add(&hitters->trackers[DNS_HITTERS_QNAME], qname->wire, qname->len);
+
+  uint8_t type[2] = {(uint8_t)(qtype >> 8), (uint8_t)qtype};
+  dns_topk_add(&hitters->trackers[DNS_HITTERS_QTYPE], type, sizeof(type));
+
+  if (!client) return;
+
+  // whole bytes of the prefix are enough for /24 and /56
+  uint8_t prefix[1 + DNS_HITTERS_V6_PREFIX / 8];
+  size_t length = 0;
+  if (client->ss_family == AF_INET) {
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)client;
+    prefix[0] = 4;
+    memcpy(prefix + 1, &sin->sin_addr, DNS_HITTERS_V4_PREFIX / 8);
+    length = 1 + DNS_HITTERS_V4_PREFIX / 8;
+  } else if (client->ss_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)client;
+    prefix[0] = 6;
+    memcpy(prefix + 1, &sin6->sin6_addr, DNS_HITTERS_V6_PREFIX / 8);
+    length = 1 + DNS_HITTERS_V6_PREFIX / 8;
+  }
+  if (length > 0) dns_topk_add(&hitters->trackers[DNS_HITTERS_CLIENT], prefix, length);
+}
+
+const char *dns_hitters_kind_name(dns_hitters_kind_t kind) {
+  switch (kind) {
+    case DNS_HITTERS_QNAME: return "qname";
+    case DNS_HITTERS_CLIENT: return "client";
+    case DNS_HITTERS_QTYPE: return "qtype";
+    default: return "unknown";
+  }
+}
+
+// presentation format, bytes that are not printable become \DDD
+static void qname_text(const uint8_t *wire, size_t length, char *buf, size_t len) {
+  size_t n = 0;
+  size_t offset = 0;
+  while (offset < length && wire[offset] != 0 && n + 1 < len) {
+    size_t label = wire[offset++];
+    for (size_t i = 0; i < label && offset < length && n + 5 < len; ++i, ++offset) {
+      uint8_t c = wire[offset];
+      if (c == '.' || c == '\\' || c == '"') {
+        buf[n++] = '\\';
+        buf[n++] = (char)c;
+      } else if (c < 0x21 || c > 0x7E) {
+        n += (size_t)snprintf(buf + n, len - n, "\\%03u", c);
+      } else {
+        buf[n++] = (char)c;
+      }
+    }
+    if (n + 1 < len) buf[n++] = '.';
+  }
+  if (n == 0 && len > 1) buf[n++] = '.'; // the root
+  buf[n < len ? n : len - 1] = '\0';
+}
+
+const char *dns_hitters_key_text(dns_hitters_kind_t kind, const dns_topk_entry_t *entry,
+                                 char *buf, size_t len) {
+  if (!entry || !buf || len == 0) return NULL;
+
+  buf[0] = '\0';
+  switch (kind) {
+    case DNS_HITTERS_QNAME:
+      qname_text(entry->key, entry->key_length, buf, len);
+      break;
+
+    case DNS_HITTERS_CLIENT: {
+      uint8_t address[16] = {0};
+      char text[INET6_ADDRSTRLEN];
+      if (entry->key_length < 1) break;
+
+      if (entry->key[0] == 4) {
+        memcpy(address, entry->key + 1, DNS_HITTERS_V4_PREFIX / 8);
+        inet_ntop(AF_INET, address, text, sizeof(text));
+        snprintf(buf, len, "%s/%d", text, DNS_HITTERS_V4_PREFIX);
+      } else if (entry->key[0] == 6) {
+        memcpy(address, entry->key + 1, DNS_HITTERS_V6_PREFIX / 8);
+        inet_ntop(AF_INET6, address, text, sizeof(text));
+        snprintf(buf, len, "%s/%d", text, DNS_HITTERS_V6_PREFIX);
+      }
+      break;
+    }
+
+    case DNS_HITTERS_QTYPE:
+      if (entry->key_length == 2) {
+        // known types come back as a mnemonic, not in buf
+        const char *text = dns_rdata_type_to_text((uint16_t)((entry->key[0] << 8) | entry->key[1]),
+                                                  buf, len);
+        if (text != buf) dns_safe_strncpy(buf, text, len);
+      }
+      break;
+
+    default:
+      break;
+  }
+  return buf;
+}
+
+void dns_hitters_print(const dns_hitters_t *hitters, FILE *output) {
+  if (!hitters || !output) return;
+
+  dns_topk_entry_t entries[DNS_TOPK_REPORT];
+  char key[DNS_TOPK_KEY_MAX * 4 + 1];
+  for (int kind = 0; kind < DNS_HITTERS_COUNT; ++kind) {
+    const dns_topk_t *topk = &hitters->trackers[kind];
+    int n = dns_topk_top(topk, entries, DNS_TOPK_REPORT);
+    if (n == 0) continue;
+
+    fprintf(output, "Top %s of %lu:\n", dns_hitters_kind_name(kind), (unsigned long)topk->total);
+    for (int i = 0; i < n; ++i) {
+      dns_hitters_key_text(kind, &entries[i], key, sizeof(key));
+      fprintf(output, "  %-40s %10lu", key, (unsigned long)entries[i].count);
+      if (entries[i].error > 0) fprintf(output, "  (error %lu)", (unsigned long)entries[i].error);
+      fprintf(output, "\n");
+    }
+  }
+}
@@ -1,106 +1,184 @@
 #include "dns_trie.h"
 #include "dns_zone_file.h"
+#include "dns_simd.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <strings.h>
 
 
-static unsigned int hash_type(dns_record_type_t type) {
-  return type % RRSET_MAP_SIZE;
+static inline size_t map_bytes(uint32_t capacity) {
+  return sizeof(rrset_map_t) + capacity * sizeof(rrset_entry_t);
 }
 
+// copy on write, an RRset that a result or the cache still references is
+// replaced by a private copy before the caller changes it
+static dns_rrset_t *rrset_map_writable(dns_trie_node_t *node, dns_record_type_t type) {
+  rrset_map_t *map = node->rrsets;
+  if (!map) return NULL;
 
-dns_trie_t *dns_trie_create(void) {
-  dns_trie_t *trie = malloc(sizeof(dns_trie_t));
-  if (!trie) return NULL;
+  for (uint32_t i = 0; i < map->count; ++i) {
+    if (map->entries[i].type != type) continue;
 
-  trie->root = dns_trie_node_create("");
-  if (!trie->root) {
-    free(trie);
-    return NULL;
+    // the caller is about to change it, the encoded answer goes stale
+    dns_fragment_free(map->entries[i].fragment);
+    map->entries[i].fragment = NULL;
+
+    dns_rrset_t *rrset = map->entries[i].rrset;
+    if (!dns_rrset_is_shared(rrset)) return rrset;
+
+    dns_rrset_t *copy = dns_rrset_copy(rrset);
+    if (!copy) return NULL;
+    map->entries[i].rrset = copy;
+    dns_rrset_free(rrset);
+    return copy;
   }
 
-  return trie;
+  return NULL;
 }
 
-void dns_trie_free(dns_trie_t *trie) {
-  if (!trie) return;
+static void zone_release(dns_trie_t *trie, dns_zone_t *zone) {
+  if (!zone) return;
 
-  dns_trie_node_free(trie->root);
-  free(trie);
+  free(zone->soa);
+  dns_rrset_free(zone->soa_rrset);
+  dns_fragment_free(zone->soa_fragment);
+  dns_rrset_free(zone->ns_records);
+  dns_arena_release(trie->arena, zone, sizeof(dns_zone_t));
 }
 
-static int split_domain(const char *domain, char labels[][MAX_LABEL_LEN+1], int max_labels) {
-  char normalized[MAX_DOMAIN_NAME];
-  dns_normalize_domain(domain, normalized);
+// rebuilt whenever the soa changes, answers already holding the old one keep it
+static bool zone_update_soa_rrset(dns_zone_t *zone) {
+  const dns_soa_t *soa = zone->soa;
+  dns_rr_t *rr = dns_rr_create_soa(soa->mname, soa->rname, soa->serial, soa->refresh,
+                                   soa->retry, soa->expire, soa->minimum, soa->minimum);
+  if (!rr) return false;
 
-  int count = 0;
-  const char *end = normalized + strlen(normalized);
+  dns_rrset_t *rrset = dns_rrset_create(DNS_TYPE_SOA, rr->ttl);
+  if (!rrset) {
+    dns_rr_free(rr);
+    return false;
+  }
+  dns_rrset_add(rrset, rr);
 
-  // find all dots and split from right to left (root [TLD] down)
-  const char *dots[128];
-  int dot_count = 0;
-  for (const char *p = normalized; *p; ++p) {
-    if (*p == '.') {
-      dots[dot_count++] = p;
-    }
+  dns_rrset_free(zone->soa_rrset);
+  zone->soa_rrset = rrset;
+
+  // negative answers copy this, a zone without one takes the slow path
+  dns_name_t apex;
+  dns_fragment_free(zone->soa_fragment);
+  zone->soa_fragment = (dns_name_from_text(&apex, zone->zone_name) == 0)
+    ? dns_fragment_build(&apex, 0, rrset, rrset->ttl)
+    : NULL;
+  return true;
+}
+
+static dns_rrset_t *cname_rrset_create(const char *target, uint32_t ttl) {
+  dns_rr_t *rr = dns_rr_create_cname(target, ttl);
+  if (!rr) return NULL;
+
+  dns_rrset_t *rrset = dns_rrset_create(DNS_TYPE_CNAME, ttl);
+  if (!rrset) {
+    dns_rr_free(rr);
+    return NULL;
   }
+  dns_rrset_add(rrset, rr);
+  return rrset;
+}
 
-  // extract labels from right to left (root [TLD] down)
-  const char *start = (dot_count > 0) ? dots[dot_count-1] + 1 : normalized;
-  const char *label_end = end;
 
-  for (int i = dot_count - 1; i >= -1 && count < max_labels; --i) {
+dns_trie_t *dns_trie_create(void) {
+  dns_trie_t *trie = calloc(1, sizeof(dns_trie_t));
+  if (!trie) return NULL;
 
-    size_t len = label_end - start;
+  trie->arena = dns_arena_create(DNS_TRIE_ARENA_CHUNK);
+  if (!trie->arena) goto cleanup;
 
-    if (len > 0 && len <= MAX_LABEL_LEN) {
-      memcpy(labels[count], start, len);
-      labels[count][len] = '\0';
-      ++count;
-    }
+  trie->root = dns_trie_node_create(trie, "");
+  if (!trie->root) goto cleanup;
 
-    if (i >= 0) {
-      label_end = dots[i];
-      start = (i > 0) ? dots[i-1] + 1 : normalized;
+  return trie;
+
+cleanup:
+  dns_arena_destroy(trie->arena);
+  free(trie);
+  return NULL;
+}
+
+void dns_trie_free(dns_trie_t *trie) {
+  if (!trie) return;
+
+  // only the heap owned data needs visiting, the nodes themselves go with the arena
+  for (dns_trie_slab_t *slab = trie->slabs; slab; slab = slab->next) {
+    for (size_t i = 0; i < slab->used; ++i) {
+      dns_trie_node_t *node = &slab->nodes[i];
+      if (!node->in_use) continue;
+
+      if (node->rrsets) {
+        for (uint32_t j = 0; j < node->rrsets->count; ++j) {
+          dns_rrset_free(node->rrsets->entries[j].rrset);
+          dns_fragment_free(node->rrsets->entries[j].fragment);
+        }
+      }
+      dns_rrset_free(node->cname);
+      if (node->zone) {
+        free(node->zone->soa);
+        dns_rrset_free(node->zone->soa_rrset);
+        dns_fragment_free(node->zone->soa_fragment);
+        dns_rrset_free(node->zone->ns_records);
+      }
     }
   }
 
-  return count;
+  dns_arena_destroy(trie->arena);
+  free(trie);
 }
 
+// labels in the trie are stored lowercase, names are canonical
+static dns_trie_node_t *find_child(const dns_trie_node_t *node, const uint8_t *label, uint8_t len) {
+  for (size_t j = 0; j < node->children_count; ++j) {
+    dns_trie_node_t *child = node->children[j];
+    if (child->label_len == len && memcmp(child->label, label, len) == 0) {
+      return child;
+    }
+  }
+  return NULL;
+}
+
+static dns_trie_node_t *node_create(dns_trie_t *trie, const uint8_t *label, uint8_t len);
+
+// the trie runs root [TLD] first, names are stored leftmost label first
 static dns_trie_node_t *find_or_create_node(dns_trie_t *trie, const char *domain) {
-  char labels[128][MAX_LABEL_LEN + 1];
-  int label_count = split_domain(domain, labels, 128);
+  dns_name_t name;
+  if (dns_name_from_text(&name, domain) < 0) return NULL;
 
   dns_trie_node_t *curr = trie->root;
 
-  for (int i = 0; i < label_count; ++i) {
+  for (int i = name.label_count - 1; i >= 0; --i) {
+    uint8_t label_len;
+    const uint8_t *label = dns_name_label(&name, i, &label_len);
+
     // find child with matching label
-    dns_trie_node_t *child = NULL;
-    for (size_t j = 0; j < curr->children_count; ++j) {
-      if (strcasecmp(curr->children[j]->label, labels[i]) == 0) {
-        child = curr->children[j];
-        break;
-      }
-    }
+    dns_trie_node_t *child = find_child(curr, label, label_len);
 
     // create child if not found
     if (!child) {
-      child = dns_trie_node_create(labels[i]);
+      child = node_create(trie, label, label_len);
       if (!child) return NULL;
 
       // add to children
       if (curr->children_count >= curr->children_capacity) {
         size_t new_capacity = (curr->children_capacity == 0)
-          ? 4
+          ? 2
           : curr->children_capacity * 2;
-        dns_trie_node_t **new_children = realloc(curr->children, new_capacity * sizeof(dns_trie_node_t*));
+        dns_trie_node_t **new_children = dns_arena_alloc(trie->arena, new_capacity * sizeof(dns_trie_node_t*));
         if (!new_children) {
-          dns_trie_node_free(child);
+          dns_trie_node_free(trie, child);
           return NULL;
         }
+        if (curr->children) {
+          memcpy(new_children, curr->children, curr->children_count * sizeof(dns_trie_node_t*));
+          dns_arena_release(trie->arena, curr->children, curr->children_capacity * sizeof(dns_trie_node_t*));
+        }
         curr->children = new_children;
         curr->children_capacity = new_capacity;
       }
@@ -114,48 +192,146 @@ static dns_trie_node_t *find_or_create_node(dns_trie_t *trie, const char *domain
   return curr;
 }
 
-dns_trie_node_t *dns_trie_node_create(const char *label) {
-  dns_trie_node_t *node = calloc(1, sizeof(dns_trie_node_t));
-  if (!node) return NULL;
+// exact descent recording every node on the way, path[0] is the root
+static int find_node_path(dns_trie_t *trie, const char *domain, dns_trie_node_t **path, int max_depth) {
+  dns_name_t name;
+  if (dns_name_from_text(&name, domain) < 0) return -1;
+  if (name.label_count >= max_depth) return -1;
 
-  if (label) {
-    dns_safe_strncpy(node->label, label, sizeof(node->label));
+  path[0] = trie->root;
+  for (int depth = 0; depth < name.label_count; ++depth) {
+    uint8_t label_len;
+    const uint8_t *label = dns_name_label(&name, name.label_count - 1 - depth, &label_len);
+    dns_trie_node_t *child = find_child(path[depth], label, label_len);
+
+    if (!child) return -1;
+    path[depth + 1] = child;
   }
 
-  node->children = NULL;
-  node->children_count = 0;
-  node->children_capacity = 0;
-  node->rrsets = rrset_map_create();
-  node->zone = NULL;
-  node->cname = NULL;
-  node->is_delegation = false;;
+  return name.label_count;
+}
+
+// exact node for a canonical name, NULL when it does not exist
+static dns_trie_node_t *find_node(dns_trie_t *trie, const dns_name_t *name) {
+  dns_trie_node_t *curr = trie->root;
+
+  for (int i = name->label_count - 1; i >= 0 && curr; --i) {
+    uint8_t label_len;
+    const uint8_t *label = dns_name_label(name, i, &label_len);
+    curr = find_child(curr, label, label_len);
+  }
+
+  return curr;
+}
+
+static bool node_has_data(const dns_trie_node_t *node) {
+  return node->cname || node->zone || !rrset_map_is_empty(node->rrsets);
+}
+
+// drop empty leaves from the bottom of the path, never the root
+static void prune_node_path(dns_trie_t *trie, dns_trie_node_t **path, int depth) {
+  for (int i = depth; i > 0; --i) {
+    dns_trie_node_t *node = path[i];
+    if (node->children_count > 0 || node_has_data(node)) return;
+
+    dns_trie_node_t *parent = path[i - 1];
+    for (size_t j = 0; j < parent->children_count; ++j) {
+      if (parent->children[j] == node) {
+        parent->children[j] = parent->children[--parent->children_count];
+        break;
+      }
+    }
+    dns_trie_node_free(trie, node);
+  }
+}
+
+dns_trie_node_t *dns_trie_node_create(dns_trie_t *trie, const char *label) {
+  if (!trie) return NULL;
+
+  size_t len = label ? strnlen(label, MAX_LABEL_LEN + 1) : 0;
+  if (len > MAX_LABEL_LEN) return NULL;
+
+  // children are matched bytewise against canonical names
+  char lowered[MAX_LABEL_LEN + 1];
+  dns_simd_lower(lowered, label ? label : "", len);
+  return node_create(trie, (const uint8_t *)lowered, (uint8_t)len);
+}
+
+static dns_trie_node_t *node_create(dns_trie_t *trie, const uint8_t *label, uint8_t len) {
+  dns_trie_node_t *node = trie->free_nodes;
+  if (node) {
+    trie->free_nodes = node->next_free;
+    memset(node, 0, sizeof(dns_trie_node_t));
+  } else {
+    dns_trie_slab_t *slab = trie->slabs;
+    if (!slab || slab->used == DNS_TRIE_SLAB_NODES) {
+      slab = dns_arena_alloc(trie->arena, sizeof(dns_trie_slab_t));
+      if (!slab) return NULL;
+      slab->next = trie->slabs;
+      trie->slabs = slab;
+    }
+    node = &slab->nodes[slab->used++];
+  }
+
+  memcpy(node->label, label, len);
+  node->label[len] = '\0';
+  node->label_len = len;
+
+  // children, rrsets, zone and cname are created on demand
+  node->in_use = true;
+  trie->node_count++;
 
   return node;
 }
 
-void dns_trie_node_free(dns_trie_node_t *node) {
-  if (!node) return;
+// answers for every rrset at node that lost (or never had) its fragment
+static size_t node_compile(dns_trie_node_t *node, const dns_name_t *name) {
+  if (!node->rrsets) return 0;
+
+  size_t built = 0;
+  for (uint32_t i = 0; i < node->rrsets->count; ++i) {
+    rrset_entry_t *entry = &node->rrsets->entries[i];
+    if (entry->fragment) continue;
+    // a fragment freezes one order, rotated sets are encoded per answer
+    if (entry->rrset->order != DNS_RRSET_ORDER_FIXED && entry->rrset->count > 1) continue;
+
+    // gap is the qtype and qclass of the question in front of the answers
+    entry->fragment = dns_fragment_build(name, 4, entry->rrset, entry->rrset->ttl);
+    if (entry->fragment) ++built;
+  }
+  return built;
+}
+
+static void node_compile_domain(dns_trie_node_t *node, const char *domain) {
+  dns_name_t name;
+  if (dns_name_from_text(&name, domain) == 0) node_compile(node, &name);
+}
+
+void dns_trie_node_free(dns_trie_t *trie, dns_trie_node_t *node) {
+  if (!trie || !node || !node->in_use) return;
 
   // free children
   for (size_t i = 0; i < node->children_count; ++i) {
-    dns_trie_node_free(node->children[i]);
+    dns_trie_node_free(trie, node->children[i]);
   }
-  free(node->children);
+  dns_arena_release(trie->arena, node->children, node->children_capacity * sizeof(dns_trie_node_t*));
 
   // free rrsets
-  rrset_map_free(node->rrsets);
-
-  // free zone
-  if (node->zone) {
-    if (node->zone->soa) free(node->zone->soa);
-    dns_rrset_free(node->zone->ns_records);
-    free(node->zone);
+  if (node->rrsets) {
+    for (uint32_t i = 0; i < node->rrsets->count; ++i) {
+      dns_rrset_free(node->rrsets->entries[i].rrset);
+      dns_fragment_free(node->rrsets->entries[i].fragment);
+    }
+    dns_arena_release(trie->arena, node->rrsets, map_bytes(node->rrsets->capacity));
   }
 
-  // free cname
-  if (node->cname) free(node->cname);
+  zone_release(trie, node->zone);
+  dns_rrset_free(node->cname);
 
-  free(node);
+  node->in_use = false;
+  node->next_free = trie->free_nodes;
+  trie->free_nodes = node;
+  trie->node_count--;
 }
 
 bool dns_trie_insert_rr(dns_trie_t *trie, const char *domain, dns_rr_t *rr) {
@@ -168,19 +344,16 @@ bool dns_trie_insert_rr(dns_trie_t *trie, const char *domain, dns_rr_t *rr) {
   if (node->cname != NULL) return false;
 
   // check if adding CNAME when any other records exist
-  if (rr->type == DNS_TYPE_CNAME && node->rrsets) {
-    for (int i = 0; i < RRSET_MAP_SIZE; ++i) {
-      if (node->rrsets->buckets[i] != NULL) return false;
-    }
-  }
+  if (rr->type == DNS_TYPE_CNAME && !rrset_map_is_empty(node->rrsets)) return false;
 
   // get or create rrset for this type
-  dns_rrset_t *rrset = rrset_map_lookup(node->rrsets, rr->type);
+  dns_rrset_t *rrset = rrset_map_writable(node, rr->type);
   if (!rrset) {
     rrset = dns_rrset_create(rr->type, rr->ttl);
     if (!rrset) return false;
+    rrset->order = dns_rrset_order_policy_lookup(&trie->rrset_order, domain, rr->type);
 
-    if (!rrset_map_insert(node->rrsets, rr->type, rrset)) {
+    if (!rrset_map_insert(trie, node, rr->type, rrset)) {
       dns_rrset_free(rrset);
       return false;
     }
@@ -189,18 +362,190 @@ bool dns_trie_insert_rr(dns_trie_t *trie, const char *domain, dns_rr_t *rr) {
   return dns_rrset_add(rrset, rr);
 }
 
+bool dns_trie_update_rr(dns_trie_t *trie, const char *domain, dns_rr_t *rr) {
+  if (!trie || !domain || !rr) return false;
+
+  dns_trie_node_t *node = find_or_create_node(trie, domain);
+  if (!node) return false;
+
+  // CNAME and other data are mutually exclusive, the update is ignored
+  if (rr->type == DNS_TYPE_CNAME) {
+    if (!rrset_map_is_empty(node->rrsets)) return false;
+
+    dns_rrset_t *cname = dns_rrset_create(DNS_TYPE_CNAME, rr->ttl);
+    if (!cname) return false;
+    dns_rrset_add(cname, rr);
+
+    // replaced rather than changed, results may still point at the old one
+    dns_rrset_free(node->cname);
+    node->cname = cname;
+    return true;
+  }
+  if (node->cname) return false;
+
+  // at most one SOA, which is always replaced
+  if (rr->type == DNS_TYPE_SOA) {
+    rrset_map_remove(trie, node, DNS_TYPE_SOA);
+    if (node->zone && node->zone->soa) {
+      dns_safe_strncpy(node->zone->soa->mname, rr->rdata.soa->mname, sizeof(node->zone->soa->mname));
+      dns_safe_strncpy(node->zone->soa->rname, rr->rdata.soa->rname, sizeof(node->zone->soa->rname));
+      node->zone->soa->serial = rr->rdata.soa->serial;
+      node->zone->soa->refresh = rr->rdata.soa->refresh;
+      node->zone->soa->retry = rr->rdata.soa->retry;
+      node->zone->soa->expire = rr->rdata.soa->expire;
+      node->zone->soa->minimum = rr->rdata.soa->minimum;
+      if (!zone_update_soa_rrset(node->zone)) return false;
+    }
+  }
+
+  dns_rrset_t *rrset = rrset_map_writable(node, rr->type);
+  if (!rrset) {
+    rrset = dns_rrset_create(rr->type, rr->ttl);
+    if (!rrset) return false;
+    rrset->order = dns_rrset_order_policy_lookup(&trie->rrset_order, domain, rr->type);
+
+    if (!rrset_map_insert(trie, node, rr->type, rrset)) {
+      dns_rrset_free(rrset);
+      return false;
+    }
+  }
+
+  // the update TTL applies to the whole RRset
+  rrset->ttl = rr->ttl;
+  for (dns_rr_t *curr = rrset->records; curr; curr = curr->next) {
+    curr->ttl = rr->ttl;
+  }
+
+  // duplicate rdata only refreshes the TTL
+  bool updated = true;
+  for (dns_rr_t *curr = rrset->records; curr; curr = curr->next) {
+    if (dns_rr_rdata_equal(curr, rr)) {
+      dns_rr_free(rr);
+      rr = NULL;
+      break;
+    }
+  }
+  if (rr) updated = dns_rrset_add(rrset, rr);
+
+  node_compile_domain(node, domain);
+  return updated;
+}
+
+bool dns_trie_delete_rr(dns_trie_t *trie, const char *domain, const dns_rr_t *rr) {
+  if (!trie || !domain || !rr) return false;
+
+  dns_trie_node_t *path[129];
+  int depth = find_node_path(trie, domain, path, 129);
+  if (depth < 0) return false;
+
+  dns_trie_node_t *node = path[depth];
+  bool deleted = false;
+
+  if (rr->type == DNS_TYPE_CNAME) {
+    const char *target = node->cname ? node->cname->records->rdata.cname.cname : NULL;
+    if (target && rr->rdata.cname.cname && dns_name_equal(target, rr->rdata.cname.cname)) {
+      dns_rrset_free(node->cname);
+      node->cname = NULL;
+      deleted = true;
+    }
+  } else {
+    dns_rrset_t *rrset = rrset_map_writable(node, rr->type);
+    if (!rrset) return false;
+
+    for (dns_rr_t **curr = &rrset->records; *curr; curr = &(*curr)->next) {
+      if (dns_rr_rdata_equal(*curr, rr)) {
+        dns_rr_t *victim = *curr;
+        *curr = victim->next;
+        victim->next = NULL; // dns_rr_free follows next
+        dns_rr_free(victim);
+        rrset->count--;
+        deleted = true;
+        break;
+      }
+    }
+
+    if (rrset->count == 0) {
+      rrset_map_remove(trie, node, rr->type);
+    } else {
+      node_compile_domain(node, domain);
+    }
+  }
+
+  prune_node_path(trie, path, depth);
+  return deleted;
+}
+
+bool dns_trie_delete_rrset(dns_trie_t *trie, const char *domain, dns_record_type_t type) {
+  if (!trie || !domain) return false;
+
+  dns_trie_node_t *path[129];
+  int depth = find_node_path(trie, domain, path, 129);
+  if (depth < 0) return false;
+
+  dns_trie_node_t *node = path[depth];
+  bool deleted = false;
+
+  if (type == DNS_TYPE_CNAME) {
+    if (node->cname) {
+      dns_rrset_free(node->cname);
+      node->cname = NULL;
+      deleted = true;
+    }
+  } else {
+    deleted = rrset_map_remove(trie, node, type);
+  }
+
+  prune_node_path(trie, path, depth);
+  return deleted;
+}
+
+bool dns_trie_delete_name(dns_trie_t *trie, const char *domain, bool keep_apex) {
+  if (!trie || !domain) return false;
+
+  dns_trie_node_t *path[129];
+  int depth = find_node_path(trie, domain, path, 129);
+  if (depth < 0) return false;
+
+  dns_trie_node_t *node = path[depth];
+  bool deleted = false;
+
+  if (node->cname) {
+    dns_rrset_free(node->cname);
+    node->cname = NULL;
+    deleted = true;
+  }
+
+  // walk backwards, removal moves the last entry into the freed slot
+  for (uint32_t i = node->rrsets ? node->rrsets->count : 0; i > 0; --i) {
+    dns_record_type_t type = node->rrsets->entries[i - 1].type;
+    if (keep_apex && (type == DNS_TYPE_SOA || type == DNS_TYPE_NS)) continue;
+
+    rrset_map_remove(trie, node, type);
+    deleted = true;
+  }
+
+  prune_node_path(trie, path, depth);
+  return deleted;
+}
+
 bool dns_trie_insert_zone(dns_trie_t *trie, const char *zone_name, dns_soa_t *soa, dns_rrset_t *ns_records) {
   if (!trie || !zone_name || !soa || !ns_records) return false;
 
   dns_trie_node_t *node = find_or_create_node(trie, zone_name);
+  if (!node) return false;
 
   if (node->zone) return false; // zone already exists
 
-  node->zone = calloc(1, sizeof(dns_zone_t));
+  node->zone = dns_arena_alloc(trie->arena, sizeof(dns_zone_t));
   if (!node->zone) return false;
 
   dns_safe_strncpy(node->zone->zone_name, zone_name, sizeof(node->zone->zone_name));
   node->zone->soa = soa;
+  if (!zone_update_soa_rrset(node->zone)) {
+    dns_arena_release(trie->arena, node->zone, sizeof(dns_zone_t));
+    node->zone = NULL;
+    return false;
+  }
   node->zone->ns_records = ns_records;
   node->zone->authoritative = true;
 
@@ -214,192 +559,255 @@ bool dns_trie_insert_cname(dns_trie_t *trie, const char *domain, const char *tar
   if (!node) return false;
 
   // check if other records exist
-  for (int i = 0; i < RRSET_MAP_SIZE; ++i) {
-    if (node->rrsets->buckets[i] != NULL) return false;
-  }
+  if (!rrset_map_is_empty(node->rrsets)) return false;
 
   // check if CNAME already exists
   if (node->cname) return false;
 
-  node->cname = calloc(1, sizeof(dns_cname_t));
-  if (!node->cname) return false;
+  node->cname = cname_rrset_create(target, ttl);
+  return node->cname != NULL;
+}
+
+dns_rrset_t *dns_trie_lookup(dns_trie_t *trie, const char *domain, dns_record_type_t type) {
+  if (!trie || !domain) return NULL;
 
-  dns_safe_strncpy(node->cname->cname, target, sizeof(node->cname->cname));
-  node->cname_ttl = ttl;
+  dns_name_t name;
+  if (dns_name_from_text(&name, domain) < 0) return NULL;
 
-  return true;
+  dns_trie_node_t *node = find_node(trie, &name);
+  return node ? rrset_map_lookup(node->rrsets, type) : NULL;
 }
 
-dns_rrset_t *dns_trie_lookup(dns_trie_t *trie, const char *domain, dns_record_type_t type) {
+dns_rrset_t *dns_trie_lookup_cname(dns_trie_t *trie, const char *domain, uint32_t *ttl) {
   if (!trie || !domain) return NULL;
 
-  char labels[128][MAX_LABEL_LEN + 1];
-  int label_count = split_domain(domain, labels, 128);
+  dns_name_t name;
+  if (dns_name_from_text(&name, domain) < 0) return NULL;
 
-  dns_trie_node_t *curr = trie->root;
-  for (int i = 0; i < label_count; ++i) {
-    dns_trie_node_t *child = NULL;
-    for (size_t j = 0; j < curr->children_count; ++j) {
-      if (strcasecmp(curr->children[j]->label, labels[i]) == 0) {
-        child = curr->children[j];
-        break;
-      }
-    }
+  dns_trie_node_t *node = find_node(trie, &name);
+  if (!node) return NULL;
 
-    if (!child) return NULL;
-    curr = child;
+  if (node->cname && ttl) {
+    *ttl = node->cname->ttl;
   }
 
-  return rrset_map_lookup(curr->rrsets, type);
+  return node->cname;
 }
 
-dns_cname_t *dns_trie_lookup_cname(dns_trie_t *trie, const char *domain, uint32_t *ttl) {
+dns_zone_t *dns_trie_find_zone(dns_trie_t *trie, const char *domain) {
   if (!trie || !domain) return NULL;
 
-  char labels[128][MAX_LABEL_LEN + 1];
-  int label_count = split_domain(domain, labels, 128);
+  dns_trie_match_result_t match;
+  dns_trie_find(trie, domain, &match);
+  return match.zone;
+}
 
-  dns_trie_node_t *curr = trie->root;
-  for (int i = 0; i < label_count; ++i) {
-    dns_trie_node_t *child = NULL;
-    for (size_t j = 0; j < curr->children_count; ++j) {
-      if (strcasecmp(curr->children[j]->label, labels[i]) == 0) {
-        child = curr->children[j];
-        break;
-      }
-    }
+static void match_result_init(dns_trie_match_result_t *result) {
+  result->match = DNS_TRIE_MATCH_NONE;
+  result->node = NULL;
+  result->closest_encloser = NULL;
+  result->encloser_labels = 0;
+  result->zone = NULL;
+}
 
-    if (!child) return NULL;
-    curr = child;
-  }
+dns_trie_match_t dns_trie_find(dns_trie_t *trie, const char *domain, dns_trie_match_result_t *result) {
+  if (!result) return DNS_TRIE_MATCH_NONE;
 
-  if (curr->cname && ttl) {
-    *ttl = curr->cname_ttl;
-  }
+  match_result_init(result);
+  if (!trie || !domain) return DNS_TRIE_MATCH_NONE;
+
+  dns_name_t name;
+  if (dns_name_from_text(&name, domain) < 0) return DNS_TRIE_MATCH_NONE;
 
-  return curr->cname;
+  return dns_trie_find_name(trie, &name, result);
 }
 
-dns_zone_t *dns_trie_find_zone(dns_trie_t *trie, const char *domain) {
-  if (!trie || !domain) return NULL;
+dns_trie_match_t dns_trie_find_name(dns_trie_t *trie, const dns_name_t *name,
+                                    dns_trie_match_result_t *result) {
+  if (!result) return DNS_TRIE_MATCH_NONE;
 
-  char labels[128][MAX_LABEL_LEN + 1];
-  int label_count = split_domain(domain, labels, 128);
+  match_result_init(result);
+  if (!trie || !name) return DNS_TRIE_MATCH_NONE;
 
   dns_trie_node_t *curr = trie->root;
-  dns_zone_t *closest_zone = NULL;
 
-  for (int i = 0; i < label_count; ++i) {
-    if (curr->zone) closest_zone = curr->zone;
+  // single descent, TLD first
+  for (int i = name->label_count - 1; i >= 0; --i) {
+    if (curr->zone) result->zone = curr->zone;
+
+    uint8_t label_len;
+    const uint8_t *label = dns_name_label(name, i, &label_len);
 
+    // remember the wildcard child while scanning so a miss needs no second pass
     dns_trie_node_t *child = NULL;
+    dns_trie_node_t *wildcard = NULL;
     for (size_t j = 0; j < curr->children_count; ++j) {
-      if (strcasecmp(curr->children[j]->label, labels[i]) == 0) {
-        child = curr->children[j];
+      dns_trie_node_t *candidate = curr->children[j];
+      if (candidate->label_len == label_len && memcmp(candidate->label, label, label_len) == 0) {
+        child = candidate;
         break;
       }
+      if (candidate->label_len == 1 && candidate->label[0] == '*') wildcard = candidate;
+    }
+
+    if (!child) {
+      // curr is the closest encloser; *.<closest encloser> synthesizes the answer
+      result->closest_encloser = curr;
+      result->encloser_labels = name->label_count - 1 - i;
+      if (wildcard) {
+        result->match = DNS_TRIE_MATCH_WILDCARD;
+        result->node = wildcard;
+      }
+      return result->match;
     }
 
-    if (!child) break;
     curr = child;
   }
 
-  // check final node
-  if (curr->zone) closest_zone = curr->zone;
+  if (curr->zone) result->zone = curr->zone;
 
-  return closest_zone;
+  result->match = DNS_TRIE_MATCH_EXACT;
+  result->node = curr;
+  result->closest_encloser = curr;
+  result->encloser_labels = name->label_count;
+  return result->match;
 }
 
-rrset_map_t *rrset_map_create(void) {
-  rrset_map_t *map = calloc(1, sizeof(rrset_map_t));
-  return map;
+bool dns_trie_name_in_use(dns_trie_t *trie, const char *domain) {
+  if (!trie || !domain) return false;
+
+  dns_trie_node_t *path[129];
+  int depth = find_node_path(trie, domain, path, 129);
+  if (depth < 0) return false;
+
+  dns_trie_node_t *node = path[depth];
+  return node->cname || !rrset_map_is_empty(node->rrsets);
 }
 
-void rrset_map_free(rrset_map_t *map) {
-  if (!map) return;
+// path[0] is the root, the name of path[depth] is its labels read upwards
+static size_t compile_walk(dns_trie_node_t **path, int depth) {
+  dns_trie_node_t *node = path[depth];
+  size_t built = 0;
 
-  for (int i = 0; i < RRSET_MAP_SIZE; ++i) {
-    rrset_entry_t *entry = map->buckets[i];
-    while (entry) {
-      rrset_entry_t *next = entry->next;
-      dns_rrset_free(entry->rrset);
-      free(entry);
-      entry = next;
+  if (node->rrsets) {
+    dns_name_t name;
+    dns_name_init(&name);
+    for (int i = depth; i > 0; --i) {
+      dns_name_append_label(&name, (const uint8_t *)path[i]->label, path[i]->label_len);
     }
+    dns_name_finish(&name);
+    built += node_compile(node, &name);
   }
-  free(map);
+
+  if (depth + 1 > DNS_NAME_MAX_LABELS) return built;
+  for (size_t i = 0; i < node->children_count; ++i) {
+    path[depth + 1] = node->children[i];
+    built += compile_walk(path, depth + 1);
+  }
+  return built;
 }
 
-bool rrset_map_insert(rrset_map_t *map, dns_record_type_t type, dns_rrset_t *rrset) {
-  if (!map || !rrset) return false;
+size_t dns_trie_compile(dns_trie_t *trie) {
+  if (!trie || !trie->root) return 0;
 
-  unsigned int bucket = hash_type(type);
+  dns_trie_node_t *path[DNS_NAME_MAX_LABELS + 1];
+  path[0] = trie->root;
+  return compile_walk(path, 0);
+}
+
+bool rrset_map_insert(dns_trie_t *trie, dns_trie_node_t *node, dns_record_type_t type, dns_rrset_t *rrset) {
+  if (!trie || !node || !rrset) return false;
 
   // check if type already exists
-  rrset_entry_t *entry = map->buckets[bucket];
-  while (entry) {
-    if (entry->type == type) return false; // already exists
-    entry = entry->next;
+  if (rrset_map_lookup(node->rrsets, type)) return false;
+
+  rrset_map_t *map = node->rrsets;
+  if (!map || map->count == map->capacity) {
+    uint32_t capacity = map ? map->capacity * 2 + 1 : 1;
+    rrset_map_t *grown = dns_arena_alloc(trie->arena, map_bytes(capacity));
+    if (!grown) return false;
+
+    grown->capacity = capacity;
+    if (map) {
+      grown->count = map->count;
+      memcpy(grown->entries, map->entries, map->count * sizeof(rrset_entry_t));
+      dns_arena_release(trie->arena, map, map_bytes(map->capacity));
+    }
+    node->rrsets = map = grown;
   }
 
-  rrset_entry_t *new_entry = malloc(sizeof(rrset_entry_t));
-  if (!new_entry) return false;
-
-  new_entry->type = type;
-  new_entry->rrset = rrset;
-  new_entry->next = map->buckets[bucket];
-  map->buckets[bucket] = new_entry;
+  map->entries[map->count].type = type;
+  map->entries[map->count].rrset = rrset;
+  map->entries[map->count].fragment = NULL;
+  map->count++;
 
   return true;
 }
 
-dns_rrset_t *rrset_map_lookup(rrset_map_t *map, dns_record_type_t type) {
-  if (!map) return NULL;
+dns_rrset_t *rrset_map_lookup(const rrset_map_t *map, dns_record_type_t type) {
+  rrset_entry_t *entry = rrset_map_entry(map, type);
+  return entry ? entry->rrset : NULL;
+}
 
-  unsigned int bucket = hash_type(type);
-  rrset_entry_t *entry = map->buckets[bucket];
+rrset_entry_t *rrset_map_entry(const rrset_map_t *map, dns_record_type_t type) {
+  if (!map) return NULL;
 
-  while (entry) {
-    if (entry->type == type) return entry->rrset;
-    entry = entry->next;
+  for (uint32_t i = 0; i < map->count; ++i) {
+    if (map->entries[i].type == type) return (rrset_entry_t *)&map->entries[i];
   }
 
   return NULL;
 }
 
+bool rrset_map_remove(dns_trie_t *trie, dns_trie_node_t *node, dns_record_type_t type) {
+  if (!trie || !node || !node->rrsets) return false;
+
+  rrset_map_t *map = node->rrsets;
+  for (uint32_t i = 0; i < map->count; ++i) {
+    if (map->entries[i].type == type) {
+      dns_rrset_free(map->entries[i].rrset);
+      dns_fragment_free(map->entries[i].fragment);
+      map->entries[i] = map->entries[--map->count];
+
+      // an empty map goes back to the arena, nodes without data carry none
+      if (map->count == 0) {
+        dns_arena_release(trie->arena, map, map_bytes(map->capacity));
+        node->rrsets = NULL;
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool rrset_map_is_empty(const rrset_map_t *map) {
+  return !map || map->count == 0;
+}
+
 bool dns_trie_is_empty(const dns_trie_t *trie) {
   if (!trie || !trie->root) return true;
   return (trie->root->children_count == 0);
 }
 
-static size_t count_records_recursive(dns_trie_node_t *node) {
-  if (!node) return 0;
+size_t dns_trie_get_record_count(const dns_trie_t *trie) {
+  if (!trie) return 0;
 
   size_t count = 0;
+  for (const dns_trie_slab_t *slab = trie->slabs; slab; slab = slab->next) {
+    for (size_t i = 0; i < slab->used; ++i) {
+      const dns_trie_node_t *node = &slab->nodes[i];
+      if (!node->in_use || !node->rrsets) continue;
 
-  // count records at this node
-  if (node->rrsets) {
-    for (int i = 0; i < RRSET_MAP_SIZE; ++i) {
-      rrset_entry_t *entry = node->rrsets->buckets[i];
-      while (entry) {
-        count += entry->rrset->count;
-        entry = entry->next;
+      for (uint32_t j = 0; j < node->rrsets->count; ++j) {
+        count += node->rrsets->entries[j].rrset->count;
       }
     }
   }
 
-  // make a recursive call for each child
-  for (size_t i = 0; i < node->children_count; ++i) {
-    count += count_records_recursive(node->children[i]);
-  }
-
   return count;
 }
 
-size_t dns_trie_get_record_count(const dns_trie_t *trie) {
-  return trie ? count_records_recursive(trie->root) : 0;
-}
-
 const char *dns_trie_get_stats(const dns_trie_t *trie, char *buf, size_t len) {
   if (!trie || !buf || len == 0) return "";
 
@@ -0,0 +1,404 @@
+#include "dns_update.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+// smallest possible RR: root name, type, class, ttl, rdlength
+#define DNS_MIN_RR_SIZE 11
+
+
+typedef struct {
+  dns_rr_header_t header;
+  dns_rr_t *rr; // parsed rdata, NULL for class ANY/NONE without rdata
+  bool checked;
+} update_rr_t;
+
+
+static void update_rrs_free(update_rr_t *rrs, int count) {
+  if (!rrs) return;
+
+  for (int i = 0; i < count; ++i) {
+    if (rrs[i].rr) dns_rr_free(rrs[i].rr);
+  }
+  free(rrs);
+}
+
+// RFC 1982 serial number arithmetic
+static bool serial_newer(uint32_t next, uint32_t current) {
+  return (int32_t)(next - current) > 0;
+}
+
+static bool rrset_exists(dns_trie_t *trie, const char *name, uint16_t type) {
+  if (type == DNS_TYPE_CNAME) return dns_trie_lookup_cname(trie, name, NULL) != NULL;
+  return dns_trie_lookup(trie, name, (dns_record_type_t)type) != NULL;
+}
+
+static bool zone_is_authoritative(dns_trie_t *trie, const char *zone_name) {
+  dns_zone_t *zone = dns_trie_find_zone(trie, zone_name);
+  if (zone && strcasecmp(zone->zone_name, zone_name) == 0) return true;
+
+  // zone files register the apex SOA as a plain RRset
+  return dns_trie_lookup(trie, zone_name, DNS_TYPE_SOA) != NULL;
+}
+
+// read one RR from an update section, owner name is normalized
+static int read_update_rr(const uint8_t *buf, size_t len, size_t *offset, update_rr_t *out) {
+  if (dns_parse_rr_header(buf, len, offset, &out->header) < 0) return -1;
+
+  char name[MAX_DOMAIN_NAME];
+  dns_normalize_domain(out->header.name, name);
+  memcpy(out->header.name, name, sizeof(name));
+  return 0;
+}
+
+// RFC 2136 3.2.3, the value-dependent prerequisites compare whole RRsets
+static uint8_t check_rrset_prerequisites(dns_trie_t *trie, update_rr_t *prereqs, int count) {
+  for (int i = 0; i < count; ++i) {
+    if (prereqs[i].checked) continue;
+
+    const char *name = prereqs[i].header.name;
+    uint16_t type = prereqs[i].header.type;
+
+    // gather the unique records of this (name, type) group
+    int unique = 0;
+    bool missing = false;
+    for (int j = i; j < count; ++j) {
+      if (prereqs[j].checked) continue;
+      if (prereqs[j].header.type != type || strcasecmp(prereqs[j].header.name, name) != 0) continue;
+      prereqs[j].checked = true;
+
+      bool duplicate = false;
+      for (int k = i; k < j; ++k) {
+        if (prereqs[k].header.type == type
+            && strcasecmp(prereqs[k].header.name, name) == 0
+            && dns_rr_rdata_equal(prereqs[k].rr, prereqs[j].rr)) {
+          duplicate = true;
+          break;
+        }
+      }
+      if (duplicate) continue;
+      ++unique;
+
+      if (type == DNS_TYPE_CNAME) {
+        dns_rrset_t *cname = dns_trie_lookup_cname(trie, name, NULL);
+        if (!cname || !dns_rr_rdata_equal(cname->records, prereqs[j].rr)) missing = true;
+        continue;
+      }
+
+      dns_rrset_t *rrset = dns_trie_lookup(trie, name, (dns_record_type_t)type);
+      bool found = false;
+      for (dns_rr_t *rr = rrset ? rrset->records : NULL; rr; rr = rr->next) {
+        if (dns_rr_rdata_equal(rr, prereqs[j].rr)) {
+          found = true;
+          break;
+        }
+      }
+      if (!found) missing = true;
+    }
+
+    if (missing) return DNS_RCODE_NXRRSET;
+
+    if (type != DNS_TYPE_CNAME) {
+      dns_rrset_t *rrset = dns_trie_lookup(trie, name, (dns_record_type_t)type);
+      if (!rrset || rrset->count != (size_t)unique) return DNS_RCODE_NXRRSET;
+    }
+  }
+
+  return DNS_RCODE_NOERROR;
+}
+
+static uint8_t check_prerequisites(dns_trie_t *trie,
+                                   const char *zone_name,
+                                   uint16_t zone_class,
+                                   const uint8_t *buf,
+                                   size_t len,
+                                   size_t *offset,
+                                   int count,
+                                   dns_update_result_t *result) {
+  if (count == 0) return DNS_RCODE_NOERROR;
+
+  update_rr_t *prereqs = calloc(count, sizeof(update_rr_t));
+  if (!prereqs) return DNS_RCODE_SERVFAIL;
+
+  int rrset_count = 0;
+  uint8_t rcode = DNS_RCODE_NOERROR;
+
+  for (int i = 0; i < count && rcode == DNS_RCODE_NOERROR; ++i) {
+    update_rr_t *curr = &prereqs[rrset_count];
+    if (read_update_rr(buf, len, offset, curr) < 0) {
+      rcode = DNS_RCODE_FORMERROR;
+      break;
+    }
+    result->prerequisites_checked++;
+
+    const dns_rr_header_t *hdr = &curr->header;
+    if (hdr->ttl != 0) {
+      rcode = DNS_RCODE_FORMERROR;
+    } else if (!dns_is_subdomain(hdr->name, zone_name)) {
+      rcode = DNS_RCODE_NOTZONE;
+    } else if (hdr->rclass == DNS_CLASS_ANY) {
+      if (hdr->rdlength != 0) {
+        rcode = DNS_RCODE_FORMERROR;
+      } else if (hdr->type == DNS_TYPE_ANY) {
+        if (!dns_trie_name_in_use(trie, hdr->name)) rcode = DNS_RCODE_NXDOMAIN;
+      } else if (!rrset_exists(trie, hdr->name, hdr->type)) {
+        rcode = DNS_RCODE_NXRRSET;
+      }
+    } else if (hdr->rclass == DNS_CLASS_NONE) {
+      if (hdr->rdlength != 0) {
+        rcode = DNS_RCODE_FORMERROR;
+      } else if (hdr->type == DNS_TYPE_ANY) {
+        if (dns_trie_name_in_use(trie, hdr->name)) rcode = DNS_RCODE_YXDOMAIN;
+      } else if (rrset_exists(trie, hdr->name, hdr->type)) {
+        rcode = DNS_RCODE_YXRRSET;
+      }
+    } else if (hdr->rclass == zone_class) {
+      if (hdr->rdlength == 0 || dns_parse_rdata(buf, len, hdr, &curr->rr) < 0) {
+        rcode = DNS_RCODE_FORMERROR;
+      } else {
+        ++rrset_count; // checked as a group below
+      }
+    } else {
+      rcode = DNS_RCODE_FORMERROR;
+    }
+  }
+
+  if (rcode == DNS_RCODE_NOERROR) rcode = check_rrset_prerequisites(trie, prereqs, rrset_count);
+
+  update_rrs_free(prereqs, rrset_count);
+  return rcode;
+}
+
+// RFC 2136 3.4.1, reject the whole message before anything is applied
+static uint8_t prescan_updates(const char *zone_name,
+                               uint16_t zone_class,
+                               const uint8_t *buf,
+                               size_t len,
+                               size_t *offset,
+                               update_rr_t *updates,
+                               int count) {
+  for (int i = 0; i < count; ++i) {
+    update_rr_t *curr = &updates[i];
+    if (read_update_rr(buf, len, offset, curr) < 0) return DNS_RCODE_FORMERROR;
+
+    const dns_rr_header_t *hdr = &curr->header;
+    if (!dns_is_subdomain(hdr->name, zone_name)) return DNS_RCODE_NOTZONE;
+
+    if (hdr->rclass == zone_class) {
+      if (hdr->type == DNS_TYPE_ANY) return DNS_RCODE_FORMERROR;
+      if (hdr->rdlength == 0 || dns_parse_rdata(buf, len, hdr, &curr->rr) < 0) return DNS_RCODE_FORMERROR;
+    } else if (hdr->rclass == DNS_CLASS_ANY) {
+      if (hdr->ttl != 0 || hdr->rdlength != 0) return DNS_RCODE_FORMERROR;
+    } else if (hdr->rclass == DNS_CLASS_NONE) {
+      if (hdr->ttl != 0 || hdr->type == DNS_TYPE_ANY) return DNS_RCODE_FORMERROR;
+      if (dns_parse_rdata(buf, len, hdr, &curr->rr) < 0) return DNS_RCODE_FORMERROR;
+    } else {
+      return DNS_RCODE_FORMERROR;
+    }
+  }
+
+  return DNS_RCODE_NOERROR;
+}
+
+static bool node_exists(dns_trie_t *trie, const char *name) {
+  dns_trie_match_result_t match;
+  return dns_trie_find(trie, name, &match) == DNS_TRIE_MATCH_EXACT;
+}
+
+// drop the cached answers a change at name can make wrong, by key rather than
+// by walking the cache: every type at the name, and answers synthesized from
+// it when it is a wildcard. a name appearing or disappearing also moves the
+// closest encloser of the NXDOMAIN and wildcard answers around it, those are
+// found through the cache's encloser index on the way up to the apex, along
+// with the ancestors themselves (NXDOMAIN/NODATA for empty non-terminals)
+static void invalidate_cache(dns_cache_t *cache,
+                             dns_trie_t *trie,
+                             const char *name,
+                             const char *zone_name,
+                             bool existence_changed) {
+  if (!cache) return;
+
+  dns_cache_remove_name(cache, name);
+
+  // answers synthesized from *.parent are cached under arbitrary names
+  bool wildcard = strncmp(name, DNS_WILDCARD_LABEL ".", 2) == 0;
+  if (wildcard) dns_cache_remove_enclosed(cache, name + 2, NULL);
+
+  if (!existence_changed) return;
+
+  // what hung on the name itself, a deleted name had nothing below it
+  dns_cache_remove_enclosed(cache, name, NULL);
+
+  size_t zone_len = strlen(zone_name);
+  const char *curr = name;
+  while (strlen(curr) > zone_len) {
+    const char *dot = strchr(curr, '.');
+    if (!dot) break;
+    curr = dot + 1;
+
+    // an ancestor that came or went takes every answer hanging on it, one
+    // that stayed only those at or below the changed name
+    dns_cache_remove_name(cache, curr);
+    dns_cache_remove_enclosed(cache, curr, node_exists(trie, curr) ? name : NULL);
+  }
+  if (zone_len == 0 && curr != name) {
+    dns_cache_remove_name(cache, "");
+    dns_cache_remove_enclosed(cache, "", name);
+  }
+}
+
+static void apply_update(dns_trie_t *trie,
+                         dns_cache_t *cache,
+                         const char *zone_name,
+                         uint16_t zone_class,
+                         update_rr_t *update,
+                         dns_update_result_t *result) {
+  const dns_rr_header_t *hdr = &update->header;
+  const char *name = hdr->name;
+  bool is_apex = strcasecmp(name, zone_name) == 0;
+  bool existed = dns_trie_name_in_use(trie, name);
+  bool changed = false;
+
+  if (hdr->rclass == zone_class) {
+    dns_rr_t *rr = update->rr;
+
+    if (rr->type == DNS_TYPE_SOA) {
+      // SOA only lives at the apex and only moves forward
+      dns_rrset_t *soa = dns_trie_lookup(trie, name, DNS_TYPE_SOA);
+      if (!is_apex || (soa && soa->records && !serial_newer(rr->rdata.soa->serial, soa->records->rdata.soa->serial))) {
+        return;
+      }
+    }
+
+    if (dns_trie_update_rr(trie, name, rr)) {
+      update->rr = NULL; // owned by the trie now
+      result->records_added++;
+      changed = true;
+    }
+  } else if (hdr->rclass == DNS_CLASS_ANY) {
+    if (hdr->type == DNS_TYPE_ANY) {
+      changed = dns_trie_delete_name(trie, name, is_apex);
+    } else if (!(is_apex && (hdr->type == DNS_TYPE_SOA || hdr->type == DNS_TYPE_NS))) {
+      changed = dns_trie_delete_rrset(trie, name, (dns_record_type_t)hdr->type);
+    }
+    if (changed) result->records_deleted++;
+  } else if (hdr->rclass == DNS_CLASS_NONE) {
+    if (hdr->type == DNS_TYPE_SOA) return;
+
+    // never remove the last apex NS
+    if (is_apex && hdr->type == DNS_TYPE_NS) {
+      dns_rrset_t *ns = dns_trie_lookup(trie, name, DNS_TYPE_NS);
+      if (ns && ns->count <= 1) return;
+    }
+
+    changed = dns_trie_delete_rr(trie, name, update->rr);
+    if (changed) result->records_deleted++;
+  }
+
+  if (changed) {
+    invalidate_cache(cache, trie, name, zone_name, existed != dns_trie_name_in_use(trie, name));
+  }
+}
+
+int dns_update_process(dns_trie_t *trie,
+                       dns_cache_t *cache,
+                       const uint8_t *buf,
+                       size_t len,
+                       dns_update_result_t *result,
+                       dns_error_t *err) {
+  if (!trie || !buf || !result) {
+    DNS_ERROR_SET(err, DNS_ERR_INVALID_ARG, "Invalid update arguments");
+    return -1;
+  }
+
+  memset(result, 0, sizeof(*result));
+
+  dns_header_t header;
+  if (dns_parse_header(buf, len, &header) < 0) {
+    DNS_ERROR_SET(err, DNS_ERR_INVALID_PACKET, "Failed to parse update header");
+    return -1;
+  }
+
+  if (header.opcode != DNS_OPCODE_UPDATE) {
+    DNS_ERROR_SET(err, DNS_ERR_UNSUPPORTED_OPCODE, "Not an update");
+    return -1;
+  }
+
+  // zone section: exactly one SOA question
+  size_t offset = 12;
+  if (header.qdcount != 1 || dns_parse_question(buf, len, &offset, &result->zone) < 0) {
+    result->rcode = DNS_RCODE_FORMERROR;
+    return 0;
+  }
+  result->has_zone = true;
+
+  if (result->zone.qtype != DNS_TYPE_SOA) {
+    result->rcode = DNS_RCODE_FORMERROR;
+    return 0;
+  }
+
+  // counts that cannot fit in the message are malformed
+  size_t max_rrs = len / DNS_MIN_RR_SIZE;
+  if (header.ancount > max_rrs || header.nscount > max_rrs) {
+    result->rcode = DNS_RCODE_FORMERROR;
+    return 0;
+  }
+
+  char zone_name[MAX_DOMAIN_NAME];
+  dns_normalize_domain(result->zone.qname, zone_name);
+
+  if (!zone_is_authoritative(trie, zone_name)) {
+    result->rcode = DNS_RCODE_NOTAUTH;
+    return 0;
+  }
+
+  result->rcode = check_prerequisites(trie, zone_name, result->zone.qclass,
+                                      buf, len, &offset, header.ancount, result);
+  if (result->rcode != DNS_RCODE_NOERROR) return 0;
+
+  if (header.nscount == 0) return 0;
+
+  update_rr_t *updates = calloc(header.nscount, sizeof(update_rr_t));
+  if (!updates) {
+    DNS_ERROR_SET(err, DNS_ERR_MEMORY_ALLOCATION, "Failed to allocate update records");
+    result->rcode = DNS_RCODE_SERVFAIL;
+    return 0;
+  }
+
+  result->rcode = prescan_updates(zone_name, result->zone.qclass,
+                                  buf, len, &offset, updates, header.nscount);
+
+  if (result->rcode == DNS_RCODE_NOERROR) {
+    for (int i = 0; i < header.nscount; ++i) {
+      apply_update(trie, cache, zone_name, result->zone.qclass, &updates[i], result);
+    }
+  }
+
+  update_rrs_free(updates, header.nscount);
+  return 0;
+}
+
+int dns_update_build_response(uint16_t id,
+                              const dns_update_result_t *result,
+                              uint8_t *buf,
+                              size_t capacity,
+                              size_t *length) {
+  if (!result || !buf || !length) return -1;
+
+  dns_header_t header = {
+    .id = id,
+    .qr = DNS_QR_RESPONSE,
+    .opcode = DNS_OPCODE_UPDATE,
+    .rcode = result->rcode,
+    .qdcount = result->has_zone ? 1 : 0,
+  };
+
+  if (dns_encode_header(buf, capacity, &header) < 0) return -1;
+
+  size_t offset = 12;
+  if (result->has_zone && dns_encode_question(buf, capacity, &offset, &result->zone) < 0) return -1;
+
+  *length = offset;
+  return 0;
+}
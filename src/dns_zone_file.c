@@ -1,12 +1,11 @@
 #include "dns_zone_file.h"
-#include <netinet/in.h>
+#include "dns_rdata.h"
+#include "dns_log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include <arpa/inet.h>
 #include <strings.h>
-#include <sys/socket.h>
 
 
 zone_parser_t *zone_parser_create(const char *filename, const char *origin) {
@@ -42,18 +41,7 @@ void zone_parser_free(zone_parser_t *parser) {
 }
 
 dns_record_type_t zone_string_to_type(const char *type_str) {
-  if (!type_str) return 0;
-
-  if (strcasecmp(type_str, "A") == 0) return DNS_TYPE_A;
-  if (strcasecmp(type_str, "NS") == 0) return DNS_TYPE_NS;
-  if (strcasecmp(type_str, "CNAME") == 0) return DNS_TYPE_CNAME;
-  if (strcasecmp(type_str, "SOA") == 0) return DNS_TYPE_SOA;
-  if (strcasecmp(type_str, "PTR") == 0) return DNS_TYPE_PTR;
-  if (strcasecmp(type_str, "MX") == 0) return DNS_TYPE_MX;
-  if (strcasecmp(type_str, "TXT") == 0) return DNS_TYPE_TXT;
-  if (strcasecmp(type_str, "AAAA") == 0) return DNS_TYPE_AAAA;
-
-  return 0; // unknown type
+  return (dns_record_type_t)dns_rdata_type_from_text(type_str);
 }
 
 dns_class_t zone_string_to_class(const char *class_str) {
@@ -140,8 +128,22 @@ int zone_get_next_token(zone_parser_t *parser, zone_token_t *token) {
   const char *start = &parser->curr_line[parser->position];
   const char *end = start;
 
-  while (*end && !isspace(*end) && *end != ';') {
+  if (*start == '"') {
+    // a quoted string is one token, spaces and ';' included, quotes kept
     ++end;
+    while (*end && *end != '"') {
+      if (*end == '\\' && end[1]) ++end;
+      ++end;
+    }
+    if (*end != '"') {
+      token->type = ZONE_TOKEN_ERROR;
+      return -1;
+    }
+    ++end;
+  } else {
+    while (*end && !isspace(*end) && *end != ';') {
+      ++end;
+    }
   }
 
   size_t token_len = end - start;
@@ -162,61 +164,24 @@ int zone_get_next_token(zone_parser_t *parser, zone_token_t *token) {
   return 0;
 }
 
-bool zone_parse_rdata(const char *type_str, const char *rdata_str, dns_rr_t *rr) {
-  if (!type_str || !rdata_str || !rr) return false;
-
-  dns_record_type_t type = zone_string_to_type(type_str);
-
-  switch (type) {
-    case DNS_TYPE_A: {
-      struct in_addr addr;
-      if (inet_aton(rdata_str, &addr) == 0) return false;
-      rr->rdata.a.address = addr.s_addr;
-      return true;
-    }
-
-    case DNS_TYPE_NS: {
-      strncpy(rr->rdata.ns.nsdname, rdata_str, MAX_DOMAIN_NAME - 1);
-      return true;
-    }
-
-    case DNS_TYPE_SOA: {
-      // SOA format: "primary-ns email serial refresh retry expire minimum"
-      // handle this in zone_parse_soa_record (need to parse multiple tokens
-      return false;
-    }
+// swap the placeholder for a record sized to its rdata, keeping class/ttl
+static bool zone_replace_rr(dns_rr_t **rr, dns_rr_t *sized) {
+  if (!sized) return false;
 
-    case DNS_TYPE_MX: {
-      // MX format: "priority hostname"
-      char *space = strchr(rdata_str, ' ');
-      if (!space) return false;
+  sized->class = (*rr)->class;
+  sized->ttl = (*rr)->ttl;
+  dns_rr_free(*rr);
+  *rr = sized;
+  return true;
+}
 
-      *space = '\0'; // temp null terminator
-      rr->rdata.mx.preference = (uint16_t) atoi(rdata_str);
-      strncpy(rr->rdata.mx.exchange, space + 1, MAX_DOMAIN_NAME - 1);
-      *space = ' ';
-      return true;
-    }
+bool zone_parse_rdata(const char *type_str, const char *rdata_str, dns_rr_t **rr) {
+  if (!type_str || !rdata_str || !rr || !*rr) return false;
 
-    case DNS_TYPE_TXT: {
-      // simple TXT implementation - just store the string
-      size_t len = strlen(rdata_str);
-      rr->rdata.txt.text = malloc(len + 1);
-      if (!rr->rdata.txt.text) return false;
-      strcpy(rr->rdata.txt.text, rdata_str);
-      rr->rdata.txt.length = len;
-      return true;
-    }
+  uint16_t type = dns_rdata_type_from_text(type_str);
+  if (type == 0) return false;
 
-    case DNS_TYPE_AAAA: {
-      struct in6_addr addr;
-      if (inet_pton(AF_INET6, rdata_str, &addr) != 1) return false;
-      memcpy(rr->rdata.aaaa.address, &addr, sizeof(struct in6_addr));
-      return true;
-    }
-
-    default: return false;
-  }
+  return zone_replace_rr(rr, dns_rdata_ops(type)->from_text(type, rdata_str, (*rr)->ttl));
 }
 
 zone_directive_t zone_parse_directive(const char *line) {
@@ -251,7 +216,7 @@ int zone_handle_directive(zone_parser_t *parser, const char *line) {
         --end;
       }
 
-      printf("DEBUG: Set origin to '%s'\n", parser->curr_origin);
+      DNS_LOG_DEBUG("Set origin to '%s'", parser->curr_origin);
       return 0;
     }
 
@@ -266,7 +231,7 @@ int zone_handle_directive(zone_parser_t *parser, const char *line) {
 
     case ZONE_DIRECTIVE_INCLUDE: {
       // TODO: #INCLUDE support
-      printf("DEBUG: $INCLUDE directive not supported yet\n");
+      DNS_LOG_WARN("$INCLUDE directive not supported yet");
       return 0;
     }
 
@@ -275,7 +240,7 @@ int zone_handle_directive(zone_parser_t *parser, const char *line) {
 }
 
 static bool zone_parse_soa_record(zone_parser_t *parser,
-                                  dns_rr_t *rr,
+                                  dns_rr_t **rr,
                                   zone_token_t *initial_tokens,
                                   int initial_count) {
   if (!parser || !rr) return false;
@@ -309,16 +274,14 @@ static bool zone_parse_soa_record(zone_parser_t *parser,
   if (token_count < 7) return false;
 
   // parse SOA fields
-  dns_safe_strncpy(rr->rdata.soa.mname, tokens[0].value, sizeof(rr->rdata.soa.mname));
-  dns_safe_strncpy(rr->rdata.soa.rname, tokens[1].value, sizeof(rr->rdata.soa.rname));
-
-  rr->rdata.soa.serial = (uint32_t) atol(tokens[2].value);
-  rr->rdata.soa.refresh = (uint32_t) atol(tokens[3].value);
-  rr->rdata.soa.retry = (uint32_t) atol(tokens[4].value);
-  rr->rdata.soa.expire = (uint32_t) atol(tokens[5].value);
-  rr->rdata.soa.minimum = (uint32_t) atol(tokens[6].value);
-
-  return true;
+  return zone_replace_rr(rr, dns_rr_create_soa(tokens[0].value,
+                                               tokens[1].value,
+                                               (uint32_t) atol(tokens[2].value),
+                                               (uint32_t) atol(tokens[3].value),
+                                               (uint32_t) atol(tokens[4].value),
+                                               (uint32_t) atol(tokens[5].value),
+                                               (uint32_t) atol(tokens[6].value),
+                                               (*rr)->ttl));
 }
 
 static void zone_process_name(zone_parser_t *parser, const char *input, char *output) {
@@ -465,7 +428,7 @@ int zone_parse_record(zone_parser_t *parser, dns_rr_t **rr, char *owner_name) {
     int rdata_token_count = token_count - rdata_start_idx;
     zone_token_t *rdata_tokens = (rdata_token_count > 0) ? &tokens[rdata_start_idx] : NULL;
 
-    if (!zone_parse_soa_record(parser, *rr, rdata_tokens, rdata_token_count)) {
+    if (!zone_parse_soa_record(parser, rr, rdata_tokens, rdata_token_count)) {
       dns_rr_free(*rr);
       *rr = NULL;
       return -1;
@@ -477,7 +440,7 @@ int zone_parse_record(zone_parser_t *parser, dns_rr_t **rr, char *owner_name) {
       strcat(rdata, tokens[i].value);
     }
 
-    if (!zone_parse_rdata(tokens[type_idx].value, rdata, *rr)) {
+    if (!zone_parse_rdata(tokens[type_idx].value, rdata, rr)) {
       dns_rr_free(*rr);
       *rr = NULL;
       return -1;
@@ -487,6 +450,33 @@ int zone_parse_record(zone_parser_t *parser, dns_rr_t **rr, char *owner_name) {
   return 1; // successfully parsed 1 record
 }
 
+// the apex SOA makes the zone authoritative, its NS set is shared with the
+// records just loaded
+static void zone_register_apex(dns_trie_t *trie, const char *zone_name) {
+  dns_rrset_t *soa_rrset = dns_trie_lookup(trie, zone_name, DNS_TYPE_SOA);
+  if (!soa_rrset || !soa_rrset->records) return;
+
+  const dns_soa_rdata_t *rdata = soa_rrset->records->rdata.soa;
+  dns_soa_t *soa = calloc(1, sizeof(dns_soa_t));
+  if (!soa) return;
+  dns_safe_strncpy(soa->mname, rdata->mname, sizeof(soa->mname));
+  dns_safe_strncpy(soa->rname, rdata->rname, sizeof(soa->rname));
+  soa->serial = rdata->serial;
+  soa->refresh = rdata->refresh;
+  soa->retry = rdata->retry;
+  soa->expire = rdata->expire;
+  soa->minimum = rdata->minimum;
+
+  dns_rrset_t *ns_records = dns_trie_lookup(trie, zone_name, DNS_TYPE_NS);
+  ns_records = ns_records ? dns_rrset_ref(ns_records) : dns_rrset_create(DNS_TYPE_NS, soa_rrset->ttl);
+
+  // refused when the zone is already there, nothing was taken then
+  if (!ns_records || !dns_trie_insert_zone(trie, zone_name, soa, ns_records)) {
+    dns_rrset_free(ns_records);
+    free(soa);
+  }
+}
+
 int zone_load_file(dns_trie_t *trie,
                    const char *filename,
                    const char *zone_name,
@@ -508,7 +498,7 @@ int zone_load_file(dns_trie_t *trie,
   char owner_name[MAX_DOMAIN_NAME + 1];
   int parse_result;
 
-  printf("Loading zone file: %s for zone: %s\n", filename, zone_name);
+  DNS_LOG_INFO("Loading zone file: %s for zone: %s", filename, zone_name);
 
   while ((parse_result = zone_parse_record(parser, &rr, owner_name)) != 0) {
     if (parse_result < 0) {
@@ -532,13 +522,9 @@ int zone_load_file(dns_trie_t *trie,
           default: break;
         }
 
-        printf("  Loaded: %s %u IN %s\n", owner_name, rr->ttl,
-               (rr->type == DNS_TYPE_A) ? "A" :
-               (rr->type == DNS_TYPE_AAAA) ? "AAAA" :
-               (rr->type == DNS_TYPE_NS) ? "NS" :
-               (rr->type == DNS_TYPE_CNAME) ? "CNAME" :
-               (rr->type == DNS_TYPE_SOA) ? "SOA" :
-               (rr->type == DNS_TYPE_MX) ? "MX" : "OTHER");
+        char type_buf[16];
+        DNS_LOG_DEBUG("Loaded: %s %u IN %s", owner_name, rr->ttl,
+                      dns_rdata_type_to_text(rr->type, type_buf, sizeof(type_buf)));
       } else {
         result->errors_encountered++;
         result->error_details.invalid_rdata++;
@@ -549,22 +535,26 @@ int zone_load_file(dns_trie_t *trie,
 
   zone_parser_free(parser);
 
-  // print detailed summary
-  printf("Zone loading complete: %s\n", zone_name);
-  printf("  Records loaded: %d\n", result->records_loaded);
-  printf("    A: %d, NS: %d, CNAME: %d, SOA: %d, MX: %d, TXT: %d, AAAA: %d\n",
-         result->record_stats.a_records,
-         result->record_stats.ns_records,
-         result->record_stats.cname_records,
-         result->record_stats.soa_records,
-         result->record_stats.mx_records,
-         result->record_stats.txt_records,
-         result->record_stats.aaaa_records);
-  printf("  Errors: %d\n", result->errors_encountered);
+  // answers are encoded once here instead of on every query
+  zone_register_apex(trie, zone_name);
+  dns_trie_compile(trie);
+
+  DNS_LOG_INFO("Zone loading complete: %s, %d records (A: %d, NS: %d, CNAME: %d, SOA: %d, MX: %d, TXT: %d, AAAA: %d)",
+               zone_name,
+               result->records_loaded,
+               result->record_stats.a_records,
+               result->record_stats.ns_records,
+               result->record_stats.cname_records,
+               result->record_stats.soa_records,
+               result->record_stats.mx_records,
+               result->record_stats.txt_records,
+               result->record_stats.aaaa_records);
   if (result->errors_encountered > 0) {
-    printf("    Parse errors: %d, Invalid rdata: %d\n",
-           result->error_details.parse_errors,
-           result->error_details.invalid_rdata);
+    DNS_LOG_WARN("Zone %s: %d errors (parse errors: %d, invalid rdata: %d)",
+                 zone_name,
+                 result->errors_encountered,
+                 result->error_details.parse_errors,
+                 result->error_details.invalid_rdata);
   }
 
   return result->records_loaded > 0 ? 0 : -1;
@@ -30,6 +30,11 @@ int main(int argc, char *argv[]) {
   const char *config_file = (argc > 1) ? argv[1] : "dns_server.conf";
   dns_server_config_load(config, config_file);
 
+  dns_log_set_level(config->log_level);
+  if (strlen(config->log_file) > 0 && dns_log_start_async(config->log_file) < 0) {
+    fprintf(stderr, "Failed to open log file '%s', logging to stdout\n", config->log_file);
+  }
+
   // create server with configuration
   dns_server_t *server = dns_server_create_with_config(config);
   global_server = server;
@@ -37,6 +42,7 @@ int main(int argc, char *argv[]) {
   if (!server) {
     fprintf(stderr, "Failed to create server\n");
     dns_server_config_free(config);
+    dns_log_shutdown();
     return 1;
   }
 
@@ -51,7 +57,7 @@ int main(int argc, char *argv[]) {
   // load zone file if configured
   if (strlen(config->zone_file) > 0) {
     zone_load_result_t zone_result;
-    if (zone_load_file(server->trie, config->zone_file, "example.com", &zone_result) == 0) {
+    if (dns_server_load_zone(server, config->zone_file, "example.com", &zone_result) == 0) {
       printf("Loaded zone file '%s' with %d records\n",
              config->zone_file, zone_result.records_loaded);
     } else {
@@ -66,12 +72,14 @@ int main(int argc, char *argv[]) {
     dns_trie_insert_a(server->trie, "test.local", "192.168.1.1", 300);
 
     printf("Added default test records\n");
+    dns_trie_compile(server->trie);
   }
 
   if (dns_server_start(server) < 0) {
     fprintf(stderr, "Failed to start server\n");
     dns_server_free(server);
     dns_server_config_free(config);
+    dns_log_shutdown();
     return 1;
   }
 
@@ -101,19 +109,19 @@ int main(int argc, char *argv[]) {
   dns_trie_get_stats(server->trie, stats_buf, sizeof(stats_buf));
   printf("\n=== Trie Statistics ===\n%s\n", stats_buf);
 
-  printf("\n=== Server Statistics ===\n");
-  printf("Queries received:       %lu\n", server->queries_received);
-  printf("Queries processed:      %lu\n", server->queries_processed);
-  printf("Queries failed:         %lu\n", server->queries_failed);
-  printf("Responses sent:         %lu\n", server->responses_sent);
-  printf("Authoritative responses: %lu\n", server->authoritative_responses);
-  printf("Recursive responses:    %lu\n", server->recursive_responses);
+  printf("\n=== Statistics ===\n");
+  dns_stats_snapshot_t stats;
+  dns_server_stats(server, &stats);
+  dns_stats_print(&stats, stdout);
 
-  if (server->recursive_resolver) {
-    printf("\n=== Recursive Resolver Statistics ===\n");
-    printf("Recursive queries:      %lu\n", server->recursive_resolver->recursive_queries);
-    printf("Forwarded queries:      %lu\n", server->recursive_resolver->forwarded_queries);
-    printf("Failed queries:         %lu\n", server->recursive_resolver->failed_queries);
+  if (server->latency) {
+    printf("\n=== Latency ===\n");
+    dns_latency_print(server->latency, stdout);
+  }
+
+  if (server->hitters) {
+    printf("\n=== Heavy Hitters ===\n");
+    dns_hitters_print(server->hitters, stdout);
   }
 
   if (server->cache) {
@@ -131,5 +139,6 @@ int main(int argc, char *argv[]) {
   dns_server_stop(server);
   dns_server_free(server);
   dns_server_config_free(config);
+  dns_log_shutdown();
   return 0;
 }
@@ -5,6 +5,7 @@
 #include "dns_error.h"
 #include <arpa/inet.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 
@@ -59,7 +60,7 @@ static MunitResult test_insert_positive(const MunitParameter params[], void *dat
 
   munit_assert_int(result, ==, 0);
   munit_assert_size(cache->current_entries, ==, 1);
-  munit_assert_int(cache->stats.insertions, ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_INSERTIONS), ==, 1);
 
   dns_rr_free(record);
   dns_cache_free(cache);
@@ -104,7 +105,7 @@ static MunitResult test_eviction(const MunitParameter params[], void *data) {
   }
 
   munit_assert_size(cache->current_entries, ==, 3);
-  munit_assert_int(cache->stats.evictions, ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_EVICTIONS), ==, 1);
 
   dns_cache_free(cache);
   return MUNIT_OK;
@@ -135,15 +136,13 @@ static MunitResult test_stats(const MunitParameter params[], void *data) {
 
   dns_cache_t *cache = dns_cache_create(10);
 
-  const dns_cache_stats_t *stats = dns_cache_get_stats(cache);
-  munit_assert_not_null(stats);
-  munit_assert_int(stats->insertions, ==, 0);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_INSERTIONS), ==, 0);
 
   dns_rr_t *record = dns_rr_create(DNS_TYPE_A, DNS_CLASS_IN, 300);
   record->rdata.a.address = inet_addr("192.168.1.1");
   dns_cache_insert(cache, "test.com", DNS_TYPE_A, DNS_CLASS_IN, record, 1, 300);
 
-  munit_assert_int(stats->insertions, ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_INSERTIONS), ==, 1);
   // tODO: more stat cases
 
   dns_rr_free(record);
@@ -173,20 +172,19 @@ static MunitResult test_lookup_hit(const MunitParameter params[], void *data) {
   munit_assert_true(lookup->found);
   munit_assert_int(lookup->type, ==, DNS_CACHE_TYPE_POSITIVE);
   munit_assert_int(lookup->record_count, ==, 1);
-  munit_assert_not_null(lookup->records);
+  munit_assert_int(lookup->rrset_count, ==, 1);
   munit_assert_uint32(lookup->remaining_ttl, >, 0);
   munit_assert_uint32(lookup->remaining_ttl, <=, 300);
 
   // check IP address
-  munit_assert_int(lookup->records->type, ==, DNS_TYPE_A);
-  munit_assert_uint32(lookup->records->rdata.a.address, ==, inet_addr("192.168.1.1"));
+  munit_assert_int(lookup->rrsets[0]->type, ==, DNS_TYPE_A);
+  munit_assert_uint32(lookup->rrsets[0]->records->rdata.a.address, ==, inet_addr("192.168.1.1"));
 
   // stats
-  const dns_cache_stats_t *stats = dns_cache_get_stats(cache);
-  munit_assert_int(stats->queries, ==, 1);
-  munit_assert_int(stats->hits, ==, 1);
-  munit_assert_int(stats->misses, ==, 0);
-  munit_assert_int(stats->positive_hits, ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUPS), ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUP_HITS), ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUP_MISSES), ==, 0);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_POSITIVE_HITS), ==, 1);
 
   dns_cache_result_free(lookup);
   dns_cache_free(cache);
@@ -204,10 +202,9 @@ static MunitResult test_lookup_miss(const MunitParameter params[], void *data) {
 
   munit_assert_null(result);
 
-  const dns_cache_stats_t *stats = dns_cache_get_stats(cache);
-  munit_assert_int(stats->queries, ==, 1);
-  munit_assert_int(stats->misses, ==, 1);
-  munit_assert_int(stats->hits, ==, 0);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUPS), ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUP_MISSES), ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUP_HITS), ==, 0);
 
   dns_cache_free(cache);
   return MUNIT_OK;
@@ -231,13 +228,12 @@ static MunitResult test_negative_lookup(const MunitParameter params[], void *dat
   munit_assert_true(lookup->found);
   munit_assert_int(lookup->type, ==, DNS_CACHE_TYPE_NXDOMAIN);
   munit_assert_int(lookup->rcode, ==, DNS_RCODE_NXDOMAIN);
-  munit_assert_null(lookup->records);
+  munit_assert_int(lookup->rrset_count, ==, 0);
   munit_assert_int(lookup->record_count, ==, 0);
 
   // stats
-  const dns_cache_stats_t *stats = dns_cache_get_stats(cache);
-  munit_assert_int(stats->negative_hits, ==, 1);
-  munit_assert_int(stats->nxdomain_hits, ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_NEGATIVE_HITS), ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_NXDOMAIN_HITS), ==, 1);
 
   dns_cache_result_free(lookup);
   dns_cache_free(cache);
@@ -271,8 +267,7 @@ static MunitResult test_expiration(const MunitParameter params[], void *data) {
   dns_cache_result_t *result2 = dns_cache_lookup(cache, "example.com", DNS_TYPE_A, DNS_CLASS_IN);
   munit_assert_null(result2);
 
-  const dns_cache_stats_t *stats = dns_cache_get_stats(cache);
-  munit_assert_int(stats->expired, ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_EXPIRED), ==, 1);
 
   dns_cache_free(cache);
   return MUNIT_OK;
@@ -406,9 +401,10 @@ static MunitResult test_multiple_records(const MunitParameter params[], void *da
   munit_assert_int(lookup->record_count, ==, 2);
 
   // check linked records exist
-  munit_assert_not_null(lookup->records);
-  munit_assert_not_null(lookup->records->next);
-  munit_assert_null(lookup->records->next->next);
+  munit_assert_int(lookup->rrset_count, ==, 1);
+  munit_assert_not_null(lookup->rrsets[0]->records);
+  munit_assert_not_null(lookup->rrsets[0]->records->next);
+  munit_assert_null(lookup->rrsets[0]->records->next->next);
 
   dns_cache_result_free(lookup);
   dns_cache_free(cache);
@@ -423,9 +419,9 @@ static MunitResult test_resolver_with_cache_create(const MunitParameter params[]
   munit_assert_not_null(resolver->trie);
   munit_assert_not_null(resolver->cache);
   munit_assert_true(resolver->cache_enabled);
-  munit_assert_uint64(resolver->queries, ==, 0);
-  munit_assert_uint64(resolver->cache_hits, ==, 0);
-  munit_assert_uint64(resolver->cache_misses, ==, 0);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_QUERIES), ==, 0);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_HITS), ==, 0);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_MISSES), ==, 0);
 
   dns_resolver_free(resolver);
   return MUNIT_OK;
@@ -456,8 +452,8 @@ static MunitResult test_cache_hit_on_second_query(const MunitParameter params[],
 
   int ret = dns_resolver_query_with_cache(resolver, &question, result1, &err1);
   munit_assert_int(ret, ==, 0);
-  munit_assert_uint64(resolver->cache_misses, ==, 1);
-  munit_assert_uint64(resolver->cache_hits, ==, 0);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_MISSES), ==, 1);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_HITS), ==, 0);
   munit_assert_int(result1->answer_count, ==, 1);
 
   dns_resolution_result_free(result1);
@@ -469,8 +465,8 @@ static MunitResult test_cache_hit_on_second_query(const MunitParameter params[],
 
   ret = dns_resolver_query_with_cache(resolver, &question, result2, &err2);
   munit_assert_int(ret, ==, 0);
-  munit_assert_uint64(resolver->cache_misses, ==, 1);
-  munit_assert_uint64(resolver->cache_hits, ==, 1);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_MISSES), ==, 1);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_HITS), ==, 1);
   munit_assert_int(result2->answer_count, ==, 1);
 
   dns_resolution_result_free(result2);
@@ -498,7 +494,7 @@ static MunitResult test_negative_caching(const MunitParameter params[], void *da
   int ret = dns_resolver_query_with_cache(resolver, &question, result1, &err1);
   munit_assert_int(ret, ==, 0);
   munit_assert_int(result1->rcode, ==, DNS_RCODE_NXDOMAIN);
-  munit_assert_uint64(resolver->cache_misses, ==, 1);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_MISSES), ==, 1);
 
   dns_resolution_result_free(result1);
 
@@ -510,7 +506,7 @@ static MunitResult test_negative_caching(const MunitParameter params[], void *da
   ret = dns_resolver_query_with_cache(resolver, &question, result2, &err2);
   munit_assert_int(ret, ==, 0);
   munit_assert_int(result2->rcode, ==, DNS_RCODE_NXDOMAIN);
-  munit_assert_uint64(resolver->cache_hits, ==, 1);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_HITS), ==, 1);
 
   dns_resolution_result_free(result2);
   dns_resolver_free(resolver);
@@ -551,8 +547,8 @@ static MunitResult test_cache_disabled(const MunitParameter params[], void *data
   dns_resolver_query_with_cache(resolver, &question, result2, &err2);
   dns_resolution_result_free(result2);
 
-  munit_assert_uint64(resolver->cache_hits, ==, 0);
-  munit_assert_uint64(resolver->cache_misses, ==, 0);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_HITS), ==, 0);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_MISSES), ==, 0);
 
   dns_resolver_free(resolver);
   return MUNIT_OK;
@@ -582,7 +578,7 @@ static MunitResult test_cache_expiration(const MunitParameter params[], void *da
   dns_resolver_query_with_cache(resolver, &question, result1, &err1);
   dns_resolution_result_free(result1);
 
-  munit_assert_uint64(resolver->cache_misses, ==, 1);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_MISSES), ==, 1);
 
   // immediate second query - cache hit
   dns_resolution_result_t *result2 = dns_resolution_result_create();
@@ -591,7 +587,7 @@ static MunitResult test_cache_expiration(const MunitParameter params[], void *da
   dns_resolver_query_with_cache(resolver, &question, result2, &err2);
   dns_resolution_result_free(result2);
 
-  munit_assert_uint64(resolver->cache_hits, ==, 1);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_HITS), ==, 1);
 
   // wait for expiration
   sleep(2);
@@ -603,7 +599,7 @@ static MunitResult test_cache_expiration(const MunitParameter params[], void *da
   dns_resolver_query_with_cache(resolver, &question, result3, &err3);
   dns_resolution_result_free(result3);
 
-  munit_assert_uint64(resolver->cache_misses, ==, 2);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_MISSES), ==, 2);
 
   dns_resolver_free(resolver);
   return MUNIT_OK;
@@ -657,6 +653,24 @@ static MunitResult test_cache_summary(const MunitParameter params[], void *data)
   munit_assert_size(summary.current_entries, ==, 2);
   munit_assert_size(summary.positive_entries, ==, 1);
   munit_assert_size(summary.negative_entries, ==, 1);
+  munit_assert_uint64(summary.record_count, ==, 1);
+  munit_assert_uint32(summary.avg_remaining_ttl, >=, 299);
+  munit_assert_uint32(summary.avg_remaining_ttl, <=, 300);
+
+  // the totals follow replacements and removals
+  dns_cache_insert_negative(cache, "example.com", DNS_TYPE_A, DNS_CLASS_IN, DNS_CACHE_TYPE_NODATA, DNS_RCODE_NOERROR, 60);
+  dns_cache_remove_entry(cache, "notfound.com", DNS_TYPE_A, DNS_CLASS_IN);
+  dns_cache_get_summary(cache, &summary);
+  munit_assert_size(summary.current_entries, ==, 1);
+  munit_assert_size(summary.positive_entries, ==, 0);
+  munit_assert_size(summary.negative_entries, ==, 1);
+  munit_assert_uint64(summary.record_count, ==, 0);
+  munit_assert_uint32(summary.avg_remaining_ttl, <=, 60);
+
+  dns_cache_clear(cache);
+  dns_cache_get_summary(cache, &summary);
+  munit_assert_size(summary.negative_entries, ==, 0);
+  munit_assert_uint32(summary.avg_remaining_ttl, ==, 0);
 
   dns_cache_free(cache);
   return MUNIT_OK;
@@ -706,6 +720,56 @@ static MunitResult test_cache_dump(const MunitParameter params[], void *data) {
   return MUNIT_OK;
 }
 
+static MunitResult test_cache_cursor(const MunitParameter params[], void *data) {
+  (void)params; (void)data;
+
+  dns_cache_t *cache = dns_cache_create(100);
+  munit_assert_not_null(cache);
+
+  char name[32];
+  for (int i = 0; i < 40; ++i) {
+    snprintf(name, sizeof(name), "host%d.example.com", i);
+    dns_cache_insert_negative(cache, name, DNS_TYPE_A, DNS_CLASS_IN, DNS_CACHE_TYPE_NXDOMAIN,
+                              DNS_RCODE_NXDOMAIN, 300);
+  }
+
+  // every entry once, in as many steps as it takes
+  bool seen[40] = {false};
+  int count = 0;
+  dns_cache_cursor_t cursor = {0};
+  const dns_cache_entry_t *entry;
+  while ((entry = dns_cache_next_entry(cache, &cursor)) != NULL) {
+    char text[MAX_DOMAIN_NAME];
+    dns_name_to_text(&entry->name, text, sizeof(text));
+    int i = -1;
+    if (strncmp(text, "new", 3) == 0) continue;
+    munit_assert_int(sscanf(text, "host%d.", &i), ==, 1);
+    munit_assert_false(seen[i]);
+    seen[i] = true;
+    ++count;
+
+    // the chains change under the walk, nothing there all along is missed
+    if (count == 10) dns_cache_remove_name(cache, text);
+    if (count % 5 == 0) {
+      snprintf(name, sizeof(name), "new%d.example.com", count);
+      dns_cache_insert_negative(cache, name, DNS_TYPE_A, DNS_CLASS_IN, DNS_CACHE_TYPE_NXDOMAIN,
+                                DNS_RCODE_NXDOMAIN, 300);
+    }
+  }
+  munit_assert_int(count, ==, 40);
+  munit_assert_null(dns_cache_next_entry(cache, &cursor));
+
+  char line[DNS_CACHE_DUMP_LINE_MAX];
+  cursor = (dns_cache_cursor_t){0};
+  entry = dns_cache_next_entry(cache, &cursor);
+  munit_assert_int(dns_cache_format_entry(entry, time(NULL), line, sizeof(line)), >, 0);
+  munit_assert_not_null(strstr(line, "NXDOMAIN"));
+  munit_assert_char(line[strlen(line) - 1], ==, '\n');
+
+  dns_cache_free(cache);
+  return MUNIT_OK;
+}
+
 static MunitResult test_cache_maintainer(const MunitParameter params[], void *data) {
   (void)params; (void)data;
 
@@ -819,7 +883,7 @@ static MunitResult test_update_existing(const MunitParameter params[], void *dat
   // new entry should have a new IP
   dns_cache_result_t *result = dns_cache_lookup(cache, "test.com", DNS_TYPE_A, DNS_CLASS_IN);
   munit_assert_not_null(result);
-  munit_assert_uint32(result->records->rdata.a.address, ==, inet_addr("192.168.1.2"));
+  munit_assert_uint32(result->rrsets[0]->records->rdata.a.address, ==, inet_addr("192.168.1.2"));
 
   dns_cache_result_free(result);
   dns_cache_free(cache);
@@ -898,6 +962,71 @@ static MunitResult test_case_insensitive(const MunitParameter params[], void *da
   return MUNIT_OK;
 }
 
+static MunitResult test_lookup_name(const MunitParameter params[], void *data) {
+  (void)params; (void)data;
+
+  dns_cache_t *cache = dns_cache_create(10);
+
+  dns_rr_t *record = dns_rr_create(DNS_TYPE_A, DNS_CLASS_IN, 300);
+  record->rdata.a.address = inet_addr("192.168.1.1");
+  munit_assert_int(dns_cache_insert(cache, "www.example.com", DNS_TYPE_A, DNS_CLASS_IN, record, 1, 300), ==, 0);
+
+  uint8_t buf[512];
+  size_t offset = 0;
+  dns_question_t question = {.qtype = DNS_TYPE_A, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, "WWW.Example.com");
+  dns_encode_question(buf, sizeof(buf), &offset, &question);
+
+  dns_question_view_t view;
+  offset = 0;
+  munit_assert_int(dns_parse_question_view(buf, sizeof(buf), &offset, &view), ==, 0);
+
+  // wire names find text keys regardless of case
+  dns_cache_result_t result;
+  munit_assert_true(dns_cache_lookup_name(cache, &view.name, view.qtype, view.qclass, &result));
+  munit_assert_int(result.record_count, ==, 1);
+  dns_cache_result_clear(&result);
+
+  // a different type or a longer name misses
+  munit_assert_false(dns_cache_lookup_name(cache, &view.name, DNS_TYPE_AAAA, view.qclass, &result));
+
+  offset = 0;
+  strcpy(question.qname, "a.www.example.com");
+  dns_encode_question(buf, sizeof(buf), &offset, &question);
+  offset = 0;
+  munit_assert_int(dns_parse_question_view(buf, sizeof(buf), &offset, &view), ==, 0);
+  munit_assert_false(dns_cache_lookup_name(cache, &view.name, view.qtype, view.qclass, &result));
+
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUP_HITS), ==, 1);
+  munit_assert_int(dns_stats_get(cache->stats, DNS_STAT_CACHE_LOOKUP_MISSES), ==, 2);
+
+  dns_rr_free(record);
+  dns_cache_free(cache);
+  return MUNIT_OK;
+}
+
+static MunitResult test_clear_enclosers(const MunitParameter params[], void *data) {
+  (void)params; (void)data;
+
+  dns_cache_t *cache = dns_cache_create(10);
+  munit_assert_int(dns_cache_insert_negative(cache, "gone.example.com", DNS_TYPE_A, DNS_CLASS_IN,
+                                             DNS_CACHE_TYPE_NXDOMAIN, DNS_RCODE_NXDOMAIN, 300), ==, 0);
+  munit_assert_int(dns_cache_set_encloser(cache, "gone.example.com", DNS_TYPE_A, DNS_CLASS_IN, 2), ==, 0);
+
+  // a clear empties the encloser index along with the entries
+  dns_cache_clear(cache);
+  munit_assert_int(dns_cache_remove_enclosed(cache, "example.com", NULL), ==, 0);
+
+  munit_assert_int(dns_cache_insert_negative(cache, "gone.example.com", DNS_TYPE_A, DNS_CLASS_IN,
+                                             DNS_CACHE_TYPE_NXDOMAIN, DNS_RCODE_NXDOMAIN, 300), ==, 0);
+  munit_assert_int(dns_cache_set_encloser(cache, "gone.example.com", DNS_TYPE_A, DNS_CLASS_IN, 2), ==, 0);
+  munit_assert_int(dns_cache_remove_enclosed(cache, "example.com", NULL), ==, 1);
+  munit_assert_int(cache->current_entries, ==, 0);
+
+  dns_cache_free(cache);
+  return MUNIT_OK;
+}
+
 static MunitTest tests[] = {
   {"/operations/create", test_create, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/operations/toggle_negative", test_toggle_negative, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
@@ -921,6 +1050,7 @@ static MunitTest tests[] = {
   {"/lookup/negative_disabled", test_negative_disabled, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/lookup/lru_eviction", test_lru_eviction_order, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/lookup/case_insensitive", test_case_insensitive, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/lookup/clear_enclosers", test_clear_enclosers, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/resolver/create", test_resolver_with_cache_create, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/resolver/cache_hit", test_cache_hit_on_second_query, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/resolver/negative_caching", test_negative_caching, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
@@ -930,7 +1060,9 @@ static MunitTest tests[] = {
   {"/monitoring/summary", test_cache_summary, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/monitoring/memory_usage", test_cache_memory_usage, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/monitoring/dump", test_cache_dump, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/monitoring/cursor", test_cache_cursor, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/maintenance/maintainer", test_cache_maintainer, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/lookup/name", test_lookup_name, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
 };
 
@@ -0,0 +1,344 @@
+#include "munit.h"
+#include "dns_control.h"
+#include "dns_server.h"
+#include "test_dns_query.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+static void temp_path(char *path, size_t len, const char *suffix) {
+  snprintf(path, len, "/tmp/dns_control_%d%s", (int)getpid(), suffix);
+}
+
+static void write_file(const char *path, const char *content) {
+  FILE *file = fopen(path, "w");
+  munit_assert_not_null(file);
+  fputs(content, file);
+  fclose(file);
+}
+
+static int count_lines(const char *text) {
+  int lines = 0;
+  for (const char *p = text; *p; ++p) {
+    if (*p == '\n') ++lines;
+  }
+  return lines;
+}
+
+// one pass of the server's loop over the control sockets
+static void control_poll(dns_server_t *server) {
+  fd_set read_fds;
+  fd_set write_fds;
+  FD_ZERO(&read_fds);
+  FD_ZERO(&write_fds);
+  int max_fd = dns_control_watch(server->control, &read_fds, &write_fds, -1);
+
+  struct timeval timeout = {1, 0};
+  munit_assert_int(select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout), >, 0);
+
+  const char *command = dns_control_ready(server->control, &read_fds);
+  if (command) {
+    dns_server_control(server, server->control, command);
+    dns_control_respond(server->control);
+  }
+  if (dns_control_flush(server->control, &write_fds)) {
+    dns_control_dump_next(server->control, server->cache);
+    dns_control_respond(server->control);
+  }
+}
+
+// the whole reply to command and the passes it took
+static size_t run_command(dns_server_t *server, const char *command, char *out, size_t cap,
+                          int *passes) {
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", server->control->path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  munit_assert_int(fd, >=, 0);
+  munit_assert_int(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+  munit_assert_int(send(fd, command, strlen(command), 0), ==, (int)strlen(command));
+
+  // the client reads as the server writes, a dump is bigger than the socket buffer
+  size_t length = 0;
+  int n_passes = 0;
+  do {
+    control_poll(server);
+    ++n_passes;
+
+    ssize_t n;
+    while ((n = recv(fd, out + length, cap - 1 - length, MSG_DONTWAIT)) > 0) length += (size_t)n;
+  } while (server->control->client_fd >= 0 && n_passes < 1000);
+
+  ssize_t n;
+  while ((n = recv(fd, out + length, cap - 1 - length, 0)) > 0) length += (size_t)n;
+  out[length] = '\0';
+  close(fd);
+
+  if (passes) *passes = n_passes;
+  return length;
+}
+
+static dns_server_t *control_server(char *path, size_t len) {
+  temp_path(path, len, ".sock");
+  dns_server_t *server = dns_server_create(5353);
+  munit_assert_not_null(server);
+  server->control = dns_control_create(path);
+  munit_assert_not_null(server->control);
+  return server;
+}
+
+static MunitResult test_commands(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char path[64];
+  dns_server_t *server = control_server(path, sizeof(path));
+
+  static const char *names[] = {"a.example.com", "b.example.com", "www.example.org"};
+  for (size_t i = 0; i < 3; ++i) {
+    dns_cache_insert_negative(server->cache, names[i], DNS_TYPE_A, DNS_CLASS_IN,
+                              DNS_CACHE_TYPE_NXDOMAIN, DNS_RCODE_NXDOMAIN, 300);
+  }
+  dns_cache_insert_negative(server->cache, "a.example.com", DNS_TYPE_AAAA, DNS_CLASS_IN,
+                            DNS_CACHE_TYPE_NODATA, DNS_RCODE_NOERROR, 300);
+
+  static char reply[DNS_CONTROL_BUFFER_SIZE + 1];
+  run_command(server, "stats\n", reply, sizeof(reply), NULL);
+  munit_assert_not_null(strstr(reply, "dns_cache_entries{type=\"negative\"} 4\n"));
+
+  // every type of a name, then a whole subtree
+  run_command(server, "flush a.example.com\n", reply, sizeof(reply), NULL);
+  munit_assert_string_equal(reply, "flushed 2 entries\n");
+  run_command(server, "flush_suffix example.com\n", reply, sizeof(reply), NULL);
+  munit_assert_string_equal(reply, "flushed 1 entries\n");
+  munit_assert_size(server->cache->current_entries, ==, 1);
+  run_command(server, "flush_all\n", reply, sizeof(reply), NULL);
+  munit_assert_size(server->cache->current_entries, ==, 0);
+
+  run_command(server, "set_ttl_limits 60 3600\n", reply, sizeof(reply), NULL);
+  munit_assert_uint32(server->cache->min_ttl, ==, 60);
+  munit_assert_uint32(server->cache->max_ttl, ==, 3600);
+  run_command(server, "set_negative_ttl 45\r\n", reply, sizeof(reply), NULL);
+  munit_assert_uint32(server->cache->negative_ttl, ==, 45);
+
+  // nothing changes on a bad command
+  run_command(server, "set_ttl_limits 600 60\n", reply, sizeof(reply), NULL);
+  munit_assert_true(strncmp(reply, "error: ", 7) == 0);
+  munit_assert_uint32(server->cache->min_ttl, ==, 60);
+  run_command(server, "set_negative_ttl -1\n", reply, sizeof(reply), NULL);
+  munit_assert_true(strncmp(reply, "error: ", 7) == 0);
+  run_command(server, "flush\n", reply, sizeof(reply), NULL);
+  munit_assert_true(strncmp(reply, "error: ", 7) == 0);
+  run_command(server, "reload\n", reply, sizeof(reply), NULL);
+  munit_assert_true(strncmp(reply, "error: ", 7) == 0);
+
+  dns_server_free(server);
+  munit_assert_int(access(path, F_OK), ==, -1);
+  return MUNIT_OK;
+}
+
+static MunitResult test_dump(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char path[64];
+  dns_server_t *server = control_server(path, sizeof(path));
+
+  char name[64];
+  for (int i = 0; i < 900; ++i) {
+    snprintf(name, sizeof(name), "host%d.example.com", i);
+    dns_cache_insert_negative(server->cache, name, DNS_TYPE_A, DNS_CLASS_IN,
+                              DNS_CACHE_TYPE_NXDOMAIN, DNS_RCODE_NXDOMAIN, 300);
+  }
+
+  // two header lines, then every entry, a chunk per pass of the loop
+  static char reply[1 << 20];
+  int passes = 0;
+  run_command(server, "dump\n", reply, sizeof(reply), &passes);
+  munit_assert_int(count_lines(reply), ==, 2 + 900);
+  munit_assert_int(passes, >=, 900 / DNS_CONTROL_DUMP_CHUNK);
+  munit_assert_not_null(strstr(reply, "host899.example.com "));
+
+  run_command(server, "dump 5\n", reply, sizeof(reply), NULL);
+  munit_assert_int(count_lines(reply), ==, 2 + 5);
+
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+static MunitResult test_reload(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char path[64];
+  char zone[64];
+  dns_server_t *server = control_server(path, sizeof(path));
+  server->enable_recursion = false;
+  temp_path(zone, sizeof(zone), ".zone");
+
+  write_file(zone,
+             "example.com.  IN  SOA  ns1.example.com. admin.example.com. 1 3600 600 86400 300\n"
+             "example.com.  300  IN  MX  10 mx1.example.com.\n"
+             "www.example.com.  300  IN  A  192.0.2.1\n");
+  zone_load_result_t result;
+  munit_assert_int(dns_server_load_zone(server, zone, "example.com", &result), ==, 0);
+  munit_assert_not_null(dns_trie_lookup(server->trie, "www.example.com", DNS_TYPE_A));
+
+  // asked twice so both answers are served from the cache before the reload
+  dns_arena_t *arena = dns_arena_create(0);
+  dns_message_t msg;
+  for (int pass = 0; pass < 2; ++pass) {
+    dns_response_t *response = send_query(server, "example.com", DNS_TYPE_MX);
+    dns_arena_reset(arena);
+    munit_assert_int(dns_parse_message(response->buffer, response->length, arena, &msg), ==, 0);
+    munit_assert_string_equal(msg.answers[0].rr->rdata.mx.exchange, "mx1.example.com");
+    dns_response_free(response);
+
+    // MX takes the cached path, A has a precompiled NXDOMAIN ahead of it
+    response = send_query(server, "mail.example.com", DNS_TYPE_MX);
+    munit_assert_int(dns_parse_message(response->buffer, response->length, arena, &msg), ==, 0);
+    munit_assert_int(msg.header.rcode, ==, DNS_RCODE_NXDOMAIN);
+    dns_response_free(response);
+  }
+  munit_assert_uint64(dns_stats_get(server->stats, DNS_STAT_CACHE_HITS), ==, 2);
+
+  write_file(zone,
+             "example.com.  IN  SOA  ns1.example.com. admin.example.com. 2 3600 600 86400 300\n"
+             "example.com.  300  IN  MX  20 mx2.example.com.\n"
+             "mail.example.com.  300  IN  MX  5 mx2.example.com.\n"
+             "mail.example.com.  300  IN  A  192.0.2.2\n");
+  static char reply[4096];
+  run_command(server, "reload\n", reply, sizeof(reply), NULL);
+  munit_assert_string_equal(reply, "reloaded example.com, 4 records, 0 errors\n");
+  munit_assert_null(dns_trie_lookup(server->trie, "www.example.com", DNS_TYPE_A));
+  munit_assert_not_null(dns_trie_lookup(server->trie, "mail.example.com", DNS_TYPE_A));
+
+  // nothing cached from the old zone is served against the new one
+  dns_response_t *response = send_query(server, "example.com", DNS_TYPE_MX);
+  dns_arena_reset(arena);
+  munit_assert_int(dns_parse_message(response->buffer, response->length, arena, &msg), ==, 0);
+  munit_assert_int(msg.header.ancount, ==, 1);
+  munit_assert_string_equal(msg.answers[0].rr->rdata.mx.exchange, "mx2.example.com");
+  dns_response_free(response);
+
+  response = send_query(server, "mail.example.com", DNS_TYPE_MX);
+  munit_assert_int(dns_parse_message(response->buffer, response->length, arena, &msg), ==, 0);
+  munit_assert_int(msg.header.rcode, ==, DNS_RCODE_NOERROR);
+  munit_assert_int(msg.header.ancount, ==, 1);
+  munit_assert_uint16(msg.answers[0].rr->rdata.mx.preference, ==, 5);
+  dns_response_free(response);
+  dns_arena_destroy(arena);
+
+  // a file that does not load leaves the zone being served alone
+  unlink(zone);
+  run_command(server, "reload\n", reply, sizeof(reply), NULL);
+  munit_assert_true(strncmp(reply, "error: ", 7) == 0);
+  munit_assert_not_null(dns_trie_lookup(server->trie, "mail.example.com", DNS_TYPE_A));
+
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+
+// an RFC 2136 update of example.com from 127.0.0.1, a record to add or,
+// with add NULL, every RRset at name deleted. the rcode of the reply
+static uint8_t send_update(dns_server_t *server, const char *name, dns_rr_t *add) {
+  uint8_t buf[512];
+  dns_header_t header = {.id = 0x4242, .opcode = DNS_OPCODE_UPDATE, .qdcount = 1, .nscount = 1};
+  dns_encode_header(buf, sizeof(buf), &header);
+
+  size_t offset = 12;
+  dns_question_t zone = {.qtype = DNS_TYPE_SOA, .qclass = DNS_CLASS_IN};
+  strcpy(zone.qname, "example.com");
+  dns_encode_question(buf, sizeof(buf), &offset, &zone);
+  if (add) {
+    munit_assert_int(dns_encode_rr(buf, sizeof(buf), &offset, name, add), ==, 0);
+    dns_rr_free(add);
+  } else {
+    dns_encode_name(buf, sizeof(buf), &offset, name);
+    dns_write_uint16(buf, sizeof(buf), &offset, DNS_TYPE_ANY);
+    dns_write_uint16(buf, sizeof(buf), &offset, DNS_CLASS_ANY);
+    dns_write_uint32(buf, sizeof(buf), &offset, 0);
+    dns_write_uint16(buf, sizeof(buf), &offset, 0);
+  }
+
+  dns_request_t request = {.buffer = buf, .length = offset};
+  struct sockaddr_in *client = (struct sockaddr_in *)&request.client_addr;
+  client->sin_family = AF_INET;
+  client->sin_addr.s_addr = inet_addr("127.0.0.1");
+
+  dns_response_t *response = dns_response_create(DNS_BUFFER_SIZE);
+  munit_assert_int(dns_process_query(server, &request, response, NULL), ==, 0);
+  dns_parse_header(response->buffer, response->length, &header);
+  dns_response_free(response);
+  return header.rcode;
+}
+
+// a negative answer for name, cached with the closest encloser it hangs off
+static void cache_nxdomain(dns_server_t *server, const char *name) {
+  dns_response_t *response = send_query(server, name, DNS_TYPE_MX);
+  dns_header_t header;
+  dns_parse_header(response->buffer, response->length, &header);
+  munit_assert_int(header.rcode, ==, DNS_RCODE_NXDOMAIN);
+  dns_response_free(response);
+  munit_assert_int(server->cache->current_entries, >, 0);
+}
+
+static MunitResult test_update_after_clear(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char path[64];
+  char zone[64];
+  dns_server_t *server = control_server(path, sizeof(path));
+  server->enable_recursion = false;
+  munit_assert_int(dns_server_allow_update(server, "127.0.0.1"), ==, 0);
+  temp_path(zone, sizeof(zone), ".zone");
+
+  write_file(zone,
+             "example.com.  IN  SOA  ns1.example.com. admin.example.com. 1 3600 600 86400 300\n"
+             "example.com.  300  IN  NS  ns1.example.com.\n"
+             "www.example.com.  300  IN  A  192.0.2.1\n");
+  zone_load_result_t result;
+  munit_assert_int(dns_server_load_zone(server, zone, "example.com", &result), ==, 0);
+
+  // updates that create or remove a name walk the negative answers under
+  // its encloser, none of which may survive the clear
+  static char reply[4096];
+  cache_nxdomain(server, "new.example.com");
+  run_command(server, "flush_all\n", reply, sizeof(reply), NULL);
+  munit_assert_size(server->cache->current_entries, ==, 0);
+  munit_assert_int(send_update(server, "new.example.com", dns_rr_create_a_str("192.0.2.7", 300)),
+                   ==, DNS_RCODE_NOERROR);
+  munit_assert_not_null(dns_trie_lookup(server->trie, "new.example.com", DNS_TYPE_A));
+
+  cache_nxdomain(server, "other.example.com");
+  run_command(server, "reload\n", reply, sizeof(reply), NULL);
+  munit_assert_true(strncmp(reply, "reloaded", 8) == 0);
+  munit_assert_int(send_update(server, "www.example.com", NULL), ==, DNS_RCODE_NOERROR);
+  munit_assert_null(dns_trie_lookup(server->trie, "www.example.com", DNS_TYPE_A));
+
+  unlink(zone);
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+  {"/commands", test_commands, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/dump", test_dump, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/reload", test_reload, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/update_after_clear", test_update_after_clear, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+
+  {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
+};
+
+static const MunitSuite suite = {"/control", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  return munit_suite_main(&suite, NULL, argc, argv);
+}
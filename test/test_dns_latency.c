@@ -0,0 +1,163 @@
+#include "munit.h"
+#include "dns_latency.h"
+#include "dns_server.h"
+#include "test_dns_query.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+static MunitResult test_buckets(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  // exact below DNS_HIST_SUB
+  for (uint64_t v = 0; v < DNS_HIST_SUB; ++v) {
+    munit_assert_uint(dns_histogram_bucket(v), ==, v);
+  }
+
+  // every value sits inside its bucket, buckets are contiguous and never
+  // wider than 1/16 of their low end
+  uint64_t values[] = {16, 31, 32, 33, 63, 64, 100, 1000, 4095, 4096, 123456789, UINT64_C(1) << 39};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    unsigned b = dns_histogram_bucket(values[i]);
+    munit_assert_uint64(dns_histogram_bucket_low(b), <=, values[i]);
+    munit_assert_uint64(dns_histogram_bucket_high(b), >=, values[i]);
+    uint64_t width = dns_histogram_bucket_high(b) - dns_histogram_bucket_low(b) + 1;
+    munit_assert_uint64(width * DNS_HIST_SUB, <=, dns_histogram_bucket_low(b));
+  }
+  for (unsigned b = 1; b < DNS_HIST_BUCKETS; ++b) {
+    munit_assert_uint64(dns_histogram_bucket_low(b), ==, dns_histogram_bucket_high(b - 1) + 1);
+  }
+
+  // past the top everything lands in the last bucket
+  munit_assert_uint(dns_histogram_bucket(UINT64_MAX), ==, DNS_HIST_BUCKETS - 1);
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_quantiles(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_histogram_t *hist = calloc(1, sizeof(dns_histogram_t));
+  munit_assert_uint64(dns_histogram_quantile(hist, 0.5), ==, 0);
+
+  // 1..1000, once each
+  for (uint64_t v = 1; v <= 1000; ++v) dns_histogram_record(hist, v);
+  munit_assert_uint64(hist->count, ==, 1000);
+  munit_assert_uint64(hist->max, ==, 1000);
+  munit_assert_uint64(hist->sum, ==, 500500);
+
+  // within a bucket of the exact answer, never below it
+  uint64_t p50 = dns_histogram_quantile(hist, 0.50);
+  uint64_t p99 = dns_histogram_quantile(hist, 0.99);
+  uint64_t p999 = dns_histogram_quantile(hist, 0.999);
+  munit_assert_uint64(p50, >=, 500);
+  munit_assert_uint64(p50, <=, 500 + 500 / DNS_HIST_SUB);
+  munit_assert_uint64(p99, >=, 990);
+  munit_assert_uint64(p99, <=, 1000);
+  munit_assert_uint64(p999, ==, 1000);
+  munit_assert_uint64(dns_histogram_quantile(hist, 1.0), ==, 1000);
+
+  // merging doubles the counts and keeps the quantiles
+  dns_histogram_t *sum = calloc(1, sizeof(dns_histogram_t));
+  dns_histogram_merge(sum, hist);
+  dns_histogram_merge(sum, hist);
+  munit_assert_uint64(sum->count, ==, 2000);
+  munit_assert_uint64(dns_histogram_quantile(sum, 0.50), ==, p50);
+
+  dns_histogram_reset(sum);
+  munit_assert_uint64(sum->count, ==, 0);
+
+  free(sum);
+  free(hist);
+  return MUNIT_OK;
+}
+
+static MunitResult test_timer(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_latency_t *latency = dns_latency_create();
+
+  dns_query_timer_t timer;
+  dns_query_timer_start(&timer, true);
+  dns_query_timer_mark(&timer, DNS_STAGE_PARSE);
+  dns_query_timer_mark(&timer, DNS_STAGE_ENCODE);
+  timer.outcome = DNS_OUTCOME_CACHE_HIT;
+  dns_latency_record_timer(latency, &timer);
+
+  // only the stages marked, plus the total
+  munit_assert_uint64(latency->histograms[DNS_STAGE_PARSE][DNS_OUTCOME_CACHE_HIT].count, ==, 1);
+  munit_assert_uint64(latency->histograms[DNS_STAGE_ENCODE][DNS_OUTCOME_CACHE_HIT].count, ==, 1);
+  munit_assert_uint64(latency->histograms[DNS_STAGE_TOTAL][DNS_OUTCOME_CACHE_HIT].count, ==, 1);
+  munit_assert_uint64(latency->histograms[DNS_STAGE_RESOLVE][DNS_OUTCOME_CACHE_HIT].count, ==, 0);
+  munit_assert_uint64(latency->histograms[DNS_STAGE_PARSE][DNS_OUTCOME_ERROR].count, ==, 0);
+
+  // a disabled timer records nothing
+  dns_query_timer_start(&timer, false);
+  dns_query_timer_mark(&timer, DNS_STAGE_PARSE);
+  dns_latency_record_timer(latency, &timer);
+  munit_assert_uint64(latency->histograms[DNS_STAGE_PARSE][DNS_OUTCOME_ERROR].count, ==, 0);
+
+  munit_assert_double(dns_clock_ns_per_tick(), >, 0.0);
+  munit_assert_string_equal(dns_stage_name(DNS_STAGE_RECURSIVE), "recursive");
+  munit_assert_string_equal(dns_outcome_name(DNS_OUTCOME_CACHE_HIT), "cache_hit");
+
+  dns_latency_summary_t summary;
+  dns_latency_summary(latency, DNS_STAGE_TOTAL, DNS_OUTCOME_CACHE_HIT, &summary);
+  munit_assert_uint64(summary.count, ==, 1);
+  munit_assert_uint64(summary.p50_ns, <=, summary.p999_ns);
+  munit_assert_uint64(summary.p999_ns, <=, summary.max_ns);
+
+  dns_latency_free(latency);
+  return MUNIT_OK;
+}
+
+static MunitResult test_server_stages(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  munit_assert_not_null(server->latency);
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.1", 300);
+
+  // authoritative, then the same from the cache, then a NOTIMP
+  dns_response_free(send_query(server, "www.example.com", DNS_TYPE_A));
+  dns_response_free(send_query(server, "www.example.com", DNS_TYPE_A));
+  dns_response_free(send_query_with(server, &(test_query_t){.qname = "www.example.com", .opcode = DNS_OPCODE_STATUS}));
+
+  dns_histogram_t (*h)[DNS_OUTCOME_COUNT] = server->latency->histograms;
+  munit_assert_uint64(h[DNS_STAGE_TOTAL][DNS_OUTCOME_AUTHORITATIVE].count, ==, 1);
+  munit_assert_uint64(h[DNS_STAGE_RESOLVE][DNS_OUTCOME_AUTHORITATIVE].count, ==, 1);
+  munit_assert_uint64(h[DNS_STAGE_ENCODE][DNS_OUTCOME_AUTHORITATIVE].count, ==, 1);
+  munit_assert_uint64(h[DNS_STAGE_TOTAL][DNS_OUTCOME_CACHE_HIT].count, ==, 1);
+  munit_assert_uint64(h[DNS_STAGE_CACHE][DNS_OUTCOME_CACHE_HIT].count, ==, 1);
+  munit_assert_uint64(h[DNS_STAGE_RESOLVE][DNS_OUTCOME_CACHE_HIT].count, ==, 0);
+  munit_assert_uint64(h[DNS_STAGE_TOTAL][DNS_OUTCOME_ERROR].count, ==, 1);
+  munit_assert_uint64(h[DNS_STAGE_PARSE][DNS_OUTCOME_ERROR].count, ==, 1);
+
+  // turned off, nothing is kept
+  dns_latency_free(server->latency);
+  server->latency = NULL;
+  dns_response_free(send_query(server, "www.example.com", DNS_TYPE_A));
+
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+
+static MunitTest tests[] = {
+  {"/buckets", test_buckets, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/quantiles", test_quantiles, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/timer", test_timer, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/server_stages", test_server_stages, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+
+  {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
+};
+
+static const MunitSuite suite = {"/latency", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  return munit_suite_main(&suite, NULL, argc, argv);
+}
@@ -1,6 +1,8 @@
 #include "munit.h"
 #include "dns_log.h"
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -146,6 +148,151 @@ static MunitResult test_hexdump(const MunitParameter params[], void *data) {
   dns_log_shutdown();
   return MUNIT_OK;
 }
+static int evaluated;
+
+static int side_effect(void) {
+  return ++evaluated;
+}
+
+static MunitResult test_lazy_arguments(const MunitParameter params[], void *data) {
+  (void)params; (void)data;
+
+  dns_log_init();
+  dns_log_set_output(fopen("/dev/null", "w"));
+  dns_log_set_level(DNS_LOG_WARN);
+  evaluated = 0;
+
+  // off at runtime, the arguments are skipped
+  DNS_LOG_INFO("%d", side_effect());
+  munit_assert_int(evaluated, ==, 0);
+  DNS_LOG_WARN("%d", side_effect());
+  munit_assert_int(evaluated, ==, 1);
+
+  // what a level below DNS_LOG_COMPILE_LEVEL turns into
+  dns_log_set_level(DNS_LOG_TRACE);
+  DNS_LOG_DISCARD("%d", side_effect());
+  munit_assert_int(evaluated, ==, 1);
+
+  fclose(dns_log_get_logger()->output);
+  dns_log_set_output(stdout);
+  dns_log_shutdown();
+  return MUNIT_OK;
+}
+
+// lines of the file that contain needle
+static int count_lines(const char *path, const char *needle) {
+  FILE *file = fopen(path, "r");
+  munit_assert_not_null(file);
+
+  int count = 0;
+  char buf[DNS_LOG_LINE_MAX + 1];
+  while (fgets(buf, sizeof(buf), file)) {
+    if (strstr(buf, needle)) ++count;
+  }
+  fclose(file);
+  return count;
+}
+
+#define ASYNC_THREADS 4
+#define ASYNC_LINES 500 // fits a ring, nothing is dropped
+
+static pthread_barrier_t async_barrier;
+
+static void *async_producer(void *arg) {
+  long id = (long)arg;
+  for (int i = 0; i < ASYNC_LINES; ++i) DNS_LOG_INFO("thread %ld line %d", id, i);
+  // nobody exits and hands its ring on while the others still log
+  if (id < ASYNC_THREADS) pthread_barrier_wait(&async_barrier);
+  return NULL;
+}
+
+static MunitResult test_async(const MunitParameter params[], void *data) {
+  (void)params; (void)data;
+
+  dns_log_init();
+  dns_log_set_level(DNS_LOG_INFO);
+  dns_log_set_timestamp(false);
+  dns_log_set_file_line(false);
+
+  char fname[] = "/tmp/dns_log_async_XXXXXX";
+  int fd = mkstemp(fname);
+  munit_assert_int(fd, >=, 0);
+  close(fd);
+
+  munit_assert_int(dns_log_start_async(fname), ==, 0);
+  munit_assert_true(dns_log_is_async());
+  munit_assert_int(dns_log_start_async(fname), ==, -1); // already running
+
+  uint64_t dropped = dns_log_dropped();
+  pthread_t threads[ASYNC_THREADS];
+  pthread_barrier_init(&async_barrier, NULL, ASYNC_THREADS);
+  for (long i = 0; i < ASYNC_THREADS; ++i) {
+    munit_assert_int(pthread_create(&threads[i], NULL, async_producer, (void*)i), ==, 0);
+  }
+  for (int i = 0; i < ASYNC_THREADS; ++i) pthread_join(threads[i], NULL);
+  pthread_barrier_destroy(&async_barrier);
+
+  DNS_LOG_INFO("main %d", 1);
+  DNS_LOG_DEBUG("below the level");
+  dns_log_flush();
+  munit_assert_int(count_lines(fname, "INFO  main 1\n"), ==, 1);
+
+  // exited threads leave their rings to the next ones
+  munit_assert_int(pthread_create(&threads[0], NULL, async_producer, (void*)ASYNC_THREADS), ==, 0);
+  pthread_join(threads[0], NULL);
+
+  dns_log_stop_async();
+  munit_assert_false(dns_log_is_async());
+  munit_assert_int(dns_log_dropped(), ==, dropped);
+  munit_assert_int(count_lines(fname, "INFO  thread "), ==, (ASYNC_THREADS + 1) * ASYNC_LINES);
+  munit_assert_int(count_lines(fname, "INFO  thread 2 line 499\n"), ==, 1);
+  munit_assert_int(count_lines(fname, "below the level"), ==, 0);
+
+  unlink(fname);
+  dns_log_shutdown();
+  return MUNIT_OK;
+}
+
+static MunitResult test_async_dropped(const MunitParameter params[], void *data) {
+  (void)params; (void)data;
+
+  dns_log_init();
+  dns_log_set_level(DNS_LOG_INFO);
+  dns_log_set_timestamp(false);
+  dns_log_set_file_line(false);
+
+  char fname[] = "/tmp/dns_log_async_XXXXXX";
+  int fd = mkstemp(fname);
+  munit_assert_int(fd, >=, 0);
+  close(fd);
+
+  // far more than a ring holds, the writer catches what it can
+  munit_assert_int(dns_log_start_async(fname), ==, 0);
+  uint64_t before = dns_log_dropped();
+  const int total = DNS_LOG_RING_SLOTS * 8;
+  for (int i = 0; i < total; ++i) DNS_LOG_INFO("burst %d", i);
+  dns_log_stop_async();
+
+  // every line is either in the file or counted
+  uint64_t dropped = dns_log_dropped() - before;
+  munit_assert_int(count_lines(fname, "INFO  burst "), ==, total - (int)dropped);
+  if (dropped > 0) munit_assert_int(count_lines(fname, "lines dropped"), >=, 1);
+
+  // a line longer than a slot is cut, still one line
+  char *long_line = malloc(DNS_LOG_LINE_MAX * 2);
+  memset(long_line, 'x', DNS_LOG_LINE_MAX * 2 - 1);
+  long_line[DNS_LOG_LINE_MAX * 2 - 1] = '\0';
+  munit_assert_int(dns_log_start_async(fname), ==, 0);
+  DNS_LOG_INFO("%s", long_line);
+  dns_log_stop_async();
+  free(long_line);
+  munit_assert_int(count_lines(fname, "xxxx\n"), ==, 1);
+
+  unlink(fname);
+  dns_log_shutdown();
+  return MUNIT_OK;
+}
+
 
 static MunitTest tests[] = {
   {"/init", test_init, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
@@ -154,6 +301,9 @@ static MunitTest tests[] = {
   {"/is_enabled", test_is_enabled, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/output_to_file", test_output_to_file, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/hexdump", test_hexdump, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/lazy_arguments", test_lazy_arguments, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/async", test_async, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/async_dropped", test_async_dropped, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
 };
 
@@ -0,0 +1,177 @@
+#include "munit.h"
+#include "dns_metrics.h"
+#include "dns_server.h"
+#include "test_dns_query.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+static MunitResult test_buffer(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char storage[32];
+  dns_metrics_buffer_t buf = {.data = storage, .capacity = sizeof(storage)};
+
+  dns_metrics_appendf(&buf, "a %d\n", 1);
+  munit_assert_size(buf.length, ==, 4);
+  munit_assert_false(buf.overflow);
+
+  // what does not fit is dropped whole and remembered
+  dns_metrics_appendf(&buf, "%s\n", "this line is longer than the room left");
+  munit_assert_true(buf.overflow);
+  munit_assert_size(buf.length, ==, 4);
+
+  dns_metrics_buffer_reset(&buf);
+  munit_assert_false(buf.overflow);
+  munit_assert_size(buf.length, ==, 0);
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_exposition(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.1", 300);
+  dns_response_free(send_query(server, "www.example.com", DNS_TYPE_A));
+  dns_response_free(send_query(server, "www.example.com", DNS_TYPE_A));
+
+  // upstream counters are 64 bit, past where a uint32_t would wrap
+  atomic_store(&server->recursive_resolver->root_servers[1].queries_sent, (1ull << 32) + 5);
+
+  dns_metrics_buffer_t buf = {.data = malloc(DNS_METRICS_BUFFER_SIZE + 1), .capacity = DNS_METRICS_BUFFER_SIZE};
+  dns_server_write_metrics(server, &buf);
+  munit_assert_false(buf.overflow);
+  buf.data[buf.length] = '\0';
+
+  munit_assert_not_null(strstr(buf.data, "# TYPE dns_queries_received_total counter\n"));
+  munit_assert_not_null(strstr(buf.data, "\ndns_queries_received_total 2\n"));
+  munit_assert_not_null(strstr(buf.data, "\ndns_cache_hits_total 1\n"));
+  munit_assert_not_null(strstr(buf.data, "\ndns_cache_entries{type=\"positive\"} 1\n"));
+  munit_assert_not_null(strstr(buf.data, "\ndns_cache_records 1\n"));
+  munit_assert_not_null(strstr(buf.data, "# TYPE dns_query_duration_seconds summary\n"));
+  munit_assert_not_null(strstr(buf.data,
+                               "dns_query_duration_seconds_count{stage=\"total\",outcome=\"cache_hit\"} 1\n"));
+  munit_assert_not_null(strstr(buf.data,
+                               "dns_query_duration_seconds{stage=\"total\",outcome=\"authoritative\",quantile=\"0.99\"} "));
+  munit_assert_not_null(strstr(buf.data, "\ndns_trie_nodes "));
+  munit_assert_not_null(strstr(buf.data, "dns_upstream_queries_sent_total{server=\"a.root-servers.net\"} 0\n"));
+  munit_assert_not_null(strstr(buf.data, "dns_upstream_timeouts_total{server=\"other\"} 0\n"));
+  munit_assert_not_null(strstr(buf.data, "dns_upstream_queries_sent_total{server=\"b.root-servers.net\"} 4294967301\n"));
+
+  // every sample line is a name, an optional label set and a value
+  for (char *line = buf.data; *line; line = strchr(line, '\n') + 1) {
+    if (*line == '#') continue;
+    char *end = strchr(line, '\n');
+    munit_assert_not_null(end);
+    char *value = end;
+    while (value > line && value[-1] != ' ') --value;
+    munit_assert_ptr(value, >, line);
+    munit_assert_true(value[0] >= '0' && value[0] <= '9');
+    munit_assert_true(strncmp(line, "dns_", 4) == 0);
+  }
+
+  free(buf.data);
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+// one pass of the server's loop over the metrics sockets
+static void metrics_poll(dns_server_t *server) {
+  fd_set read_fds;
+  fd_set write_fds;
+  FD_ZERO(&read_fds);
+  FD_ZERO(&write_fds);
+  int max_fd = dns_metrics_watch(server->metrics, &read_fds, &write_fds, -1);
+
+  struct timeval timeout = {1, 0};
+  munit_assert_int(select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout), >, 0);
+
+  if (dns_metrics_ready(server->metrics, &read_fds)) {
+    dns_server_write_metrics(server, &server->metrics->body);
+    dns_metrics_respond(server->metrics);
+  }
+  dns_metrics_flush(server->metrics, &write_fds);
+}
+
+static size_t scrape(dns_server_t *server, const char *request, char *out, size_t cap) {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  munit_assert_int(getsockname(server->metrics->listen_fd, (struct sockaddr *)&addr, &addr_len), ==, 0);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  munit_assert_int(fd, >=, 0);
+  munit_assert_int(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+  munit_assert_int(send(fd, request, strlen(request), 0), ==, (int)strlen(request));
+
+  // accept and read, then whatever is left to write
+  int passes = 0;
+  do {
+    metrics_poll(server);
+  } while (server->metrics->client_fd >= 0 && ++passes < 10);
+
+  size_t length = 0;
+  ssize_t n;
+  while ((n = recv(fd, out + length, cap - 1 - length, 0)) > 0) length += (size_t)n;
+  out[length] = '\0';
+  close(fd);
+  return length;
+}
+
+static MunitResult test_scrape(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.1", 300);
+  dns_response_free(send_query(server, "www.example.com", DNS_TYPE_A));
+
+  // port 0 takes whatever the kernel hands out
+  server->metrics = dns_metrics_create(0);
+  munit_assert_not_null(server->metrics);
+
+  static char response[DNS_METRICS_BUFFER_SIZE + 512];
+  size_t length = scrape(server, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                         response, sizeof(response));
+  munit_assert_size(length, >, 0);
+  munit_assert_true(strncmp(response, "HTTP/1.0 200 OK\r\n", 17) == 0);
+  munit_assert_not_null(strstr(response, "Content-Type: text/plain; version=0.0.4"));
+
+  // the body is exactly what Content-Length promised
+  char *body = strstr(response, "\r\n\r\n");
+  munit_assert_not_null(body);
+  body += 4;
+  unsigned long content_length = 0;
+  munit_assert_int(sscanf(strstr(response, "Content-Length: "), "Content-Length: %lu", &content_length), ==, 1);
+  munit_assert_size(strlen(body), ==, content_length);
+  munit_assert_not_null(strstr(body, "\ndns_queries_received_total 1\n"));
+
+  // nothing else is served
+  scrape(server, "GET /admin HTTP/1.0\r\n\r\n", response, sizeof(response));
+  munit_assert_true(strncmp(response, "HTTP/1.0 404", 12) == 0);
+  munit_assert_int(server->metrics->client_fd, ==, -1);
+
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+
+static MunitTest tests[] = {
+  {"/buffer", test_buffer, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/exposition", test_exposition, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/scrape", test_scrape, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+
+  {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
+};
+
+static const MunitSuite suite = {"/metrics", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  return munit_suite_main(&suite, NULL, argc, argv);
+}
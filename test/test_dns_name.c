@@ -0,0 +1,194 @@
+#include "munit.h"
+#include "dns_name.h"
+#include "dns_parser.h"
+#include <string.h>
+
+
+static MunitResult test_from_text(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_name_t name;
+  munit_assert_int(dns_name_from_text(&name, "WWW.Example.COM."), ==, 0);
+
+  const uint8_t wire[] = {3, 'w', 'w', 'w', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0};
+  munit_assert_int(name.len, ==, sizeof(wire));
+  munit_assert_memory_equal(sizeof(wire), name.wire, wire);
+  munit_assert_int(name.label_count, ==, 3);
+  munit_assert_int(name.label_offsets[0], ==, 0);
+  munit_assert_int(name.label_offsets[1], ==, 4);
+  munit_assert_int(name.label_offsets[2], ==, 12);
+
+  uint8_t len;
+  const uint8_t *label = dns_name_label(&name, 2, &len);
+  munit_assert_int(len, ==, 3);
+  munit_assert_memory_equal(3, label, "com");
+
+  char text[MAX_DOMAIN_NAME];
+  munit_assert_int(dns_name_to_text(&name, text, sizeof(text)), ==, 0);
+  munit_assert_string_equal(text, "www.example.com");
+
+  // too small for "www.example.com" and its NUL
+  munit_assert_int(dns_name_to_text(&name, text, 15), ==, -1);
+
+  // the root, with or without its dot
+  munit_assert_int(dns_name_from_text(&name, ""), ==, 0);
+  munit_assert_int(name.len, ==, 1);
+  munit_assert_int(name.label_count, ==, 0);
+  munit_assert_int(dns_name_to_text(&name, text, sizeof(text)), ==, 0);
+  munit_assert_string_equal(text, "");
+
+  dns_name_t dot;
+  munit_assert_int(dns_name_from_text(&dot, "."), ==, 0);
+  munit_assert_true(dns_name_eq(&name, &dot));
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_from_text_invalid(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_name_t name;
+  munit_assert_int(dns_name_from_text(&name, "a..b"), ==, -1);
+  munit_assert_int(dns_name_from_text(&name, ".a"), ==, -1);
+  munit_assert_int(dns_name_from_text(&name, "a.."), ==, -1);
+  munit_assert_int(dns_name_from_text(NULL, "a"), ==, -1);
+  munit_assert_int(dns_name_from_text(&name, NULL), ==, -1);
+
+  // 63 is the longest label
+  char text[300];
+  memset(text, 'a', 64);
+  text[64] = '\0';
+  munit_assert_int(dns_name_from_text(&name, text), ==, -1);
+  text[63] = '\0';
+  munit_assert_int(dns_name_from_text(&name, text), ==, 0);
+
+  // 253 characters of text is the longest name, 255 bytes on the wire
+  memset(text, 'a', 253);
+  for (int i = 1; i < 253; i += 2) text[i] = '.';
+  text[253] = '\0';
+  munit_assert_int(dns_name_from_text(&name, text), ==, 0);
+  munit_assert_int(name.len, ==, 255);
+  munit_assert_int(name.label_count, ==, 127);
+
+  text[253] = '.';
+  text[254] = 'a';
+  text[255] = '\0';
+  munit_assert_int(dns_name_from_text(&name, text), ==, -1);
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_equality(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_name_t a;
+  dns_name_t b;
+  dns_name_t c;
+  dns_name_from_text(&a, "Mail.Example.com");
+  dns_name_from_text(&b, "mail.EXAMPLE.COM.");
+  dns_name_from_text(&c, "mail.example.co");
+
+  munit_assert_true(dns_name_eq(&a, &b));
+  munit_assert_uint32(a.hash, ==, b.hash);
+  munit_assert_false(dns_name_eq(&a, &c));
+
+  // same bytes, different label split
+  dns_name_from_text(&b, "ab.c");
+  dns_name_from_text(&c, "a.bc");
+  munit_assert_false(dns_name_eq(&b, &c));
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_subdomain(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_name_t name;
+  dns_name_t parent;
+  dns_name_from_text(&name, "www.Example.com");
+
+  dns_name_from_text(&parent, "example.COM");
+  munit_assert_true(dns_name_is_subdomain(&name, &parent));
+
+  dns_name_from_text(&parent, "www.example.com");
+  munit_assert_true(dns_name_is_subdomain(&name, &parent));
+
+  dns_name_from_text(&parent, "");
+  munit_assert_true(dns_name_is_subdomain(&name, &parent));
+
+  // a suffix that does not start on a label boundary
+  dns_name_from_text(&parent, "ample.com");
+  munit_assert_false(dns_name_is_subdomain(&name, &parent));
+
+  dns_name_from_text(&parent, "a.www.example.com");
+  munit_assert_false(dns_name_is_subdomain(&name, &parent));
+
+  // suffixes are whole names, equal to the same name built from text
+  dns_name_t suffix;
+  dns_name_suffix(&name, 2, &suffix);
+  dns_name_from_text(&parent, "example.com");
+  munit_assert_true(dns_name_eq(&suffix, &parent));
+  munit_assert_true(dns_name_is_subdomain(&name, &suffix));
+
+  dns_name_suffix(&name, 0, &suffix);
+  dns_name_from_text(&parent, "");
+  munit_assert_true(dns_name_eq(&suffix, &parent));
+
+  dns_name_suffix(&name, 3, &suffix);
+  munit_assert_true(dns_name_eq(&suffix, &name));
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_parse_wire(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  // "Example.COM" at 0, then "www" + pointer to it
+  uint8_t buf[] = {
+    7, 'E', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'C', 'O', 'M', 0,
+    3, 'w', 'w', 'w', 0xC0, 0x00,
+    0xFF
+  };
+
+  size_t offset = 13;
+  dns_name_t name;
+  munit_assert_int(dns_parse_name_wire(buf, sizeof(buf), &offset, &name), ==, 0);
+  munit_assert_size(offset, ==, 19);
+
+  dns_name_t expected;
+  dns_name_from_text(&expected, "www.example.com");
+  munit_assert_true(dns_name_eq(&name, &expected));
+
+  // a pointer to itself never ends
+  uint8_t loop[] = {0xC0, 0x00};
+  offset = 0;
+  munit_assert_int(dns_parse_name_wire(loop, sizeof(loop), &offset, &name), ==, -1);
+
+  // no root label before the end of the buffer
+  offset = 0;
+  munit_assert_int(dns_parse_name_wire(buf, 12, &offset, &name), ==, -1);
+
+  return MUNIT_OK;
+}
+
+
+static MunitTest tests[] = {
+  {"/from_text", test_from_text, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/from_text_invalid", test_from_text_invalid, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/equality", test_equality, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/subdomain", test_subdomain, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/parse_wire", test_parse_wire, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+
+  {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
+};
+
+static const MunitSuite suite = {"/name", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  return munit_suite_main(&suite, NULL, argc, argv);
+}
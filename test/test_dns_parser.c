@@ -1,7 +1,9 @@
 #include "munit.h"
 #include "dns_parser.h"
+#include "dns_rdata.h"
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <arpa/inet.h>
 
 
@@ -129,7 +131,7 @@ static MunitResult test_rr_encoding(const MunitParameter params[], void *data) {
     .class = DNS_CLASS_IN,
     .ttl = 1800,
   };
-  strcpy(cname_record.rdata.cname.cname, "www.example.com");
+  cname_record.rdata.cname.cname = "www.example.com";
 
   result = dns_encode_rr(buffer, sizeof(buffer), &offset, "alias.example.com", &cname_record);
   munit_assert_int(result, ==, 0);
@@ -159,21 +161,34 @@ static MunitResult test_rr_encoding(const MunitParameter params[], void *data) {
     .class = DNS_CLASS_IN,
     .ttl = 86400,
   };
-  strcpy(ns_record.rdata.ns.nsdname, "ns1.example.com");
+  ns_record.rdata.ns.nsdname = "ns1.example.com";
 
   result = dns_encode_rr(buffer, sizeof(buffer), &offset, "example.com", &ns_record);
   munit_assert_int(result, ==, 0);
   munit_assert_int(offset, >, 0);
 
-  // unsupported type, should fail
+  // unknown type, written as its opaque rdata (empty here)
   offset = 0;
-  dns_rr_t unsupported_record = {
+  dns_rr_t unknown_record = {
     .type = 999,
     .class = DNS_CLASS_IN,
     .ttl = 3600,
   };
 
-  result = dns_encode_rr(buffer, sizeof(buffer), &offset, "test.com", &unsupported_record);
+  result = dns_encode_rr(buffer, sizeof(buffer), &offset, "test.com", &unknown_record);
+  munit_assert_int(result, ==, 0);
+  munit_assert_uint8(buffer[offset - 2], ==, 0);
+  munit_assert_uint8(buffer[offset - 1], ==, 0);
+
+  // a name type without its name, should fail
+  offset = 0;
+  dns_rr_t nameless_record = {
+    .type = DNS_TYPE_MX,
+    .class = DNS_CLASS_IN,
+    .ttl = 3600,
+  };
+
+  result = dns_encode_rr(buffer, sizeof(buffer), &offset, "test.com", &nameless_record);
   munit_assert_int(result, ==, -1);
 
   // buffer too small, should fail
@@ -491,24 +506,15 @@ static MunitResult test_soa_rr_encoding(const MunitParameter params[], void *dat
   uint8_t buf[512];
   size_t offset = 0;
 
-  dns_rr_t soa_record = {
-    .type = DNS_TYPE_SOA,
-    .class = DNS_CLASS_IN,
-    .ttl = 3600,
-  };
-
-  strcpy(soa_record.rdata.soa.mname, "ns1.example.com");
-  strcpy(soa_record.rdata.soa.rname, "admin.example.com");
-  soa_record.rdata.soa.serial = 2024010101;
-  soa_record.rdata.soa.refresh = 7200;
-  soa_record.rdata.soa.retry = 3600;
-  soa_record.rdata.soa.expire = 604800;
-  soa_record.rdata.soa.minimum = 86400;
+  dns_rr_t *soa_record = dns_rr_create_soa("ns1.example.com", "admin.example.com",
+                                           2024010101, 7200, 3600, 604800, 86400, 3600);
 
-  int result = dns_encode_rr(buf, sizeof(buf), &offset, "example.com", &soa_record);
+  int result = dns_encode_rr(buf, sizeof(buf), &offset, "example.com", soa_record);
   munit_assert_int(result, ==, 0);
   munit_assert_size(offset, >, 50); // sOA records are large
 
+  dns_rr_free(soa_record);
+
   return MUNIT_OK;
 }
 
@@ -671,6 +677,468 @@ static MunitResult test_encode_buffer_too_small(const MunitParameter params[], v
   return MUNIT_OK;
 }
 
+static MunitResult test_name_compression(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  uint8_t buf[256];
+  size_t offset = 12;
+  dns_compress_t ctx;
+  dns_compress_init(&ctx);
+
+  munit_assert_int(dns_encode_name_compressed(buf, sizeof(buf), &offset, "www.example.com", &ctx), ==, 0);
+  munit_assert_size(offset, ==, 12 + 17);
+
+  // same name, any case, is a bare pointer to the first one
+  size_t second = offset;
+  munit_assert_int(dns_encode_name_compressed(buf, sizeof(buf), &offset, "WWW.Example.COM", &ctx), ==, 0);
+  munit_assert_size(offset, ==, second + 2);
+  munit_assert_uint8(buf[second], ==, 0xC0);
+  munit_assert_uint8(buf[second + 1], ==, 12);
+
+  // a sibling writes its own label and points at example.com
+  size_t third = offset;
+  munit_assert_int(dns_encode_name_compressed(buf, sizeof(buf), &offset, "mail.example.com", &ctx), ==, 0);
+  munit_assert_size(offset, ==, third + 5 + 2);
+  munit_assert_uint8(buf[third + 5], ==, 0xC0);
+  munit_assert_uint8(buf[third + 6], ==, 12 + 4);
+
+  // a name below the sibling points at the sibling, which itself ends in a pointer
+  size_t fourth = offset;
+  munit_assert_int(dns_encode_name_compressed(buf, sizeof(buf), &offset, "a.mail.example.com", &ctx), ==, 0);
+  munit_assert_size(offset, ==, fourth + 2 + 2);
+  munit_assert_uint8(buf[fourth + 3], ==, third);
+
+  // unrelated names are not compressed
+  size_t fifth = offset;
+  munit_assert_int(dns_encode_name_compressed(buf, sizeof(buf), &offset, "example.org", &ctx), ==, 0);
+  munit_assert_size(offset, ==, fifth + 13);
+
+  char name[MAX_DOMAIN_NAME];
+  size_t pos = fourth;
+  munit_assert_int(dns_parse_name(buf, offset, &pos, name, sizeof(name)), ==, 0);
+  munit_assert_string_equal(name, "a.mail.example.com");
+
+  // entries past a rewind point are forgotten
+  dns_compress_truncate(&ctx, third);
+  offset = third;
+  munit_assert_int(dns_encode_name_compressed(buf, sizeof(buf), &offset, "a.mail.example.com", &ctx), ==, 0);
+  munit_assert_size(offset, ==, third + 2 + 5 + 2);
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_rdata_compression(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  uint8_t buf[512];
+  size_t offset = 12;
+  dns_compress_t ctx;
+  dns_compress_init(&ctx);
+
+  dns_question_t question = {.qtype = DNS_TYPE_MX, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, "example.com");
+  munit_assert_int(dns_encode_question_compressed(buf, sizeof(buf), &offset, &question, &ctx), ==, 0);
+
+  dns_rr_t *mx = dns_rr_create_mx(10, "mail.example.com", 300);
+  dns_rr_t *soa = dns_rr_create_soa("ns1.example.com", "admin.example.com", 1, 2, 3, 4, 5, 300);
+
+  size_t mx_start = offset;
+  munit_assert_int(dns_encode_rr_ttl(buf, sizeof(buf), &offset, "example.com", mx, 60, &ctx), ==, 0);
+  // owner pointer, type, class, ttl, rdlength, preference, "mail" + pointer
+  munit_assert_size(offset - mx_start, ==, 2 + 10 + 2 + 5 + 2);
+
+  size_t soa_start = offset;
+  munit_assert_int(dns_encode_rr_ttl(buf, sizeof(buf), &offset, "example.com", soa, 60, &ctx), ==, 0);
+  munit_assert_size(offset - soa_start, ==, 2 + 10 + (4 + 2) + (6 + 2) + 20);
+
+  // the records parse back with their names expanded
+  size_t pos = mx_start;
+  dns_rr_header_t header;
+  dns_rr_t *parsed = NULL;
+  munit_assert_int(dns_parse_rr_header(buf, offset, &pos, &header), ==, 0);
+  munit_assert_string_equal(header.name, "example.com");
+  munit_assert_uint32(header.ttl, ==, 60);
+  munit_assert_int(dns_parse_rdata(buf, offset, &header, &parsed), ==, 0);
+  munit_assert_uint16(parsed->rdata.mx.preference, ==, 10);
+  munit_assert_string_equal(parsed->rdata.mx.exchange, "mail.example.com");
+  dns_rr_free(parsed);
+
+  munit_assert_int(dns_parse_rr_header(buf, offset, &pos, &header), ==, 0);
+  munit_assert_int(dns_parse_rdata(buf, offset, &header, &parsed), ==, 0);
+  munit_assert_string_equal(parsed->rdata.soa->mname, "ns1.example.com");
+  munit_assert_string_equal(parsed->rdata.soa->rname, "admin.example.com");
+  munit_assert_uint32(parsed->rdata.soa->minimum, ==, 5);
+  dns_rr_free(parsed);
+
+  dns_rr_free(mx);
+  dns_rr_free(soa);
+  return MUNIT_OK;
+}
+
+static MunitResult test_question_view(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  uint8_t buf[] = {
+    3, 'W', 'w', 'W', 7, 'E', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+    0x00, 0x0F, 0x00, 0x01
+  };
+  size_t offset = 0;
+  dns_question_view_t view;
+  munit_assert_int(dns_parse_question_view(buf, sizeof(buf), &offset, &view), ==, 0);
+  munit_assert_size(offset, ==, sizeof(buf));
+  munit_assert_ptr_equal(view.msg, buf);
+  munit_assert_uint16(view.qname_offset, ==, 0);
+  munit_assert_int(view.name.len, ==, 17);
+  munit_assert_int(view.name.label_count, ==, 3);
+  munit_assert_uint16(view.qtype, ==, DNS_TYPE_MX);
+  munit_assert_uint16(view.qclass, ==, DNS_CLASS_IN);
+
+  // the key is lowercased, the request is left as sent
+  uint8_t len;
+  const uint8_t *label = dns_name_label(&view.name, 1, &len);
+  munit_assert_int(len, ==, 7);
+  munit_assert_memory_equal(len, label, "example");
+  munit_assert_memory_equal(7, buf + 5, "Example");
+
+  dns_question_t question;
+  munit_assert_int(dns_question_view_to_question(&view, &question), ==, 0);
+  munit_assert_string_equal(question.qname, "WwW.Example.com");
+  munit_assert_uint16(question.qtype, ==, DNS_TYPE_MX);
+
+  // the root name has no labels
+  uint8_t root[] = {0, 0x00, 0x02, 0x00, 0x01};
+  offset = 0;
+  munit_assert_int(dns_parse_question_view(root, sizeof(root), &offset, &view), ==, 0);
+  munit_assert_int(view.name.label_count, ==, 0);
+  munit_assert_int(dns_question_view_to_question(&view, &question), ==, 0);
+  munit_assert_string_equal(question.qname, "");
+
+  // pointers, labels with a '.' and short buffers are refused
+  uint8_t pointer[] = {0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01};
+  offset = 0;
+  munit_assert_int(dns_parse_question_view(pointer, sizeof(pointer), &offset, &view), ==, -1);
+
+  uint8_t dot[] = {3, 'a', '.', 'b', 0, 0x00, 0x01, 0x00, 0x01};
+  offset = 0;
+  munit_assert_int(dns_parse_question_view(dot, sizeof(dot), &offset, &view), ==, -1);
+
+  offset = 0;
+  munit_assert_int(dns_parse_question_view(buf, 19, &offset, &view), ==, -1);
+  offset = 0;
+  munit_assert_int(dns_parse_question_view(buf, 10, &offset, &view), ==, -1);
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_parse_message(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  uint8_t buf[512];
+  dns_header_t header = {
+    .id = 7, .qr = DNS_QR_RESPONSE, .qdcount = 1, .ancount = 2, .nscount = 1, .arcount = 1
+  };
+  dns_encode_header(buf, sizeof(buf), &header);
+
+  size_t offset = 12;
+  dns_compress_t ctx;
+  dns_compress_init(&ctx);
+  dns_question_t question = {.qtype = DNS_TYPE_A, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, "www.example.com");
+  dns_encode_question_compressed(buf, sizeof(buf), &offset, &question, &ctx);
+
+  dns_rr_t *cname = dns_rr_create_cname("web.example.com", 300);
+  dns_rr_t *a = dns_rr_create(DNS_TYPE_A, DNS_CLASS_IN, 60);
+  a->rdata.a.address = inet_addr("192.0.2.1");
+  dns_rr_t *soa = dns_rr_create_soa("ns1.example.com", "admin.example.com", 1, 2, 3, 4, 5, 900);
+  munit_assert_int(dns_encode_rr_ttl(buf, sizeof(buf), &offset, "www.example.com", cname, 300, &ctx), ==, 0);
+  munit_assert_int(dns_encode_rr_ttl(buf, sizeof(buf), &offset, "web.example.com", a, 60, &ctx), ==, 0);
+  munit_assert_int(dns_encode_rr_ttl(buf, sizeof(buf), &offset, "example.com", soa, 900, &ctx), ==, 0);
+
+  // an OPT record, kept without decoding
+  const uint8_t opt[] = {0, 0x00, 0x29, 0x10, 0x00, 0, 0, 0, 0, 0x00, 0x02, 0xAB, 0xCD};
+  memcpy(buf + offset, opt, sizeof(opt));
+  offset += sizeof(opt);
+
+  dns_arena_t *arena = dns_arena_create(0);
+  dns_message_t msg;
+  munit_assert_int(dns_parse_message(buf, offset, arena, &msg), ==, 0);
+
+  munit_assert_int(msg.header.id, ==, 7);
+  munit_assert_true(msg.has_question_view);
+  munit_assert_uint16(msg.question_view.qtype, ==, DNS_TYPE_A);
+
+  dns_name_t name;
+  dns_name_from_text(&name, "web.example.com");
+  munit_assert_uint16(msg.answers[0].type, ==, DNS_TYPE_CNAME);
+  munit_assert_string_equal(msg.answers[0].rr->rdata.cname.cname, "web.example.com");
+  munit_assert_true(dns_name_eq(&msg.answers[1].owner, &name));
+  munit_assert_uint32(msg.answers[1].ttl, ==, 60);
+  munit_assert_uint32(msg.answers[1].rr->rdata.a.address, ==, inet_addr("192.0.2.1"));
+
+  munit_assert_uint16(msg.authority[0].type, ==, DNS_TYPE_SOA);
+  munit_assert_string_equal(msg.authority[0].rr->rdata.soa->rname, "admin.example.com");
+  munit_assert_uint32(msg.authority[0].rr->rdata.soa->minimum, ==, 5);
+
+  // OPT has no codec of its own and is kept as opaque rdata
+  munit_assert_uint16(msg.additional[0].type, ==, 41);
+  munit_assert_uint16(msg.additional[0].rr->rdata.opaque.len, ==, 2);
+  munit_assert_uint8(msg.additional[0].rr->rdata.opaque.data[0], ==, 0xAB);
+  munit_assert_uint16(msg.additional[0].rdlength, ==, 2);
+  munit_assert_uint8(buf[msg.additional[0].rdata_offset], ==, 0xAB);
+
+  // cut anywhere inside the records, the parse fails
+  dns_arena_reset(arena);
+  for (size_t cut = 12; cut < offset; ++cut) {
+    munit_assert_int(dns_parse_message(buf, cut, arena, &msg), ==, -1);
+  }
+
+  // a count the packet cannot hold is refused before allocating
+  buf[6] = 0xFF;
+  buf[7] = 0xFF;
+  munit_assert_int(dns_parse_message(buf, offset, arena, &msg), ==, -1);
+
+  dns_arena_destroy(arena);
+  dns_rr_free(cname);
+  dns_rr_free(a);
+  dns_rr_free(soa);
+  return MUNIT_OK;
+}
+
+// question for qname, then the fragment anchored at the tail of qname
+static size_t write_fragment_message(uint8_t *buf, size_t len, const char *qname,
+                                     const dns_fragment_t *fragment) {
+  dns_header_t header = {.id = 1, .qr = DNS_QR_RESPONSE, .qdcount = 1, .ancount = fragment->count};
+  dns_encode_header(buf, len, &header);
+
+  size_t offset = 12;
+  dns_question_t question = {.qtype = DNS_TYPE_MX, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, qname);
+  dns_encode_question(buf, len, &offset, &question);
+
+  size_t qname_len = offset - 4 - 12;
+  munit_assert_int(dns_fragment_write(buf, len, &offset, fragment,
+                                      12 + qname_len - fragment->anchor_len), ==, 0);
+  return offset;
+}
+
+static MunitResult test_fragment(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_rrset_t *rrset = dns_rrset_create(DNS_TYPE_MX, 300);
+  dns_rrset_add(rrset, dns_rr_create_mx(10, "mail.example.com", 300));
+  dns_rrset_add(rrset, dns_rr_create_mx(20, "mail.example.com", 300));
+
+  dns_name_t anchor;
+  dns_name_from_text(&anchor, "Example.com");
+  dns_fragment_t *fragment = dns_fragment_build(&anchor, 4, rrset, 300);
+  munit_assert_not_null(fragment);
+  munit_assert_int(fragment->count, ==, 2);
+  munit_assert_int(fragment->base, ==, 12 + 13 + 4);
+
+  // two owners, "mail" + apex and a pointer to the first exchange
+  munit_assert_int(fragment->reloc_count, ==, 4);
+
+  // where it was encoded for, and behind a longer name that moves everything
+  const char *qnames[] = {"EXAMPLE.com", "www.example.com"};
+  for (int i = 0; i < 2; ++i) {
+    uint8_t buf[512];
+    size_t len = write_fragment_message(buf, sizeof(buf), qnames[i], fragment);
+
+    dns_arena_t *arena = dns_arena_create(0);
+    dns_message_t msg;
+    munit_assert_int(dns_parse_message(buf, len, arena, &msg), ==, 0);
+    munit_assert_true(dns_name_eq(&msg.answers[0].owner, &anchor));
+    munit_assert_true(dns_name_eq(&msg.answers[1].owner, &anchor));
+    munit_assert_int(msg.answers[0].rr->rdata.mx.preference + msg.answers[1].rr->rdata.mx.preference, ==, 30);
+
+    // the apex is the question's, so is its case
+    munit_assert_int(strcasecmp(msg.answers[0].rr->rdata.mx.exchange, "mail.example.com"), ==, 0);
+    munit_assert_int(strcasecmp(msg.answers[1].rr->rdata.mx.exchange, "mail.example.com"), ==, 0);
+    dns_arena_destroy(arena);
+  }
+
+  uint8_t small[40];
+  size_t offset = 12 + 13 + 4;
+  munit_assert_int(dns_fragment_write(small, sizeof(small), &offset, fragment, 12), ==, -1);
+  munit_assert_size(offset, ==, 12 + 13 + 4);
+
+  dns_fragment_free(fragment);
+  dns_rrset_free(rrset);
+  return MUNIT_OK;
+}
+
+static MunitResult test_rdata_round_trip(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  // a TXT longer than one character-string
+  char long_text[300];
+  memset(long_text, 't', sizeof(long_text) - 1);
+  long_text[sizeof(long_text) - 1] = '\0';
+
+  const char *spf[] = {"v=spf1", "include:x", ""};
+
+  const uint8_t caa_value[] = "letsencrypt.org";
+  const uint8_t opaque[] = {0xDE, 0xAD, 0xBE, 0xEF};
+  dns_rr_t *records[] = {
+    dns_rr_create_mx(10, "mail.example.com", 300),
+    dns_rr_create_txt(long_text, 300),
+    dns_rr_create_txt("", 300),
+    dns_rr_create_txt_strings(spf, 3, 300),
+    dns_rr_create_ptr("host.example.com", 300),
+    dns_rr_create_srv(1, 5, 5060, "sip.example.com", 300),
+    dns_rr_create_caa(128, "issue", caa_value, sizeof(caa_value) - 1, 300),
+    dns_rr_create_opaque(99, opaque, sizeof(opaque), 300),
+  };
+  const int count = (int)(sizeof(records) / sizeof(records[0]));
+
+  uint8_t buf[1024];
+  size_t offset = 0;
+  dns_compress_t ctx;
+  dns_compress_init(&ctx);
+  for (int i = 0; i < count; ++i) {
+    munit_assert_not_null(records[i]);
+    munit_assert_int(dns_encode_rr_ttl(buf, sizeof(buf), &offset, "example.com", records[i], 60, &ctx), ==, 0);
+  }
+
+  size_t pos = 0;
+  for (int i = 0; i < count; ++i) {
+    dns_rr_header_t header;
+    dns_rr_t *parsed = NULL;
+    munit_assert_int(dns_parse_rr_header(buf, offset, &pos, &header), ==, 0);
+    munit_assert_int(dns_parse_rdata(buf, offset, &header, &parsed), ==, 0);
+    munit_assert_uint16(parsed->type, ==, records[i]->type);
+    munit_assert_true(dns_rr_rdata_equal(parsed, records[i]));
+
+    // the size op bounds what went out, and is exact without compression
+    munit_assert_size(dns_rdata_size(records[i]), >=, header.rdlength);
+    if (parsed->type != DNS_TYPE_MX && parsed->type != DNS_TYPE_PTR) {
+      munit_assert_size(dns_rdata_size(parsed), ==, header.rdlength);
+    }
+
+    // the SRV target is never a pointer, even with example.com in the table
+    if (parsed->type == DNS_TYPE_SRV) munit_assert_uint16(header.rdlength, ==, 6 + 17);
+
+    // clones move their pointers over
+    dns_rr_t *clone = dns_rr_clone(parsed);
+    dns_rr_free(parsed);
+    munit_assert_true(dns_rr_rdata_equal(clone, records[i]));
+    dns_rr_free(clone);
+  }
+  munit_assert_size(pos, ==, offset);
+
+  for (int i = 0; i < count; ++i) dns_rr_free(records[i]);
+  return MUNIT_OK;
+}
+
+static MunitResult test_rdata_from_text(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  munit_assert_uint16(dns_rdata_type_from_text("srv"), ==, DNS_TYPE_SRV);
+  munit_assert_uint16(dns_rdata_type_from_text("TYPE65"), ==, 65);
+  munit_assert_uint16(dns_rdata_type_from_text("TYPE"), ==, 0);
+  munit_assert_uint16(dns_rdata_type_from_text("TYPE70000"), ==, 0);
+  munit_assert_uint16(dns_rdata_type_from_text("BOGUS"), ==, 0);
+
+  char type_buf[16];
+  munit_assert_string_equal(dns_rdata_type_to_text(DNS_TYPE_CAA, type_buf, sizeof(type_buf)), "CAA");
+  munit_assert_string_equal(dns_rdata_type_to_text(65, type_buf, sizeof(type_buf)), "TYPE65");
+
+  dns_rr_t *srv = dns_rdata_ops(DNS_TYPE_SRV)->from_text(DNS_TYPE_SRV, "0 5 443 web.example.com", 60);
+  munit_assert_not_null(srv);
+  munit_assert_uint16(srv->rdata.srv.weight, ==, 5);
+  munit_assert_uint16(srv->rdata.srv.port, ==, 443);
+  munit_assert_string_equal(srv->rdata.srv.target, "web.example.com");
+  dns_rr_free(srv);
+
+  dns_rr_t *caa = dns_rdata_ops(DNS_TYPE_CAA)->from_text(DNS_TYPE_CAA, "0 issue \"ca.example.net\"", 60);
+  munit_assert_not_null(caa);
+  munit_assert_string_equal(caa->rdata.caa.tag, "issue");
+  munit_assert_uint16(caa->rdata.caa.value_len, ==, 14);
+  munit_assert_memory_equal(14, dns_caa_value(caa), "ca.example.net");
+  dns_rr_free(caa);
+
+  // RFC 3597 generic rdata for a type without a codec
+  dns_rr_t *opaque = dns_rdata_ops(65)->from_text(65, "\\# 3 0a0B 0c", 60);
+  munit_assert_not_null(opaque);
+  munit_assert_uint16(opaque->type, ==, 65);
+  munit_assert_uint16(opaque->rdata.opaque.len, ==, 3);
+  munit_assert_memory_equal(3, opaque->rdata.opaque.data, "\x0a\x0b\x0c");
+  dns_rr_free(opaque);
+
+  // quoted strings keep their spaces, each token is a string of its own
+  dns_rr_t *txt = dns_rdata_ops(DNS_TYPE_TXT)->from_text(DNS_TYPE_TXT,
+                                                         "\"v=spf1 a\" include:x \"q\\\"\\065\" \"\"", 60);
+  munit_assert_not_null(txt);
+  munit_assert_uint16(txt->rdata.txt.length, ==, 1 + 8 + 1 + 9 + 1 + 3 + 1);
+  munit_assert_memory_equal(txt->rdata.txt.length, txt->rdata.txt.strings,
+                            "\x08v=spf1 a\x09include:x\x03q\"A\x00");
+  dns_rr_free(txt);
+
+  munit_assert_null(dns_rdata_ops(DNS_TYPE_TXT)->from_text(DNS_TYPE_TXT, "\"open", 60));
+  munit_assert_null(dns_rdata_ops(DNS_TYPE_TXT)->from_text(DNS_TYPE_TXT, "\\256", 60));
+  munit_assert_null(dns_rdata_ops(65)->from_text(65, "\\# 2 0a", 60));
+  munit_assert_null(dns_rdata_ops(65)->from_text(65, "0a0b", 60));
+  munit_assert_null(dns_rdata_ops(DNS_TYPE_SRV)->from_text(DNS_TYPE_SRV, "0 5 web.example.com", 60));
+  munit_assert_null(dns_rdata_ops(DNS_TYPE_CAA)->from_text(DNS_TYPE_CAA, "256 issue x", 60));
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_edns(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  // question, one answer to skip, then the OPT in the additional section
+  uint8_t buf[128];
+  dns_header_t header = {.id = 1, .qdcount = 1, .ancount = 1, .arcount = 1};
+  dns_encode_header(buf, sizeof(buf), &header);
+  size_t offset = 12;
+  dns_question_t question = {.qtype = DNS_TYPE_A, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, "example.com");
+  dns_encode_question(buf, sizeof(buf), &offset, &question);
+  size_t question_end = offset;
+
+  dns_rr_t *a = dns_rr_create_a_str("192.0.2.1", 60);
+  munit_assert_int(dns_encode_rr(buf, sizeof(buf), &offset, "example.com", a), ==, 0);
+  dns_rr_free(a);
+
+  size_t opt_start = offset;
+  munit_assert_int(dns_encode_opt(buf, sizeof(buf), &offset, 1400), ==, 0);
+  munit_assert_size(offset - opt_start, ==, DNS_OPT_RR_LEN);
+  buf[opt_start + 7] = 0x80; // DO
+
+  dns_edns_t edns;
+  munit_assert_int(dns_parse_edns(buf, offset, question_end, &header, &edns), ==, 0);
+  munit_assert_true(edns.present);
+  munit_assert_true(edns.dnssec_ok);
+  munit_assert_uint16(edns.udp_size, ==, 1400);
+  munit_assert_uint8(edns.version, ==, 0);
+
+  // the whole-message parse agrees
+  dns_arena_t *arena = dns_arena_create(0);
+  dns_message_t msg;
+  munit_assert_int(dns_parse_message(buf, offset, arena, &msg), ==, 0);
+  munit_assert_true(msg.edns.present);
+  munit_assert_uint16(msg.edns.udp_size, ==, 1400);
+  dns_arena_destroy(arena);
+
+  // without it, and cut short
+  header.arcount = 0;
+  munit_assert_int(dns_parse_edns(buf, opt_start, question_end, &header, &edns), ==, 0);
+  munit_assert_false(edns.present);
+  header.arcount = 1;
+  munit_assert_int(dns_parse_edns(buf, offset - 1, question_end, &header, &edns), ==, -1);
+
+  return MUNIT_OK;
+}
+
 static MunitTest tests[] = {
   {"/header_encoding", test_header_encoding, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/name_encoding", test_name_encoding, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
@@ -694,6 +1162,14 @@ static MunitTest tests[] = {
   {"/name_too_long", test_name_too_long, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/encode_name_boundary", test_encode_name_boundary, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/encode_buffer_too_small", test_encode_buffer_too_small, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/name_compression", test_name_compression, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/rdata_compression", test_rdata_compression, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/question_view", test_question_view, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/parse_message", test_parse_message, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/fragment", test_fragment, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/rdata_round_trip", test_rdata_round_trip, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/rdata_from_text", test_rdata_from_text, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/edns", test_edns, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
 
   {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
 };
@@ -0,0 +1,60 @@
+#ifndef TEST_DNS_QUERY_H
+#define TEST_DNS_QUERY_H
+
+
+#include "munit.h"
+#include "dns_server.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+
+
+// one query as a client would send it, fields left at zero are a plain
+// A question with no OPT and no client address
+typedef struct {
+  const char *qname;
+  uint16_t qtype;     // A when 0
+  uint16_t id;
+  uint8_t opcode;
+  bool rd;
+  uint16_t udp_size;  // 0 sends no OPT
+  const char *client; // IPv4 address the query came from
+  uint16_t port;
+} test_query_t;
+
+// runs the query through dns_process_query, the caller frees the response
+static inline dns_response_t *send_query_with(dns_server_t *server, const test_query_t *query) {
+  uint8_t buf[512];
+  dns_header_t header = {
+    .id = query->id, .qr = DNS_QR_QUERY, .opcode = query->opcode, .rd = query->rd,
+    .qdcount = 1, .arcount = query->udp_size ? 1 : 0
+  };
+  dns_encode_header(buf, sizeof(buf), &header);
+
+  size_t offset = 12;
+  dns_question_t question = {.qtype = query->qtype ? query->qtype : DNS_TYPE_A, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, query->qname);
+  dns_encode_question(buf, sizeof(buf), &offset, &question);
+  if (query->udp_size) dns_encode_opt(buf, sizeof(buf), &offset, query->udp_size);
+
+  dns_request_t request = {.buffer = buf, .length = offset};
+  if (query->client) {
+    struct sockaddr_in *client = (struct sockaddr_in *)&request.client_addr;
+    client->sin_family = AF_INET;
+    client->sin_port = htons(query->port);
+    inet_pton(AF_INET, query->client, &client->sin_addr);
+    request.client_addr_len = sizeof(*client);
+  }
+
+  dns_response_t *response = dns_response_create(DNS_BUFFER_SIZE);
+  munit_assert_not_null(response);
+  munit_assert_int(dns_process_query(server, &request, response, NULL), ==, 0);
+  return response;
+}
+
+static inline dns_response_t *send_query(dns_server_t *server, const char *qname, uint16_t qtype) {
+  return send_query_with(server, &(test_query_t){.qname = qname, .qtype = qtype, .id = 0x0101});
+}
+
+
+#endif // TEST_DNS_QUERY_H
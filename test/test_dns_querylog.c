@@ -0,0 +1,264 @@
+#include "munit.h"
+#include "dns_querylog.h"
+#include "dns_server.h"
+#include "test_dns_query.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static void temp_path(char *path, size_t len) {
+  char name[] = "/tmp/dns_querylog_XXXXXX";
+  int fd = mkstemp(name);
+  munit_assert_int(fd, >=, 0);
+  close(fd);
+  unlink(name); // the log writes the magic only into a file it creates empty
+  snprintf(path, len, "%s", name);
+}
+
+// every record of a file, -1 when it is not a whole query log
+static int read_records(const char *path, dns_querylog_record_t *records, int max) {
+  FILE *file = fopen(path, "rb");
+  if (!file) return -1;
+
+  static uint8_t buf[1 << 20];
+  size_t length = fread(buf, 1, sizeof(buf), file);
+  fclose(file);
+  if (length < DNS_QUERYLOG_MAGIC_SIZE || memcmp(buf, DNS_QUERYLOG_MAGIC, DNS_QUERYLOG_MAGIC_SIZE)) {
+    return -1;
+  }
+
+  int count = 0;
+  size_t offset = DNS_QUERYLOG_MAGIC_SIZE;
+  dns_querylog_record_t record;
+  size_t used;
+  while ((used = dns_querylog_decode(buf + offset, length - offset, &record)) > 0) {
+    if (count < max) records[count] = record;
+    ++count;
+    offset += used;
+  }
+  return offset == length ? count : -1;
+}
+
+static MunitResult test_encode_decode(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_querylog_record_t record = {
+    .time_ns = 1760000000123456789ull,
+    .latency_ns = 4242,
+    .family = 4,
+    .outcome = DNS_OUTCOME_CACHE_HIT,
+    .port = 53000,
+    .id = 0xBEEF,
+    .query_flags = 0x0100,
+    .response_flags = 0x8583,
+    .response_size = 97,
+    .qtype = DNS_TYPE_AAAA,
+    .qclass = DNS_CLASS_IN,
+    .qname_length = 13,
+    .qname = "\x07" "example" "\x03" "com",
+  };
+  inet_pton(AF_INET, "192.0.2.7", record.address);
+
+  uint8_t buf[DNS_QUERYLOG_RECORD_MAX];
+  size_t length = dns_querylog_encode(&record, buf, sizeof(buf));
+  munit_assert_size(length, ==, DNS_QUERYLOG_HEADER_SIZE + 13);
+  munit_assert_uint8(buf[0], ==, 0); // big endian length
+  munit_assert_uint8(buf[1], ==, length);
+  munit_assert_size(dns_querylog_encode(&record, buf, length - 1), ==, 0);
+
+  dns_querylog_record_t decoded;
+  memset(&decoded, 0xAA, sizeof(decoded));
+  munit_assert_size(dns_querylog_decode(buf, length, &decoded), ==, length);
+  munit_assert_uint64(decoded.time_ns, ==, record.time_ns);
+  munit_assert_uint32(decoded.latency_ns, ==, 4242);
+  munit_assert_memory_equal(4, decoded.address, record.address);
+  munit_assert_uint16(decoded.port, ==, 53000);
+  munit_assert_uint16(decoded.id, ==, 0xBEEF);
+  munit_assert_uint16(decoded.response_flags, ==, 0x8583);
+  munit_assert_uint16(decoded.qtype, ==, DNS_TYPE_AAAA);
+  munit_assert_uint8(decoded.qname_length, ==, 13);
+  munit_assert_memory_equal(13, decoded.qname, record.qname);
+
+  // a cut record is not a record
+  munit_assert_size(dns_querylog_decode(buf, length - 1, &decoded), ==, 0);
+  buf[46] = 12;
+  munit_assert_size(dns_querylog_decode(buf, length, &decoded), ==, 0);
+
+  return MUNIT_OK;
+}
+
+static MunitResult test_append(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char path[64];
+  temp_path(path, sizeof(path));
+  dns_querylog_t *log = dns_querylog_create(path, 1, 0, 0);
+  munit_assert_not_null(log);
+
+  dns_querylog_record_t record = {.qname_length = 1};
+  for (int i = 0; i < 1000; ++i) {
+    record.id = (uint16_t)i;
+    munit_assert_true(dns_querylog_append(log, &record));
+  }
+  dns_querylog_flush(log);
+
+  static dns_querylog_record_t records[1000];
+  munit_assert_int(read_records(path, records, 1000), ==, 1000);
+  munit_assert_uint16(records[999].id, ==, 999);
+
+  // more than a ring holds at once, whatever is not written is counted
+  size_t burst = 2 * DNS_QUERYLOG_RING_SIZE / DNS_QUERYLOG_HEADER_SIZE;
+  for (size_t i = 0; i < burst; ++i) dns_querylog_append(log, &record);
+  uint64_t dropped = atomic_load(&log->dropped);
+  dns_querylog_free(log);
+
+  int count = read_records(path, NULL, 0);
+  munit_assert_int(count, >, 1000);
+  munit_assert_uint64(1000 + burst, ==, (uint64_t)count + dropped);
+
+  unlink(path);
+  return MUNIT_OK;
+}
+
+static MunitResult test_rotation(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char path[64];
+  temp_path(path, sizeof(path));
+  dns_querylog_t *log = dns_querylog_create(path, 1, 4096, 2);
+  munit_assert_not_null(log);
+
+  // each batch is flushed, so every file ends up a little over 4096 bytes
+  dns_querylog_record_t record = {.qname_length = 1};
+  for (int batch = 0; batch < 5; ++batch) {
+    for (int i = 0; i < 100; ++i) dns_querylog_append(log, &record);
+    dns_querylog_flush(log);
+  }
+  dns_querylog_free(log);
+
+  char rotated[96];
+  for (int i = 1; i <= 2; ++i) {
+    snprintf(rotated, sizeof(rotated), "%s.%d", path, i);
+    munit_assert_int(read_records(rotated, NULL, 0), >, 0);
+    unlink(rotated);
+  }
+  snprintf(rotated, sizeof(rotated), "%s.3", path);
+  munit_assert_int(access(rotated, F_OK), ==, -1);
+
+  munit_assert_int(read_records(path, NULL, 0), >=, 0);
+  unlink(path);
+  return MUNIT_OK;
+}
+
+static MunitResult test_write_error(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char path[64];
+  temp_path(path, sizeof(path));
+  dns_querylog_t *log = dns_querylog_create(path, 1, 0, 0);
+  munit_assert_not_null(log);
+
+  dns_querylog_record_t record = {.qname_length = 1};
+  for (int i = 0; i < 10; ++i) dns_querylog_append(log, &record);
+  dns_querylog_flush(log);
+
+  // a full disk under the open log, what it refuses is dropped
+  int full = open("/dev/full", O_WRONLY);
+  if (full < 0) {
+    dns_querylog_free(log);
+    unlink(path);
+    return MUNIT_SKIP;
+  }
+  munit_assert_int(dup2(full, log->fd), ==, log->fd);
+  close(full);
+
+  for (int i = 0; i < 5; ++i) dns_querylog_append(log, &record);
+  dns_querylog_flush(log);
+  munit_assert_uint64(atomic_load(&log->records), ==, 10);
+  munit_assert_uint64(atomic_load(&log->dropped), ==, 5);
+
+  // the next records open the file again
+  for (int i = 0; i < 3; ++i) dns_querylog_append(log, &record);
+  dns_querylog_flush(log);
+  munit_assert_uint64(atomic_load(&log->records), ==, 13);
+  munit_assert_uint64(atomic_load(&log->dropped), ==, 5);
+  dns_querylog_free(log);
+
+  munit_assert_int(read_records(path, NULL, 0), ==, 13);
+  unlink(path);
+  return MUNIT_OK;
+}
+
+static MunitResult test_server(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char path[64];
+  temp_path(path, sizeof(path));
+
+  dns_server_t *server = dns_server_create(5353);
+  server->enable_recursion = false;
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.1", 300);
+  server->querylog = dns_querylog_create(path, 2, 0, 0);
+  munit_assert_not_null(server->querylog);
+
+  // one in two, starting with the first
+  test_query_t query = {.qname = "www.example.com", .rd = true, .client = "198.51.100.9", .port = 40000};
+  for (query.id = 1; query.id <= 4; ++query.id) dns_response_free(send_query_with(server, &query));
+  query.qname = "missing.example.com";
+  dns_response_free(send_query_with(server, &query));
+  dns_querylog_flush(server->querylog);
+
+  dns_querylog_record_t records[4];
+  munit_assert_int(read_records(path, records, 4), ==, 3);
+
+  munit_assert_uint16(records[0].id, ==, 1);
+  munit_assert_uint8(records[0].family, ==, 4);
+  munit_assert_uint16(records[0].port, ==, 40000);
+  uint8_t client[4];
+  inet_pton(AF_INET, "198.51.100.9", client);
+  munit_assert_memory_equal(4, records[0].address, client);
+  munit_assert_uint16(records[0].qtype, ==, DNS_TYPE_A);
+  munit_assert_uint8(records[0].qname_length, ==, 17);
+  munit_assert_memory_equal(17, records[0].qname, "\x03www\x07" "example\x03" "com");
+  munit_assert_true(records[0].query_flags & 0x0100);
+  munit_assert_true(records[0].response_flags & 0x8000);
+  munit_assert_uint8(records[0].response_flags & 0x0F, ==, DNS_RCODE_NOERROR);
+  munit_assert_uint16(records[0].response_size, >, 12);
+  munit_assert_uint8(records[0].outcome, ==, DNS_OUTCOME_AUTHORITATIVE);
+  munit_assert_uint64(records[0].time_ns, >, 0);
+
+  munit_assert_uint16(records[1].id, ==, 3);
+  munit_assert_uint16(records[2].id, ==, 5);
+  munit_assert_uint8(records[2].response_flags & 0x0F, ==, DNS_RCODE_NXDOMAIN);
+
+  dns_server_free(server);
+  unlink(path);
+  return MUNIT_OK;
+}
+
+
+static MunitTest tests[] = {
+  {"/encode_decode", test_encode_decode, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/append", test_append, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/rotation", test_rotation, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/write_error", test_write_error, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/server", test_server, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+
+  {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
+};
+
+static const MunitSuite suite = {"/querylog", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  return munit_suite_main(&suite, NULL, argc, argv);
+}
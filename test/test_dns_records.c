@@ -2,6 +2,7 @@
 #include "dns_records.h"
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <stdio.h>
 #include <string.h>
 
 
@@ -135,9 +136,43 @@ static MunitResult test_rr_create_txt(const MunitParameter params[], void *data)
   dns_rr_t *rr = dns_rr_create_txt("v=spf1 include:example.com ~all", 3600);
   munit_assert_not_null(rr);
   munit_assert_int(rr->type, ==, DNS_TYPE_TXT);
-  munit_assert_string_equal(rr->rdata.txt.text, "v=spf1 include:example.com ~all");
-  munit_assert_size(rr->rdata.txt.length, ==, strlen("v=spf1 include:example.com ~all"));
-
+  munit_assert_uint16(rr->rdata.txt.length, ==, 1 + strlen("v=spf1 include:example.com ~all"));
+
+  size_t pos = 0;
+  const uint8_t *string;
+  uint8_t len;
+  munit_assert_true(dns_txt_next(rr, &pos, &string, &len));
+  munit_assert_uint8(len, ==, strlen("v=spf1 include:example.com ~all"));
+  munit_assert_memory_equal(len, string, "v=spf1 include:example.com ~all");
+  munit_assert_false(dns_txt_next(rr, &pos, &string, &len));
+
+  // separate strings stay separate, "a" "b" is not "ab"
+  const char *split[] = {"v=spf1", "include:x"};
+  dns_rr_t *strings = dns_rr_create_txt_strings(split, 2, 3600);
+  munit_assert_not_null(strings);
+  munit_assert_uint16(strings->rdata.txt.length, ==, 1 + 6 + 1 + 9);
+  pos = 0;
+  for (int i = 0; i < 2; ++i) {
+    munit_assert_true(dns_txt_next(strings, &pos, &string, &len));
+    munit_assert_uint8(len, ==, strlen(split[i]));
+    munit_assert_memory_equal(len, string, split[i]);
+  }
+  munit_assert_false(dns_txt_next(strings, &pos, &string, &len));
+
+  const char *ab[] = {"a", "b"};
+  dns_rr_t *two = dns_rr_create_txt_strings(ab, 2, 3600);
+  dns_rr_t *one = dns_rr_create_txt("ab", 3600);
+  munit_assert_false(dns_rr_rdata_equal(two, one));
+
+  char long_string[257];
+  memset(long_string, 'x', 256);
+  long_string[256] = '\0';
+  const char *too_long[] = {long_string};
+  munit_assert_null(dns_rr_create_txt_strings(too_long, 1, 3600));
+
+  dns_rr_free(two);
+  dns_rr_free(one);
+  dns_rr_free(strings);
   dns_rr_free(rr);
   return MUNIT_OK;
 }
@@ -159,18 +194,57 @@ static MunitResult test_rr_create_soa(const MunitParameter params[], void *data)
 
   munit_assert_not_null(rr);
   munit_assert_int(rr->type, ==, DNS_TYPE_SOA);
-  munit_assert_string_equal(rr->rdata.soa.mname, "ns1.example.com");
-  munit_assert_string_equal(rr->rdata.soa.rname, "admin.example.com");
-  munit_assert_uint32(rr->rdata.soa.serial, ==, 2024010101);
-  munit_assert_uint32(rr->rdata.soa.refresh, ==, 7200);
-  munit_assert_uint32(rr->rdata.soa.retry, ==, 3600);
-  munit_assert_uint32(rr->rdata.soa.expire, ==, 604800);
-  munit_assert_uint32(rr->rdata.soa.minimum, ==, 86400);
+  munit_assert_string_equal(rr->rdata.soa->mname, "ns1.example.com");
+  munit_assert_string_equal(rr->rdata.soa->rname, "admin.example.com");
+  munit_assert_uint32(rr->rdata.soa->serial, ==, 2024010101);
+  munit_assert_uint32(rr->rdata.soa->refresh, ==, 7200);
+  munit_assert_uint32(rr->rdata.soa->retry, ==, 3600);
+  munit_assert_uint32(rr->rdata.soa->expire, ==, 604800);
+  munit_assert_uint32(rr->rdata.soa->minimum, ==, 86400);
 
   dns_rr_free(rr);
   return MUNIT_OK;
 }
 
+static MunitResult test_rr_clone(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  // names are stored at their length, not in fixed buffers
+  dns_rr_t *mx = dns_rr_create_mx(10, "mail.example.com", 3600);
+  munit_assert_size(mx->data_len, ==, strlen("mail.example.com") + 1);
+
+  dns_rr_t *soa = dns_rr_create_soa("ns1.example.com", "admin.example.com",
+                                    2024010101, 7200, 3600, 604800, 86400, 3600);
+  dns_rr_t *txt = dns_rr_create_txt("hello world", 300);
+
+  // clones own their data, pointers must not alias the source
+  dns_rr_t *mx_copy = dns_rr_clone(mx);
+  dns_rr_t *soa_copy = dns_rr_clone(soa);
+  dns_rr_t *txt_copy = dns_rr_clone(txt);
+  dns_rr_free(mx);
+  dns_rr_free(soa);
+  dns_rr_free(txt);
+
+  munit_assert_ptr_equal(mx_copy->rdata.mx.exchange, mx_copy->data);
+  munit_assert_string_equal(mx_copy->rdata.mx.exchange, "mail.example.com");
+  munit_assert_int(mx_copy->rdata.mx.preference, ==, 10);
+
+  munit_assert_ptr_equal(soa_copy->rdata.soa, (dns_soa_rdata_t *) soa_copy->data);
+  munit_assert_string_equal(soa_copy->rdata.soa->mname, "ns1.example.com");
+  munit_assert_string_equal(soa_copy->rdata.soa->rname, "admin.example.com");
+  munit_assert_uint32(soa_copy->rdata.soa->serial, ==, 2024010101);
+
+  munit_assert_ptr_equal(txt_copy->rdata.txt.strings, (const uint8_t *) txt_copy->data);
+  munit_assert_uint16(txt_copy->rdata.txt.length, ==, 12);
+  munit_assert_memory_equal(12, txt_copy->rdata.txt.strings, "\x0bhello world");
+  munit_assert_null(txt_copy->next);
+
+  dns_rr_free(mx_copy);
+  dns_rr_free(soa_copy);
+  dns_rr_free(txt_copy);
+  return MUNIT_OK;
+}
 
 static MunitResult test_rrset_add(const MunitParameter params[], void *data) {
   (void)params;
@@ -203,6 +277,88 @@ static MunitResult test_rrset_add(const MunitParameter params[], void *data) {
   return MUNIT_OK;
 }
 
+// walks the set in rotated order, returns the record count seen
+static size_t rrset_walk(const dns_rrset_t *rrset, uint32_t *addresses) {
+  size_t n = 0;
+  const dns_rr_t *first = dns_rrset_first(rrset);
+  for (const dns_rr_t *rr = first; rr; rr = dns_rrset_next(rrset, first, rr)) {
+    addresses[n++] = rr->rdata.a.address;
+  }
+  return n;
+}
+
+static MunitResult test_rrset_order(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_rrset_t *rrset = dns_rrset_create(DNS_TYPE_A, 300);
+  for (uint32_t i = 1; i <= 3; ++i) {
+    munit_assert_true(dns_rrset_add(rrset, dns_rr_create_a(i, 300)));
+  }
+  const dns_rr_t *head = rrset->records;
+
+  // fixed is the list as stored, every time
+  uint32_t seen[3];
+  for (int i = 0; i < 2; ++i) {
+    munit_assert_size(rrset_walk(rrset, seen), ==, 3);
+    munit_assert_uint32(seen[0], ==, 3);
+    munit_assert_uint32(seen[1], ==, 2);
+    munit_assert_uint32(seen[2], ==, 1);
+  }
+
+  // cyclic moves the start on by one and wraps, the rest keep their order
+  rrset->order = DNS_RRSET_ORDER_CYCLIC;
+  const uint32_t cyclic[4][3] = {{3, 2, 1}, {2, 1, 3}, {1, 3, 2}, {3, 2, 1}};
+  for (int i = 0; i < 4; ++i) {
+    munit_assert_size(rrset_walk(rrset, seen), ==, 3);
+    munit_assert_memory_equal(sizeof(seen), seen, cyclic[i]);
+  }
+  munit_assert_ptr_equal(rrset->records, head);
+
+  // random still gives every record once
+  rrset->order = DNS_RRSET_ORDER_RANDOM;
+  for (int i = 0; i < 16; ++i) {
+    munit_assert_size(rrset_walk(rrset, seen), ==, 3);
+    munit_assert_uint32(seen[0] + seen[1] + seen[2], ==, 6);
+  }
+
+  // a copy keeps the order
+  dns_rrset_t *copy = dns_rrset_copy(rrset);
+  munit_assert_int(copy->order, ==, DNS_RRSET_ORDER_RANDOM);
+  dns_rrset_free(copy);
+
+  dns_rrset_order_t order;
+  munit_assert_int(dns_rrset_order_from_text("cyclic", &order), ==, 0);
+  munit_assert_int(order, ==, DNS_RRSET_ORDER_CYCLIC);
+  munit_assert_int(dns_rrset_order_from_text("round-robin", &order), ==, -1);
+
+  // per name rules, the type one wins over the one for every type
+  dns_rrset_order_policy_t policy = {.fallback = DNS_RRSET_ORDER_RANDOM};
+  munit_assert_int(dns_rrset_order_policy_add(&policy, "Pool.Example.com.", 0, DNS_RRSET_ORDER_FIXED), ==, 0);
+  munit_assert_int(dns_rrset_order_policy_add(&policy, "pool.example.com", DNS_TYPE_A, DNS_RRSET_ORDER_FIXED), ==, 0);
+  munit_assert_int(dns_rrset_order_policy_add(&policy, "pool.example.com", DNS_TYPE_A, DNS_RRSET_ORDER_CYCLIC), ==, 0);
+  munit_assert_int(policy.rule_count, ==, 2);
+  munit_assert_int(dns_rrset_order_policy_lookup(&policy, "pool.example.com", DNS_TYPE_A), ==, DNS_RRSET_ORDER_CYCLIC);
+  munit_assert_int(dns_rrset_order_policy_lookup(&policy, "POOL.example.com", DNS_TYPE_MX), ==, DNS_RRSET_ORDER_FIXED);
+  munit_assert_int(dns_rrset_order_policy_lookup(&policy, "www.example.com", DNS_TYPE_A), ==, DNS_RRSET_ORDER_RANDOM);
+
+  char name[32];
+  for (int i = policy.rule_count; i < DNS_RRSET_ORDER_RULES; ++i) {
+    snprintf(name, sizeof(name), "host%d.example.com", i);
+    munit_assert_int(dns_rrset_order_policy_add(&policy, name, 0, DNS_RRSET_ORDER_CYCLIC), ==, 0);
+  }
+  munit_assert_int(dns_rrset_order_policy_add(&policy, "one.too.many", 0, DNS_RRSET_ORDER_CYCLIC), ==, -1);
+
+  // an empty set has nothing to start at
+  dns_rrset_t *empty = dns_rrset_create(DNS_TYPE_A, 300);
+  empty->order = DNS_RRSET_ORDER_CYCLIC;
+  munit_assert_null(dns_rrset_first(empty));
+  dns_rrset_free(empty);
+
+  dns_rrset_free(rrset);
+  return MUNIT_OK;
+}
+
 static MunitResult test_domain_normalization(const MunitParameter params[], void *data) {
   (void)params;
   (void)data;
@@ -345,7 +501,9 @@ static MunitTest tests[] = {
   {"/rr_create_mx", test_rr_create_mx, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/rr_create_txt", test_rr_create_txt, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/rr_create_soa", test_rr_create_soa, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/rr_clone", test_rr_clone, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/rrset_add", test_rrset_add, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/rrset_order", test_rrset_order, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/domain_normalization", test_domain_normalization, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/is_subdomain", test_is_subdomain, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/null_pointer_safety", test_null_pointer_safety, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
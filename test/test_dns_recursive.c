@@ -13,7 +13,7 @@ static MunitResult test_recursive_resolver_create(const MunitParameter params[],
   munit_assert_not_null(resolver);
   munit_assert_int(resolver->socket_fd, ==, -1);
   munit_assert_int(resolver->next_query_id, ==, 1);
-  munit_assert_int(resolver->recursive_queries, ==, 0);
+  munit_assert_int(dns_stats_get(resolver->stats, DNS_STAT_RECURSIVE_QUERIES), ==, 0);
 
   dns_recursive_free(resolver);
   return MUNIT_OK;
@@ -217,14 +217,53 @@ static MunitResult test_authority_parsing(const MunitParameter params[], void *d
     0x03, 'n', 'e', 't', 0x00
   };
 
+  dns_arena_t *arena = dns_arena_create(DNS_RECURSIVE_ARENA_CHUNK);
+  dns_message_t msg;
+  munit_assert_int(dns_parse_message(mock_response, sizeof(mock_response), arena, &msg), ==, 0);
+
   dns_upstream_list_t servers = {0};
 
-  int result = dns_extract_nameservers_from_authority(mock_response, sizeof(mock_response), &servers);
+  int result = dns_recursive_extract_nameservers(&msg, &servers);
 
   // should extract or provide fallback servers with no A records in additional section
   munit_assert_int(result, >, 0);
   munit_assert_int(servers.server_count, >=, 2);
 
+  dns_arena_destroy(arena);
+  return MUNIT_OK;
+}
+
+static MunitResult test_authority_glue(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  uint8_t response[] = {
+    0x00, 0x01, 0x81, 0x80,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01,
+
+    // question: example.com A IN
+    0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00,
+    0x00, 0x01, 0x00, 0x01,
+
+    // authority: example.com NS ns1.example.com (compressed)
+    0xC0, 0x0C, 0x00, 0x02, 0x00, 0x01, 0x00, 0x00, 0x0E, 0x10,
+    0x00, 0x06, 0x03, 'n', 's', '1', 0xC0, 0x0C,
+
+    // additional: NS1.EXAMPLE.COM A 192.0.2.53, owner spelled differently
+    0x03, 'N', 'S', '1', 0x07, 'E', 'X', 'A', 'M', 'P', 'L', 'E', 0x03, 'C', 'O', 'M', 0x00,
+    0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0E, 0x10,
+    0x00, 0x04, 192, 0, 2, 53
+  };
+
+  dns_arena_t *arena = dns_arena_create(DNS_RECURSIVE_ARENA_CHUNK);
+  dns_message_t msg;
+  munit_assert_int(dns_parse_message(response, sizeof(response), arena, &msg), ==, 0);
+
+  dns_upstream_list_t servers = {0};
+  munit_assert_int(dns_recursive_extract_nameservers(&msg, &servers), ==, 1);
+  munit_assert_uint32(servers.servers[0].ipv4.sin_addr.s_addr, ==, inet_addr("192.0.2.53"));
+
+  dns_arena_destroy(arena);
   return MUNIT_OK;
 }
 
@@ -294,6 +333,7 @@ static MunitTest tests[] = {
   {"/backward_compatibility", test_backward_compatibility, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/response_forwarding", test_response_forwarding, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/authority_parsing", test_authority_parsing, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/authority_glue", test_authority_glue, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/timeout_cleanup", test_query_timeout_cleanup, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/full_integration", test_full_integration, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
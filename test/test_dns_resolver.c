@@ -10,9 +10,9 @@ static MunitResult test_result_create(const MunitParameter params[], void *data)
 
   dns_resolution_result_t *result = dns_resolution_result_create();
   munit_assert_not_null(result);
-  munit_assert_null(result->answer_list);
-  munit_assert_null(result->authority_list);
-  munit_assert_null(result->additional_list);
+  munit_assert_int(result->answer.rrset_count, ==, 0);
+  munit_assert_int(result->authority.rrset_count, ==, 0);
+  munit_assert_int(result->additional.rrset_count, ==, 0);
   munit_assert_int(result->answer_count, ==, 0);
   munit_assert_int(result->authority_count, ==, 0);
   munit_assert_int(result->additional_count, ==, 0);
@@ -49,8 +49,8 @@ static MunitResult test_simple_a_record(const MunitParameter params[], void *dat
   munit_assert_int(err.code, ==, DNS_ERR_NONE);
   munit_assert_int(result->rcode, ==, DNS_RCODE_NOERROR);
   munit_assert_int(result->answer_count, ==, 1);
-  munit_assert_not_null(result->answer_list);
-  munit_assert_uint32(result->answer_list->rdata.a.address, ==, htonl(0x01020304));
+  munit_assert_int(result->answer.rrset_count, ==, 1);
+  munit_assert_uint32(result->answer.rrsets[0].rrset->records->rdata.a.address, ==, htonl(0x01020304));
 
   dns_resolution_result_free(result);
   dns_trie_free(trie);
@@ -100,8 +100,7 @@ static MunitResult test_nxdomain_with_soa(const MunitParameter params[], void *d
   soa->minimum = 300;
 
   dns_rrset_t *ns_rrset = dns_rrset_create(DNS_TYPE_NS, 3600);
-  dns_rr_t *ns = dns_rr_create(DNS_TYPE_NS, DNS_CLASS_IN, 3600);
-  strcpy(ns->rdata.ns.nsdname, "ns1.test.com");
+  dns_rr_t *ns = dns_rr_create_ns("ns1.test.com", 3600);
   dns_rrset_add(ns_rrset, ns);
 
   dns_trie_insert_zone(trie, "test.com", soa, ns_rrset);
@@ -159,14 +158,15 @@ static MunitResult test_cname_simple(const MunitParameter params[], void *data)
   munit_assert_int(result->answer_count, ==, 2); // CNAME + A
 
   // first should be CNAME
-  munit_assert_not_null(result->answer_list);
-  munit_assert_int(result->answer_list->type, ==, DNS_TYPE_CNAME);
-  munit_assert_string_equal(result->answer_list->rdata.cname.cname, "target.com");
+  munit_assert_int(result->answer.rrset_count, ==, 2);
+  const dns_rrset_t *first = result->answer.rrsets[0].rrset;
+  munit_assert_int(first->type, ==, DNS_TYPE_CNAME);
+  munit_assert_string_equal(first->records->rdata.cname.cname, "target.com");
 
   // second should be A record
-  munit_assert_not_null(result->answer_list->next);
-  munit_assert_int(result->answer_list->next->type, ==, DNS_TYPE_A);
-  munit_assert_uint32(result->answer_list->next->rdata.a.address, ==, htonl(0x01020304));
+  const dns_rrset_t *second = result->answer.rrsets[1].rrset;
+  munit_assert_int(second->type, ==, DNS_TYPE_A);
+  munit_assert_uint32(second->records->rdata.a.address, ==, htonl(0x01020304));
 
   dns_resolution_result_free(result);
   dns_trie_free(trie);
@@ -205,7 +205,37 @@ static MunitResult test_cname_chain(const MunitParameter params[], void *data) {
   munit_assert_int(result->rcode, ==, DNS_RCODE_NOERROR);
   munit_assert_int(result->answer_count, ==, 4); // 3 CNAMEs + 1 A
 
+  // each link is owned by the target before it, the first by the query name
+  static const char *owners[] = {NULL, "alias2.com", "alias3.com", "final.com"};
+  for (int i = 0; i < 4; ++i) {
+    const char *owner = result->answer.rrsets[i].owner;
+    if (owners[i]) {
+      munit_assert_string_equal(owner, owners[i]);
+    } else {
+      munit_assert_null(owner);
+    }
+  }
+
+  // a chain put in the cache comes back with the same owners
+  dns_cache_t *cache = dns_cache_create(10);
+  dns_rrset_t *rrsets[4];
+  for (int i = 0; i < 4; ++i) rrsets[i] = result->answer.rrsets[i].rrset;
+  munit_assert_int(dns_cache_insert_rrsets(cache, "alias1.com", DNS_TYPE_A, DNS_CLASS_IN,
+                                           rrsets, 4, 300), ==, 0);
   dns_resolution_result_free(result);
+
+  dns_cache_result_t hit;
+  munit_assert_true(dns_cache_lookup_into(cache, "alias1.com", DNS_TYPE_A, DNS_CLASS_IN, &hit));
+  dns_resolution_result_t cached;
+  dns_resolution_result_init(&cached);
+  dns_resolution_result_from_cache(&cached, &hit);
+  dns_cache_result_clear(&hit);
+  dns_cache_free(cache);
+
+  munit_assert_null(cached.answer.rrsets[0].owner);
+  munit_assert_string_equal(cached.answer.rrsets[3].owner, "final.com");
+  dns_resolution_result_clear(&cached);
+
   dns_trie_free(trie);
   return MUNIT_OK;
 }
@@ -325,24 +355,73 @@ static MunitResult test_error_codes(const MunitParameter params[], void *data) {
   return MUNIT_OK;
 }
 
-static MunitResult test_wildcard_not_implemented(const MunitParameter params[], void *data) {
+static MunitResult test_wildcard_synthesis(const MunitParameter params[], void *data) {
   (void)params; (void)data;
 
-  // wildcard not yet implemented, just verify we do not crash
   dns_trie_t *trie = dns_trie_create();
 
   dns_trie_insert_a(trie, "*.example.com", "192.168.1.1", 300);
 
-  dns_question_t q = { .qtype = DNS_TYPE_A, .qclass = DNS_CLASS_IN };
+  // single and multi-label names below the closest encloser both match
+  const char *names[] = { "anything.example.com", "a.b.example.com" };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+    dns_question_t q = { .qtype = DNS_TYPE_A, .qclass = DNS_CLASS_IN };
+    dns_safe_strncpy(q.qname, names[i], sizeof(q.qname));
+
+    dns_resolution_result_t *result = dns_resolution_result_create();
+    dns_error_t err = DNS_ERROR_INIT;
+
+    munit_assert_int(dns_resolve_query_full(trie, &q, result, &err), ==, 0);
+    munit_assert_int(result->rcode, ==, DNS_RCODE_NOERROR);
+    munit_assert_int(result->answer_count, ==, 1);
+    munit_assert_uint32(result->answer.rrsets[0].rrset->records->rdata.a.address, ==, inet_addr("192.168.1.1"));
+
+    dns_resolution_result_free(result);
+  }
+
+  // wildcard owns no AAAA, so a synthesized name answers NODATA
+  dns_question_t q = { .qtype = DNS_TYPE_AAAA, .qclass = DNS_CLASS_IN };
   dns_safe_strncpy(q.qname, "anything.example.com", sizeof(q.qname));
 
   dns_resolution_result_t *result = dns_resolution_result_create();
   dns_error_t err = DNS_ERROR_INIT;
 
-  dns_resolve_query_full(trie, &q, result, &err);
+  munit_assert_int(dns_resolve_query_full(trie, &q, result, &err), ==, 0);
+  munit_assert_int(result->rcode, ==, DNS_RCODE_NOERROR);
+  munit_assert_int(result->answer_count, ==, 0);
+
+  dns_resolution_result_free(result);
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+static MunitResult test_wildcard_closest_encloser(const MunitParameter params[], void *data) {
+  (void)params; (void)data;
+
+  dns_trie_t *trie = dns_trie_create();
+
+  dns_trie_insert_a(trie, "*.example.com", "192.168.1.1", 300);
+  dns_trie_insert_a(trie, "host.sub.example.com", "192.168.1.2", 300);
 
-  // return NXDOMAIN for now without wildcard expansion
+  // sub.example.com exists (empty non-terminal), so the wildcard does not apply
+  dns_question_t q = { .qtype = DNS_TYPE_A, .qclass = DNS_CLASS_IN };
+  dns_safe_strncpy(q.qname, "sub.example.com", sizeof(q.qname));
+
+  dns_resolution_result_t *result = dns_resolution_result_create();
+  dns_error_t err = DNS_ERROR_INIT;
+
+  munit_assert_int(dns_resolve_query_full(trie, &q, result, &err), ==, 0);
+  munit_assert_int(result->rcode, ==, DNS_RCODE_NOERROR);
+  munit_assert_int(result->answer_count, ==, 0);
+  dns_resolution_result_free(result);
+
+  // closest encloser is sub.example.com which has no wildcard child
+  dns_safe_strncpy(q.qname, "other.sub.example.com", sizeof(q.qname));
+  result = dns_resolution_result_create();
+
+  munit_assert_int(dns_resolve_query_full(trie, &q, result, &err), ==, 0);
   munit_assert_int(result->rcode, ==, DNS_RCODE_NXDOMAIN);
+  munit_assert_int(result->answer_count, ==, 0);
 
   dns_resolution_result_free(result);
   dns_trie_free(trie);
@@ -410,13 +489,71 @@ static MunitResult test_cname_to_nonexistent(const MunitParameter params[], void
   // RFC: NOERROR with just the CNAME
   munit_assert_int(result->rcode, ==, DNS_RCODE_NOERROR);
   munit_assert_int(result->answer_count, ==, 1);
-  munit_assert_int(result->answer_list->type, ==, DNS_TYPE_CNAME);
+  munit_assert_int(result->answer.rrsets[0].rrset->type, ==, DNS_TYPE_CNAME);
 
   dns_resolution_result_free(result);
   dns_trie_free(trie);
   return MUNIT_OK;
 }
 
+static MunitResult test_shared_rrsets(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_resolver_t *resolver = dns_resolver_create();
+  munit_assert_true(dns_trie_insert_a(resolver->trie, "test.com", "1.2.3.4", 300));
+  dns_rrset_t *zone_rrset = dns_trie_lookup(resolver->trie, "test.com", DNS_TYPE_A);
+
+  dns_question_t question = {.qtype = DNS_TYPE_A, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, "test.com");
+
+  // the answer, the cache entry and the trie share one RRset
+  dns_error_t err;
+  dns_error_init(&err);
+
+  dns_resolution_result_t miss;
+  dns_resolution_result_init(&miss);
+  munit_assert_int(dns_resolver_query_with_cache(resolver, &question, &miss, &err), ==, 0);
+  munit_assert_int(miss.answer.rrset_count, ==, 1);
+  munit_assert_ptr_equal(miss.answer.rrsets[0].rrset, zone_rrset);
+
+  dns_resolution_result_t hit;
+  dns_resolution_result_init(&hit);
+  munit_assert_int(dns_resolver_query_with_cache(resolver, &question, &hit, &err), ==, 0);
+  munit_assert_uint64(dns_stats_get(resolver->stats, DNS_STAT_RESOLVER_CACHE_HITS), ==, 1);
+  munit_assert_ptr_equal(hit.answer.rrsets[0].rrset, zone_rrset);
+  munit_assert_uint32(hit.answer.rrsets[0].ttl, <=, 300);
+  munit_assert_int(hit.answer_count, ==, 1);
+
+  // an update copies the shared RRset, earlier answers keep what they saw
+  dns_rr_t *rr = dns_rr_create(DNS_TYPE_A, DNS_CLASS_IN, 60);
+  rr->rdata.a.address = inet_addr("5.6.7.8");
+  munit_assert_true(dns_trie_update_rr(resolver->trie, "test.com", rr));
+  dns_rrset_t *updated = dns_trie_lookup(resolver->trie, "test.com", DNS_TYPE_A);
+  munit_assert_ptr_not_equal(updated, zone_rrset);
+  munit_assert_int(updated->count, ==, 2);
+  munit_assert_uint32(updated->ttl, ==, 60);
+
+  munit_assert_int(zone_rrset->count, ==, 1);
+  munit_assert_uint32(zone_rrset->ttl, ==, 300);
+  munit_assert_uint32(zone_rrset->records->rdata.a.address, ==, inet_addr("1.2.3.4"));
+
+  // the TTL is applied on encode, the shared records are left alone
+  uint8_t buf[64];
+  size_t offset = 0;
+  munit_assert_int(dns_encode_rrset(buf, sizeof(buf), &offset, "test.com", zone_rrset, 42, NULL), ==, 1);
+  size_t ttl_offset = 10 + 4; // encoded test.com, type and class
+  uint32_t wire_ttl;
+  munit_assert_int(dns_read_uint32(buf, sizeof(buf), &ttl_offset, &wire_ttl), ==, 0);
+  munit_assert_uint32(wire_ttl, ==, 42);
+  munit_assert_uint32(zone_rrset->records->ttl, ==, 300);
+
+  dns_resolution_result_clear(&miss);
+  dns_resolution_result_clear(&hit);
+  dns_resolver_free(resolver);
+  return MUNIT_OK;
+}
+
 static MunitTest tests[] = {
   {"/create_resolution_result", test_result_create, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/simple_a_record", test_simple_a_record, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
@@ -428,10 +565,12 @@ static MunitTest tests[] = {
   {"/cname_too_long", test_cname_too_long, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/nodata", test_nodata, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/error_codes", test_error_codes, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
-  {"/wildcard_not_implemented", test_wildcard_not_implemented, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/wildcard_synthesis", test_wildcard_synthesis, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/wildcard_closest_encloser", test_wildcard_closest_encloser, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/empty_qname", test_empty_qname, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/invalid_class", test_invalid_class, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/cname_to_nonexistent", test_cname_to_nonexistent, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/shared_rrsets", test_shared_rrsets, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
 };
 
@@ -1,8 +1,11 @@
 #include "munit.h"
 #include "dns_server.h"
 #include "dns_error.h"
+#include "test_dns_query.h"
+#include <stdio.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <unistd.h>
 
 static MunitResult test_server_create(const MunitParameter params[], void *data) {
   (void)params;
@@ -14,9 +17,9 @@ static MunitResult test_server_create(const MunitParameter params[], void *data)
   munit_assert_not_null(server->trie);
   munit_assert_false(server->running);
   munit_assert_int(server->socket_fd, ==, -1);
-  munit_assert_int(server->queries_received, ==, 0);
-  munit_assert_int(server->queries_processed, ==, 0);
-  munit_assert_int(server->queries_failed, ==, 0);
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_QUERIES_RECEIVED), ==, 0);
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_QUERIES_PROCESSED), ==, 0);
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_QUERIES_FAILED), ==, 0);
 
   dns_server_free(server);
   return MUNIT_OK;
@@ -177,8 +180,7 @@ static MunitResult test_process_query_nxdomain(const MunitParameter params[], vo
   soa->minimum = 300;
 
   dns_rrset_t *ns_rrset = dns_rrset_create(DNS_TYPE_NS, 3600);
-  dns_rr_t *ns = dns_rr_create(DNS_TYPE_NS, DNS_CLASS_IN, 3600);
-  strcpy(ns->rdata.ns.nsdname, "ns1.local");
+  dns_rr_t *ns = dns_rr_create_ns("ns1.local", 3600);
   dns_rrset_add(ns_rrset, ns);
 
   dns_trie_insert_zone(server->trie, "local", soa, ns_rrset);
@@ -299,14 +301,419 @@ static MunitResult test_process_query_notimp(const MunitParameter params[], void
   return MUNIT_OK;
 }
 
+static MunitResult test_process_query_question_echo(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+
+  dns_rr_t *a_record = dns_rr_create(DNS_TYPE_A, DNS_CLASS_IN, 300);
+  a_record->rdata.a.address = htonl(0x7F000001);
+  dns_trie_insert_rr(server->trie, "test.local", a_record);
+
+  dns_header_t query_header = {
+    .id = 0x4321,
+    .qr = DNS_QR_QUERY,
+    .opcode = DNS_OPCODE_QUERY,
+    .qdcount = 1
+  };
+  uint8_t query_buffer[512];
+  dns_encode_header(query_buffer, sizeof(query_buffer), &query_header);
+
+  // mixed case is echoed as sent
+  const uint8_t question[] = {4, 'T', 'e', 's', 'T', 5, 'L', 'O', 'C', 'A', 'L', 0, 0x00, 0x01, 0x00, 0x01};
+  memcpy(query_buffer + 12, question, sizeof(question));
+
+  dns_request_t request = {
+    .buffer = query_buffer,
+    .length = 12 + sizeof(question)
+  };
+
+  // the second pass is answered from the cache
+  for (int pass = 0; pass < 2; ++pass) {
+    dns_response_t *response = dns_response_create(512);
+    dns_error_t err;
+    dns_error_init(&err);
+
+    munit_assert_int(dns_process_query(server, &request, response, &err), ==, 0);
+
+    dns_header_t response_header;
+    dns_parse_header(response->buffer, response->length, &response_header);
+    munit_assert_int(response_header.rcode, ==, DNS_RCODE_NOERROR);
+    munit_assert_int(response_header.ancount, ==, 1);
+
+    munit_assert_memory_equal(sizeof(question), response->buffer + 12, question);
+
+    // the answer owner points back at the question
+    size_t answer = 12 + sizeof(question);
+    munit_assert_uint8(response->buffer[answer], ==, 0xC0);
+    munit_assert_uint8(response->buffer[answer + 1], ==, 0x0C);
+    munit_assert_size(response->length, ==, answer + 2 + 10 + 4);
+
+    dns_response_free(response);
+  }
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_CACHE_HITS), ==, 1);
+
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+// the response process_query sends and the one the resolver path builds
+static void compare_precompiled(dns_server_t *server, const char *qname, uint16_t qtype, uint8_t rcode) {
+  uint8_t query_buffer[512];
+  dns_header_t query_header = {.id = 0x55AA, .qr = DNS_QR_QUERY, .opcode = DNS_OPCODE_QUERY, .qdcount = 1};
+  dns_encode_header(query_buffer, sizeof(query_buffer), &query_header);
+
+  size_t offset = 12;
+  dns_question_t question = {.qtype = qtype, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, qname);
+  dns_encode_question(query_buffer, sizeof(query_buffer), &offset, &question);
+
+  dns_request_t request = {.buffer = query_buffer, .length = offset};
+  dns_response_t *response = dns_response_create(512);
+  dns_error_t err;
+  dns_error_init(&err);
+  munit_assert_int(dns_process_query(server, &request, response, &err), ==, 0);
+
+  dns_message_t query = {0};
+  dns_parse_header(query_buffer, offset, &query.header);
+  size_t question_offset = 12;
+  dns_parse_question_view(query_buffer, offset, &question_offset, &query.question_view);
+  query.has_question_view = true;
+
+  dns_resolution_result_t result;
+  dns_resolution_result_init(&result);
+  munit_assert_int(dns_resolve_query_view(server->trie, &query.question_view, &result, NULL), ==, 0);
+
+  uint8_t expected[512];
+  size_t expected_len;
+  munit_assert_int(dns_build_response(&query, &result, expected, sizeof(expected), &expected_len, NULL), ==, 0);
+  dns_resolution_result_clear(&result);
+
+  dns_header_t header;
+  dns_parse_header(response->buffer, response->length, &header);
+  munit_assert_int(header.rcode, ==, rcode);
+  munit_assert_int(header.aa, ==, 1);
+  munit_assert_size(response->length, ==, expected_len);
+  munit_assert_memory_equal(expected_len, response->buffer, expected);
+
+  dns_response_free(response);
+}
+
+static MunitResult test_process_query_precompiled(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+
+  dns_soa_t *soa = calloc(1, sizeof(dns_soa_t));
+  strcpy(soa->mname, "ns1.example.com");
+  strcpy(soa->rname, "hostmaster.example.com");
+  soa->serial = 7;
+  soa->minimum = 600;
+
+  dns_rrset_t *ns_rrset = dns_rrset_create(DNS_TYPE_NS, 3600);
+  dns_rrset_add(ns_rrset, dns_rr_create_ns("ns1.example.com", 3600));
+  dns_trie_insert_zone(server->trie, "example.com", soa, ns_rrset);
+
+  dns_trie_insert_ns(server->trie, "example.com", "ns1.example.com", 3600);
+  dns_trie_insert_mx(server->trie, "example.com", 10, "mail.example.com", 3600);
+  dns_trie_insert_mx(server->trie, "example.com", 20, "backup.example.net", 3600);
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.1", 300);
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.2", 300);
+  munit_assert_size(dns_trie_compile(server->trie), ==, 3);
+
+  // MX and NS answers only stay on the fast path without additional data
+  server->minimal_responses = true;
+
+  compare_precompiled(server, "Example.COM", DNS_TYPE_MX, DNS_RCODE_NOERROR);
+  compare_precompiled(server, "example.com", DNS_TYPE_NS, DNS_RCODE_NOERROR);
+  compare_precompiled(server, "WWW.example.com", DNS_TYPE_A, DNS_RCODE_NOERROR);
+  compare_precompiled(server, "www.example.com", DNS_TYPE_AAAA, DNS_RCODE_NOERROR);
+  compare_precompiled(server, "nope.www.Example.com", DNS_TYPE_A, DNS_RCODE_NXDOMAIN);
+
+  // an update rebuilds what it touched
+  dns_trie_update_rr(server->trie, "www.example.com", dns_rr_create_a_str("192.0.2.3", 60));
+  compare_precompiled(server, "www.example.com", DNS_TYPE_A, DNS_RCODE_NOERROR);
+
+  // none of it went through the cache
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_AUTHORITATIVE_RESPONSES), ==, 6);
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_CACHE_HITS), ==, 0);
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_CACHE_MISSES), ==, 0);
+
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+static MunitResult test_process_query_additional(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  server->enable_cache = false;
+
+  dns_soa_t *soa = calloc(1, sizeof(dns_soa_t));
+  strcpy(soa->mname, "ns1.example.com");
+  strcpy(soa->rname, "hostmaster.example.com");
+  soa->minimum = 600;
+  dns_rrset_t *ns_rrset = dns_rrset_create(DNS_TYPE_NS, 3600);
+  dns_rrset_add(ns_rrset, dns_rr_create_ns("ns1.example.com", 3600));
+  dns_trie_insert_zone(server->trie, "example.com", soa, ns_rrset);
+
+  dns_trie_insert_ns(server->trie, "example.com", "ns1.example.com", 3600);
+  dns_trie_insert_mx(server->trie, "example.com", 10, "mail.example.com", 3600);
+  dns_trie_insert_mx(server->trie, "example.com", 20, "Mail.example.com", 3600);
+  dns_trie_insert_mx(server->trie, "example.com", 30, "mx.example.net", 3600);
+  dns_trie_insert_a(server->trie, "mail.example.com", "192.0.2.25", 300);
+  dns_trie_insert_aaaa(server->trie, "mail.example.com", "2001:db8::25", 300);
+  dns_trie_insert_a(server->trie, "ns1.example.com", "192.0.2.53", 300);
+  dns_trie_compile(server->trie);
+
+  // both addresses of the in-zone exchange once, nothing for the other one
+  dns_response_t *response = send_query(server, "example.com", DNS_TYPE_MX);
+  dns_arena_t *arena = dns_arena_create(0);
+  dns_message_t msg;
+  munit_assert_int(dns_parse_message(response->buffer, response->length, arena, &msg), ==, 0);
+  munit_assert_int(msg.header.ancount, ==, 3);
+  munit_assert_int(msg.header.arcount, ==, 2);
+
+  dns_name_t mail;
+  dns_name_from_text(&mail, "mail.example.com");
+  munit_assert_true(dns_name_eq(&msg.additional[0].owner, &mail));
+  munit_assert_true(dns_name_eq(&msg.additional[1].owner, &mail));
+  munit_assert_uint16(msg.additional[0].type + msg.additional[1].type, ==, DNS_TYPE_A + DNS_TYPE_AAAA);
+  dns_response_free(response);
+
+  // glue for the name servers
+  response = send_query(server, "example.com", DNS_TYPE_NS);
+  dns_arena_reset(arena);
+  munit_assert_int(dns_parse_message(response->buffer, response->length, arena, &msg), ==, 0);
+  munit_assert_int(msg.header.arcount, ==, 1);
+  munit_assert_uint32(msg.additional[0].rr->rdata.a.address, ==, inet_addr("192.0.2.53"));
+  dns_response_free(response);
+
+  // minimal responses carry the answer alone, negative ones keep the SOA
+  server->minimal_responses = true;
+  response = send_query(server, "example.com", DNS_TYPE_MX);
+  dns_header_t header;
+  dns_parse_header(response->buffer, response->length, &header);
+  munit_assert_int(header.ancount, ==, 3);
+  munit_assert_int(header.nscount, ==, 0);
+  munit_assert_int(header.arcount, ==, 0);
+  dns_response_free(response);
+
+  response = send_query(server, "none.example.com", DNS_TYPE_MX);
+  dns_parse_header(response->buffer, response->length, &header);
+  munit_assert_int(header.rcode, ==, DNS_RCODE_NXDOMAIN);
+  munit_assert_int(header.nscount, ==, 1);
+  dns_response_free(response);
+
+  dns_arena_destroy(arena);
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+static MunitResult test_process_query_cname_owners(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  server->enable_recursion = false;
+  dns_trie_insert_cname(server->trie, "www.example.com", "edge.example.net", 300);
+  dns_trie_insert_cname(server->trie, "edge.example.net", "target.example.org", 300);
+  dns_trie_insert_a(server->trie, "target.example.org", "192.0.2.80", 300);
+
+  static const char *owners[] = {"www.example.com", "edge.example.net", "target.example.org"};
+  dns_arena_t *arena = dns_arena_create(0);
+
+  // every record of the chain under its own name, asked twice for the cached path
+  for (int pass = 0; pass < 2; ++pass) {
+    dns_response_t *response = send_query(server, "www.example.com", DNS_TYPE_A);
+    dns_message_t msg;
+    dns_arena_reset(arena);
+    munit_assert_int(dns_parse_message(response->buffer, response->length, arena, &msg), ==, 0);
+    munit_assert_int(msg.header.ancount, ==, 3);
+
+    for (int i = 0; i < 3; ++i) {
+      dns_name_t owner;
+      dns_name_from_text(&owner, owners[i]);
+      munit_assert_true(dns_name_eq(&msg.answers[i].owner, &owner));
+    }
+    munit_assert_uint16(msg.answers[2].type, ==, DNS_TYPE_A);
+    dns_response_free(response);
+  }
+
+  dns_arena_destroy(arena);
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+static MunitResult test_process_query_truncation(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  server->enable_cache = false;
+
+  dns_soa_t *soa = calloc(1, sizeof(dns_soa_t));
+  strcpy(soa->mname, "ns1.example.com");
+  strcpy(soa->rname, "hostmaster.example.com");
+  dns_rrset_t *ns_rrset = dns_rrset_create(DNS_TYPE_NS, 3600);
+  dns_rrset_add(ns_rrset, dns_rr_create_ns("ns1.example.com", 3600));
+  dns_trie_insert_zone(server->trie, "example.com", soa, ns_rrset);
+
+  // 40 A records are 640 bytes of answer, past 512 but inside 1232
+  char ip[32];
+  for (int i = 0; i < 40; ++i) {
+    snprintf(ip, sizeof(ip), "192.0.2.%d", i + 1);
+    dns_trie_insert_a(server->trie, "big.example.com", ip, 300);
+  }
+
+  // an exchange whose AAAA set alone is past 512
+  dns_trie_insert_mx(server->trie, "example.com", 10, "mail.example.com", 3600);
+  dns_trie_insert_a(server->trie, "mail.example.com", "192.0.2.25", 300);
+  for (int i = 0; i < 20; ++i) {
+    snprintf(ip, sizeof(ip), "2001:db8::%x", i + 1);
+    dns_trie_insert_aaaa(server->trie, "mail.example.com", ip, 300);
+  }
+  dns_trie_compile(server->trie);
+
+  // the answer set does not fit plain DNS, TC and nothing half sent
+  dns_response_t *response = send_query(server, "big.example.com", DNS_TYPE_A);
+  dns_header_t header;
+  dns_parse_header(response->buffer, response->length, &header);
+  munit_assert_int(header.tc, ==, 1);
+  munit_assert_int(header.ancount, ==, 0);
+  munit_assert_size(response->length, <=, DNS_MAX_PACKET_SIZE);
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_TRUNCATED_ANSWER), ==, 1);
+  dns_response_free(response);
+
+  // with EDNS it goes out whole, the OPT echoed last
+  response = send_query_with(server, &(test_query_t){.qname = "big.example.com", .udp_size = 4096});
+  dns_parse_header(response->buffer, response->length, &header);
+  munit_assert_int(header.tc, ==, 0);
+  munit_assert_int(header.ancount, ==, 40);
+  munit_assert_int(header.arcount, ==, 1);
+  munit_assert_size(response->length, <=, DNS_EDNS_UDP_SIZE);
+
+  dns_edns_t edns;
+  size_t question_end = 12 + 17 + 4;
+  munit_assert_int(dns_parse_edns(response->buffer, response->length, question_end, &header, &edns), ==, 0);
+  munit_assert_true(edns.present);
+  munit_assert_uint16(edns.udp_size, ==, DNS_EDNS_UDP_SIZE);
+  dns_response_free(response);
+
+  // the AAAA glue is dropped, the A glue kept, no TC
+  response = send_query(server, "example.com", DNS_TYPE_MX);
+  dns_parse_header(response->buffer, response->length, &header);
+  munit_assert_int(header.tc, ==, 0);
+  munit_assert_int(header.ancount, ==, 1);
+  munit_assert_int(header.arcount, ==, 1);
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_TRIMMED_OPTIONAL), ==, 1);
+  munit_assert_int(dns_stats_get(server->stats, DNS_STAT_TRUNCATED_ANSWER), ==, 1);
+  dns_response_free(response);
+
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+static MunitResult test_process_query_rotation(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  server->minimal_responses = true;
+  server->trie->rrset_order.fallback = DNS_RRSET_ORDER_CYCLIC;
+
+  dns_soa_t *soa = calloc(1, sizeof(dns_soa_t));
+  strcpy(soa->mname, "ns1.example.com");
+  strcpy(soa->rname, "hostmaster.example.com");
+  dns_rrset_t *ns_rrset = dns_rrset_create(DNS_TYPE_NS, 3600);
+  dns_rrset_add(ns_rrset, dns_rr_create_ns("ns1.example.com", 3600));
+  dns_trie_insert_zone(server->trie, "example.com", soa, ns_rrset);
+
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.1", 300);
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.2", 300);
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.3", 300);
+  dns_trie_compile(server->trie);
+
+  // the first answer moves on by one record per response, cached or not
+  dns_arena_t *arena = dns_arena_create(0);
+  uint32_t first[4];
+  for (int i = 0; i < 4; ++i) {
+    dns_response_t *response = send_query(server, "www.example.com", DNS_TYPE_A);
+    dns_message_t msg;
+    dns_arena_reset(arena);
+    munit_assert_int(dns_parse_message(response->buffer, response->length, arena, &msg), ==, 0);
+    munit_assert_int(msg.header.ancount, ==, 3);
+    first[i] = msg.answers[0].rr->rdata.a.address;
+    dns_response_free(response);
+  }
+  munit_assert_uint32(first[0], !=, first[1]);
+  munit_assert_uint32(first[1], !=, first[2]);
+  munit_assert_uint32(first[0], !=, first[2]);
+  munit_assert_uint32(first[3], ==, first[0]);
+
+  dns_arena_destroy(arena);
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+static MunitResult test_rrset_order_config(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/dns_server_%d.conf", (int)getpid());
+  FILE *file = fopen(path, "w");
+  munit_assert_not_null(file);
+  fputs("recursion no\n"
+        "rrset_order fixed\n"
+        "rrset_order pool.example.com. A cyclic\n"
+        "rrset_order pool.example.com ANY random\n"
+        "rrset_order mx.example.com BOGUS cyclic\n",
+        file);
+  fclose(file);
+
+  dns_server_config_t *config = dns_server_config_create();
+  munit_assert_int(dns_server_config_load(config, path), ==, 0);
+  unlink(path);
+  munit_assert_int(config->rrset_order.rule_count, ==, 2);
+
+  // the rule for the name and type, then the name, then the fallback
+  dns_server_t *server = dns_server_create_with_config(config);
+  munit_assert_not_null(server);
+  dns_trie_insert_a(server->trie, "pool.example.com", "192.0.2.1", 300);
+  dns_trie_insert_aaaa(server->trie, "pool.example.com", "2001:db8::1", 300);
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.2", 300);
+
+  munit_assert_int(dns_trie_lookup(server->trie, "pool.example.com", DNS_TYPE_A)->order,
+                   ==, DNS_RRSET_ORDER_CYCLIC);
+  munit_assert_int(dns_trie_lookup(server->trie, "pool.example.com", DNS_TYPE_AAAA)->order,
+                   ==, DNS_RRSET_ORDER_RANDOM);
+  munit_assert_int(dns_trie_lookup(server->trie, "www.example.com", DNS_TYPE_A)->order,
+                   ==, DNS_RRSET_ORDER_FIXED);
+
+  dns_server_free(server);
+  dns_server_config_free(config);
+  return MUNIT_OK;
+}
+
 static MunitTest tests[] = {
   {"/create", test_server_create, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/response/create", test_response_create, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/process_query/simple", test_process_query_simple, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/process_query/with_cname", test_process_query_with_cname, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/process_query/cname_owners", test_process_query_cname_owners, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/process_query/nxdomain", test_process_query_nxdomain, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/process_query/formerr", test_process_query_formerr, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/process_query/notimp", test_process_query_notimp, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/process_query/question_echo", test_process_query_question_echo, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/process_query/precompiled", test_process_query_precompiled, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/process_query/additional", test_process_query_additional, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/process_query/truncation", test_process_query_truncation, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/process_query/rotation", test_process_query_rotation, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/rrset_order_config", test_rrset_order_config, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
 };
 
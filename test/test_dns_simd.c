@@ -0,0 +1,186 @@
+#include "munit.h"
+#include "dns_simd.h"
+#include "dns_records.h"
+#include "dns_parser.h"
+#include <string.h>
+
+
+static const dns_simd_level_t levels[] = {DNS_SIMD_SCALAR, DNS_SIMD_SSE2, DNS_SIMD_AVX2};
+
+// lengths around every vector width, a full label and a full name
+static const size_t lengths[] = {0, 1, 7, 15, 16, 17, 31, 32, 33, 47, 63, 64, 100, 255};
+
+static void fill_random(char *buf, size_t len) {
+  // letters of both cases, digits, hyphens and some bytes >= 0x80
+  static const char alphabet[] = "abcXYZmnAZaz09-_\x80\xc1\xff@[`{";
+  for (size_t i = 0; i < len; ++i) {
+    buf[i] = alphabet[munit_rand_int_range(0, sizeof(alphabet) - 2)];
+  }
+}
+
+static char fold(char c) {
+  return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+}
+
+
+static MunitResult test_lower(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+    if (dns_simd_set_level(levels[l]) != levels[l]) continue;
+
+    for (size_t n = 0; n < sizeof(lengths) / sizeof(lengths[0]); ++n) {
+      size_t len = lengths[n];
+      char src[256];
+      char dst[257];
+      fill_random(src, len);
+      dst[len] = '#';
+
+      dns_simd_lower(dst, src, len);
+      for (size_t i = 0; i < len; ++i) {
+        munit_assert_char(dst[i], ==, fold(src[i]));
+      }
+      munit_assert_char(dst[len], ==, '#');
+
+      // in place
+      dns_simd_lower(src, src, len);
+      munit_assert_memory_equal(len, src, dst);
+    }
+  }
+
+  dns_simd_set_level(dns_simd_best_level());
+  return MUNIT_OK;
+}
+
+static MunitResult test_find_byte(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+    if (dns_simd_set_level(levels[l]) != levels[l]) continue;
+
+    for (size_t n = 0; n < sizeof(lengths) / sizeof(lengths[0]); ++n) {
+      size_t len = lengths[n];
+      char buf[256];
+      fill_random(buf, len);
+
+      munit_assert_size(dns_simd_find_byte(buf, len, '.'), ==, len);
+
+      for (size_t at = 0; at < len; ++at) {
+        fill_random(buf, len);
+        buf[at] = '.';
+        if (at + 1 < len) buf[len - 1] = '.';
+        munit_assert_size(dns_simd_find_byte(buf, len, '.'), ==, at);
+      }
+    }
+  }
+
+  dns_simd_set_level(dns_simd_best_level());
+  return MUNIT_OK;
+}
+
+static MunitResult test_case_equal(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+    if (dns_simd_set_level(levels[l]) != levels[l]) continue;
+
+    for (size_t n = 0; n < sizeof(lengths) / sizeof(lengths[0]); ++n) {
+      size_t len = lengths[n];
+      char a[256];
+      char b[256];
+      fill_random(a, len);
+
+      // flip the case of every letter
+      for (size_t i = 0; i < len; ++i) {
+        char c = a[i];
+        if (c >= 'a' && c <= 'z') c = (char)(c - 32);
+        else if (c >= 'A' && c <= 'Z') c = (char)(c + 32);
+        b[i] = c;
+      }
+      munit_assert_true(dns_simd_case_equal(a, b, len));
+
+      // one differing byte anywhere, '@' and '`' differ only in bit 0x20
+      for (size_t at = 0; at < len; ++at) {
+        char saved = b[at];
+        b[at] = (fold(a[at]) == '@') ? '`' : '@';
+        munit_assert_false(dns_simd_case_equal(a, b, len));
+        b[at] = saved;
+      }
+    }
+  }
+
+  dns_simd_set_level(dns_simd_best_level());
+  return MUNIT_OK;
+}
+
+static MunitResult test_label_valid(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+    if (dns_simd_set_level(levels[l]) != levels[l]) continue;
+
+    uint8_t label[63];
+    memset(label, 'a', sizeof(label));
+    munit_assert_true(dns_simd_label_valid(label, sizeof(label)));
+
+    for (size_t at = 0; at < sizeof(label); ++at) {
+      label[at] = '.';
+      munit_assert_false(dns_simd_label_valid(label, sizeof(label)));
+      label[at] = 0;
+      munit_assert_false(dns_simd_label_valid(label, sizeof(label)));
+      label[at] = 0xFF;
+      munit_assert_true(dns_simd_label_valid(label, sizeof(label)));
+      label[at] = 'a';
+    }
+  }
+
+  dns_simd_set_level(dns_simd_best_level());
+  return MUNIT_OK;
+}
+
+static MunitResult test_call_sites(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  char out[MAX_DOMAIN_NAME];
+  dns_normalize_domain("WWW.Example.COM.", out);
+  munit_assert_string_equal(out, "www.example.com");
+
+  munit_assert_true(dns_name_equal("Mail.Example.com", "mail.EXAMPLE.COM"));
+  munit_assert_false(dns_name_equal("mail.example.com", "mail.example.co"));
+  munit_assert_true(dns_name_equal(NULL, ""));
+
+  // a label holding a '.' cannot be turned into dotted text
+  uint8_t wire[] = {3, 'a', '.', 'b', 3, 'c', 'o', 'm', 0, 0};
+  char name[MAX_DOMAIN_NAME];
+  size_t offset = 0;
+  munit_assert_int(dns_parse_name(wire, sizeof(wire), &offset, name, sizeof(name)), ==, -1);
+
+  wire[2] = 'x';
+  offset = 0;
+  munit_assert_int(dns_parse_name(wire, sizeof(wire), &offset, name, sizeof(name)), ==, 0);
+  munit_assert_string_equal(name, "axb.com");
+
+  return MUNIT_OK;
+}
+
+
+static MunitTest tests[] = {
+  {"/lower", test_lower, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/find_byte", test_find_byte, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/case_equal", test_case_equal, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/label_valid", test_label_valid, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/call_sites", test_call_sites, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+
+  {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
+};
+
+static const MunitSuite suite = {"/simd", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  return munit_suite_main(&suite, NULL, argc, argv);
+}
@@ -0,0 +1,130 @@
+#include "munit.h"
+#include "dns_stats.h"
+#include "dns_server.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+
+static MunitResult test_counters(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_stats_t *stats = dns_stats_create();
+  munit_assert_not_null(stats);
+  munit_assert_uint64((uintptr_t)stats % DNS_STATS_CACHE_LINE, ==, 0);
+  munit_assert_size(sizeof(dns_stats_shard_t) % DNS_STATS_CACHE_LINE, ==, 0);
+
+  dns_stats_inc(stats, DNS_STAT_CACHE_HITS);
+  dns_stats_inc(stats, DNS_STAT_CACHE_HITS);
+  dns_stats_add(stats, DNS_STAT_RESPONSES_SENT, 5);
+  munit_assert_uint64(dns_stats_get(stats, DNS_STAT_CACHE_HITS), ==, 2);
+
+  dns_stats_snapshot_t snapshot;
+  dns_stats_snapshot(stats, &snapshot);
+  munit_assert_uint64(snapshot.cache_hits, ==, 2);
+  munit_assert_uint64(snapshot.responses_sent, ==, 5);
+  munit_assert_uint64(snapshot.values[DNS_STAT_RESPONSES_SENT], ==, 5);
+  munit_assert_uint64(snapshot.queries_received, ==, 0);
+
+  // accumulating adds on top
+  dns_stats_accumulate(stats, &snapshot);
+  munit_assert_uint64(snapshot.cache_hits, ==, 4);
+
+  dns_stats_reset(stats);
+  munit_assert_uint64(dns_stats_get(stats, DNS_STAT_CACHE_HITS), ==, 0);
+
+  munit_assert_string_equal(dns_stats_name(DNS_STAT_CACHE_HITS), "cache_hits");
+  munit_assert_not_null(dns_stats_help(DNS_STAT_CACHE_HITS));
+  munit_assert_null(dns_stats_name(DNS_STAT_COUNT));
+
+  // a NULL stats is a no-op for writers and zero for readers
+  dns_stats_inc(NULL, DNS_STAT_CACHE_HITS);
+  dns_stats_snapshot(NULL, &snapshot);
+  munit_assert_uint64(snapshot.cache_hits, ==, 0);
+
+  dns_stats_free(stats);
+  return MUNIT_OK;
+}
+
+#define STATS_THREADS 40 // more than there are private rows
+#define STATS_PER_THREAD 10000
+
+static void *stats_writer(void *arg) {
+  dns_stats_t *stats = arg;
+  for (int i = 0; i < STATS_PER_THREAD; ++i) {
+    dns_stats_inc(stats, DNS_STAT_QUERIES_RECEIVED);
+  }
+  return NULL;
+}
+
+static MunitResult test_threads(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_stats_t *stats = dns_stats_create();
+
+  pthread_t threads[STATS_THREADS];
+  for (int i = 0; i < STATS_THREADS; ++i) {
+    munit_assert_int(pthread_create(&threads[i], NULL, stats_writer, stats), ==, 0);
+  }
+  for (int i = 0; i < STATS_THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // threads past the private rows share one, nothing is lost either way
+  munit_assert_uint64(dns_stats_get(stats, DNS_STAT_QUERIES_RECEIVED), ==,
+                      (uint64_t)STATS_THREADS * STATS_PER_THREAD);
+
+  dns_stats_free(stats);
+  return MUNIT_OK;
+}
+
+static MunitResult test_server_snapshot(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.1", 300);
+
+  uint8_t query[512];
+  dns_header_t header = {.id = 1, .qr = DNS_QR_QUERY, .opcode = DNS_OPCODE_QUERY, .qdcount = 1};
+  dns_encode_header(query, sizeof(query), &header);
+  size_t offset = 12;
+  dns_question_t question = {.qtype = DNS_TYPE_A, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, "www.example.com");
+  dns_encode_question(query, sizeof(query), &offset, &question);
+
+  for (int i = 0; i < 2; ++i) {
+    dns_request_t request = {.buffer = query, .length = offset};
+    dns_response_t *response = dns_response_create(DNS_BUFFER_SIZE);
+    munit_assert_int(dns_process_query(server, &request, response, NULL), ==, 0);
+    dns_response_free(response);
+  }
+
+  // the server's and the cache's counters come back in one snapshot
+  dns_stats_snapshot_t snapshot;
+  dns_server_stats(server, &snapshot);
+  munit_assert_uint64(snapshot.queries_received, ==, 2);
+  munit_assert_uint64(snapshot.cache_hits, ==, 1);
+  munit_assert_uint64(snapshot.cache_lookups, >=, 2);
+  munit_assert_uint64(snapshot.cache_insertions, ==, 1);
+
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+
+static MunitTest tests[] = {
+  {"/counters", test_counters, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/threads", test_threads, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/server_snapshot", test_server_snapshot, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+
+  {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
+};
+
+static const MunitSuite suite = {"/stats", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  return munit_suite_main(&suite, NULL, argc, argv);
+}
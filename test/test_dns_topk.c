@@ -0,0 +1,207 @@
+#include "munit.h"
+#include "dns_topk.h"
+#include "dns_server.h"
+#include "test_dns_query.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void add_text(dns_topk_t *topk, const char *key) {
+  dns_topk_add(topk, key, strlen(key));
+}
+
+static bool entry_is(const dns_topk_entry_t *entry, const char *key) {
+  return entry->key_length == strlen(key) && memcmp(entry->key, key, entry->key_length) == 0;
+}
+
+// counters in ascending buckets, and every key added is counted once
+static void assert_consistent(const dns_topk_t *topk) {
+  uint64_t sum = 0;
+  uint64_t last = 0;
+  int counters = 0;
+  for (int b = topk->min_bucket; b >= 0; b = topk->buckets[b].next) {
+    munit_assert_uint64(topk->buckets[b].count, >, last);
+    last = topk->buckets[b].count;
+    munit_assert_int(topk->buckets[b].first, >=, 0);
+    for (int c = topk->buckets[b].first; c >= 0; c = topk->counters[c].next) {
+      munit_assert_uint64(topk->counters[c].count, ==, last);
+      sum += last;
+      ++counters;
+    }
+  }
+  munit_assert_int(counters, ==, topk->used);
+  munit_assert_uint64(sum, ==, topk->total);
+}
+
+static MunitResult test_exact(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_topk_t topk;
+  dns_topk_init(&topk);
+
+  dns_topk_entry_t entries[DNS_TOPK_REPORT];
+  munit_assert_int(dns_topk_top(&topk, entries, DNS_TOPK_REPORT), ==, 0);
+
+  // under capacity nothing is estimated
+  for (int i = 0; i < 5; ++i) add_text(&topk, "c");
+  for (int i = 0; i < 9; ++i) add_text(&topk, "a");
+  for (int i = 0; i < 7; ++i) add_text(&topk, "b");
+  add_text(&topk, "d");
+  assert_consistent(&topk);
+
+  int n = dns_topk_top(&topk, entries, 3);
+  munit_assert_int(n, ==, 3);
+  munit_assert_true(entry_is(&entries[0], "a"));
+  munit_assert_uint64(entries[0].count, ==, 9);
+  munit_assert_true(entry_is(&entries[1], "b"));
+  munit_assert_uint64(entries[1].count, ==, 7);
+  munit_assert_true(entry_is(&entries[2], "c"));
+  munit_assert_uint64(entries[2].error, ==, 0);
+
+  munit_assert_int(dns_topk_top(&topk, entries, DNS_TOPK_REPORT), ==, 4);
+  munit_assert_uint64(topk.total, ==, 22);
+  return MUNIT_OK;
+}
+
+static MunitResult test_heavy(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_topk_t topk;
+  dns_topk_init(&topk);
+
+  // five keys well above total / capacity, buried in keys seen once
+  static const char *heavy[] = {"heavy0", "heavy1", "heavy2", "heavy3", "heavy4"};
+  char key[32];
+  int rounds = 1000;
+  for (int i = 0; i < rounds; ++i) {
+    for (int h = 0; h < 5; ++h) {
+      if (i % (h + 1) == 0) add_text(&topk, heavy[h]);
+    }
+    for (int j = 0; j < 10; ++j) {
+      snprintf(key, sizeof(key), "noise%d", i * 10 + j);
+      add_text(&topk, key);
+    }
+  }
+  assert_consistent(&topk);
+  munit_assert_int(topk.used, ==, DNS_TOPK_CAPACITY);
+
+  dns_topk_entry_t entries[5];
+  munit_assert_int(dns_topk_top(&topk, entries, 5), ==, 5);
+  for (int h = 0; h < 5; ++h) {
+    munit_assert_true(entry_is(&entries[h], heavy[h]));
+
+    // the true count lies between the bounds
+    uint64_t truth = (uint64_t)(rounds + h) / (uint64_t)(h + 1);
+    munit_assert_uint64(entries[h].count, >=, truth);
+    munit_assert_uint64(entries[h].count - entries[h].error, <=, truth);
+  }
+
+  // the bound on the error holds for every counter
+  for (int c = 0; c < topk.used; ++c) {
+    munit_assert_uint64(topk.counters[c].error, <=, topk.total / DNS_TOPK_CAPACITY);
+  }
+  return MUNIT_OK;
+}
+
+static MunitResult test_hitters(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_hitters_t *hitters = dns_hitters_create();
+  munit_assert_not_null(hitters);
+
+  struct sockaddr_storage v4 = {0};
+  struct sockaddr_in *sin = (struct sockaddr_in *)&v4;
+  sin->sin_family = AF_INET;
+  inet_pton(AF_INET, "192.0.2.77", &sin->sin_addr);
+  struct sockaddr_storage v4_same_net = v4;
+  inet_pton(AF_INET, "192.0.2.200", &((struct sockaddr_in *)&v4_same_net)->sin_addr);
+
+  struct sockaddr_storage v6 = {0};
+  struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&v6;
+  sin6->sin6_family = AF_INET6;
+  inet_pton(AF_INET6, "2001:db8:1:2ff::1", &sin6->sin6_addr);
+
+  dns_name_t www;
+  dns_name_t odd;
+  munit_assert_int(dns_name_from_text(&www, "WWW.Example.com"), ==, 0);
+  munit_assert_int(dns_name_from_text(&odd, "a\"b.example.com"), ==, 0);
+
+  dns_hitters_record(hitters, &www, DNS_TYPE_AAAA, &v4);
+  dns_hitters_record(hitters, &www, DNS_TYPE_AAAA, &v4_same_net);
+  dns_hitters_record(hitters, &odd, DNS_TYPE_A, &v6);
+
+  char text[DNS_TOPK_KEY_MAX * 4 + 1];
+  dns_topk_entry_t entries[2];
+  munit_assert_int(dns_topk_top(&hitters->trackers[DNS_HITTERS_QNAME], entries, 2), ==, 2);
+  munit_assert_string_equal(dns_hitters_key_text(DNS_HITTERS_QNAME, &entries[0], text, sizeof(text)),
+                            "www.example.com.");
+  munit_assert_uint64(entries[0].count, ==, 2);
+  munit_assert_string_equal(dns_hitters_key_text(DNS_HITTERS_QNAME, &entries[1], text, sizeof(text)),
+                            "a\\\"b.example.com.");
+
+  // clients are counted by network
+  munit_assert_int(dns_topk_top(&hitters->trackers[DNS_HITTERS_CLIENT], entries, 2), ==, 2);
+  munit_assert_string_equal(dns_hitters_key_text(DNS_HITTERS_CLIENT, &entries[0], text, sizeof(text)),
+                            "192.0.2.0/24");
+  munit_assert_uint64(entries[0].count, ==, 2);
+  munit_assert_string_equal(dns_hitters_key_text(DNS_HITTERS_CLIENT, &entries[1], text, sizeof(text)),
+                            "2001:db8:1:200::/56");
+
+  munit_assert_int(dns_topk_top(&hitters->trackers[DNS_HITTERS_QTYPE], entries, 2), ==, 2);
+  munit_assert_string_equal(dns_hitters_key_text(DNS_HITTERS_QTYPE, &entries[0], text, sizeof(text)),
+                            "AAAA");
+
+  dns_hitters_free(hitters);
+  return MUNIT_OK;
+}
+
+static MunitResult test_server(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  server->enable_recursion = false;
+  dns_trie_insert_a(server->trie, "www.example.com", "192.0.2.1", 300);
+  for (int i = 0; i < 3; ++i) dns_response_free(send_query(server, "www.example.com", DNS_TYPE_A));
+  dns_response_free(send_query(server, "missing.example.com", DNS_TYPE_A));
+
+  dns_metrics_buffer_t buf = {0};
+  buf.data = malloc(DNS_METRICS_BUFFER_SIZE);
+  buf.capacity = DNS_METRICS_BUFFER_SIZE;
+  dns_server_write_metrics(server, &buf);
+  munit_assert_false(buf.overflow);
+  buf.data[buf.length] = '\0';
+
+  munit_assert_not_null(strstr(buf.data, "# TYPE dns_top_queries gauge\n"));
+  munit_assert_not_null(strstr(buf.data,
+                               "dns_top_queries{kind=\"qname\",rank=\"1\",key=\"www.example.com.\"} 3\n"));
+  munit_assert_not_null(strstr(buf.data,
+                               "dns_top_queries{kind=\"qname\",rank=\"2\",key=\"missing.example.com.\"} 1\n"));
+  munit_assert_not_null(strstr(buf.data, "dns_top_queries{kind=\"qtype\",rank=\"1\",key=\"A\"} 4\n"));
+
+  free(buf.data);
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+
+static MunitTest tests[] = {
+  {"/exact", test_exact, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/heavy", test_heavy, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/hitters", test_hitters, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/server", test_server, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+
+  {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
+};
+
+static const MunitSuite suite = {"/topk", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  return munit_suite_main(&suite, NULL, argc, argv);
+}
@@ -1,6 +1,8 @@
 #include "dns_trie.h"
 #include "munit.h"
 #include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
 
 static MunitResult test_create(const MunitParameter params[], void *data) {
   (void)params;
@@ -77,9 +79,10 @@ static MunitResult test_cname(const MunitParameter params[], void *data) {
 
   // lookup CNAME
   uint32_t ttl;
-  dns_cname_t *cname = dns_trie_lookup_cname(trie, "www.example.com", &ttl);
+  dns_rrset_t *cname = dns_trie_lookup_cname(trie, "www.example.com", &ttl);
   munit_assert_not_null(cname);
-  munit_assert_int(strcmp(cname->cname, "example.com"), ==, 0);
+  munit_assert_int(cname->count, ==, 1);
+  munit_assert_int(strcmp(cname->records->rdata.cname.cname, "example.com"), ==, 0);
   munit_assert_int(ttl, ==, 300);
 
   // inserting A record at CNAME location should fail
@@ -156,6 +159,67 @@ static MunitResult test_subdomain_lookup(const MunitParameter params[], void *da
   return MUNIT_OK;
 }
 
+static MunitResult test_find_wildcard(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = dns_trie_create();
+  munit_assert_true(dns_trie_insert_a(trie, "*.example.com", "1.2.3.4", 300));
+  munit_assert_true(dns_trie_insert_a(trie, "www.example.com", "5.6.7.8", 300));
+
+  dns_trie_match_result_t match;
+
+  // exact match wins over the wildcard
+  munit_assert_int(dns_trie_find(trie, "www.example.com", &match), ==, DNS_TRIE_MATCH_EXACT);
+  munit_assert_string_equal(match.node->label, "www");
+
+  // miss below example.com is synthesized from *.example.com
+  munit_assert_int(dns_trie_find(trie, "foo.bar.example.com", &match), ==, DNS_TRIE_MATCH_WILDCARD);
+  munit_assert_string_equal(match.node->label, "*");
+  munit_assert_string_equal(match.closest_encloser->label, "example");
+
+  // no wildcard under com
+  munit_assert_int(dns_trie_find(trie, "other.com", &match), ==, DNS_TRIE_MATCH_NONE);
+  munit_assert_null(match.node);
+
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+static MunitResult test_find_name(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = dns_trie_create();
+  munit_assert_true(dns_trie_insert_a(trie, "*.example.com", "1.2.3.4", 300));
+  munit_assert_true(dns_trie_insert_a(trie, "www.example.com", "5.6.7.8", 300));
+
+  // a name parsed off the wire walks the same way as text, whatever its case
+  static const char *names[] = {"WWW.example.COM", "foo.Bar.example.com", "other.com", "example.com", ""};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+    uint8_t buf[512];
+    size_t offset = 0;
+    dns_question_t question = {.qtype = DNS_TYPE_A, .qclass = DNS_CLASS_IN};
+    strcpy(question.qname, names[i]);
+    munit_assert_int(dns_encode_question(buf, sizeof(buf), &offset, &question), ==, 0);
+
+    dns_question_view_t view;
+    offset = 0;
+    munit_assert_int(dns_parse_question_view(buf, sizeof(buf), &offset, &view), ==, 0);
+
+    dns_trie_match_result_t text_match;
+    dns_trie_match_result_t view_match;
+    dns_trie_match_t text_kind = dns_trie_find(trie, names[i], &text_match);
+    munit_assert_int(dns_trie_find_name(trie, &view.name, &view_match), ==, text_kind);
+    munit_assert_ptr_equal(view_match.node, text_match.node);
+    munit_assert_ptr_equal(view_match.closest_encloser, text_match.closest_encloser);
+    munit_assert_ptr_equal(view_match.zone, text_match.zone);
+  }
+
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
 static MunitResult test_utils_invalid_input(const MunitParameter params[], void *data) {
   (void)params;
   (void)data;
@@ -201,6 +265,112 @@ static MunitResult test_record_count(const MunitParameter params[], void *data)
   return MUNIT_OK;
 }
 
+static MunitResult test_lazy_rrset_maps(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = dns_trie_create();
+  munit_assert_true(dns_trie_insert_a(trie, "www.example.com", "1.2.3.4", 300));
+
+  // empty non-terminals carry no map
+  dns_trie_match_result_t result;
+  munit_assert_int(dns_trie_find(trie, "example.com", &result), ==, DNS_TRIE_MATCH_EXACT);
+  munit_assert_null(result.node->rrsets);
+
+  // more types than the first map holds
+  dns_record_type_t types[] = {DNS_TYPE_AAAA, DNS_TYPE_MX, DNS_TYPE_TXT, DNS_TYPE_NS, DNS_TYPE_PTR};
+  munit_assert_true(dns_trie_insert_aaaa(trie, "www.example.com", "2001:db8::1", 300));
+  munit_assert_true(dns_trie_insert_mx(trie, "www.example.com", 10, "mail.example.com", 300));
+  munit_assert_true(dns_trie_insert_rr(trie, "www.example.com", dns_rr_create_txt("v=1", 300)));
+  munit_assert_true(dns_trie_insert_ns(trie, "www.example.com", "ns.example.com", 300));
+  munit_assert_true(dns_trie_insert_rr(trie, "www.example.com", dns_rr_create_ptr("host.example.com", 300)));
+
+  munit_assert_not_null(dns_trie_lookup(trie, "www.example.com", DNS_TYPE_A));
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+    dns_rrset_t *rrset = dns_trie_lookup(trie, "www.example.com", types[i]);
+    munit_assert_not_null(rrset);
+    munit_assert_int(rrset->type, ==, types[i]);
+  }
+  munit_assert_size(dns_trie_get_record_count(trie), ==, 6);
+
+  // removing every type drops the map again
+  munit_assert_true(dns_trie_delete_name(trie, "www.example.com", false));
+  munit_assert_null(dns_trie_lookup(trie, "www.example.com", DNS_TYPE_A));
+  munit_assert_size(dns_trie_get_record_count(trie), ==, 0);
+
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+static MunitResult test_node_reuse(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = dns_trie_create();
+  munit_assert_true(dns_trie_insert_a(trie, "keep.example.com", "1.1.1.1", 300));
+  size_t base = trie->node_count;
+
+  // pruned nodes go back on the free list and are handed out again
+  for (int round = 0; round < 3; ++round) {
+    munit_assert_true(dns_trie_insert_a(trie, "a.b.tmp.example.com", "2.2.2.2", 300));
+    munit_assert_size(trie->node_count, ==, base + 3);
+
+    munit_assert_true(dns_trie_delete_name(trie, "a.b.tmp.example.com", false));
+    munit_assert_size(trie->node_count, ==, base);
+    munit_assert_not_null(trie->free_nodes);
+  }
+
+  // spans several slabs
+  char name[64];
+  for (int i = 0; i < 1000; ++i) {
+    snprintf(name, sizeof(name), "h%d.example.com", i);
+    munit_assert_true(dns_trie_insert_a(trie, name, "3.3.3.3", 300));
+  }
+  munit_assert_size(dns_trie_get_record_count(trie), ==, 1001);
+  munit_assert_not_null(dns_trie_lookup(trie, "h999.example.com", DNS_TYPE_A));
+
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+static MunitResult test_arena(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_arena_t *arena = dns_arena_create(0);
+  munit_assert_not_null(arena);
+
+  // zeroed and aligned
+  uint8_t *block = dns_arena_alloc(arena, 40);
+  munit_assert_not_null(block);
+  munit_assert_size((uintptr_t)block % DNS_ARENA_ALIGN, ==, 0);
+  for (int i = 0; i < 40; ++i) munit_assert_uint8(block[i], ==, 0);
+  munit_assert_size(arena->bytes_in_use, ==, 64);
+
+  // released blocks are reused by their size class and zeroed again
+  memset(block, 0xab, 40);
+  dns_arena_release(arena, block, 40);
+  munit_assert_size(arena->bytes_in_use, ==, 0);
+  uint8_t *again = dns_arena_alloc(arena, 33);
+  munit_assert_ptr_equal(again, block);
+  munit_assert_uint8(again[0], ==, 0);
+
+  // large blocks get a chunk of their own
+  size_t large = 3 * DNS_ARENA_DEFAULT_CHUNK;
+  uint8_t *big = dns_arena_alloc(arena, large);
+  munit_assert_not_null(big);
+  big[large - 1] = 1;
+  munit_assert_size(arena->bytes_reserved, >, large);
+
+  dns_arena_reset(arena);
+  munit_assert_size(arena->bytes_in_use, ==, 0);
+  munit_assert_size(arena->bytes_reserved, <, large);
+  munit_assert_not_null(dns_arena_alloc(arena, 16));
+
+  dns_arena_destroy(arena);
+  return MUNIT_OK;
+}
+
 static MunitTest tests[] = {
   {"/create", test_create, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/insert_and_lookup", test_insert_and_lookup, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
@@ -208,8 +378,13 @@ static MunitTest tests[] = {
   {"/cname", test_cname, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/zone", test_zone, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/subdomain_lookup", test_subdomain_lookup, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/find_wildcard", test_find_wildcard, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/find_name", test_find_name, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/utils_invalid", test_utils_invalid_input, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/record_count", test_record_count, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/lazy_rrset_maps", test_lazy_rrset_maps, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/node_reuse", test_node_reuse, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/arena", test_arena, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
 
 static const MunitSuite suite = {"/trie", tests, NULL, 1,
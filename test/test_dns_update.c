@@ -0,0 +1,389 @@
+#include "munit.h"
+#include "dns_update.h"
+#include "dns_server.h"
+#include <string.h>
+#include <arpa/inet.h>
+
+
+typedef struct {
+  uint8_t buf[1024];
+  size_t len;
+  dns_header_t header;
+} update_msg_t;
+
+static void msg_init(update_msg_t *msg, const char *zone) {
+  memset(msg, 0, sizeof(*msg));
+  msg->header.id = 0x4242;
+  msg->header.opcode = DNS_OPCODE_UPDATE;
+  msg->header.qdcount = 1;
+  msg->len = 12;
+
+  dns_question_t question = {.qtype = DNS_TYPE_SOA, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, zone);
+  dns_encode_question(msg->buf, sizeof(msg->buf), &msg->len, &question);
+}
+
+// RR without rdata, used by class ANY/NONE prerequisites and deletes
+static void msg_add_empty(update_msg_t *msg, const char *name, uint16_t type, uint16_t rclass) {
+  dns_encode_name(msg->buf, sizeof(msg->buf), &msg->len, name);
+  dns_write_uint16(msg->buf, sizeof(msg->buf), &msg->len, type);
+  dns_write_uint16(msg->buf, sizeof(msg->buf), &msg->len, rclass);
+  dns_write_uint32(msg->buf, sizeof(msg->buf), &msg->len, 0);
+  dns_write_uint16(msg->buf, sizeof(msg->buf), &msg->len, 0);
+}
+
+static void msg_add_rr(update_msg_t *msg, const char *name, dns_rr_t *rr) {
+  munit_assert_int(dns_encode_rr(msg->buf, sizeof(msg->buf), &msg->len, name, rr), ==, 0);
+  dns_rr_free(rr);
+}
+
+static void msg_finish(update_msg_t *msg) {
+  dns_encode_header(msg->buf, sizeof(msg->buf), &msg->header);
+}
+
+static dns_rr_t *rr_with_class(dns_rr_t *rr, dns_class_t cls, uint32_t ttl) {
+  rr->class = cls;
+  rr->ttl = ttl;
+  return rr;
+}
+
+static dns_trie_t *create_zone(void) {
+  dns_trie_t *trie = dns_trie_create();
+  dns_trie_insert_rr(trie, "example.com",
+                     dns_rr_create_soa("ns1.example.com", "admin.example.com",
+                                       2024010101, 7200, 3600, 604800, 300, 3600));
+  dns_trie_insert_ns(trie, "example.com", "ns1.example.com", 3600);
+  dns_trie_insert_a(trie, "www.example.com", "1.2.3.4", 300);
+  return trie;
+}
+
+static uint8_t run_update(dns_trie_t *trie, dns_cache_t *cache, update_msg_t *msg, dns_update_result_t *result) {
+  msg_finish(msg);
+
+  dns_error_t err;
+  dns_error_init(&err);
+  munit_assert_int(dns_update_process(trie, cache, msg->buf, msg->len, result, &err), ==, 0);
+  return result->rcode;
+}
+
+static MunitResult test_add_and_delete(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = create_zone();
+  update_msg_t msg;
+  dns_update_result_t result;
+
+  // add a new name two levels down
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 2;
+  msg_add_rr(&msg, "host.lab.example.com", dns_rr_create_a_str("10.0.0.1", 60));
+  msg_add_rr(&msg, "host.lab.example.com", dns_rr_create_a_str("10.0.0.2", 60));
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NOERROR);
+  munit_assert_int(result.records_added, ==, 2);
+
+  dns_rrset_t *rrset = dns_trie_lookup(trie, "host.lab.example.com", DNS_TYPE_A);
+  munit_assert_not_null(rrset);
+  munit_assert_int(rrset->count, ==, 2);
+
+  // delete one record by value, then the rest by RRset
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_rr(&msg, "host.lab.example.com", rr_with_class(dns_rr_create_a_str("10.0.0.1", 0), DNS_CLASS_NONE, 0));
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NOERROR);
+  munit_assert_int(dns_trie_lookup(trie, "host.lab.example.com", DNS_TYPE_A)->count, ==, 1);
+
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_empty(&msg, "host.lab.example.com", DNS_TYPE_A, DNS_CLASS_ANY);
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NOERROR);
+  munit_assert_int(result.records_deleted, ==, 1);
+
+  // emptied nodes are pruned, so the name is gone entirely
+  dns_trie_match_result_t match;
+  munit_assert_int(dns_trie_find(trie, "lab.example.com", &match), ==, DNS_TRIE_MATCH_NONE);
+  munit_assert_not_null(dns_trie_lookup(trie, "www.example.com", DNS_TYPE_A));
+
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+static MunitResult test_apex_protected(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = create_zone();
+  update_msg_t msg;
+  dns_update_result_t result;
+
+  // deleting every RRset at the apex keeps SOA and NS
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 2;
+  msg_add_empty(&msg, "example.com", DNS_TYPE_ANY, DNS_CLASS_ANY);
+  msg_add_rr(&msg, "example.com", rr_with_class(dns_rr_create_ns("ns1.example.com", 0), DNS_CLASS_NONE, 0));
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NOERROR);
+
+  munit_assert_not_null(dns_trie_lookup(trie, "example.com", DNS_TYPE_SOA));
+  munit_assert_not_null(dns_trie_lookup(trie, "example.com", DNS_TYPE_NS));
+
+  // an older serial is ignored, a newer one replaces the SOA
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_rr(&msg, "example.com", dns_rr_create_soa("ns1.example.com", "admin.example.com",
+                                                    2023010101, 7200, 3600, 604800, 300, 3600));
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NOERROR);
+  munit_assert_uint32(dns_trie_lookup(trie, "example.com", DNS_TYPE_SOA)->records->rdata.soa->serial, ==, 2024010101);
+
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_rr(&msg, "example.com", dns_rr_create_soa("ns1.example.com", "admin.example.com",
+                                                    2024010102, 7200, 3600, 604800, 300, 3600));
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NOERROR);
+  dns_rrset_t *soa = dns_trie_lookup(trie, "example.com", DNS_TYPE_SOA);
+  munit_assert_int(soa->count, ==, 1);
+  munit_assert_uint32(soa->records->rdata.soa->serial, ==, 2024010102);
+
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+static MunitResult test_prerequisites(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = create_zone();
+  update_msg_t msg;
+  dns_update_result_t result;
+
+  // name must be in use
+  msg_init(&msg, "example.com");
+  msg.header.ancount = 1;
+  msg.header.nscount = 1;
+  msg_add_empty(&msg, "missing.example.com", DNS_TYPE_ANY, DNS_CLASS_ANY);
+  msg_add_rr(&msg, "missing.example.com", dns_rr_create_a_str("10.0.0.9", 60));
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NXDOMAIN);
+  munit_assert_null(dns_trie_lookup(trie, "missing.example.com", DNS_TYPE_A));
+
+  // RRset must not exist
+  msg_init(&msg, "example.com");
+  msg.header.ancount = 1;
+  msg_add_empty(&msg, "www.example.com", DNS_TYPE_A, DNS_CLASS_NONE);
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_YXRRSET);
+
+  // value-dependent: exact RRset match
+  msg_init(&msg, "example.com");
+  msg.header.ancount = 1;
+  msg_add_rr(&msg, "www.example.com", rr_with_class(dns_rr_create_a_str("1.2.3.4", 0), DNS_CLASS_IN, 0));
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NOERROR);
+
+  msg_init(&msg, "example.com");
+  msg.header.ancount = 1;
+  msg_add_rr(&msg, "www.example.com", rr_with_class(dns_rr_create_a_str("5.6.7.8", 0), DNS_CLASS_IN, 0));
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NXRRSET);
+
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+static MunitResult test_zone_errors(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = create_zone();
+  update_msg_t msg;
+  dns_update_result_t result;
+
+  msg_init(&msg, "other.org");
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NOTAUTH);
+
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_rr(&msg, "www.other.org", dns_rr_create_a_str("10.0.0.1", 60));
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_NOTZONE);
+
+  // a bad record later in the message leaves earlier ones unapplied
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 2;
+  msg_add_rr(&msg, "new.example.com", dns_rr_create_a_str("10.0.0.1", 60));
+  msg_add_empty(&msg, "new.example.com", DNS_TYPE_ANY, DNS_CLASS_IN);
+  munit_assert_int(run_update(trie, NULL, &msg, &result), ==, DNS_RCODE_FORMERROR);
+  munit_assert_null(dns_trie_lookup(trie, "new.example.com", DNS_TYPE_A));
+
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+static MunitResult test_cache_invalidation(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = create_zone();
+  dns_cache_t *cache = dns_cache_create(100);
+
+  dns_rr_t *cached = dns_rr_create_a_str("1.2.3.4", 300);
+  dns_cache_insert(cache, "www.example.com", DNS_TYPE_A, DNS_CLASS_IN, cached, 1, 300);
+  dns_cache_insert(cache, "mail.other.org", DNS_TYPE_A, DNS_CLASS_IN, cached, 1, 300);
+  dns_cache_insert_negative(cache, "lab.example.com", DNS_TYPE_A, DNS_CLASS_IN,
+                            DNS_CACHE_TYPE_NXDOMAIN, DNS_RCODE_NXDOMAIN, 300);
+  dns_rr_free(cached);
+
+  update_msg_t msg;
+  dns_update_result_t result;
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 2;
+  msg_add_rr(&msg, "www.example.com", dns_rr_create_a_str("5.6.7.8", 300));
+  msg_add_rr(&msg, "host.lab.example.com", dns_rr_create_a_str("10.0.0.1", 300));
+  munit_assert_int(run_update(trie, cache, &msg, &result), ==, DNS_RCODE_NOERROR);
+
+  // touched names and their ancestors are dropped, unrelated entries survive
+  munit_assert_null(dns_cache_lookup(cache, "www.example.com", DNS_TYPE_A, DNS_CLASS_IN));
+  munit_assert_null(dns_cache_lookup(cache, "lab.example.com", DNS_TYPE_A, DNS_CLASS_IN));
+
+  dns_cache_result_t *hit = dns_cache_lookup(cache, "mail.other.org", DNS_TYPE_A, DNS_CLASS_IN);
+  munit_assert_true(hit->found);
+  dns_cache_result_free(hit);
+
+  dns_cache_free(cache);
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+// what the server does on a cache miss
+static void resolve_and_store(dns_trie_t *trie, dns_cache_t *cache, const char *name, dns_record_type_t type) {
+  dns_question_t question = {.qtype = type, .qclass = DNS_CLASS_IN};
+  strcpy(question.qname, name);
+
+  dns_resolution_result_t result;
+  dns_resolution_result_init(&result);
+  munit_assert_int(dns_resolve_query_full(trie, &question, &result, NULL), ==, 0);
+  dns_resolution_cache_store(cache, &question, &result);
+  dns_resolution_result_clear(&result);
+}
+
+static bool is_cached(dns_cache_t *cache, const char *name, dns_record_type_t type) {
+  dns_cache_result_t hit;
+  bool found = dns_cache_lookup_into(cache, name, type, DNS_CLASS_IN, &hit);
+  dns_cache_result_clear(&hit);
+  return found;
+}
+
+static MunitResult test_cache_enclosers(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_trie_t *trie = create_zone();
+  dns_trie_insert_cname(trie, "alias.example.com", "www.example.com", 300);
+  dns_cache_t *cache = dns_cache_create(100);
+
+  // NXDOMAIN below the apex, chained answers are not kept at all
+  resolve_and_store(trie, cache, "www.example.com", DNS_TYPE_A);
+  resolve_and_store(trie, cache, "x.example.com", DNS_TYPE_A);
+  resolve_and_store(trie, cache, "alias.example.com", DNS_TYPE_A);
+  munit_assert_true(is_cached(cache, "x.example.com", DNS_TYPE_A));
+  munit_assert_false(is_cached(cache, "alias.example.com", DNS_TYPE_A));
+
+  // a wildcard turns the NXDOMAIN into an answer
+  update_msg_t msg;
+  dns_update_result_t result;
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_rr(&msg, "*.example.com", dns_rr_create_a_str("10.0.0.9", 300));
+  munit_assert_int(run_update(trie, cache, &msg, &result), ==, DNS_RCODE_NOERROR);
+  munit_assert_false(is_cached(cache, "x.example.com", DNS_TYPE_A));
+  munit_assert_true(is_cached(cache, "www.example.com", DNS_TYPE_A));
+
+  // a new name ends the synthesis below it and nowhere else
+  resolve_and_store(trie, cache, "a.sub.example.com", DNS_TYPE_A);
+  resolve_and_store(trie, cache, "z.example.com", DNS_TYPE_A);
+  munit_assert_true(is_cached(cache, "a.sub.example.com", DNS_TYPE_A));
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_rr(&msg, "sub.example.com", dns_rr_create_a_str("10.0.0.2", 300));
+  munit_assert_int(run_update(trie, cache, &msg, &result), ==, DNS_RCODE_NOERROR);
+  munit_assert_false(is_cached(cache, "a.sub.example.com", DNS_TYPE_A));
+  munit_assert_true(is_cached(cache, "z.example.com", DNS_TYPE_A));
+  munit_assert_true(is_cached(cache, "www.example.com", DNS_TYPE_A));
+
+  resolve_and_store(trie, cache, "a.sub.example.com", DNS_TYPE_A);
+  munit_assert_true(is_cached(cache, "a.sub.example.com", DNS_TYPE_A));
+
+  // and deleting it brings the wildcard back
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_empty(&msg, "sub.example.com", DNS_TYPE_ANY, DNS_CLASS_ANY);
+  munit_assert_int(run_update(trie, cache, &msg, &result), ==, DNS_RCODE_NOERROR);
+  munit_assert_false(is_cached(cache, "a.sub.example.com", DNS_TYPE_A));
+
+  // dropping the wildcard takes every answer it made
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_empty(&msg, "*.example.com", DNS_TYPE_A, DNS_CLASS_ANY);
+  munit_assert_int(run_update(trie, cache, &msg, &result), ==, DNS_RCODE_NOERROR);
+  munit_assert_false(is_cached(cache, "z.example.com", DNS_TYPE_A));
+  munit_assert_true(is_cached(cache, "www.example.com", DNS_TYPE_A));
+
+  dns_cache_free(cache);
+  dns_trie_free(trie);
+  return MUNIT_OK;
+}
+
+static MunitResult test_server_update(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  dns_server_t *server = dns_server_create(5353);
+  dns_trie_free(server->trie);
+  server->trie = create_zone();
+
+  update_msg_t msg;
+  msg_init(&msg, "example.com");
+  msg.header.nscount = 1;
+  msg_add_rr(&msg, "api.example.com", dns_rr_create_a_str("10.0.0.1", 60));
+  msg_finish(&msg);
+
+  dns_request_t request = {.buffer = msg.buf, .length = msg.len};
+  struct sockaddr_in *client = (struct sockaddr_in *) &request.client_addr;
+  client->sin_family = AF_INET;
+  client->sin_addr.s_addr = inet_addr("127.0.0.1");
+
+  dns_response_t *response = dns_response_create(512);
+  dns_error_t err;
+  dns_error_init(&err);
+
+  // refused by default
+  munit_assert_int(dns_process_query(server, &request, response, &err), ==, 0);
+  dns_header_t header;
+  dns_parse_header(response->buffer, response->length, &header);
+  munit_assert_int(header.opcode, ==, DNS_OPCODE_UPDATE);
+  munit_assert_int(header.rcode, ==, DNS_RCODE_REFUSED);
+  munit_assert_null(dns_trie_lookup(server->trie, "api.example.com", DNS_TYPE_A));
+
+  munit_assert_int(dns_server_allow_update(server, "127.0.0.1"), ==, 0);
+  munit_assert_int(dns_process_query(server, &request, response, &err), ==, 0);
+  dns_parse_header(response->buffer, response->length, &header);
+  munit_assert_int(header.id, ==, 0x4242);
+  munit_assert_int(header.rcode, ==, DNS_RCODE_NOERROR);
+  munit_assert_int(header.qdcount, ==, 1);
+  munit_assert_not_null(dns_trie_lookup(server->trie, "api.example.com", DNS_TYPE_A));
+
+  dns_response_free(response);
+  dns_server_free(server);
+  return MUNIT_OK;
+}
+
+static MunitTest tests[] = {
+  {"/add_and_delete", test_add_and_delete, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/apex_protected", test_apex_protected, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/prerequisites", test_prerequisites, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/zone_errors", test_zone_errors, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/cache_invalidation", test_cache_invalidation, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/cache_enclosers", test_cache_enclosers, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/server_update", test_server_update, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+
+static const MunitSuite suite = {"/update", tests, NULL, 1,
+                                 MUNIT_SUITE_OPTION_NONE};
+
+int main(int argc, char *argv[]) {
+  return munit_suite_main(&suite, NULL, argc, argv);
+}
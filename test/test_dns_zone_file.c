@@ -127,6 +127,9 @@ static MunitResult test_string_to_type_conversion(const MunitParameter params[],
   munit_assert_int(zone_string_to_type("CNAME"), ==, DNS_TYPE_CNAME);
   munit_assert_int(zone_string_to_type("SOA"), ==, DNS_TYPE_SOA);
   munit_assert_int(zone_string_to_type("AAAA"), ==, DNS_TYPE_AAAA);
+  munit_assert_int(zone_string_to_type("SRV"), ==, DNS_TYPE_SRV);
+  munit_assert_int(zone_string_to_type("caa"), ==, DNS_TYPE_CAA);
+  munit_assert_int(zone_string_to_type("TYPE65"), ==, 65);
   munit_assert_int(zone_string_to_type("UNKNOWN"), ==, 0);
 
   return MUNIT_OK;
@@ -188,9 +191,9 @@ static MunitResult test_soa_parsing(const MunitParameter params[], void *data) {
 
   dns_rrset_t *soa_rrset = dns_trie_lookup(trie, "example.com", DNS_TYPE_SOA);
   munit_assert_not_null(soa_rrset);
-  munit_assert_string_equal(soa_rrset->records->rdata.soa.mname, "ns1.example.com.");
-  munit_assert_string_equal(soa_rrset->records->rdata.soa.rname, "admin.example.com.");
-  munit_assert_int(soa_rrset->records->rdata.soa.serial, ==, 2024010101);
+  munit_assert_string_equal(soa_rrset->records->rdata.soa->mname, "ns1.example.com.");
+  munit_assert_string_equal(soa_rrset->records->rdata.soa->rname, "admin.example.com.");
+  munit_assert_int(soa_rrset->records->rdata.soa->serial, ==, 2024010101);
 
   dns_trie_free(trie);
   cleanup_test_file(fname);
@@ -260,6 +263,41 @@ static MunitResult test_mx_records(const MunitParameter params[], void *data) {
   return MUNIT_OK;
 }
 
+static MunitResult test_txt_records(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  // a quoted string is one token, ';' inside it is not a comment
+  const char *zone_content =
+    "example.com. 300 IN TXT \"v=spf1\" \"include:x\" ; two strings\n"
+    "_dmarc.example.com. 300 IN TXT \"v=DMARC1; p=none\"\n";
+
+  char *fname = create_test_file(zone_content);
+  munit_assert_not_null(fname);
+
+  dns_trie_t *trie = dns_trie_create();
+  zone_load_result_t result;
+
+  int load_result = zone_load_file(trie, fname, "example.com", &result);
+
+  munit_assert_int(load_result, ==, 0);
+  munit_assert_int(result.records_loaded, ==, 2);
+
+  dns_rrset_t *spf = dns_trie_lookup(trie, "example.com", DNS_TYPE_TXT);
+  munit_assert_not_null(spf);
+  munit_assert_uint16(spf->records->rdata.txt.length, ==, 1 + 6 + 1 + 9);
+  munit_assert_memory_equal(17, spf->records->rdata.txt.strings, "\x06v=spf1\x09include:x");
+
+  dns_rrset_t *dmarc = dns_trie_lookup(trie, "_dmarc.example.com", DNS_TYPE_TXT);
+  munit_assert_not_null(dmarc);
+  munit_assert_memory_equal(17, dmarc->records->rdata.txt.strings, "\x10v=DMARC1; p=none");
+
+  dns_trie_free(trie);
+  cleanup_test_file(fname);
+
+  return MUNIT_OK;
+}
+
 static MunitResult test_relative_names(const MunitParameter params[], void *data) {
   (void)params;
   (void)data;
@@ -428,6 +466,43 @@ static MunitResult test_missing_rdata(const MunitParameter params[], void *data)
   return MUNIT_OK;
 }
 
+static MunitResult test_codec_types(const MunitParameter params[], void *data) {
+  (void)params;
+  (void)data;
+
+  const char *zone_content =
+    "_sip._udp.example.com. 300 IN SRV 10 60 5060 sip.example.com.\n"
+    "example.com. 300 IN CAA 0 issue ca.example.net\n"
+    "example.com. 300 IN TYPE65 \\# 2 abcd\n";
+
+  char *fname = create_test_file(zone_content);
+  munit_assert_not_null(fname);
+
+  dns_trie_t *trie = dns_trie_create();
+  zone_load_result_t result;
+  munit_assert_int(zone_load_file(trie, fname, "example.com", &result), ==, 0);
+  munit_assert_int(result.records_loaded, ==, 3);
+
+  dns_rrset_t *srv = dns_trie_lookup(trie, "_sip._udp.example.com", DNS_TYPE_SRV);
+  munit_assert_not_null(srv);
+  munit_assert_uint16(srv->records->rdata.srv.port, ==, 5060);
+  munit_assert_string_equal(srv->records->rdata.srv.target, "sip.example.com.");
+
+  dns_rrset_t *caa = dns_trie_lookup(trie, "example.com", DNS_TYPE_CAA);
+  munit_assert_not_null(caa);
+  munit_assert_string_equal(caa->records->rdata.caa.tag, "issue");
+
+  dns_rrset_t *generic = dns_trie_lookup(trie, "example.com", 65);
+  munit_assert_not_null(generic);
+  munit_assert_uint16(generic->records->rdata.opaque.len, ==, 2);
+  munit_assert_uint8(generic->records->rdata.opaque.data[1], ==, 0xCD);
+
+  dns_trie_free(trie);
+  cleanup_test_file(fname);
+
+  return MUNIT_OK;
+}
+
 static MunitResult test_unknown_type(const MunitParameter params[], void *data) {
   (void)params; (void)data;
 
@@ -484,6 +559,8 @@ static MunitTest tests[] = {
   {"/soa_parsing", test_soa_parsing, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/directives", test_directives, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/mx_records", test_mx_records, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/txt_records", test_txt_records, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+  {"/codec_types", test_codec_types, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/relative_names", test_relative_names, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/blank_lines_and_whitespace", test_blank_lines_and_whitespace, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
   {"/ttl_inheritance", test_ttl_inheritance, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
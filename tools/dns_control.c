@@ -0,0 +1,110 @@
+#include "dns_control.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// control socket client
+//
+// sends one command to a running server and prints the reply as it comes,
+// a dump included. exits 1 when the server answered with an error.
+//
+// usage: dns_control [-s socket] command [arg...]
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-s socket] command [arg...]\n", prog);
+  fprintf(stderr, "       %s help   lists the commands\n", prog);
+}
+
+static int send_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    data += n;
+    length -= (size_t)n;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = DNS_CONTROL_DEFAULT_PATH;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:h")) != -1) {
+    switch (opt) {
+      case 's': path = optarg; break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  char command[DNS_CONTROL_REQUEST_SIZE];
+  size_t length = 0;
+  for (int i = optind; i < argc; ++i) {
+    int n = snprintf(command + length, sizeof(command) - length, "%s%s",
+                     i > optind ? " " : "", argv[i]);
+    if (n < 0 || (size_t)n >= sizeof(command) - length - 1) {
+      fprintf(stderr, "command too long\n");
+      return 1;
+    }
+    length += (size_t)n;
+  }
+  command[length++] = '\n';
+
+  struct sockaddr_un addr = {0};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: socket path too long\n", path);
+    return 1;
+  }
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, strlen(path) + 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return 1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    close(fd);
+    return 1;
+  }
+  if (send_all(fd, command, length) < 0) {
+    perror("send");
+    close(fd);
+    return 1;
+  }
+  shutdown(fd, SHUT_WR);
+
+  // the reply ends when the server closes the connection
+  static char buf[DNS_CONTROL_BUFFER_SIZE];
+  bool first = true;
+  bool failed = false;
+  ssize_t n;
+  while ((n = recv(fd, buf, sizeof(buf), 0)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("recv");
+      failed = true;
+      break;
+    }
+    if (first && n >= 7 && memcmp(buf, "error: ", 7) == 0) failed = true;
+    first = false;
+    fwrite(buf, 1, (size_t)n, failed ? stderr : stdout);
+  }
+  close(fd);
+
+  return failed ? 1 : 0;
+}
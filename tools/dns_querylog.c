@@ -0,0 +1,192 @@
+#include "dns_querylog.h"
+#include "dns_latency.h"
+#include "dns_parser.h"
+#include "dns_rdata.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// query log decoder
+//
+// prints every record of the files named, oldest file first if they are
+// given that way, as one line of text or, with -j, one JSON object per line.
+//
+// usage: dns_querylog [-j] file...
+
+#define READ_CHUNK (64 * 1024)
+
+static const char *rcode_names[] = {
+  "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+  "YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE",
+};
+
+static const char *class_name(uint16_t qclass, char *buf, size_t len) {
+  switch (qclass) {
+    case DNS_CLASS_IN: return "IN";
+    case DNS_CLASS_CH: return "CH";
+    case DNS_CLASS_HS: return "HS";
+    case DNS_CLASS_ANY: return "ANY";
+    default:
+      snprintf(buf, len, "CLASS%u", qclass);
+      return buf;
+  }
+}
+
+static const char *rcode_name(uint16_t flags, char *buf, size_t len) {
+  unsigned rcode = flags & 0x0F;
+  if (rcode < sizeof(rcode_names) / sizeof(rcode_names[0])) return rcode_names[rcode];
+  snprintf(buf, len, "RCODE%u", rcode);
+  return buf;
+}
+
+// the header bits that are set, comma separated
+static void flag_names(uint16_t flags, char *buf, size_t len) {
+  static const struct { uint16_t bit; const char *name; } bits[] = {
+    {0x8000, "qr"}, {0x0400, "aa"}, {0x0200, "tc"}, {0x0100, "rd"},
+    {0x0080, "ra"}, {0x0020, "ad"}, {0x0010, "cd"},
+  };
+
+  size_t n = 0;
+  buf[0] = '\0';
+  for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]); ++i) {
+    if (!(flags & bits[i].bit)) continue;
+    n += snprintf(buf + n, len - n, "%s%s", n ? "," : "", bits[i].name);
+    if (n >= len) break;
+  }
+}
+
+// the name comes from the client, anything that would break a line of text
+// or a JSON string is written as \DDD
+static void escape_name(const char *name, char *out, size_t len) {
+  size_t n = 0;
+  for (const unsigned char *c = (const unsigned char *)name; *c && n + 5 < len; ++c) {
+    if (*c < 0x21 || *c > 0x7E || *c == '"' || *c == '\\') {
+      n += snprintf(out + n, len - n, "\\%03u", *c);
+    } else {
+      out[n++] = (char)*c;
+    }
+  }
+  out[n] = '\0';
+}
+
+static void print_record(const dns_querylog_record_t *record, bool json) {
+  char time_buf[32];
+  time_t seconds = (time_t)(record->time_ns / 1000000000u);
+  struct tm tm_info;
+  gmtime_r(&seconds, &tm_info);
+  strftime(time_buf, sizeof(time_buf), "%Y-%m-%dT%H:%M:%S", &tm_info);
+
+  char client[INET6_ADDRSTRLEN] = "-";
+  if (record->family == 4) inet_ntop(AF_INET, record->address, client, sizeof(client));
+  if (record->family == 6) inet_ntop(AF_INET6, record->address, client, sizeof(client));
+
+  char text[MAX_DOMAIN_NAME] = "";
+  char qname[MAX_DOMAIN_NAME * 4 + 1];
+  size_t offset = 0;
+  if (record->qname_length == 0
+      || dns_parse_name(record->qname, record->qname_length, &offset, text, sizeof(text)) < 0) {
+    text[0] = '\0';
+  }
+  escape_name(text, qname, sizeof(qname));
+
+  char type_buf[16];
+  char class_buf[16];
+  char rcode_buf[16];
+  char flags[64];
+  const char *qtype = dns_rdata_type_to_text(record->qtype, type_buf, sizeof(type_buf));
+  const char *qclass = class_name(record->qclass, class_buf, sizeof(class_buf));
+  bool answered = record->response_size > 0;
+  const char *rcode = answered ? rcode_name(record->response_flags, rcode_buf, sizeof(rcode_buf)) : "-";
+  flag_names(answered ? record->response_flags : record->query_flags, flags, sizeof(flags));
+  const char *outcome = record->outcome < DNS_OUTCOME_COUNT ? dns_outcome_name(record->outcome) : "unknown";
+
+  if (json) {
+    printf("{\"time\":\"%s.%09luZ\",\"client\":\"%s\",\"port\":%u,\"id\":%u,"
+           "\"qname\":\"%s.\",\"qtype\":\"%s\",\"qclass\":\"%s\",\"rcode\":\"%s\","
+           "\"flags\":\"%s\",\"size\":%u,\"latency_ns\":%u,\"outcome\":\"%s\"}\n",
+           time_buf, (unsigned long)(record->time_ns % 1000000000u), client, record->port,
+           record->id, qname, qtype, qclass, rcode, flags, record->response_size,
+           record->latency_ns, outcome);
+  } else {
+    printf("%s.%09luZ %s#%u id=%u %s. %s %s %s %s size=%u latency=%uns %s\n",
+           time_buf, (unsigned long)(record->time_ns % 1000000000u), client, record->port,
+           record->id, qname, qtype, qclass, rcode, flags[0] ? flags : "-",
+           record->response_size, record->latency_ns, outcome);
+  }
+}
+
+// -1 when the file is not a query log or ends inside a record
+static int decode_file(const char *path, bool json) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return -1;
+  }
+
+  char magic[DNS_QUERYLOG_MAGIC_SIZE];
+  if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+      || memcmp(magic, DNS_QUERYLOG_MAGIC, sizeof(magic)) != 0) {
+    fprintf(stderr, "%s: not a query log\n", path);
+    fclose(file);
+    return -1;
+  }
+
+  // records never straddle more than what is left over from the last read
+  static uint8_t buf[READ_CHUNK + DNS_QUERYLOG_RECORD_MAX];
+  size_t have = 0;
+  size_t n;
+  while ((n = fread(buf + have, 1, sizeof(buf) - have, file)) > 0) {
+    have += n;
+
+    size_t used = 0;
+    dns_querylog_record_t record;
+    size_t length;
+    while ((length = dns_querylog_decode(buf + used, have - used, &record)) > 0) {
+      print_record(&record, json);
+      used += length;
+    }
+
+    memmove(buf, buf + used, have - used);
+    have -= used;
+    if (have >= DNS_QUERYLOG_RECORD_MAX) break; // not a record, and never will be
+  }
+  fclose(file);
+
+  if (have > 0) {
+    fprintf(stderr, "%s: %zu trailing bytes are not a record\n", path, have);
+    return -1;
+  }
+  return 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-j] file...\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+  bool json = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "jh")) != -1) {
+    switch (opt) {
+      case 'j': json = true; break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int status = 0;
+  for (int i = optind; i < argc; ++i) {
+    if (decode_file(argv[i], json) < 0) status = 1;
+  }
+  return status;
+}